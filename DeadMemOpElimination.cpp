@@ -87,13 +87,15 @@ char DeadMemOpElimination::ID = 0;
 
 void DeadMemOpElimination::updateReachingDefByCallInst(MachineInstr *MI,
                                                        DefMapTy &Defs) {
-  assert(MI->getOpcode() == VTM::VOpInternalCall && "Bad Instruction type!");
+  assert((MI->getOpcode() == VTM::VOpInternalCall
+          || VInstrInfo::isBlockTransfer(MI)) && "Bad Instruction type!");
 
   typedef DefMapTy::iterator def_it;
   for (def_it I = Defs.begin(), E = Defs.end(); I != E; ++I) {
     if (I->first->isForwardingAliasSet()) continue;
 
-    // We assume submodule call modify all memory locations at the moment.
+    // We assume submodule call and block transfer modify all memory locations
+    // at the moment.
     I->second = MI;
   }
 }
@@ -122,6 +124,7 @@ DeadMemOpElimination::handleMemOp(instr_iterator I, DefMapTy &Defs,
 
   bool canHandleLastStore = LastMI && ASet->isMustAlias()
                             && LastMI->getOpcode() != VTM::VOpInternalCall
+                            && !VInstrInfo::isBlockTransfer(LastMI)
                             // FIXME: We may need to remember the last
                             // definition for all predicates.
                             && isPredIdentical(LastMI, MI);
@@ -177,7 +180,9 @@ bool DeadMemOpElimination::runOnMachineBasicBlock(MachineBasicBlock &MBB) {
   for (instr_iterator I = MBB.instr_begin(), E = MBB.instr_end(); I != E; ++I) {
     unsigned Opcode = I->getOpcode();
 
-    if (Opcode == VTM::VOpInternalCall) {
+    // The block transfer accesses an address range that cannot be described
+    // by its memory operand.
+    if (Opcode == VTM::VOpInternalCall || VInstrInfo::isBlockTransfer(I)) {
       updateReachingDefByCallInst(I, ReachingDefMap);
       continue;
     }
@@ -14,7 +14,9 @@
 #include "vtm/Passes.h"
 #include "vtm/VerilogBackendMCTargetDesc.h"
 #include "vtm/VInstrInfo.h"
+#include "vtm/VFInfo.h"
 #include "vtm/Utilities.h"
+#include "vtm/BBProfile.h"
 
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineFunction.h"
@@ -38,6 +40,10 @@
 using namespace llvm;
 
 STATISTIC(BBsMerged, "Number of blocks are merged into hyperblock");
+STATISTIC(NumProfiledEdges,
+          "Number of CFG edges weighted by the RTL block profile");
+STATISTIC(NumLoopsIfConverted,
+          "Number of loop bodies if-converted into a single hyperblock");
 
 static cl::opt<uint32_t>
 BranchProbabilityScale("vtm-branch-probability-scale",
@@ -45,6 +51,12 @@ BranchProbabilityScale("vtm-branch-probability-scale",
                    "to interger."),
           cl::init(1u << 24));
 
+static cl::opt<bool>
+IfConvertLoopBody("vtm-if-convert-loop-body",
+          cl::desc("If-convert the body of the innermost loops into a single "
+                   "predicated block so that they can be software pipelined"),
+          cl::init(true));
+
 namespace {
 struct HyperBlockFormation : public MachineFunctionPass {
   static char ID;
@@ -125,6 +137,9 @@ struct HyperBlockFormation : public MachineFunctionPass {
 
   bool runOnMachineFunction(MachineFunction &MF);
 
+  // Estimate the edge weights from the block entry counts in the RTL profile.
+  bool applyProfiledWeights(MachineFunction &MF, const BBProfile &Profile);
+
   bool simplifyCFG(MachineFunction &MF);
 
   MachineBasicBlock *getMergeDst(MachineBasicBlock *Src,
@@ -140,6 +155,8 @@ struct HyperBlockFormation : public MachineFunctionPass {
                    MachineBasicBlock *EdgeDst, const VInstrInfo::JT &DstJT);
 
   bool mergeTrivialSuccBlocks(MachineBasicBlock *MBB);
+  // Merge all blocks of the innermost loop headed by MBB into MBB.
+  bool ifConvertLoopBody(MachineBasicBlock *MBB);
   void PredicateBlock(unsigned ToBBNum, MachineOperand Cnd,
                       MachineBasicBlock *BB);
 
@@ -172,6 +189,7 @@ void HyperBlockFormation::deleteMBBAndUpdateDT(MachineBasicBlock *MBB) {
     DT->changeImmediateDominator(MBBNode->getChildren().back(), IDomNode);
 
   DT->eraseNode(MBB);
+  LI->removeBlock(MBB);
   MBB->eraseFromParent();
 }
 
@@ -208,6 +226,72 @@ bool HyperBlockFormation::mergeTrivialSuccBlocks(MachineBasicBlock *MBB) {
   return mergeBlocks(MBB, BBsToMerge);
 }
 
+bool HyperBlockFormation::ifConvertLoopBody(MachineBasicBlock *MBB) {
+  MachineLoop *L = LI->getLoopFor(MBB);
+  if (L == 0 || L->getHeader() != MBB || !L->empty()) return false;
+
+  if (L->getNumBlocks() == 1) return false;
+
+  // Sort the body blocks in topological order, ignoring the back-edges to the
+  // header. A block can be merged into the header once all its predecessors
+  // are merged.
+  typedef MachineBasicBlock::succ_iterator succ_it;
+  typedef MachineBasicBlock::pred_iterator pred_it;
+  DenseMap<MachineBasicBlock*, unsigned> NumUnvisitedPreds;
+  for (MachineLoop::block_iterator I = L->block_begin(), E = L->block_end();
+       I != E; ++I) {
+    MachineBasicBlock *BB = *I;
+    if (BB == MBB) continue;
+
+    unsigned &NumPreds = NumUnvisitedPreds[BB];
+    for (pred_it PI = BB->pred_begin(), PE = BB->pred_end(); PI != PE; ++PI) {
+      // Side entries are not possible in natural loops, just in case.
+      if (!L->contains(*PI)) return false;
+
+      ++NumPreds;
+    }
+  }
+
+  SmallVector<MachineBasicBlock*, 8> Worklist(1, MBB), BodyBlocks;
+  while (!Worklist.empty()) {
+    MachineBasicBlock *BB = Worklist.pop_back_val();
+    if (BB != MBB) BodyBlocks.push_back(BB);
+
+    for (succ_it SI = BB->succ_begin(), SE = BB->succ_end(); SI != SE; ++SI) {
+      MachineBasicBlock *Succ = *SI;
+      if (Succ == MBB || !L->contains(Succ)) continue;
+
+      if (--NumUnvisitedPreds[Succ] == 0) Worklist.push_back(Succ);
+    }
+  }
+
+  // The body is not a DAG without the back-edges, this is unexpected in the
+  // innermost loop.
+  if (BodyBlocks.size() + 1 != L->getNumBlocks()) return false;
+
+  DEBUG(dbgs() << "If-converting loop body of BB#" << MBB->getNumber()
+               << " with " << BodyBlocks.size() << " blocks\n");
+
+  bool Changed = false;
+  VInstrInfo::JT CurJT, SuccJT;
+  for (unsigned i = 0, e = BodyBlocks.size(); i != e; ++i) {
+    MachineBasicBlock *BB = BodyBlocks[i];
+    CurJT.clear();
+    SuccJT.clear();
+
+    // Give up if we run out of the traces, or the block cannot be predicated,
+    // the blocks that are already merged still form a bigger hyperblock.
+    if (NextTraceNum >= 64 || getMergeDst(BB, SuccJT, CurJT) != MBB)
+      return Changed;
+
+    hoistDatapathOpInSuccs(MBB, DT, MRI);
+    Changed |= mergeBlock(BB, MBB);
+  }
+
+  ++NumLoopsIfConverted;
+  return Changed;
+}
+
 void HyperBlockFormation::addPredToSet(MachineBasicBlock *MBB, IntSetTy &Set) {
   typedef MachineBasicBlock::pred_iterator pred_it;
   for (pred_it I = MBB->pred_begin(), E = MBB->pred_end(); I != E; ++I) {
@@ -222,6 +306,79 @@ void HyperBlockFormation::buildCFGForBB(MachineBasicBlock *MBB) {
   addPredToSet(MBB, PredSet);
 }
 
+bool HyperBlockFormation::applyProfiledWeights(MachineFunction &MF,
+                                               const BBProfile &Profile) {
+  if (!Profile.hasProfile(*MF.getFunction())) return false;
+
+  DenseMap<MachineBasicBlock*, uint64_t> Counts;
+  for (MachineFunction::iterator I = MF.begin(), E = MF.end(); I != E; ++I) {
+    uint64_t Count;
+    if (Profile.getEntryCount(I, Count)) Counts[I] = Count;
+  }
+
+  typedef MachineBasicBlock::succ_iterator succ_it;
+  typedef MachineBasicBlock::pred_iterator pred_it;
+  typedef std::pair<MachineBasicBlock*, uint64_t> EdgeCount;
+  bool Changed = false;
+  SmallVector<EdgeCount, 4> EdgeCounts;
+
+  for (MachineFunction::iterator I = MF.begin(), E = MF.end(); I != E; ++I) {
+    MachineBasicBlock *MBB = I;
+    if (MBB->succ_size() < 2 || !Counts.count(MBB)) continue;
+
+    // We only have the block entry counts. Estimate the count of the edge by
+    // splitting the entry count of the successor among its predecessors in
+    // proportion to their entry counts.
+    EdgeCounts.clear();
+    uint64_t SumCount = 0;
+    for (succ_it SI = MBB->succ_begin(), SE = MBB->succ_end(); SI != SE; ++SI) {
+      MachineBasicBlock *Succ = *SI;
+      if (!Counts.count(Succ)) break;
+
+      uint64_t PredsCount = 0;
+      bool AllPredsProfiled = true;
+      for (pred_it PI = Succ->pred_begin(), PE = Succ->pred_end(); PI != PE;
+           ++PI) {
+        DenseMap<MachineBasicBlock*, uint64_t>::iterator at = Counts.find(*PI);
+        if (at == Counts.end()) {
+          AllPredsProfiled = false;
+          break;
+        }
+
+        PredsCount += at->second;
+      }
+
+      if (!AllPredsProfiled) break;
+
+      uint64_t Count = Counts[Succ];
+      if (Succ->pred_size() > 1 && PredsCount)
+        Count = uint64_t(double(Count) * Counts[MBB] / PredsCount);
+
+      EdgeCounts.push_back(std::make_pair(Succ, Count));
+      SumCount += Count;
+    }
+
+    // Keep the static estimation if any count is missing.
+    if (EdgeCounts.size() != MBB->succ_size() || SumCount == 0) continue;
+
+    for (unsigned i = MBB->succ_size(); i > 0; --i)
+      MBB->removeSuccessor(MBB->succ_begin() + i - 1);
+
+    for (unsigned i = 0, e = EdgeCounts.size(); i != e; ++i) {
+      float Prob = float(EdgeCounts[i].second) / float(SumCount);
+      uint32_t w = std::max(uint32_t(Prob * BranchProbabilityScale), 1u);
+      DEBUG(dbgs() << "Profiled edge " << MBB->getName() << " -> "
+                   << EdgeCounts[i].first->getName() << ' ' << Prob << '\n');
+      MBB->addSuccessor(EdgeCounts[i].first, w);
+      ++NumProfiledEdges;
+    }
+
+    Changed = true;
+  }
+
+  return Changed;
+}
+
 bool HyperBlockFormation::runOnMachineFunction(MachineFunction &MF) {
   TII = MF.getTarget().getInstrInfo();
   MRI = &MF.getRegInfo();
@@ -233,6 +390,11 @@ bool HyperBlockFormation::runOnMachineFunction(MachineFunction &MF) {
   AllTraces.clear();
   CFGMap.clear();
 
+  // Use the real branch probabilities from the profile if there is any, the
+  // edge weights are maintained by foldCFGEdge when we merge the blocks.
+  if (const BBProfile *Profile = BBProfile::get())
+    MakeChanged |= applyProfiledWeights(MF, *Profile);
+
   // Eliminate the empty blocks.
   while (simplifyCFG(MF))
     MakeChanged = true;
@@ -241,6 +403,9 @@ bool HyperBlockFormation::runOnMachineFunction(MachineFunction &MF) {
 
   if (MF.size() == 1) return MakeChanged;
 
+  const bool EnablePipeLine =
+    IfConvertLoopBody && MF.getInfo<VFInfo>()->getInfo().enablePipeLine();
+
   // Cache the original CFG.
   for (MachineFunction::iterator I = MF.begin(), E = MF.end(); I != E; ++I)
     buildCFGForBB(I);
@@ -261,6 +426,9 @@ bool HyperBlockFormation::runOnMachineFunction(MachineFunction &MF) {
       hoistDatapathOpInSuccs(MBB, DT, MRI);
       MakeChanged |= BlockMerged = mergeTrivialSuccBlocks(MBB);
     } while (BlockMerged && NextTraceNum < 64);
+
+    // Form a single block loop, which can be software pipelined.
+    if (EnablePipeLine) MakeChanged |= ifConvertLoopBody(MBB);
   }
 
   for (MachineFunction::iterator I = MF.begin(), E = MF.end(); I != E; ++I)
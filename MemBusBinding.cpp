@@ -0,0 +1,170 @@
+//===------ MemBusBinding.cpp - Bind memory accesses to the buses -*- C++ -*-=//
+//
+//                      The Shang HLS frameowrk                               //
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implement the pass that bind the memory accesses to the memory
+// buses, if there are more than one memory bus available. The accesses that
+// may alias with each other are bound to the same bus, and the independent
+// alias sets are spread across the buses to balance their load. The accesses
+// to unknown locations, including the block transfers, are bound to the same
+// bus, the scheduler orders them against the accesses on all buses.
+//
+//===----------------------------------------------------------------------===//
+
+#include "vtm/VerilogBackendMCTargetDesc.h"
+#include "vtm/VInstrInfo.h"
+#include "vtm/FUInfo.h"
+#include "vtm/Passes.h"
+
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AliasSetTracker.h"
+#include "llvm/CodeGen/MachineMemOperand.h"
+#include "llvm/CodeGen/MachineInstr.h"
+#include "llvm/CodeGen/MachineBasicBlock.h"
+#include "llvm/CodeGen/MachineBlockFrequencyInfo.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Statistic.h"
+#define DEBUG_TYPE "vtm-membus-binding"
+#include "llvm/Support/Debug.h"
+
+using namespace llvm;
+
+STATISTIC(NumMemAccessRebound,
+          "Number of memory accesses bound to the memory bus other than 0");
+STATISTIC(NumUnknownAccesses,
+          "Number of memory accesses to unknown locations");
+
+namespace {
+struct MemBusBinding : public MachineFunctionPass {
+  static char ID;
+  AliasAnalysis *AA;
+
+  MemBusBinding() : MachineFunctionPass(ID), AA(0) {}
+
+  void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<AliasAnalysis>();
+    AU.addPreserved<AliasAnalysis>();
+    AU.addRequired<MachineBlockFrequencyInfo>();
+    AU.setPreservesCFG();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+  // The memory accesses in the same alias set, and their estimated number of
+  // executions.
+  struct AccessGroup {
+    SmallVector<MachineInstr*, 8> Accesses;
+    uint64_t Weight;
+
+    AccessGroup() : Weight(0) {}
+
+    bool operator<(const AccessGroup &RHS) const {
+      return Weight > RHS.Weight;
+    }
+  };
+
+  typedef DenseMap<AliasSet*, unsigned> GroupMapTy;
+
+  // Get the alias set of the memory access, return null if we do not know
+  // which locations are accessed by the access.
+  AliasSet *getAliasSet(MachineInstr *MI, AliasSetTracker &AST) {
+    // The block transfer commands access a range of locations that is not
+    // described by the memory operand.
+    if (MI->getOperand(3).getImm() >= VFUMemBus::CmdFirstNoLoadStore)
+      return 0;
+
+    if (MI->memoperands_empty()) return 0;
+
+    MachineMemOperand *MO = *MI->memoperands_begin();
+    Value *Ptr = const_cast<Value*>(MO->getValue());
+    if (Ptr == 0) return 0;
+
+    // AliasAnalysis cannot handle offset right now, so we pretend to access
+    // a big enough size to the location pointed by the base pointer.
+    uint64_t Size = MO->getSize() + MO->getOffset();
+    return &AST.getAliasSetForPointer(Ptr, Size, MO->getTBAAInfo());
+  }
+
+  bool runOnMachineFunction(MachineFunction &MF);
+};
+}
+
+Pass *llvm::createMemBusBindingPass() {
+  return new MemBusBinding();
+}
+
+char MemBusBinding::ID = 0;
+
+bool MemBusBinding::runOnMachineFunction(MachineFunction &MF) {
+  unsigned NumBuses = getFUDesc<VFUMemBus>()->getNumBuses();
+  if (NumBuses == 1) return false;
+
+  AA = &getAnalysis<AliasAnalysis>();
+  MachineBlockFrequencyInfo &MBFI = getAnalysis<MachineBlockFrequencyInfo>();
+
+  typedef MachineFunction::iterator bb_iterator;
+  typedef MachineBasicBlock::instr_iterator instr_iterator;
+
+  // Build the alias sets from all memory accesses in the function before we
+  // look up the set of any access, the sets may be merged during building.
+  AliasSetTracker AST(*AA);
+  SmallVector<MachineInstr*, 32> MemAccesses;
+  for (bb_iterator BI = MF.begin(), BE = MF.end(); BI != BE; ++BI)
+    for (instr_iterator I = BI->instr_begin(), E = BI->instr_end(); I != E; ++I)
+      if (I->getOpcode() == VTM::VOpMemTrans) {
+        getAliasSet(I, AST);
+        MemAccesses.push_back(I);
+      }
+
+  if (MemAccesses.empty()) return false;
+
+  GroupMapTy GroupMap;
+  std::vector<AccessGroup> Groups;
+  for (unsigned i = 0, e = MemAccesses.size(); i != e; ++i) {
+    MachineInstr *MI = MemAccesses[i];
+    // The unknown accesses are grouped by the null alias set, so both commands
+    // of a block transfer sequence are bound to the same bus.
+    AliasSet *AS = getAliasSet(MI, AST);
+    if (AS == 0) ++NumUnknownAccesses;
+
+    std::pair<GroupMapTy::iterator, bool> at
+      = GroupMap.insert(std::make_pair(AS, Groups.size()));
+    if (at.second) Groups.push_back(AccessGroup());
+
+    AccessGroup &G = Groups[at.first->second];
+    G.Accesses.push_back(MI);
+    // Weight the access by the frequency of its parent block.
+    G.Weight += std::max(MBFI.getBlockFreq(MI->getParent()).getFrequency(),
+                         uint64_t(1));
+  }
+
+  // Bind the heaviest group to the least loaded bus first.
+  std::stable_sort(Groups.begin(), Groups.end());
+  std::vector<uint64_t> BusLoad(NumBuses, 0);
+  bool Changed = false;
+  for (unsigned i = 0, e = Groups.size(); i != e; ++i) {
+    AccessGroup &G = Groups[i];
+    unsigned BusNum = std::min_element(BusLoad.begin(), BusLoad.end())
+                      - BusLoad.begin();
+    BusLoad[BusNum] += G.Weight;
+
+    DEBUG(dbgs() << "Bind " << G.Accesses.size() << " accesses with weight "
+                 << G.Weight << " to memory bus " << BusNum << '\n');
+
+    if (BusNum == 0) continue;
+
+    for (unsigned j = 0, je = G.Accesses.size(); j != je; ++j) {
+      G.Accesses[j]->getOperand(5).setImm(BusNum);
+      ++NumMemAccessRebound;
+    }
+    Changed = true;
+  }
+
+  return Changed;
+}
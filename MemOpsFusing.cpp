@@ -229,6 +229,10 @@ bool MemOpsFusing::trackUsesOfSrc(InstSetTy &UseSet, MachineInstr *Src,
 }
 
 bool MemOpsFusing::canBeFused(MachineInstr *LHS, MachineInstr *RHS) {
+  // The block transfer commands are not ordinary loads or stores.
+  if (VInstrInfo::isBlockTransfer(LHS) || VInstrInfo::isBlockTransfer(RHS))
+    return false;
+
   MachineMemOperand *LHSAddr = *LHS->memoperands_begin(),
                     *RHSAddr = *RHS->memoperands_begin();
 
@@ -383,8 +387,10 @@ void MemOpsFusing::fuseMachineInstr(MachineInstr *From, MachineInstr *To) {
 
   MachineOperand TraceOperand = *VInstrInfo::getTraceOperand(To);
   TraceOperand.clearParent();
+  unsigned BusNum = To->getOperand(5).getImm();
 
   // Refresh the machine operand.
+  To->RemoveOperand(7);
   To->RemoveOperand(6);
   To->RemoveOperand(5);
   To->RemoveOperand(4);
@@ -398,6 +404,7 @@ void MemOpsFusing::fuseMachineInstr(MachineInstr *From, MachineInstr *To) {
   To->addOperand(LowerData);
   To->addOperand(VInstrInfo::CreateImm(NewMO[0]->isStore(), 1));
   To->addOperand(VInstrInfo::CreateImm(ByteEn, 8));
+  To->addOperand(VInstrInfo::CreateImm(BusNum, 8));
   To->addOperand(VInstrInfo::CreatePredicate(NewPred));
   To->addOperand(TraceOperand);
 
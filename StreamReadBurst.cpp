@@ -0,0 +1,205 @@
+//===- StreamReadBurst.cpp - Fetch the read streams of loops ----*- C++ -*-===//
+//
+//                      The Shang HLS frameowrk                               //
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass finds the loads in the innermost loops that walk through a
+// contiguous address range, one element per iteration, e.g. the input arrays
+// of the fir and dot product kernels, and inserts the stream read hints to the
+// loop preheaders. The hint is lowered to the stream read command of the memory
+// bus, which fetches the whole range with burst transfers, so the loads in the
+// loop are served from the fetched data instead of individual bus reads.
+//
+// The hint does not change the memory content, and the memory bus keeps the
+// fetched data coherent with the stores, so the hint is safe even if the
+// range is modified in the loop.
+//
+//===----------------------------------------------------------------------===//
+
+#include "VIntrinsicsInfo.h"
+
+#include "vtm/Passes.h"
+
+#include "llvm/Constants.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+#include "llvm/Analysis/Dominators.h"
+#include "llvm/Analysis/LoopPass.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#define DEBUG_TYPE "vtm-stream-read-burst"
+#include "llvm/Support/Debug.h"
+
+using namespace llvm;
+
+static cl::opt<unsigned>
+MaxStreamReadBytes("vtm-max-stream-read-bytes",
+                   cl::desc("The maximal number of bytes fetched by a stream"
+                            " read command of the memory bus, i.e. the size"
+                            " of a slot of the stream buffer"),
+                   cl::init(128));
+
+STATISTIC(NumStreamReads, "Number of stream read hints inserted");
+
+namespace {
+struct StreamReadBurst : public LoopPass {
+  static char ID;
+  const TargetIntrinsicInfo &IntrInfo;
+  ScalarEvolution *SE;
+  DominatorTree *DT;
+  TargetData *TD;
+
+  StreamReadBurst(const TargetIntrinsicInfo &I)
+    : LoopPass(ID), IntrInfo(I), SE(0), DT(0), TD(0) {}
+
+  StreamReadBurst()
+    : LoopPass(ID), IntrInfo(*new VIntrinsicInfo()), SE(0), DT(0), TD(0) {
+    llvm_unreachable("Cannot construct StreamReadBurst like this!");
+  }
+
+  const char *getPassName() const { return "Stream Read Burst Pass"; }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequiredID(LoopSimplifyID);
+    AU.addPreservedID(LoopSimplifyID);
+    AU.addRequired<LoopInfo>();
+    AU.addPreserved<LoopInfo>();
+    AU.addRequired<DominatorTree>();
+    AU.addPreserved<DominatorTree>();
+    AU.addRequired<ScalarEvolution>();
+    AU.addPreserved<ScalarEvolution>();
+    AU.addRequired<TargetData>();
+    AU.setPreservesCFG();
+  }
+
+  bool runOnLoop(Loop *L, LPPassManager &LPM);
+
+  // Return the lowest address of the stream read by LI in L, or null if LI
+  // does not read a stream.
+  const SCEV *getStreamBase(LoadInst *LI, Loop *L, uint64_t TripCount,
+                            uint64_t &SizeInBytes);
+};
+}
+
+char StreamReadBurst::ID = 0;
+
+Pass *llvm::createStreamReadBurstPass(const TargetIntrinsicInfo &IntrInfo) {
+  return new StreamReadBurst(IntrInfo);
+}
+
+const SCEV *StreamReadBurst::getStreamBase(LoadInst *LI, Loop *L,
+                                           uint64_t TripCount,
+                                           uint64_t &SizeInBytes) {
+  if (LI->isVolatile()) return 0;
+
+  Value *Ptr = LI->getPointerOperand();
+  // The loads from the block RAMs are not performed by the memory bus.
+  if (cast<PointerType>(Ptr->getType())->getAddressSpace()) return 0;
+
+  const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(Ptr));
+  if (AR == 0 || AR->getLoop() != L || !AR->isAffine()) return 0;
+
+  const SCEVConstant *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(*SE));
+  if (Step == 0) return 0;
+
+  // Only read the stream which is accessed one element after another.
+  uint64_t ElemSize = TD->getTypeStoreSize(LI->getType());
+  int64_t Stride = Step->getValue()->getSExtValue();
+  if (uint64_t(Stride < 0 ? -Stride : Stride) != ElemSize) return 0;
+
+  // Do not fetch a stream that is too big.
+  if (TripCount > MaxStreamReadBytes / ElemSize) return 0;
+
+  SizeInBytes = ElemSize * TripCount;
+
+  const SCEV *Start = AR->getStart();
+  if (Stride > 0) return Start;
+
+  // The stream is read from the high address to the low address.
+  Type *IntPtrTy = SE->getEffectiveSCEVType(Start->getType());
+  return SE->getAddExpr(Start, SE->getConstant(IntPtrTy,
+                                               Stride * (TripCount - 1), true));
+}
+
+bool StreamReadBurst::runOnLoop(Loop *L, LPPassManager &LPM) {
+  // Only fetch the streams of the innermost loops, the streams of the outer
+  // loops are too long to be fetched.
+  if (!L->empty()) return false;
+
+  BasicBlock *Preheader = L->getLoopPreheader();
+  if (Preheader == 0) return false;
+
+  SE = &getAnalysis<ScalarEvolution>();
+  DT = &getAnalysis<DominatorTree>();
+  TD = &getAnalysis<TargetData>();
+
+  const SCEVConstant *BackedgeTakenCount
+    = dyn_cast<SCEVConstant>(SE->getBackedgeTakenCount(L));
+  if (BackedgeTakenCount == 0) return false;
+
+  uint64_t TripCount = BackedgeTakenCount->getValue()->getZExtValue() + 1;
+  // Nothing to gain if there is only one iteration.
+  if (TripCount < 2) return false;
+
+  SmallVector<BasicBlock*, 4> ExitingBlocks;
+  L->getExitingBlocks(ExitingBlocks);
+
+  Module &M = *Preheader->getParent()->getParent();
+  Type *Int8PtrTy = Type::getInt8PtrTy(M.getContext());
+  Type *Int32Ty = Type::getInt32Ty(M.getContext());
+  SCEVExpander Expander(*SE, "stream");
+  SmallPtrSet<const SCEV*, 8> FetchedStreams;
+  bool changed = false;
+
+  typedef Loop::block_iterator block_iterator;
+  for (block_iterator BI = L->block_begin(), BE = L->block_end();
+       BI != BE; ++BI) {
+    BasicBlock *BB = *BI;
+
+    // The loads must be executed in every iteration, otherwise the fetched
+    // data may be not used at all.
+    bool ExecutedInEveryIteration = true;
+    for (unsigned i = 0, e = ExitingBlocks.size(); i != e; ++i)
+      if (!DT->dominates(BB, ExitingBlocks[i])) {
+        ExecutedInEveryIteration = false;
+        break;
+      }
+
+    if (!ExecutedInEveryIteration) continue;
+
+    for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
+      LoadInst *LI = dyn_cast<LoadInst>(I);
+      if (LI == 0) continue;
+
+      uint64_t SizeInBytes = 0;
+      const SCEV *Base = getStreamBase(LI, L, TripCount, SizeInBytes);
+      if (Base == 0 || !FetchedStreams.insert(Base)) continue;
+
+      DEBUG(dbgs() << "Fetch " << SizeInBytes << " bytes from " << *Base
+                   << " for " << *LI << '\n');
+
+      Value *Args[] = {
+        Expander.expandCodeFor(Base, Int8PtrTy, Preheader->getTerminator()),
+        ConstantInt::get(Int32Ty, SizeInBytes)
+      };
+      Function *StreamRead =
+        IntrInfo.getDeclaration(&M, vtmIntrinsic::vtm_stream_read);
+      CallInst::Create(StreamRead, Args, "", Preheader->getTerminator());
+
+      ++NumStreamReads;
+      changed = true;
+    }
+  }
+
+  return changed;
+}
@@ -16,10 +16,13 @@
 #include "llvm/CodeGen/MachineFunction.h"
 
 #include "vtm/Passes.h"
+#include "vtm/Utilities.h"
 
 #include "llvm/Pass.h"
 #include "llvm/Module.h"
+#include "llvm/Constants.h"
 #include "llvm/Instructions.h"
+#include "llvm/Operator.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/ADT/SmallVector.h"
@@ -32,6 +35,7 @@
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
 #define DEBUG_TYPE "vtm-frame-lowering"
 #include "llvm/Support/Debug.h"
 #include "llvm/ADT/Statistic.h"
@@ -40,12 +44,25 @@ using namespace llvm;
 static cl::opt<bool> EnableBRAM("vtm-enable-bram",
                                 cl::desc("Enable block RAM in design"),
                                 cl::init(true));
+static cl::opt<unsigned>
+MaxAutoPartition("vtm-bram-auto-partition",
+                 cl::desc("The maximal number of banks that an array is"
+                          " cyclically partitioned into, if the banks accessed"
+                          " by all accesses are statically known and some"
+                          " accesses in the same block access different banks"
+                          " (1 to disable)"),
+                 cl::init(1));
 
 STATISTIC(NumGlobalAlias, "Number of global alias created for allocas");
 STATISTIC(NumBlockRAMs, "Number of block RAM created");
 STATISTIC(NumLocalizedGV, "Number of GlobalVariable localized");
 STATISTIC(NumInitializedGV,
           "Number of GlobalVariable with initializer localized");
+STATISTIC(NumPartitionedArrays, "Number of arrays partitioned into banks");
+STATISTIC(NumArrayBanks, "Number of banks created by array partitioning");
+STATISTIC(NumPartitionDirectivesIgnored,
+          "Number of array partition directives ignored because the banks"
+          " accessed are not statically known");
 
 
 void VFrameInfo::emitPrologue(MachineFunction &MF) const {
@@ -96,6 +113,59 @@ static bool visitPtrUseTree(Value *BasePtr, VisitFunc &Visitor) {
 }
 
 namespace {
+// The array is partitioned into NumBanks banks, the element with index Idx is
+// placed in bank (Idx >> BankShift) & (NumBanks - 1). In the cyclic partition
+// BankShift is 0 and the index in the bank is Idx >> log2(NumBanks); in the
+// block partition the index in the bank is Idx & ((1 << BankShift) - 1). The
+// complete partition is a cyclic partition with 1 element per bank, and the
+// banks with 1 element are replaced by registers during RTL generation.
+struct ArrayPartition {
+  unsigned NumElem, NumBankBits, BankShift;
+  bool IsCyclic;
+
+  ArrayPartition(unsigned NumElem, unsigned NumBanks, bool IsCyclic)
+    : NumElem(NumElem), NumBankBits(Log2_32(NumBanks)), BankShift(0),
+      IsCyclic(IsCyclic) {
+    assert(isPowerOf2_32(NumBanks) && NumBanks > 1 && "Bad number of banks!");
+    if (!IsCyclic)
+      BankShift = std::max(Log2_32_Ceil(NumElem), NumBankBits) - NumBankBits;
+  }
+
+  unsigned getNumBanks() const { return 1u << NumBankBits; }
+
+  // The number of elements placed in the bank.
+  unsigned getBankSize(unsigned Bank) const {
+    if (IsCyclic) return (NumElem - Bank + getNumBanks() - 1) >> NumBankBits;
+
+    // The last banks may be empty, e.g. 10 elements in 4 banks of 4 elements.
+    unsigned FirstElem = std::min(Bank << BankShift, NumElem);
+    return std::min(1u << BankShift, NumElem - FirstElem);
+  }
+
+  // Get the index of the element in the array from its index in the bank.
+  unsigned getIndexInArray(unsigned Bank, unsigned Idx) const {
+    if (IsCyclic) return (Idx << NumBankBits) | Bank;
+
+    return (Bank << BankShift) | Idx;
+  }
+
+  // Get the bank accessed by the array index, return false if it is not
+  // statically known.
+  bool getBank(Value *Idx, const TargetData *TD, unsigned &Bank) const {
+    unsigned BitWidth = Idx->getType()->getScalarSizeInBits();
+    if (BankShift + NumBankBits > BitWidth) return false;
+
+    APInt KnownZero(BitWidth, 0), KnownOne(BitWidth, 0);
+    ComputeMaskedBits(Idx, KnownZero, KnownOne, TD);
+    APInt BankMask
+      = APInt::getBitsSet(BitWidth, BankShift, BankShift + NumBankBits);
+    if (((KnownZero | KnownOne) & BankMask) != BankMask) return false;
+
+    Bank = (KnownOne & BankMask).lshr(BankShift).getZExtValue();
+    return true;
+  }
+};
+
 struct BlockRAMFormation : public ModulePass {
   static char ID;
   const TargetIntrinsicInfo &IntrInfo;
@@ -121,6 +191,17 @@ struct BlockRAMFormation : public ModulePass {
   bool runOnModule(Module &M);
   bool runOnFunction(Function &F, Module &M);
   bool localizeGV(GlobalVariable *GV, Module &M);
+
+  // Partition the array, the banks that are accessed are put into Banks and
+  // the array is deleted. Return false if the array is not partitioned.
+  bool partitionArray(Value *Array, Module &M,
+                      SmallVectorImpl<Value*> &Banks);
+  bool choosePartition(Value *Array, ArrayRef<GEPOperator*> Accesses,
+                       unsigned &NumBanks, bool &IsCyclic);
+  bool isPartitionProfitable(const ArrayPartition &P,
+                             ArrayRef<GEPOperator*> Accesses);
+  Value *createBank(Value *Array, const ArrayPartition &P, unsigned Bank,
+                    Module &M);
   bool replaceCallUser(GlobalVariable *GV);
   bool replaceCallUser(GlobalVariable *GV, Function *Callee, unsigned ArgNo,
                        ArrayRef<CallSite> Users);
@@ -299,9 +380,19 @@ void BlockRAMFormation::annotateBRAMInfo(unsigned BRAMNum, Type *AllocatedType,
 
 bool BlockRAMFormation::runOnFunction(Function &F, Module &M) {
   bool changed = false;
+  SmallVector<Value*, 16> Allocas;
+  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+    if (isa<AllocaInst>(*I)) Allocas.push_back(&*I);
+
+  // Partition the arrays before building the block RAMs, so each bank is
+  // built into its own block RAM.
+  if (EnableBRAM)
+    for (unsigned i = 0, e = Allocas.size(); i != e; ++i)
+      if (partitionArray(Allocas[i], M, Allocas)) Allocas[i] = 0;
+
   AllocateUseCollector Collector;
-  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; /*++I*/) {
-    AllocaInst *AI = dyn_cast<AllocaInst>(&*I++);
+  for (unsigned i = 0, e = Allocas.size(); i != e; ++i) {
+    AllocaInst *AI = cast_or_null<AllocaInst>(Allocas[i]);
     if (!AI) continue;
 
     BasicBlock *BB = AI->getParent();
@@ -370,6 +461,254 @@ bool BlockRAMFormation::localizeGV(GlobalVariable *GV, Module &M) {
   return true;
 }
 
+// Collect the GEPs that index the array, return false if the array is not only
+// accessed by loading/storing its elements through these GEPs.
+static bool collectArrayAccesses(Value *Array,
+                                 SmallVectorImpl<GEPOperator*> &Accesses,
+                                 SmallVectorImpl<Instruction*> &Markers) {
+  typedef Value::use_iterator use_iterator;
+  for (use_iterator I = Array->use_begin(), E = Array->use_end(); I != E; ++I) {
+    // The bitcasts used by the lifetime markers are dropped together with the
+    // markers.
+    if (BitCastInst *BC = dyn_cast<BitCastInst>(*I)) {
+      if (!onlyUsedByLifetimeMarkers(BC)) return false;
+
+      Markers.push_back(BC);
+      continue;
+    }
+
+    GEPOperator *GEP = dyn_cast<GEPOperator>(*I);
+    if (GEP == 0 || GEP->getPointerOperand() != Array
+        || GEP->getNumIndices() != 2)
+      return false;
+
+    Constant *FirstIdx = dyn_cast<Constant>(GEP->getOperand(1));
+    if (FirstIdx == 0 || !FirstIdx->isNullValue()) return false;
+
+    for (use_iterator UI = GEP->use_begin(), UE = GEP->use_end(); UI != UE;
+         ++UI) {
+      if (isa<LoadInst>(*UI)) continue;
+
+      StoreInst *SI = dyn_cast<StoreInst>(*UI);
+      if (SI == 0 || SI->getValueOperand() == GEP) return false;
+    }
+
+    Accesses.push_back(GEP);
+  }
+
+  return !Accesses.empty();
+}
+
+bool BlockRAMFormation::isPartitionProfitable(const ArrayPartition &P,
+                                              ArrayRef<GEPOperator*> Accesses) {
+  // The bank accessed by the first access of the block.
+  DenseMap<const BasicBlock*, unsigned> BankInBB;
+  bool AccessDifferentBanks = false;
+
+  for (unsigned i = 0; i < Accesses.size(); ++i) {
+    GEPOperator *GEP = Accesses[i];
+    unsigned Bank;
+    if (!P.getBank(GEP->getOperand(2), TD, Bank)) return false;
+
+    typedef Value::use_iterator use_iterator;
+    for (use_iterator I = GEP->use_begin(), E = GEP->use_end(); I != E; ++I) {
+      const BasicBlock *BB = cast<Instruction>(*I)->getParent();
+      unsigned FirstBank
+        = BankInBB.insert(std::make_pair(BB, Bank)).first->second;
+      AccessDifferentBanks |= FirstBank != Bank;
+    }
+  }
+
+  // Only partition the array if there is a chance to access the banks in
+  // parallel.
+  return AccessDifferentBanks;
+}
+
+bool BlockRAMFormation::choosePartition(Value *Array,
+                                        ArrayRef<GEPOperator*> Accesses,
+                                        unsigned &NumBanks, bool &IsCyclic) {
+  ArrayType *AT =
+    cast<ArrayType>(cast<PointerType>(Array->getType())->getElementType());
+  unsigned NumElem = AT->getNumElements();
+
+  std::string Scheme;
+  unsigned Factor = 0;
+  if (getArrayPartitionFromEngine(Array->getName(), Scheme, Factor)) {
+    if (Scheme == "none") return false;
+
+    if (Scheme == "complete") {
+      NumBanks = 1u << Log2_32_Ceil(NumElem);
+      IsCyclic = true;
+    } else if (Scheme == "cyclic" || Scheme == "block") {
+      if (Factor < 2 || !isPowerOf2_32(Factor))
+        report_fatal_error("Partition factor of array '" + Array->getName()
+                           + "' should be a power of 2 bigger than 1!");
+
+      NumBanks = std::min(Factor, 1u << Log2_32_Ceil(NumElem));
+      IsCyclic = Scheme == "cyclic";
+    } else
+      report_fatal_error("Unknown partition scheme '" + Twine(Scheme)
+                         + "' of array '" + Array->getName() + "'!");
+
+    ArrayPartition P(NumElem, NumBanks, IsCyclic);
+    for (unsigned i = 0; i < Accesses.size(); ++i) {
+      unsigned Bank;
+      if (P.getBank(Accesses[i]->getOperand(2), TD, Bank)) continue;
+
+      DEBUG(dbgs() << "Cannot partition " << Array->getName()
+                   << ", the bank accessed by " << *Accesses[i]
+                   << " is unknown.\n");
+      ++NumPartitionDirectivesIgnored;
+      return false;
+    }
+
+    return true;
+  }
+
+  // Otherwise try the cyclic partition with the most banks.
+  IsCyclic = true;
+  for (NumBanks = 1u << Log2_32(std::max(MaxAutoPartition.getValue(), 1u));
+       NumBanks > 1; NumBanks >>= 1)
+    if (NumBanks <= NumElem
+        && isPartitionProfitable(ArrayPartition(NumElem, NumBanks, true),
+                                 Accesses))
+      return true;
+
+  return false;
+}
+
+Value *BlockRAMFormation::createBank(Value *Array, const ArrayPartition &P,
+                                     unsigned Bank, Module &M) {
+  ArrayType *AT =
+    cast<ArrayType>(cast<PointerType>(Array->getType())->getElementType());
+  ArrayType *BankTy = ArrayType::get(AT->getElementType(), P.getBankSize(Bank));
+  std::string Name = Array->getName().str() + "_bank" + utostr_32(Bank);
+  ++NumArrayBanks;
+
+  if (AllocaInst *AI = dyn_cast<AllocaInst>(Array))
+    return new AllocaInst(BankTy, 0, AI->getAlignment(), Name, AI);
+
+  GlobalVariable *GV = cast<GlobalVariable>(Array);
+  Constant *Init = GV->getInitializer();
+  SmallVector<Constant*, 16> Elts;
+  for (unsigned i = 0, e = BankTy->getNumElements(); i != e; ++i)
+    Elts.push_back(Init->getAggregateElement(P.getIndexInArray(Bank, i)));
+
+  GlobalVariable *BankGV =
+    new GlobalVariable(M, BankTy, GV->isConstant(), GV->getLinkage(),
+                       ConstantArray::get(BankTy, Elts), Name, GV,
+                       GlobalVariable::NotThreadLocal, 0);
+  BankGV->setAlignment(GV->getAlignment());
+  return BankGV;
+}
+
+bool BlockRAMFormation::partitionArray(Value *Array, Module &M,
+                                       SmallVectorImpl<Value*> &Banks) {
+  ArrayType *AT =
+    dyn_cast<ArrayType>(cast<PointerType>(Array->getType())->getElementType());
+  // Only partition the single dimension arrays of scalars.
+  if (AT == 0 || AT->getNumElements() < 2
+      || !AT->getElementType()->isSingleValueType()
+      || AT->getElementType()->isVectorTy())
+    return false;
+
+  if (GlobalVariable *GV = dyn_cast<GlobalVariable>(Array)) {
+    if (!GV->hasLocalLinkage() || GV->isThreadLocal()) return false;
+
+    // We need to split the initializer.
+    Constant *Init = GV->getInitializer();
+    if (!isa<ConstantAggregateZero>(Init) && !isa<ConstantArray>(Init)
+        && !isa<ConstantDataSequential>(Init) && !isa<UndefValue>(Init))
+      return false;
+
+    // Only partition the GV that is going to be localized.
+    GV->removeDeadConstantUsers();
+    GVUseCollector Collector;
+    if (!visitPtrUseTree(GV, Collector) || !Collector.canBeLocalized())
+      return false;
+  } else if (cast<AllocaInst>(Array)->isArrayAllocation())
+    return false;
+
+  SmallVector<GEPOperator*, 16> Accesses;
+  SmallVector<Instruction*, 4> Markers;
+  if (!collectArrayAccesses(Array, Accesses, Markers)) return false;
+
+  unsigned NumBanks;
+  bool IsCyclic;
+  if (!choosePartition(Array, Accesses, NumBanks, IsCyclic)) return false;
+
+  ArrayPartition P(AT->getNumElements(), NumBanks, IsCyclic);
+  DEBUG(dbgs() << "Partition " << Array->getName() << " into " << NumBanks
+               << (IsCyclic ? " cyclic" : " block") << " banks.\n");
+
+  SmallVector<Value*, 8> BankArrays(NumBanks, 0);
+  for (unsigned i = 0; i < Accesses.size(); ++i) {
+    GEPOperator *GEP = Accesses[i];
+    Value *Idx = GEP->getOperand(2);
+    unsigned Bank = 0;
+    bool Known = P.getBank(Idx, TD, Bank);
+    assert(Known && "Bank of the access not known!");
+    (void) Known;
+
+    Value *&BankArray = BankArrays[Bank];
+    if (BankArray == 0) {
+      BankArray = createBank(Array, P, Bank, M);
+      Banks.push_back(BankArray);
+    }
+
+    // Compute the index in the bank.
+    Instruction::BinaryOps Opc = Instruction::LShr;
+    Constant *Amt = ConstantInt::get(Idx->getType(), P.NumBankBits);
+    if (!IsCyclic) {
+      Opc = Instruction::And;
+      Amt = ConstantInt::get(Idx->getType(), (1ull << P.BankShift) - 1);
+    }
+
+    if (GetElementPtrInst *GEPInst = dyn_cast<GetElementPtrInst>(GEP)) {
+      Value *BankIdx = 0;
+      if (Constant *C = dyn_cast<Constant>(Idx))
+        BankIdx = ConstantExpr::get(Opc, C, Amt);
+      else
+        BankIdx = BinaryOperator::Create(Opc, Idx, Amt,
+                                         Idx->getName() + ".bank_idx", GEPInst);
+
+      Value *Idxs[] = { GEP->getOperand(1), BankIdx };
+      GetElementPtrInst *NewGEP =
+        GetElementPtrInst::Create(BankArray, Idxs, GEPInst->getName(), GEPInst);
+      NewGEP->setIsInBounds(GEPInst->isInBounds());
+      GEPInst->replaceAllUsesWith(NewGEP);
+      GEPInst->eraseFromParent();
+      continue;
+    }
+
+    ConstantExpr *CE = cast<ConstantExpr>(GEP);
+    Constant *Idxs[] = { CE->getOperand(1),
+                         ConstantExpr::get(Opc, cast<Constant>(Idx), Amt) };
+    Constant *NewGEP =
+      ConstantExpr::getGetElementPtr(cast<Constant>(BankArray), Idxs,
+                                     GEP->isInBounds());
+    CE->replaceAllUsesWith(NewGEP);
+    CE->destroyConstant();
+  }
+
+  // Drop the lifetime markers.
+  while (!Markers.empty()) {
+    Instruction *BC = Markers.pop_back_val();
+    while (!BC->use_empty())
+      cast<Instruction>(BC->use_back())->eraseFromParent();
+    BC->eraseFromParent();
+  }
+
+  assert(Array->use_empty() && "Array still used after partitioned!");
+  if (GlobalVariable *GV = dyn_cast<GlobalVariable>(Array))
+    GV->eraseFromParent();
+  else
+    cast<AllocaInst>(Array)->eraseFromParent();
+
+  ++NumPartitionedArrays;
+  return true;
+}
+
 bool BlockRAMFormation::replaceCallUser(GlobalVariable *GV) {
   typedef DenseMap<std::pair<Function *, unsigned>, SmallVector<CallSite, 4> >
           CallUsersMap;
@@ -420,9 +759,20 @@ bool BlockRAMFormation::runOnModule(Module &M) {
 
   typedef Module::global_iterator global_iterator;
 
-  if (EnableBRAM)
+  if (EnableBRAM) {
+    // Partition the arrays before localizing them, so each bank is localized
+    // to its own block RAM.
+    SmallVector<GlobalVariable*, 16> Arrays;
+    for (global_iterator I = M.global_begin(), E = M.global_end(); I != E; ++I)
+      if (GVUseCollector::isLocalizedCandidate(I)) Arrays.push_back(I);
+
+    SmallVector<Value*, 16> Banks;
+    while (!Arrays.empty())
+      changed |= partitionArray(Arrays.pop_back_val(), M, Banks);
+
     for (global_iterator I = M.global_begin(), E = M.global_end(); I != E; ++I)
       changed |= localizeGV(I, M);
+  }
 
   for (Module::iterator I = M.begin(), E = M.end(); I != E; ++I)
     changed |= runOnFunction(*I, M);
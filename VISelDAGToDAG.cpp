@@ -72,6 +72,7 @@ private:
   SDNode *SelectUnary(SDNode *N, unsigned OpC);
   // If we need to copy the operand to register explicitly, set CopyOp to true.
   SDNode *SelectBinary(SDNode *N, unsigned OpC);
+  SDNode *SelectDiv(SDNode *N, unsigned Mode);
   SDNode *SelectSimpleNode(SDNode *N, unsigned OpC);
 
   // Function argument and return values.
@@ -177,6 +178,20 @@ SDNode *VDAGToDAGISel::SelectBinary(SDNode *N, unsigned OpC) {
                               Ops, array_lengthof(Ops));
 }
 
+SDNode *VDAGToDAGISel::SelectDiv(SDNode *N, unsigned Mode) {
+  SDValue Ops [] = { N->getOperand(0),
+                     N->getOperand(1),
+                     CurDAG->getTargetConstant(Mode, MVT::i8),
+                     SDValue()/*The dummy bit width operand*/,
+                     CurDAG->getTargetConstant(0, MVT::i64) /*and trace number*/
+                   };
+
+  computeOperandsBitWidth(N, Ops, array_lengthof(Ops));
+
+  return CurDAG->SelectNodeTo(N, VTM::VOpDiv, N->getVTList(),
+                              Ops, array_lengthof(Ops));
+}
+
 SDNode *VDAGToDAGISel::buildBitSlice(SDNode *N, unsigned SizeOfN,
                                      unsigned UB, unsigned LB) {
   BitWidthAnnotator Annotator;
@@ -359,6 +374,9 @@ SDNode *VDAGToDAGISel::SelectMemAccess(SDNode *N) {
     // Block RAM number.
     Ops.push_back(CurDAG->getTargetConstant(AS, MVT::i32));
     Opcode = VTM::VOpBRAMTrans;
+  } else {
+    // Memory bus number, the accesses are bound to the buses by MemBusBinding.
+    Ops.push_back(CurDAG->getTargetConstant(0, MVT::i32));
   }
   Ops.push_back(SDValue()); //The dummy bit width operand
   Ops.push_back(CurDAG->getTargetConstant(0, MVT::i64)); //and trace number*
@@ -442,6 +460,12 @@ SDNode *VDAGToDAGISel::Select(SDNode *N) {
     return SelectBinary(N, VTM::VOpMultLoHi_c);
   }
 
+  case ISD::UDIV:             return SelectDiv(N, 0);
+  case ISD::SDIV:             return SelectDiv(N, VFUDiv::Signed);
+  case ISD::UREM:             return SelectDiv(N, VFUDiv::Remainder);
+  case ISD::SREM:
+    return SelectDiv(N, VFUDiv::Signed | VFUDiv::Remainder);
+
   case ISD::XOR:              return SelectBinary(N, VTM::VOpXor);
   case ISD::AND:              return SelectBinary(N, VTM::VOpAnd);
   case ISD::OR:               return SelectBinary(N, VTM::VOpOr);
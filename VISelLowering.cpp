@@ -85,10 +85,16 @@ VTargetLowering::VTargetLowering(TargetMachine &TM)
   setOperationAction(ISD::INTRINSIC_W_CHAIN, MVT::Other, Custom);
   setOperationAction(ISD::INTRINSIC_VOID, MVT::Other, Custom);
 
+  // Select the divisions to the divider if it is available, otherwise expand
+  // them to library calls.
+  bool HasDivider = getFUDesc<VFUDiv>()->isAvailable();
+
   for (unsigned VT = (unsigned)MVT::FIRST_INTEGER_VALUETYPE;
        VT <= (unsigned)MVT::LAST_INTEGER_VALUETYPE; ++VT) {
     MVT CurVT = MVT((MVT::SimpleValueType)VT);
     LegalizeAction CustomOrExpand = CurVT.getSizeInBits()>64 ? Expand : Custom;
+    LegalizeAction DivAction =
+      (HasDivider && CurVT.getSizeInBits() <= 64) ? Legal : Expand;
 
     setOperationAction(ISD::FrameIndex, CurVT, CustomOrExpand);
 
@@ -112,13 +118,13 @@ VTargetLowering::VTargetLowering(TargetMachine &TM)
     setOperationAction(ISD::SMUL_LOHI, CurVT, Expand);
     //setOperationAction(ISD::UMUL_LOHI, CurVT, Expand);
 
-    // We don't have DIV
-    setOperationAction(ISD::SDIV, CurVT, Expand);
+    // The divider computes either the quotient or the remainder.
+    setOperationAction(ISD::SDIV, CurVT, DivAction);
     setOperationAction(ISD::SDIVREM, CurVT, Expand);
-    setOperationAction(ISD::SREM, CurVT, Expand);
-    setOperationAction(ISD::UDIV, CurVT, Expand);
+    setOperationAction(ISD::SREM, CurVT, DivAction);
+    setOperationAction(ISD::UDIV, CurVT, DivAction);
     setOperationAction(ISD::UDIVREM, CurVT, Expand);
-    setOperationAction(ISD::UREM, CurVT, Expand);
+    setOperationAction(ISD::UREM, CurVT, DivAction);
     //if (MVT(CurVT).getSizeInBits() > MaxMultBits) {
     //  // Expand the  multiply;
     //  setOperationAction(ISD::MUL, CurVT, Expand);
@@ -619,6 +625,33 @@ VTargetLowering::LowerINTRINSIC_VOID(SDValue Op, SelectionDAG &DAG) const {
     VFI->allocateBRAM(BRamNum, NumElem, ElemSize, Initializer);
     return Chain;
   }
+  case vtmIntrinsic::vtm_stream_read: {
+    LLVMContext *Cntx = DAG.getContext();
+    EVT CmdVT = EVT::getIntegerVT(*Cntx, VFUMemBus::CMDWidth);
+    SDValue SDOps[] = {// The chain.
+                       Chain,
+                       // The start address and the number of bytes.
+                       Op.getOperand(2), Op.getOperand(3),
+                       // CMD
+                       DAG.getTargetConstant(VFUMemBus::CmdStreamRead, CmdVT),
+                       // The stream read is a single command sequence.
+                       DAG.getTargetConstant(VFUMemBus::SeqEnd, MVT::i8)};
+
+    unsigned DataWidth = getFUDesc<VFUMemBus>()->getDataWidth();
+    MVT DataVT = EVT::getIntegerVT(*Cntx, DataWidth).getSimpleVT();
+
+    SDValue StreamRead =
+      DAG.getMemIntrinsicNode(VTMISD::MemAccess, dl,
+                              // Result and the chain.
+                              DAG.getVTList(DataVT, MVT::Other),
+                              // SDValue operands
+                              SDOps, array_lengthof(SDOps),
+                              // Memory operands.
+                              MVT::i8,
+                              cast<MemIntrinsicSDNode>(Op)->getMemOperand());
+    // Return the chain.
+    return StreamRead.getValue(1);
+  }
   }
   return SDValue();
 }
@@ -663,6 +696,16 @@ bool VTargetLowering::getTgtMemIntrinsic(IntrinsicInfo &Info, const CallInst &I,
                                          unsigned Intrinsic) const {
   switch (Intrinsic) {
   default: break;
+  case vtmIntrinsic::vtm_stream_read:
+    Info.opc = ISD::INTRINSIC_VOID;
+    Info.memVT = MVT::i8;
+    Info.ptrVal = I.getArgOperand(0);
+    Info.offset = 0;
+    Info.align = 1;
+    Info.vol = false;
+    Info.readMem = true;
+    Info.writeMem = false;
+    return true;
   }
 
   return false;
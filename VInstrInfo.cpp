@@ -783,14 +783,15 @@ static float LookupLatency(const MachineInstr *MI){
 }
 
 FuncUnitId VInstrInfo::getPreboundFUId(const MachineInstr *MI) {
-  // Dirty Hack: Bind all memory access to channel 0 at this moment.
   switch(MI->getOpcode()) {
   case VTM::VOpDisableFU:
     return FuncUnitId(uint16_t(MI->getOperand(1).getImm()));
   case VTM::VOpReadFU:
     return FuncUnitId(uint16_t(MI->getOperand(2).getImm()));
-  case VTM::VOpMemTrans:
-    return FuncUnitId(VFUs::MemoryBus, 0);
+  case VTM::VOpMemTrans: {
+    unsigned Id = MI->getOperand(5).getImm();
+    return FuncUnitId(VFUs::MemoryBus, Id);
+  }
   case VTM::VOpBRAMTrans: {
     unsigned Id = MI->getOperand(5).getImm();
     return FuncUnitId(VFUs::BRam, Id);
@@ -826,6 +827,11 @@ bool VInstrInfo::mayStore(const MachineInstr *MI) {
   }
 }
 
+bool VInstrInfo::isBlockTransfer(const MachineInstr *MI) {
+  return MI->getOpcode() == VTM::VOpMemTrans
+         && MI->getOperand(3).getImm() >= VFUMemBus::CmdFirstNoLoadStore;
+}
+
 BitWidthAnnotator::BitWidthAnnotator(MachineInstr &MI)
   : MO(&MI.getOperand(MI.getNumOperands() - 2)) {
   assert(hasBitWidthInfo() && "Bitwidth not available!");
@@ -910,6 +916,9 @@ float VInstrInfo::getDetialLatency(const MachineInstr *MI) {
   case VTM::VOpMult:
     return LookupLatency<0, VFUMult>(MI);
 
+  case VTM::VOpDiv:
+    return getFUDesc<VFUDiv>()->getLatency(getBitWidth(MI->getOperand(0)));
+
   case VTM::VOpSRA_c:
   case VTM::VOpSRL_c:
   case VTM::VOpSHL_c:
@@ -171,6 +171,7 @@ const TargetRegisterClass *VRegisterInfo::getRepRegisterClass(unsigned Opcode) {
   case VTM::VOpSHL:         return &VTM::RSHLRegClass;
   case VTM::VOpMult:        return &VTM::RMULRegClass;
   case VTM::VOpMultLoHi:    return &VTM::RMULLHRegClass;
+  case VTM::VOpDiv:         return &VTM::RDIVRegClass;
   case VTM::VOpMemTrans:    return &VTM::RINFRegClass;
   case VTM::VOpInternalCall:return &VTM::RCFNRegClass;
   case VTM::VOpBRAMTrans:   return &VTM::RBRMRegClass;
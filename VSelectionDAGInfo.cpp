@@ -12,6 +12,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "VTargetMachine.h"
+#include "vtm/Passes.h"
 #include "llvm/LLVMContext.h"
 #include "llvm/CodeGen/SelectionDAG.h"
 #include "llvm/Support/CommandLine.h"
@@ -21,6 +22,22 @@
 using namespace llvm;
 cl::opt<bool> EnableMemSCM("vtm-enable-memscm",
                            cl::init(true), cl::Hidden);
+static cl::opt<bool>
+EnableStreamBurst("vtm-enable-stream-burst",
+                  cl::desc("Turn the loops that fill or copy the memory into"
+                           " memset/memcpy, which are performed by the burst"
+                           " transfer commands of the memory bus"),
+                  cl::init(false));
+
+// The block transfer takes a variable number of cycles, which cannot be
+// handled by the pipelined memory bus.
+static bool isMemSCMAvailable() {
+  return EnableMemSCM && !getFUDesc<VFUMemBus>()->isPipelined();
+}
+
+bool llvm::isStreamBurstEnabled() {
+  return EnableStreamBurst && isMemSCMAvailable();
+}
 
 VSelectionDAGInfo::VSelectionDAGInfo(const VTargetMachine &TM)
   : TargetSelectionDAGInfo(TM) {
@@ -34,7 +51,7 @@ static SDValue EmitMemSCM(unsigned Cmd, SelectionDAG &DAG, DebugLoc dl,
                           unsigned Align, bool isVolatile,
                           MachinePointerInfo DstPtrInfo,
                           MachinePointerInfo SrcPtrInfo) {
-  if (!EnableMemSCM) return SDValue();
+  if (!isMemSCMAvailable()) return SDValue();
 
   // Emit the memset command on the membus.
   LLVMContext *Cntx = DAG.getContext();
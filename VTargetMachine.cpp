@@ -61,7 +61,8 @@ VTargetMachine::VTargetMachine(const Target &T, StringRef TT,StringRef CPU,
   TLInfo(*this),
   TSInfo(*this),
   InstrInfo(),
-  FrameInfo() {}
+  FrameInfo(),
+  SkipIRPasses(false) {}
 
 bool VTargetMachine::addInstSelector(PassManagerBase &PM) {
   PM.add(createVISelDag(*this));
@@ -141,6 +142,8 @@ struct VTMPassConfig : public TargetPassConfig {
     PM->add(createDeadMemOpEliminationPass());
     PM->add(createMemOpsFusingPass());
     addPass(DeadMachineInstructionElimID);
+    // Spread the memory accesses across the memory buses.
+    PM->add(createMemBusBindingPass());
     // Construct multiplexer tree for prebound function units.
     PM->add(createPrebindUnbalanceMuxPass());
 
@@ -255,6 +258,13 @@ struct VTMPassConfig : public TargetPassConfig {
   }
 
   virtual void addIRPasses() {
+    // The IR passes were already run over the whole module.
+    if (getTM<VTargetMachine>().skipTargetIRPasses()) return;
+
+    addTargetIRPasses();
+  }
+
+  void addTargetIRPasses() {
     // Basic AliasAnalysis support.
     // Add TypeBasedAliasAnalysis before BasicAliasAnalysis so that
     // BasicAliasAnalysis wins if they disagree. This is intended to help
@@ -271,6 +281,11 @@ struct VTMPassConfig : public TargetPassConfig {
     // Schedule the DeadArgEliminationPass to clean up the module.
     PM->add(createDeadArgEliminationPass());
 
+    // Fetch the read streams of the loops by the burst transfers, the loads
+    // from the block RAMs are already identified by BlockRAMFormation.
+    if (isStreamBurstEnabled())
+      PM->add(createStreamReadBurstPass(*TM->getIntrinsicInfo()));
+
     // Do not passs the target lowering information to LoopStrengthReducePass,
     // by doing this, the LSR pass will not perform address mode related
     // optimization which will generate inefficient code for our backend.
@@ -303,3 +318,15 @@ bool VTargetMachine::addPassesToEmitFile(PassManagerBase &PM,
   PM.add(createGCInfoDeleter());
   return false;
 }
+
+void VTargetMachine::addTargetIRPasses(PassManagerBase &PM) {
+  VTMPassConfig(this, PM).addTargetIRPasses();
+}
+
+void llvm::addTargetIRPasses(TargetMachine &TM, PassManagerBase &PM) {
+  static_cast<VTargetMachine&>(TM).addTargetIRPasses(PM);
+}
+
+void llvm::disableTargetIRPasses(TargetMachine &TM) {
+  static_cast<VTargetMachine&>(TM).disableTargetIRPasses();
+}
@@ -54,6 +54,10 @@ class VTargetMachine : public LLVMTargetMachine {
   
   // Dummy subtarget.
   VDummySubtarget ST;
+
+  // Set if the target IR passes are run separately over the whole module, in
+  // this case addPassesToEmitFile only adds the per-function passes.
+  bool SkipIRPasses;
 public:
   VTargetMachine(const Target &T, StringRef TT,StringRef CPU,
                  StringRef FS, TargetOptions Options, Reloc::Model RM,
@@ -106,6 +110,10 @@ public:
                            formatted_raw_ostream &Out,
                            CodeGenFileType FileType,
                            bool DisableVerify = true);
+
+  void addTargetIRPasses(PassManagerBase &PM);
+  void disableTargetIRPasses() { SkipIRPasses = true; }
+  bool skipTargetIRPasses() const { return SkipIRPasses; }
 };
 extern Target TheVBackendTarget;
 
@@ -0,0 +1,66 @@
+//===------- vtm/BBProfile.h - The RTL basic block profile ------*- C++ -*-===//
+//
+//                      The Shang HLS frameowrk                               //
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file define the BBProfile class, which read back the basic block entry
+// counts that are dumped by the RTL profile counters (-vtm-enable-bb-profile)
+// during a previous simulation, so the optimizations can use the real block
+// frequencies instead of the statically estimated ones.
+//
+// The profile file contains the lines that are printed by the counters when
+// the module finish, in the form of:
+//   Module: <module name> MBB#<number>: <block name> entries-><count>
+// Other lines are ignored.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef VTM_BB_PROFILE_H
+#define VTM_BB_PROFILE_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/DataTypes.h"
+
+namespace llvm {
+class Function;
+class BasicBlock;
+class MachineBasicBlock;
+
+class BBProfile {
+  // RTL module name -> (block name -> entry count).
+  typedef StringMap<uint64_t> BlockCountMapTy;
+  StringMap<BlockCountMapTy> Modules;
+
+  // DO NOT IMPLEMENT
+  BBProfile(const BBProfile &);
+  // DO NOT IMPLEMENT
+  const BBProfile &operator=(const BBProfile &);
+
+  void parseLine(StringRef Line);
+  const BlockCountMapTy *getModuleProfile(const Function &F) const;
+public:
+  BBProfile();
+
+  // Get the profile specified by -vtm-profile-use, return null if no profile
+  // is specified. The profile is read when it is first requested.
+  static const BBProfile *get();
+
+  // Get the number of times the block is entered in the profiled simulation,
+  // return false if the block is not found in the profile.
+  bool getEntryCount(const Function &F, StringRef BBName,
+                     uint64_t &Count) const;
+  bool getEntryCount(const BasicBlock *BB, uint64_t &Count) const;
+  bool getEntryCount(const MachineBasicBlock *MBB, uint64_t &Count) const;
+
+  // Return true if the function (i.e. its RTL module) is profiled.
+  bool hasProfile(const Function &F) const {
+    return getModuleProfile(F) != 0;
+  }
+};
+}
+
+#endif
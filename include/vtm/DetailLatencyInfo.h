@@ -24,7 +24,12 @@
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/PassSupport.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/CommandLine.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
 
 namespace llvm{
 
@@ -85,12 +90,195 @@ struct InstPtrTy : public PointerUnion<MachineInstr*, MachineBasicBlock*> {
   InstPtrTy() : Base(static_cast<MachineInstr*>(0)) {}
 };
 
+// The latency of MSB and LSB from the source operations to a particular
+// operation, sorted by the source operations. The table is built in a vector
+// and then frozen into the arena of DetialLatencyInfo, a frozen table can be
+// shared by the other operations, with at most one entry overridden.
+class DepLatInfoTable {
+public:
+  typedef std::pair<float, float> mapped_type;
+  typedef std::pair<InstPtrTy, mapped_type> value_type;
+
+  static bool compareSrc(const value_type &LHS, const value_type &RHS) {
+    return LHS.first < RHS.first;
+  }
+
+  static bool isSameSrc(const value_type &LHS, const value_type &RHS) {
+    return LHS.first.getOpaqueValue() == RHS.first.getOpaqueValue();
+  }
+
+  class const_iterator {
+    const value_type *Cur, *End, *Override;
+  public:
+    const_iterator(const value_type *Cur, const value_type *End,
+                   const value_type *Override)
+      : Cur(Cur), End(End), Override(Override) {}
+
+    const value_type &operator*() const {
+      if (Override && (Cur == End || !compareSrc(*Cur, *Override)))
+        return *Override;
+      return *Cur;
+    }
+    const value_type *operator->() const { return &operator*(); }
+
+    const_iterator &operator++() {
+      if (Override && (Cur == End || !compareSrc(*Cur, *Override))) {
+        // Skip the overridden entry.
+        if (Cur != End && isSameSrc(*Cur, *Override)) ++Cur;
+        Override = 0;
+      } else
+        ++Cur;
+      return *this;
+    }
+
+    bool operator==(const const_iterator &RHS) const {
+      return Cur == RHS.Cur && Override == RHS.Override;
+    }
+    bool operator!=(const const_iterator &RHS) const {
+      return !operator==(RHS);
+    }
+  };
+
+private:
+  // The entries of the table under construction.
+  std::vector<value_type> Entries;
+  // The frozen entries, which are not owned by this table.
+  const value_type *FrozenBegin, *FrozenEnd;
+  value_type Override;
+  bool HasOverride;
+
+  bool isFrozen() const { return FrozenBegin != 0; }
+  const value_type *entries_begin() const {
+    return isFrozen() ? FrozenBegin : (Entries.empty() ? 0 : &Entries[0]);
+  }
+  const value_type *entries_end() const {
+    return isFrozen() ? FrozenEnd : entries_begin() + Entries.size();
+  }
+
+
+  static mapped_type maxLatency(mapped_type LHS, mapped_type RHS) {
+    return std::make_pair(std::max(LHS.first, RHS.first),
+                          std::max(LHS.second, RHS.second));
+  }
+
+  // Copy the shared entries before modifying the table.
+  void thaw() {
+    if (!isFrozen()) return;
+
+    std::vector<value_type> Copied;
+    Copied.reserve(size());
+    for (const_iterator I = begin(), E = end(); I != E; ++I)
+      Copied.push_back(*I);
+    Entries.swap(Copied);
+    FrozenBegin = FrozenEnd = 0;
+    HasOverride = false;
+  }
+public:
+  DepLatInfoTable() : FrozenBegin(0), FrozenEnd(0), HasOverride(false) {}
+
+  const_iterator begin() const {
+    return const_iterator(entries_begin(), entries_end(),
+                          HasOverride ? &Override : 0);
+  }
+  const_iterator end() const {
+    return const_iterator(entries_end(), entries_end(), 0);
+  }
+
+  bool empty() const {
+    return !HasOverride && entries_begin() == entries_end();
+  }
+
+  // Get the entry of Src, create an entry with zero latencies if it does not
+  // exist.
+  mapped_type &operator[](InstPtrTy Src) {
+    thaw();
+    value_type V(Src, mapped_type(0.0f, 0.0f));
+    std::vector<value_type>::iterator at
+      = std::lower_bound(Entries.begin(), Entries.end(), V, compareSrc);
+    if (at == Entries.end() || !isSameSrc(*at, V))
+      at = Entries.insert(at, V);
+    return at->second;
+  }
+
+  void insert(const value_type &V) {
+    thaw();
+    std::vector<value_type>::iterator at
+      = std::lower_bound(Entries.begin(), Entries.end(), V, compareSrc);
+    if (at == Entries.end() || !isSameSrc(*at, V))
+      Entries.insert(at, V);
+  }
+
+  // Merge the entries of RHS transformed by F, keep the bigger latencies if
+  // both tables have the entry of the same source.
+  template<typename FuncTy>
+  void mergeMax(const DepLatInfoTable &RHS, FuncTy F) {
+    thaw();
+    std::vector<value_type> Merged;
+    Merged.reserve(Entries.size() + RHS.size());
+
+    const mapped_type Zero(0.0f, 0.0f);
+    std::vector<value_type>::const_iterator I = Entries.begin(),
+                                            E = Entries.end();
+    for (const_iterator J = RHS.begin(), JE = RHS.end(); J != JE; ++J) {
+      while (I != E && compareSrc(*I, *J))
+        Merged.push_back(*I++);
+
+      mapped_type Lat = maxLatency(Zero, F(J->second));
+      if (I != E && isSameSrc(*I, *J))
+        Lat = maxLatency(Lat, (I++)->second);
+
+      Merged.push_back(value_type(J->first, Lat));
+    }
+
+    Merged.insert(Merged.end(), I, E);
+    Entries.swap(Merged);
+  }
+
+  // Share the entries of a frozen table, and override the entry of Src.
+  void shareWith(const DepLatInfoTable &RHS, InstPtrTy Src, mapped_type Lat) {
+    if (!RHS.isFrozen() || RHS.HasOverride) {
+      *this = RHS;
+      (*this)[Src] = Lat;
+      return;
+    }
+
+    Entries.clear();
+    FrozenBegin = RHS.FrozenBegin;
+    FrozenEnd = RHS.FrozenEnd;
+    Override = value_type(Src, Lat);
+    HasOverride = true;
+  }
+
+  // Move the entries into the arena, return the number of bytes allocated.
+  size_t freeze(BumpPtrAllocator &Allocator) {
+    if (isFrozen() || Entries.empty()) return 0;
+
+    value_type *Frozen = Allocator.Allocate<value_type>(Entries.size());
+    std::uninitialized_copy(Entries.begin(), Entries.end(), Frozen);
+    FrozenBegin = Frozen;
+    FrozenEnd = Frozen + Entries.size();
+    // Release the memory of the vector.
+    std::vector<value_type>().swap(Entries);
+    return (FrozenEnd - FrozenBegin) * sizeof(value_type);
+  }
+
+  bool isShared() const { return HasOverride; }
+  size_t size() const {
+    size_t Size = entries_end() - entries_begin();
+    // The overridden entry may not exist in the shared entries.
+    if (HasOverride && !std::binary_search(entries_begin(), entries_end(),
+                                           Override, compareSrc))
+      ++Size;
+    return Size;
+  }
+};
+
 class DetialLatencyInfo : public MachineFunctionPass {
 public:
   static char ID;
   // The latency of MSB and LSB from a particular operation to the current
   // operation.
-  typedef std::map<InstPtrTy, std::pair<float, float> > DepLatInfoTy;
+  typedef DepLatInfoTable DepLatInfoTy;
   static float getMaxLatency(DepLatInfoTy::value_type v) {
     return std::max(v.second.first, v.second.second);
   }
@@ -119,9 +307,11 @@ private:
 
   // The latency from all register source through the datapath to a given
   // wire/register define by a datapath/control op
-  typedef std::map<const MachineInstr*, DepLatInfoTy> LatencyMapTy;
+  typedef DenseMap<const MachineInstr*, DepLatInfoTy> LatencyMapTy;
 
   LatencyMapTy LatencyMap;
+  // The arena holding the frozen latency tables.
+  BumpPtrAllocator TableAllocator;
   // Add the latency information from SrcMI to CurLatInfo.
   template<bool IsCtrlDep>
   void buildDepLatInfo(const MachineInstr *SrcMI, DepLatInfoTy &CurLatInfo,
@@ -167,6 +357,7 @@ public:
 
   void reset() {
     LatencyMap.clear();
+    TableAllocator.Reset();
     clearCachedLatencies();
   }
 
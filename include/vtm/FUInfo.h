@@ -24,6 +24,7 @@
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Constants.h"
 #include "llvm/Function.h"
@@ -52,13 +53,14 @@ namespace VFUs {
     ICmp = 4,
     Sel = 5,
     Reduction = 6,
-    MemoryBus = 7,
-    BRam = 8,
-    Mux = 9,
+    Div = 7,
+    MemoryBus = 8,
+    BRam = 9,
+    Mux = 10,
     FirstFUType = Trivial,
     FirstNonTrivialFUType = AddSub,
     LastBitLevelChainingFUType = Mult,
-    LastPostBindFUType = Reduction,
+    LastPostBindFUType = Div,
     NumPostBindFUs = LastPostBindFUType - FirstNonTrivialFUType + 1,
     LastCommonFUType = Mux,
     NumCommonFUs = LastCommonFUType - FirstFUType + 1,
@@ -66,7 +68,7 @@ namespace VFUs {
     // Special function unit.
     // RTL module corresponding to callee functions of function corresponding to
     // current RTL module.
-    CalleeFN = 10,
+    CalleeFN = 11,
     LastFUType = CalleeFN,
     NumFUs = LastFUType - FirstFUType + 1,
     // Helper enumeration value, just for internal use as a flag to indicate
@@ -138,6 +140,10 @@ public:
     return !isTrivial() && getFUNum() != 0xfff;
   }
 
+  // The number of operations that the bound function unit can start in the
+  // same slot, e.g. the number of ports of a block RAM.
+  unsigned getNumPorts() const;
+
   inline bool operator==(const FuncUnitId X) const { return UID.data == X.UID.data; }
   inline bool operator!=(const FuncUnitId X) const { return !operator==(X); }
   inline bool operator< (const FuncUnitId X) const { return UID.data < X.UID.data; }
@@ -177,6 +183,7 @@ public:
   }
 
   unsigned getType() const { return ResourceType; }
+  unsigned getStartInt() const { return StartInt; }
   const char *getTypeName() const {
     return getTypeName((VFUs::FUTypes)getType());
   }
@@ -208,16 +215,26 @@ public:
   }
 };
 
+// The memory buses, bus N is the function unit FuncUnitId(MemoryBus, N) and
+// drives the ports mem{N}*. In the default handshake mode the module waits
+// for mem{N}rdy before it read the result of a request, and the bus is busy
+// until then. In the pipelined mode the bus accepts a new request every
+// StartInterval cycles, and the result of a read request is valid exactly
+// Latency cycles after the request, so mem{N}rdy is not checked at all.
 class VFUMemBus : public VFUDesc {
   unsigned AddrWidth;
   unsigned DataWidth;
   float Latency;
+  unsigned NumBuses;
+  bool Pipelined;
 public:
   VFUMemBus(luabind::object FUTable);
 
   unsigned getAddrWidth() const { return AddrWidth; }
   unsigned getDataWidth() const { return DataWidth; }
   float getLatency() const { return Latency; }
+  unsigned getNumBuses() const { return NumBuses; }
+  bool isPipelined() const { return Pipelined; }
 
   /// Methods for support type inquiry through isa, cast, and dyn_cast:
   static inline bool classof(const VFUMemBus *A) { return true; }
@@ -265,7 +282,9 @@ public:
     CmdLoad = 0, CmdStore = 1,
     CmdFirstNoLoadStore = 2,
     // Memset/Memcpy/Memmove
-    CmdMemSet = 2, CmdMemCpy = 3, CmdMemMove = 4
+    CmdMemSet = 2, CmdMemCpy = 3, CmdMemMove = 4,
+    // Fetch a read stream by burst transfers.
+    CmdStreamRead = 5
   };
 
   enum CmdSeqs {
@@ -308,8 +327,60 @@ typedef VSimpleFUDesc<VFUs::ICmp>    VFUICmp;
 typedef VSimpleFUDesc<VFUs::Sel>     VFUSel;
 typedef VSimpleFUDesc<VFUs::Reduction>     VFUReduction;
 
+// The integer divider, which compute the quotient or the remainder of a
+// signed or unsigned division. The iterative divider retires log2(Radix) bits
+// of the quotient per cycle and is busy until the result is available, while
+// the pipelined divider has one stage per iteration and accepts a new
+// division every cycle. The divisions are expanded to library calls if the
+// divider is not described in the FUs table.
+class VFUDiv : public VFUDesc {
+  unsigned Cost[64];
+  unsigned Radix;
+  bool Pipelined;
+  bool Available;
+public:
+  VFUDiv(luabind::object FUTable);
+
+  // The operation mode, i.e. the immediate operand of VOpDiv.
+  enum Modes {
+    Signed = 0x1, Remainder = 0x2
+  };
+
+  static const int ModeWidth = 2;
+
+  bool isAvailable() const { return Available; }
+  bool isPipelined() const { return Pipelined; }
+  unsigned getBitsPerCycle() const { return Log2_32(Radix); }
+
+  // The result is available after all quotient bits are retired, plus one
+  // cycle to fix the sign of the result.
+  unsigned getLatency(unsigned SizeInBits) const {
+    unsigned BitsPerCycle = getBitsPerCycle();
+    return (SizeInBits + BitsPerCycle - 1) / BitsPerCycle + 1;
+  }
+
+  unsigned lookupCost(unsigned SizeInBits) {
+    return VFUDesc::lookupCost(Cost, SizeInBits);
+  }
+
+  /// Methods for support type inquiry through isa, cast, and dyn_cast:
+  static inline bool classof(const VFUDiv *A) { return true; }
+  static inline bool classof(const VFUDesc *A) {
+    return A->getType() == VFUs::Div;
+  }
+
+  static VFUs::FUTypes getType() { return VFUs::Div; }
+  static const char *getTypeName() { return VFUs::VFUNames[getType()]; }
+
+  // Signal names of the function unit.
+  inline static std::string getResultName(unsigned FUNum) {
+    return "div" + utostr(FUNum) + "o";
+  }
+};
+
 class VFUBRAM : public  VFUDesc {
   unsigned DataWidth;
+  unsigned NumPorts; // 2 for the true dual-port block RAMs.
   float Latency;
   std::string Prefix;   // Prefix of the block RAM object in timing constraints.
   std::string Template; // Template for inferring block ram.
@@ -318,6 +389,7 @@ public:
   VFUBRAM(luabind::object FUTable);
 
   float getLatency() const { return Latency; }
+  unsigned getNumPorts() const { return NumPorts; }
 
   std::string generateCode(const std::string &Clk, unsigned Num,
                            unsigned DataWidth, unsigned Size,
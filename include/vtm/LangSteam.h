@@ -11,12 +11,21 @@
 //   Auto-indentation
 //   ...
 //
+// It also define chunked_raw_ostream, which holds the code that is generated
+// before it can be written to the output, and flushes it to a temporary file
+// chunk by chunk.
+//
 //===----------------------------------------------------------------------===//
 
 #ifndef HAA_LANG_STREAM_H
 #define HAA_LANG_STREAM_H
 
 #include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/ErrorHandling.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 namespace llvm {
 template<class LangTraits>
@@ -264,6 +273,87 @@ public:
   }
 };
 
+// The raw_ostream that keeps the content in a fixed size chunk. Each chunk is
+// flushed to a temporary file as soon as it is full, so only the last chunk is
+// kept in memory no matter how big the content grows. The content is copied
+// to the final output by writeTo.
+class chunked_raw_ostream : public raw_ostream {
+  static const size_t ChunkSize = 64 * 1024;
+  char *Chunk;
+  // Number of bytes used in the chunk.
+  size_t ChunkUsed;
+  // The file holding the finished chunks.
+  std::FILE *Finished;
+  uint64_t TotalSize;
+
+  void flushChunk() {
+    if (Finished == 0 && (Finished = std::tmpfile()) == 0)
+      report_fatal_error("Cannot create the temporary file for the chunks!");
+
+    if (std::fwrite(Chunk, 1, ChunkUsed, Finished) != ChunkUsed)
+      report_fatal_error("Cannot write the chunk to the temporary file!");
+
+    ChunkUsed = 0;
+  }
+
+  virtual void write_impl(const char *Ptr, size_t Size) {
+    TotalSize += Size;
+    if (Chunk == 0) Chunk = new char[ChunkSize];
+
+    while (Size) {
+      if (ChunkUsed == ChunkSize) flushChunk();
+
+      size_t BytesToWrite = std::min(Size, ChunkSize - ChunkUsed);
+      memcpy(Chunk + ChunkUsed, Ptr, BytesToWrite);
+      ChunkUsed += BytesToWrite;
+      Ptr += BytesToWrite;
+      Size -= BytesToWrite;
+    }
+  }
+
+  virtual uint64_t current_pos() const { return TotalSize; }
+
+  void releaseChunks() {
+    if (Finished) std::fclose(Finished);
+    Finished = 0;
+
+    delete[] Chunk;
+    Chunk = 0;
+    ChunkUsed = 0;
+  }
+
+public:
+  chunked_raw_ostream() : Chunk(0), ChunkUsed(0), Finished(0), TotalSize(0) {}
+
+  ~chunked_raw_ostream() {
+    flush();
+    releaseChunks();
+  }
+
+  // Write the content to OS and release the chunks, the content is written
+  // to the stream in the same order as it is written to this stream.
+  void writeTo(raw_ostream &OS) {
+    flush();
+
+    if (Finished) {
+      // Append the last chunk to the finished chunks and read them back
+      // chunk by chunk.
+      flushChunk();
+      std::rewind(Finished);
+
+      size_t Size;
+      while ((Size = std::fread(Chunk, 1, ChunkSize, Finished)) != 0)
+        OS.write(Chunk, Size);
+
+      if (std::ferror(Finished))
+        report_fatal_error("Cannot read the chunks from the temporary file!");
+    } else if (ChunkUsed)
+      OS.write(Chunk, ChunkUsed);
+
+    releaseChunks();
+  }
+};
+
 
 }
 
@@ -27,6 +27,7 @@
 #include "luabind/luabind.hpp"
 
 #include <map>
+#include <vector>
 
 // Forward declaration.
 struct lua_State;
@@ -104,7 +105,31 @@ public:
     return luabind::globals(State)["Modules"][Name];
   }
 
+  // The design space exploration directives, see the DSE mode of sync.
+  luabind::object getDSEConfig() const {
+    return luabind::globals(State)["DSE"];
+  }
+
+  // The metrics of the synthesized functions, which are written as:
+  //   Metrics.<Function>.<Name> = <value>
+  luabind::object getMetrics() const {
+    return luabind::globals(State)["Metrics"];
+  }
+
+  void recordMetric(const std::string &FnName, const char *Name, double Value);
+
+  // Set the value at the dot separated Path, e.g. FUs.Mult.Latency, to a copy
+  // of V, which is a number, a string or a boolean from another engine. The
+  // missing tables along the path are created. Return false if V cannot be
+  // copied.
+  bool setValue(StringRef Path, const luabind::object &V);
+
   // Iterator to iterate over all user scripting pass from the constraint script.
+  // A pass is written as:
+  //   Passes.<Name> = { FunctionScript = <run on each function>,
+  //                     GlobalScript = <write the module level outputs>,
+  //                     SetupScript = <optional, set up the globals used by
+  //                                    the FunctionScript> }
   typedef luabind::iterator scriptpass_it;
 
   scriptpass_it passes_begin() const {
@@ -130,9 +155,33 @@ public:
   bool runScriptStr(const std::string &ScriptStr, SMDiagnostic &Err);
 
   const std::string &getDataLayout() const { return DataLayout; }
+
+  // Read the partition directive of the array from the ArrayPartition table,
+  // which is written as:
+  //   ArrayPartition.<Name> = { Scheme = "cyclic"|"block"|"complete"|"none",
+  //                             Factor = <number of banks> }
+  // where Name is the name of the global variable or the stack allocation.
+  // Return false if there is no directive for the array.
+  bool getArrayPartition(const std::string &Name, std::string &Scheme,
+                         unsigned &Factor) const;
+
+  // Copy the synthesis settings from another engine, including the settings
+  // created for the sub-functions during SW/HW partition. The settings that
+  // already exist in this engine are kept unless Override is true.
+  void inheritSynSettings(const LuaScript &From, bool Override = true);
+
+  // Point the files listed in Misc.PerFunctionOutputs to private files with
+  // the given suffix, the (Original, Private) path pairs are appended to
+  // Redirected, so the driver can merge them back.
+  typedef std::pair<std::string, std::string> RedirectedOutput;
+  void redirectPerFunctionOutputs(const std::string &Suffix,
+                                  std::vector<RedirectedOutput> &Redirected);
 };
 
+// Get the script engine of the current thread, which is the global script
+// engine unless another engine is bound by setThreadScriptEngine.
 LuaScript &scriptEngin();
+void setThreadScriptEngine(LuaScript *S);
 }
 
 #endif
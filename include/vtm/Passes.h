@@ -23,6 +23,7 @@ class PassRegistry;
 class TargetIntrinsicInfo;
 class VTargetMachine;
 class MachineRegisterInfo;
+class PassManagerBase;
 
 extern char &AdjustLIForBundlesID;
 //MachineBasicBlockTopOrder Pass - Place the MachineBasicBlocks in topological order.
@@ -30,15 +31,27 @@ extern char &MachineBasicBlockTopOrderID;
 
 FunctionPass *createVISelDag(VTargetMachine &TM);
 
+// Run the target IR passes over the whole module by the driver, so the passes
+// added by addPassesToEmitFile can be run function by function.
+void addTargetIRPasses(TargetMachine &TM, PassManagerBase &PM);
+void disableTargetIRPasses(TargetMachine &TM);
+// Return true if the streaming memory accesses should be performed by the
+// burst transfer commands of the memory bus, only valid after the FUs are
+// initialized by the script.
+bool isStreamBurstEnabled();
+
 FunctionPass *createDesignMetricsPass();
 
 // Always inline function.
 Pass *createHLSInlinerPass();
 
 Pass *createTrivialLoopUnrollPass();
+// Coalesce the perfect loop nests into a single loop.
+Pass *createLoopFlatteningPass();
 Pass *createLoopVectorizerPass();
 //Convert the AllocaInst to GlobalVariable.
 Pass *createBlockRAMFormation(const TargetIntrinsicInfo &IntrInfo);
+Pass *createStreamReadBurstPass(const TargetIntrinsicInfo &IntrInfo);
 Pass *createMemoryAccessAlignerPass();
 
 Pass *createFunctionFilterPass(raw_ostream &O);
@@ -53,6 +66,7 @@ Pass *createHyperBlockFormationPass();
 Pass *createPrebindUnbalanceMuxPass();
 Pass *createBasicPrebindMuxPass();
 Pass *createMemOpsFusingPass();
+Pass *createMemBusBindingPass();
 Pass *createDeadMemOpEliminationPass();
 Pass *createHoistDatapathPass();
 Pass *createDetialLatencyInfoPass();
@@ -68,15 +82,18 @@ FunctionPass *createSimpleRegisterAllocator();
 // Find Shortest Path.
 Pass *createCFGShortestPathPass();
 
-// Analyse the Combination Path Delay.
-Pass *createCombPathDelayAnalysisPass();
+// Analyse the Combination Path Delay, do not write the header of the timing
+// script if WriteHeader is false.
+Pass *createCombPathDelayAnalysisPass(bool WriteHeader = true);
 
 // Analysis the dependency between registers
 Pass *createRtlSSAAnalysisPass();
 
 // RTL code generation.
 Pass *createVerilogASTBuilderPass();
-Pass *createVerilogASTWriterPass(raw_ostream &O);
+// Write the RTL modules, do not write the global code if WriteGlobalCode is
+// false.
+Pass *createVerilogASTWriterPass(raw_ostream &O, bool WriteGlobalCode = true);
 Pass *createRTLCodegenPreparePass();
 Pass *createDataPathPromotionPass();
 
@@ -100,6 +117,7 @@ void initializeVerilogASTWriterPass(PassRegistry &Registry);
 void initializeFunctionFilterPass(PassRegistry &Registry);
 void initializeHLSInlinerPass(PassRegistry &Registry);
 void initializeTrivialLoopUnrollPass(PassRegistry &Registry);
+void initializeLoopFlatteningPass(PassRegistry &Registry);
 void initializeLoopVectorizerPass(PassRegistry &Registry);
 } // end namespace
 
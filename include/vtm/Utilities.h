@@ -113,6 +113,14 @@ bool runScriptStr(const std::string &ScriptStr, SMDiagnostic &Err);
 //
 unsigned getIntValueFromEngine(ArrayRef<const char*> Path);
 std::string getStrValueFromEngine(ArrayRef<const char*> Path);
+// Get the partition directive of the array from the ArrayPartition table of
+// the script engine, return false if there is no directive for the array.
+bool getArrayPartitionFromEngine(const std::string &Name, std::string &Scheme,
+                                 unsigned &Factor);
+// Record the metric of the synthesized function to the Metrics table of the
+// script engine.
+void recordMetricToEngine(const std::string &FnName, const char *Name,
+                          double Value);
 
 class MachineMemOperand;
 class ScalarEvolution;
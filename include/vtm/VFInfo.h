@@ -57,12 +57,15 @@ public:
   struct BRamInfo {
     unsigned NumElem, ElemSizeInBytes;
     unsigned PhyRegNum;
+    // The register of the second port of the dual-port block RAM, 0 if the
+    // accesses are all bound to the first port.
+    unsigned PortBRegNum;
     const Value* Initializer;
 
     BRamInfo(unsigned numElem, unsigned elemSizeInBytes,
              const Value* Initializer = 0)
       : NumElem(numElem), ElemSizeInBytes(elemSizeInBytes),
-        PhyRegNum(0), Initializer(Initializer) {}
+        PhyRegNum(0), PortBRegNum(0), Initializer(Initializer) {}
   };
 
   typedef std::map<uint16_t, BRamInfo> BRamMapTy;
@@ -71,6 +74,11 @@ public:
 private:
   BRamMapTy BRams;
 
+  // Mapping the physical register that hold the result of the memory bus to
+  // the number of the bus.
+  typedef std::map<unsigned, unsigned> MemBusRegMapTy;
+  MemBusRegMapTy MemBusRegs;
+
   // Mapping Function unit number to callee function name.
   typedef StringMap<unsigned> FNMapTy;
   typedef StringMapEntry<unsigned> FNEntryTy;
@@ -169,6 +177,19 @@ public:
 
   const_bram_iterator bram_begin() const { return BRams.begin(); }
   const_bram_iterator bram_end() const { return BRams.end(); }
+
+  // Memory bus management.
+  void rememberMemBusReg(unsigned PhyReg, unsigned BusNum) {
+    bool inserted = MemBusRegs.insert(std::make_pair(PhyReg, BusNum)).second;
+    assert(inserted && "Register already bound to a memory bus!");
+    (void) inserted;
+  }
+
+  unsigned getMemBusOfReg(unsigned PhyReg) const {
+    MemBusRegMapTy::const_iterator at = MemBusRegs.find(PhyReg);
+    assert(at != MemBusRegs.end() && "Register not bound to memory bus!");
+    return at->second;
+  }
 };
 
 }
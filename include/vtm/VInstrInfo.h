@@ -162,6 +162,8 @@ public:
   static FuncUnitId getPreboundFUId(const MachineInstr *MI);
   static bool mayLoad(const MachineInstr *MI);
   static bool mayStore(const MachineInstr *MI);
+  // Is MI a block transfer command (memset, memcpy, ...) on the memory bus?
+  static bool isBlockTransfer(const MachineInstr *MI);
 
   static const MCInstrDesc &getDesc(unsigned Opcode);
   static unsigned countNumRegUses(const MachineInstr *MI);
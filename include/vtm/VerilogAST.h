@@ -1184,8 +1184,9 @@ public:
   typedef SlotVecTy::iterator slot_iterator;
 private:
   // Dirty Hack:
-  // Buffers
-  raw_string_ostream DataPath, ControlBlock;
+  // Buffers for the code that is not built as AST, they are streamed to the
+  // output by the writer.
+  chunked_raw_ostream DataPath, ControlBlock;
   vlang_raw_ostream LangControlBlock;
   // The slots vector, each slot represent a state in the FSM of the design.
   SlotVecTy Slots;
@@ -1225,8 +1226,6 @@ public:
 
   VASTModule(const std::string &Name, VASTExprBuilder *Builder)
     : VASTNode(vastModule),
-    DataPath(*(new std::string())),
-    ControlBlock(*(new std::string())),
     LangControlBlock(ControlBlock),
     Name(Name), Builder(Builder),
     FUPortOffsets(VFUs::NumCommonFUs),
@@ -1436,17 +1435,19 @@ public:
     return LangControlBlock;
   }
 
-  std::string &getControlBlockStr() {
+  // Write the control block to OS and release the buffer.
+  void printControlBlock(raw_ostream &OS) {
     LangControlBlock.flush();
-    return ControlBlock.str();
+    ControlBlock.writeTo(OS);
   }
 
   raw_ostream &getDataPathBuffer() {
     return DataPath;
   }
 
-  std::string &getDataPathStr() {
-    return DataPath.str();
+  // Write the datapath buffer to OS and release the buffer.
+  void printDataPathBuffer(raw_ostream &OS) {
+    DataPath.writeTo(OS);
   }
 
   // Out of line virtual function to provide home for the class.
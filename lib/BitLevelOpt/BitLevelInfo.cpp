@@ -287,6 +287,7 @@ void BitLevelInfo::computeBitWidth(MachineInstr *Instr) {
   }
 
   case VTM::VOpMult:  case VTM::VOpMult_c:
+  case VTM::VOpDiv:
   case VTM::VOpOr:
   case VTM::VOpAnd:
   case VTM::VOpXor: {
@@ -0,0 +1,344 @@
+//===-- LoopFlattening.cpp - Flatten the perfect loop nests ---------------===//
+//
+//                      The Shang HLS frameowrk                               //
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass coalesces the perfect two level loop nests into a single loop, so
+// the whole nest can be software pipelined by the modulo scheduler, instead of
+// paying the pipeline fill and drain and the FSM transitions of the outer loop
+// in every outer iteration. For a nest like:
+//
+//   for (i = 0; i < N; ++i)
+//     for (j = 0; j < M; ++j)
+//       body(i, j);
+//
+// the flattened loop is:
+//
+//   i = 0; j = 0;
+//   do {
+//     body(i, j);
+//     InnerDone = (j + 1 == M);
+//     i = InnerDone ? i + 1 : i;
+//     j = InnerDone ? 0 : j + 1;
+//   } while (!(InnerDone && i == N));
+//
+// i.e. the updates of the outer induction variables and the reinitialization
+// of the inner ones are guarded by the exit condition of the inner loop. The
+// instructions in the outer latch are executed in every iteration of the
+// flattened loop, so they must be safe to speculate.
+//
+// Only the loops in the functions that are going to be pipelined are
+// flattened, the flattened loop executes the outer latch in every iteration,
+// which is only paid off by pipelining.
+//
+// The outer and inner trip counts are attached to the latch of the flattened
+// loop as "vtm.flattened" metadata, so the scheduler can estimate the cycles
+// saved by the flattening.
+//
+//===----------------------------------------------------------------------===//
+
+#include "vtm/Passes.h"
+#include "vtm/SynSettings.h"
+
+#include "llvm/Constants.h"
+#include "llvm/Instructions.h"
+#include "llvm/Metadata.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Support/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Statistic.h"
+#define DEBUG_TYPE "vtm-loop-flattening"
+#include "llvm/Support/Debug.h"
+
+using namespace llvm;
+
+STATISTIC(NumLoopsFlattened, "Number of perfect loop nests flattened");
+
+static cl::opt<bool>
+EnableLoopFlattening("vtm-enable-loop-flattening",
+                     cl::desc("Coalesce the perfect loop nests into a single"
+                              " loop, so they can be pipelined as a whole"),
+                     cl::init(true));
+
+namespace {
+struct LoopFlattening : public FunctionPass {
+  static char ID;
+  LoopInfo *LI;
+  ScalarEvolution *SE;
+
+  LoopFlattening() : FunctionPass(ID), LI(0), SE(0) {
+    initializeLoopFlatteningPass(*PassRegistry::getPassRegistry());
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<LoopInfo>();
+    AU.addRequiredID(LoopSimplifyID);
+    AU.addRequiredID(LCSSAID);
+    AU.addRequired<ScalarEvolution>();
+  }
+
+  // The blocks of the perfect loop nest.
+  struct LoopNest {
+    Loop *Outer, *Inner;
+    BasicBlock *OuterPreheader, *OuterHeader, *OuterLatch, *Exit;
+    BasicBlock *InnerEntering, *InnerHeader, *InnerLatch;
+
+    LoopNest(Loop *Outer, Loop *Inner)
+      : Outer(Outer), Inner(Inner), OuterPreheader(0), OuterHeader(0),
+        OuterLatch(0), Exit(0), InnerEntering(0), InnerHeader(0),
+        InnerLatch(0) {}
+  };
+
+  static void collectCandidates(Loop *L, SmallVectorImpl<Loop*> &Candidates);
+
+  bool isPerfectNest(LoopNest &Nest);
+  void flatten(LoopNest &Nest);
+
+  bool runOnFunction(Function &F);
+};
+}
+
+char LoopFlattening::ID = 0;
+INITIALIZE_PASS_BEGIN(LoopFlattening, "vtm-loop-flattening",
+                      "Flatten the perfect loop nests", false, false)
+INITIALIZE_PASS_DEPENDENCY(LoopInfo)
+INITIALIZE_PASS_DEPENDENCY(LoopSimplify)
+INITIALIZE_PASS_DEPENDENCY(LCSSA)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolution)
+INITIALIZE_PASS_END(LoopFlattening, "vtm-loop-flattening",
+                    "Flatten the perfect loop nests", false, false)
+
+Pass *llvm::createLoopFlatteningPass() {
+  return new LoopFlattening();
+}
+
+void LoopFlattening::collectCandidates(Loop *L,
+                                       SmallVectorImpl<Loop*> &Candidates) {
+  // Only flatten the loops that contain a single innermost loop, so the
+  // candidates never overlap with each other.
+  if (L->getSubLoops().size() == 1 && L->getSubLoops().front()->empty()) {
+    Candidates.push_back(L);
+    return;
+  }
+
+  for (Loop::iterator I = L->begin(), E = L->end(); I != E; ++I)
+    collectCandidates(*I, Candidates);
+}
+
+static bool hasOnlyPHIsAndBranch(BasicBlock *BB) {
+  return BB->getFirstNonPHI() == BB->getTerminator();
+}
+
+static BasicBlock *getUnconditionalSuccessor(BasicBlock *BB) {
+  BranchInst *Br = dyn_cast<BranchInst>(BB->getTerminator());
+  if (Br == 0 || Br->isConditional()) return 0;
+
+  return Br->getSuccessor(0);
+}
+
+bool LoopFlattening::isPerfectNest(LoopNest &Nest) {
+  Loop *Outer = Nest.Outer, *Inner = Nest.Inner;
+
+  Nest.OuterPreheader = Outer->getLoopPreheader();
+  Nest.OuterHeader = Outer->getHeader();
+  Nest.OuterLatch = Outer->getLoopLatch();
+  Nest.Exit = Outer->getExitBlock();
+  Nest.InnerHeader = Inner->getHeader();
+  Nest.InnerLatch = Inner->getLoopLatch();
+  if (!Nest.OuterPreheader || !Nest.OuterLatch || !Nest.Exit
+      || !Nest.InnerLatch || !Inner->getLoopPreheader())
+    return false;
+
+  // The loops must exit from their latches only.
+  if (Outer->getExitingBlock() != Nest.OuterLatch
+      || Inner->getExitingBlock() != Nest.InnerLatch
+      || Inner->getExitBlock() != Nest.OuterLatch)
+    return false;
+
+  // The outer header should only select the values of the outer induction
+  // variables and then enter the inner loop, maybe through the preheader of the
+  // inner loop which contains nothing.
+  BasicBlock *OH = Nest.OuterHeader;
+  if (!hasOnlyPHIsAndBranch(OH)) return false;
+
+  BasicBlock *Succ = getUnconditionalSuccessor(OH);
+  if (Succ == 0) return false;
+
+  unsigned NumExtraBlocks = 2;
+  if (Succ != Nest.InnerHeader) {
+    if (Succ != Inner->getLoopPreheader() || !Succ->getSinglePredecessor()
+        || Succ->begin() != BasicBlock::iterator(Succ->getTerminator())
+        || getUnconditionalSuccessor(Succ) != Nest.InnerHeader)
+      return false;
+
+    ++NumExtraBlocks;
+  }
+  Nest.InnerEntering = Succ;
+
+  // Nothing else is allowed between the two loops.
+  if (Outer->getNumBlocks() != Inner->getNumBlocks() + NumExtraBlocks)
+    return false;
+
+  BranchInst *InnerBr = dyn_cast<BranchInst>(Nest.InnerLatch->getTerminator());
+  BranchInst *OuterBr = dyn_cast<BranchInst>(Nest.OuterLatch->getTerminator());
+  if (!InnerBr || !InnerBr->isConditional()
+      || !OuterBr || !OuterBr->isConditional())
+    return false;
+
+  // The outer latch is executed in every iteration of the flattened loop.
+  BasicBlock *OL = Nest.OuterLatch;
+  if (OL->getSinglePredecessor() != Nest.InnerLatch) return false;
+
+  for (BasicBlock::iterator I = OL->getFirstNonPHI(), E = OL->getTerminator();
+       I != E; ++I)
+    if (!isSafeToSpeculativelyExecute(I)) {
+      DEBUG(dbgs() << "  Cannot speculate " << *I << '\n');
+      return false;
+    }
+
+  // The inner loop should be reinitialized with the values that are available
+  // at the outer latch.
+  for (BasicBlock::iterator I = Nest.InnerHeader->begin();
+       PHINode *PN = dyn_cast<PHINode>(I); ++I) {
+    Value *Init = PN->getIncomingValueForBlock(Nest.InnerEntering);
+    if (Outer->isLoopInvariant(Init)) continue;
+
+    PHINode *OuterPN = dyn_cast<PHINode>(Init);
+    if (OuterPN == 0 || OuterPN->getParent() != OH) {
+      DEBUG(dbgs() << "  Cannot reinitialize " << *PN << '\n');
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void LoopFlattening::flatten(LoopNest &Nest) {
+  BasicBlock *OH = Nest.OuterHeader, *OL = Nest.OuterLatch,
+             *IH = Nest.InnerHeader, *IL = Nest.InnerLatch;
+
+  // Remember the trip counts before we change the loops.
+  unsigned OuterTripCount = SE->getSmallConstantTripCount(Nest.Outer, OL);
+  unsigned InnerTripCount = SE->getSmallConstantTripCount(Nest.Inner, IL);
+  SE->forgetLoop(Nest.Inner);
+  SE->forgetLoop(Nest.Outer);
+
+  // The outer latch only has a single predecessor, the LCSSA PHIs are trivial.
+  while (PHINode *PN = dyn_cast<PHINode>(OL->begin())) {
+    PN->replaceAllUsesWith(PN->getIncomingValue(0));
+    PN->eraseFromParent();
+  }
+
+  // Execute the outer latch in every iteration.
+  BranchInst *InnerBr = cast<BranchInst>(IL->getTerminator());
+  BranchInst *OuterBr = cast<BranchInst>(OL->getTerminator());
+  IL->getInstList().splice(InnerBr, OL->getInstList(), OL->begin(), OuterBr);
+
+  IRBuilder<> Builder(InnerBr);
+  Value *InnerDone = InnerBr->getCondition();
+  if (InnerBr->getSuccessor(0) == IH)
+    InnerDone = Builder.CreateNot(InnerDone, "inner.done");
+  Value *OuterExit = OuterBr->getCondition();
+  if (OuterBr->getSuccessor(0) == OH)
+    OuterExit = Builder.CreateNot(OuterExit, "outer.exit");
+  Value *ExitNow = Builder.CreateAnd(InnerDone, OuterExit, "flatten.exit");
+
+  // The value of the outer induction variables in the next outer iteration,
+  // which are used to reinitialize the inner induction variables.
+  DenseMap<Value*, Value*> OuterInit, OuterNext;
+  for (BasicBlock::iterator I = OH->begin(); PHINode *PN = dyn_cast<PHINode>(I);
+       ++I) {
+    OuterInit[PN] = PN->getIncomingValueForBlock(Nest.OuterPreheader);
+    OuterNext[PN] = PN->getIncomingValueForBlock(OL);
+  }
+
+  // Reinitialize the inner induction variables when the inner loop is done.
+  for (BasicBlock::iterator I = IH->begin(); PHINode *PN = dyn_cast<PHINode>(I);
+       ++I) {
+    int EnteringIdx = PN->getBasicBlockIndex(Nest.InnerEntering);
+    Value *Init = PN->getIncomingValue(EnteringIdx), *NextInit = Init;
+    if (OuterInit.count(Init)) {
+      PN->setIncomingValue(EnteringIdx, OuterInit[Init]);
+      NextInit = OuterNext[Init];
+    }
+
+    int LatchIdx = PN->getBasicBlockIndex(IL);
+    Value *Next = PN->getIncomingValue(LatchIdx);
+    Value *V = Builder.CreateSelect(InnerDone, NextInit, Next,
+                                    PN->getName() + ".next");
+    PN->setIncomingValue(LatchIdx, V);
+  }
+
+  // Move the outer induction variables to the flattened loop, and only update
+  // them when the inner loop is done.
+  while (PHINode *PN = dyn_cast<PHINode>(OH->begin())) {
+    PN->moveBefore(IH->getFirstNonPHI());
+    int PreheaderIdx = PN->getBasicBlockIndex(Nest.OuterPreheader);
+    PN->setIncomingBlock(PreheaderIdx, Nest.InnerEntering);
+    int LatchIdx = PN->getBasicBlockIndex(OL);
+    Value *Next = PN->getIncomingValue(LatchIdx);
+    PN->setIncomingBlock(LatchIdx, IL);
+    Value *V = Builder.CreateSelect(InnerDone, Next, PN,
+                                    PN->getName() + ".next");
+    PN->setIncomingValue(LatchIdx, V);
+  }
+
+  // Loop back to the inner header until both loops are done.
+  BranchInst *Br = Builder.CreateCondBr(ExitNow, Nest.Exit, IH);
+  Br->setDebugLoc(InnerBr->getDebugLoc());
+  LLVMContext &Context = Br->getContext();
+  Value *TripCounts[] = {
+    ConstantInt::get(Type::getInt32Ty(Context), OuterTripCount),
+    ConstantInt::get(Type::getInt32Ty(Context), InnerTripCount)
+  };
+  Br->setMetadata("vtm.flattened", MDNode::get(Context, TripCounts));
+  InnerBr->eraseFromParent();
+
+  // The outer latch is not reachable anymore.
+  OL->replaceSuccessorsPhiUsesWith(IL);
+  OL->dropAllReferences();
+  OL->eraseFromParent();
+
+  ++NumLoopsFlattened;
+}
+
+bool LoopFlattening::runOnFunction(Function &F) {
+  if (!EnableLoopFlattening) return false;
+
+  // The synthesis settings of the hardware functions are created by the
+  // FunctionFilter pass.
+  SynSettings *Setting = getSynSetting(F.getName());
+  if (Setting == 0 || !Setting->enablePipeLine()) return false;
+
+  LI = &getAnalysis<LoopInfo>();
+  SE = &getAnalysis<ScalarEvolution>();
+
+  SmallVector<Loop*, 8> Candidates;
+  for (LoopInfo::iterator I = LI->begin(), E = LI->end(); I != E; ++I)
+    collectCandidates(*I, Candidates);
+
+  bool Changed = false;
+  for (unsigned i = 0, e = Candidates.size(); i != e; ++i) {
+    LoopNest Nest(Candidates[i], Candidates[i]->getSubLoops().front());
+    DEBUG(dbgs() << "Loop Flattening: F[" << F.getName() << "] Loop %"
+                 << Nest.Outer->getHeader()->getName() << '\n');
+
+    if (!isPerfectNest(Nest)) {
+      DEBUG(dbgs() << "  Not a perfect loop nest.\n");
+      continue;
+    }
+
+    flatten(Nest);
+    Changed = true;
+  }
+
+  return Changed;
+}
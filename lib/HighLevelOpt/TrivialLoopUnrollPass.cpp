@@ -16,6 +16,7 @@
 #include "vtm/DesignMetrics.h"
 #include "vtm/FUInfo.h"
 #include "vtm/Utilities.h"
+#include "vtm/BBProfile.h"
 
 #include "llvm/IntrinsicInst.h"
 #include "llvm/Analysis/AliasAnalysis.h"
@@ -31,9 +32,16 @@
 #include "llvm/Support/raw_ostream.h"
 #define DEBUG_TYPE "trivial-loop-unroll"
 #include "llvm/Support/Debug.h"
+#include <cmath>
 
 using namespace llvm;
 
+static cl::opt<double>
+ProfileUnrollScale("vtm-profile-unroll-scale",
+  cl::desc("The factor to scale the unroll threshold of the hottest loops up"
+           " and the coldest loops down, when the RTL profile is available"),
+  cl::init(4.0));
+
 namespace {
 class TrivialLoopUnroll : public LoopPass {
 public:
@@ -44,6 +52,9 @@ public:
 
   bool runOnLoop(Loop *L, LPPassManager &LPM);
 
+  // Scale the unroll threshold by the hotness of the loop in the RTL profile.
+  static uint64_t getProfiledThreshold(Loop *L, uint64_t Threshold);
+
   /// This transformation requires natural loop information & requires that
   /// loop preheaders be inserted into the CFG...
   ///
@@ -596,6 +607,35 @@ Pass *llvm::createTrivialLoopUnrollPass() {
   return new TrivialLoopUnroll();
 }
 
+uint64_t TrivialLoopUnroll::getProfiledThreshold(Loop *L, uint64_t Threshold) {
+  const BBProfile *Profile = BBProfile::get();
+  if (Profile == 0) return Threshold;
+
+  BasicBlock *Header = L->getHeader();
+  uint64_t HeaderCount;
+  if (!Profile->getEntryCount(Header, HeaderCount)) return Threshold;
+
+  // Do not waste the area on the loops that are never run.
+  if (HeaderCount == 0) return 0;
+
+  // The hotness of the loop is its entry count relative to the hottest block
+  // in the function.
+  const Function *F = Header->getParent();
+  uint64_t MaxCount = HeaderCount;
+  for (Function::const_iterator I = F->begin(), E = F->end(); I != E; ++I) {
+    uint64_t Count;
+    if (Profile->getEntryCount(I, Count)) MaxCount = std::max(MaxCount, Count);
+  }
+
+  double Hotness = double(HeaderCount) / double(MaxCount);
+  // Scale the threshold in [Threshold / Scale, Threshold * Scale], loops with
+  // half of the hotness keep the original threshold.
+  double Scale = std::pow(ProfileUnrollScale, 2.0 * Hotness - 1.0);
+  DEBUG(dbgs() << "  Profiled hotness: " << Hotness << " threshold scale: "
+               << Scale << '\n');
+  return uint64_t(Threshold * Scale);
+}
+
 bool TrivialLoopUnroll::runOnLoop(Loop *L, LPPassManager &LPM) {
   // Only unroll the deepest loops in the loop nest.
   if (!L->empty()) return false;
@@ -638,7 +678,7 @@ bool TrivialLoopUnroll::runOnLoop(Loop *L, LPPassManager &LPM) {
   }
 
   // FIXME: Read the threshold from the constraints script.
-  uint64_t Threshold = 256000;
+  uint64_t Threshold = getProfiledThreshold(L, 256000);
 
   if (TripCount != 1 && !Metrics.isUnrollAccaptable(Count, Threshold)) {
     DEBUG(dbgs() << "  Too large to fully unroll with count: " << Count
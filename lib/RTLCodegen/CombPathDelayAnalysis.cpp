@@ -31,12 +31,17 @@
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SetOperations.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/Statistic.h"
 #define DEBUG_TYPE "vtm-comb-path-delay"
 #include "llvm/Support/Debug.h"
+
+#include <algorithm>
 using namespace llvm;
 
 static cl::opt<bool>
@@ -44,6 +49,22 @@ DisableTimingScriptGeneration("vtm-disable-timing-script",
                               cl::desc("Disable timing script generation"),
                               cl::init(false));
 
+namespace {
+enum TimingScriptKind { BulkScript, PerPathScript };
+}
+
+static cl::opt<TimingScriptKind>
+TimingScriptMode("vtm-timing-script",
+  cl::desc("How the timing constraints are generated"),
+  cl::values(clEnumValN(BulkScript, "bulk",
+                        "Bind all timing paths of a module to RTLDatapaths "
+                        "and run Misc.DatapathTableScript once"),
+             clEnumValN(PerPathScript, "per-path",
+                        "Bind each timing path to RTLDatapath and run "
+                        "Misc.DatapathScript"),
+             clEnumValEnd),
+  cl::init(PerPathScript));
+
 STATISTIC(NumTimingPath, "Number of timing paths analyzed (From->To pair)");
 STATISTIC(NumMultiCyclesTimingPath, "Number of multicycles timing paths "
                                     "analyzed (From->To pair)");
@@ -56,16 +77,93 @@ STATISTIC(NumFalseTimingPath,
 namespace{
 struct CombPathDelayAnalysis;
 
+// All timing paths of a module in flat arrays, the nodes of the paths are
+// stored as the indices of their name sets, which are unique in the table.
+struct TimingPathTable {
+  struct Path {
+    unsigned Slack;
+    bool IsCritical;
+    // The nodes of the path in PathNodes, i.e. [Dst, Thu..., Src].
+    unsigned NodeBegin, NodeEnd;
+
+    Path(unsigned Slack, bool IsCritical, unsigned NodeBegin)
+      : Slack(Slack), IsCritical(IsCritical), NodeBegin(NodeBegin),
+        NodeEnd(NodeBegin) {}
+  };
+
+  std::vector<Path> Paths;
+  std::vector<unsigned> PathNodes;
+  // The name set of the nodes, a Tcl list of the name patterns.
+  std::vector<std::string> NameSets;
+  DenseMap<const VASTValue*, int> NameSetIdx;
+
+  // Get the index of the name set of V, or -1 if V does not have a name.
+  int getNameSet(const VASTValue *V);
+
+  StringRef getNode(unsigned i) const { return NameSets[PathNodes[i]]; }
+
+  void printNodesTable(raw_ostream &OS, const Path &P) const;
+  void printPathTable(raw_ostream &OS, const Path &P) const;
+
+  // Bind all paths to RTLDatapaths with a single script.
+  void bindAllPaths2ScriptEngine() const;
+  // Bind the path to RTLDatapath.
+  void bindPath2ScriptEngine(const Path &P) const;
+};
+
+// The registers that reach each node of the data-path, computed bottom-up
+// once per module and shared by all destination registers, whose cones are
+// overlapped heavily because of the structural hashing in VASTExprBuilder.
+struct DatapathSupportCache {
+  // The supporting registers, sorted by their address.
+  typedef std::vector<VASTRegister*> RegVecTy;
+
+  DenseMap<VASTValue*, unsigned> SupportIdx;
+  std::vector<RegVecTy> Supports;
+
+  // The wires and expressions in the cone of the data-path trees, the trees
+  // are shared by the destination registers as well.
+  typedef std::vector<VASTValue*> NodeVecTy;
+  DenseMap<VASTValue*, unsigned> ConeIdx;
+  std::vector<NodeVecTy> Cones;
+
+  // Get the supporting registers of a wire or expression.
+  const RegVecTy &getSupport(VASTValue *Root);
+  // Get the wires and expressions in the cone of Root, including Root.
+  const NodeVecTy &getCone(VASTValue *Root);
+
+  void reset() {
+    SupportIdx.clear();
+    Supports.clear();
+    ConeIdx.clear();
+    Cones.clear();
+  }
+};
+
 struct PathDelayQueryCache {
   typedef std::map<unsigned, DenseSet<VASTRegister*> > DelayStatsMapTy;
   typedef DenseMap<VASTRegister*, unsigned> RegSetTy;
-  typedef DenseMap<VASTValue*, RegSetTy> QueryCacheTy;
-  QueryCacheTy QueryCache;
+  DatapathSupportCache &Support;
+  // The data-path trees of the destination register, with the delay from
+  // their supporting registers, which only depends on the slots of the
+  // register assignments and thus is only computed at the leaves.
+  typedef std::vector<std::pair<VASTValue*, RegSetTy> > TreeVecTy;
+  TreeVecTy Trees;
+  // The delay from the supporting registers to the nodes of the trees, a node
+  // shared by several trees gets the tightest delay. They are computed in a
+  // single sweep over the trees, instead of walking the trees again for each
+  // source register of the paths.
+  typedef std::vector<std::pair<VASTValue*, unsigned> > NodeDelayVecTy;
+  DenseMap<VASTRegister*, NodeDelayVecTy> ThuNodeDelays;
   // Statistics for simple path and complex paths.
   DelayStatsMapTy Stats[2];
 
+  explicit PathDelayQueryCache(DatapathSupportCache &Support)
+    : Support(Support) {}
+
   void reset() {
-    QueryCache.clear();
+    Trees.clear();
+    ThuNodeDelays.clear();
     Stats[0].clear();
     Stats[1].clear();
   }
@@ -77,35 +175,16 @@ struct PathDelayQueryCache {
   void annotatePathDelay(CombPathDelayAnalysis &A, VASTValue *Tree,
                          ArrayRef<ValueAtSlot*> DstVAS);
 
-  bool updateDelay(RegSetTy &To, const RegSetTy &From,
-                   const RegSetTy &LocalDelayMap) {
-    bool Changed = false;
-
-    typedef RegSetTy::const_iterator it;
-    for (it I = From.begin(), E = From.end(); I != E; ++I) {
-      assert(I->second && "Unexpected zero delay!");
-
-      unsigned &ExistDelay = To[I->first];
-      // Look up the delay from local delay map, because the delay of the From
-      // map may correspond to another data-path with different destination.
-      RegSetTy::const_iterator at = LocalDelayMap.find(I->first);
-      assert(at != LocalDelayMap.end() && "Node not visited yet?");
-      if (ExistDelay == 0 || ExistDelay > at->second) {
-        ExistDelay = at->second;
-        Changed |= true;
-      }
-    }
-
-    return Changed;
-  }
+  void buildThuNodeDelays();
 
-  void bindAllPath2ScriptEngine(VASTRegister *Dst) const;
-  void bindAllPath2ScriptEngine(VASTRegister *Dst, bool IsSimple,
-                                DenseSet<VASTRegister*> &BoundSrc) const;
-  unsigned bindPath2ScriptEngine(VASTRegister *DstReg, VASTRegister *SrcReg,
-                                 unsigned Delay, bool SkipThu, bool IsCritical)const;
-  unsigned printPathWithDelayFrom(raw_ostream &OS, VASTRegister *SrcReg,
-                                  unsigned Delay) const;
+  void addAllPaths(TimingPathTable &T, VASTRegister *Dst);
+  void addAllPaths(TimingPathTable &T, VASTRegister *Dst, bool IsSimple,
+                   DenseSet<VASTRegister*> &BoundSrc) const;
+  unsigned addPath(TimingPathTable &T, VASTRegister *DstReg,
+                   VASTRegister *SrcReg, unsigned Delay, bool SkipThu,
+                   bool IsCritical) const;
+  unsigned addThuNodesWithDelayFrom(TimingPathTable &T, VASTRegister *SrcReg,
+                                    unsigned Delay) const;
 
   typedef DenseSet<VASTRegister*>::const_iterator src_it;
   typedef DelayStatsMapTy::const_iterator delay_it;
@@ -118,6 +197,8 @@ struct PathDelayQueryCache {
 struct CombPathDelayAnalysis : public MachineFunctionPass {
   RtlSSAAnalysis *RtlSSA;
   VASTModule *VM;
+  // Run the timing constraints header script in doInitialization?
+  bool WriteHeader;
 
   static char ID;
 
@@ -129,7 +210,8 @@ struct CombPathDelayAnalysis : public MachineFunctionPass {
     AU.setPreservesAll();
   }
 
-  void writeConstraintsForDstReg(VASTRegister *DstReg);
+  void writeConstraintsForDstReg(TimingPathTable &T, VASTRegister *DstReg,
+                                 DatapathSupportCache &Support);
 
   void extractTimingPaths(PathDelayQueryCache &Cache,
                           ArrayRef<ValueAtSlot*> DstVAS,
@@ -138,6 +220,8 @@ struct CombPathDelayAnalysis : public MachineFunctionPass {
   bool runOnMachineFunction(MachineFunction &MF);
 
   bool doInitialization(Module &) {
+    if (!WriteHeader) return false;
+
     SMDiagnostic Err;
     // Get the script from script engine.
     const char *HeaderScriptPath[] = { "Misc",
@@ -148,7 +232,8 @@ struct CombPathDelayAnalysis : public MachineFunctionPass {
     return false;
   }
 
-  CombPathDelayAnalysis() : MachineFunctionPass(ID), RtlSSA(0), VM(0) {
+  CombPathDelayAnalysis(bool WriteHeader = true)
+    : MachineFunctionPass(ID), RtlSSA(0), VM(0), WriteHeader(WriteHeader) {
     initializeCombPathDelayAnalysisPass(*PassRegistry::getPassRegistry());
   }
 };
@@ -185,7 +270,7 @@ static unsigned getMinimalDelay(CombPathDelayAnalysis &A, VASTRegister *SrcReg,
   return PathDelay;
 }
 
-static bool printBindingLuaCode(raw_ostream &OS, const VASTValue *V) {  
+static bool printNameSet(raw_ostream &OS, const VASTValue *V) {
   if (const VASTNamedValue *NV = dyn_cast<VASTNamedValue>(V)) {
     if (const VASTWire *W = dyn_cast<VASTWire>(V))
       // Do not trust the name of the assign condition, it is the pointer to the
@@ -196,24 +281,24 @@ static bool printBindingLuaCode(raw_ostream &OS, const VASTValue *V) {
     if (const VASTRegister *R = dyn_cast<VASTRegister>(V))
       // The block RAM should be printed as Prefix + ArrayName in the script.
       if (R->getRegType() == VASTRegister::BRAM) {
-        OS << " { NameSet =[=[ [ list "
+        OS << "[ list "
            // BlockRam name with prefix
            << getFUDesc<VFUBRAM>()->getPrefix()
            << VFUBRAM::getArrayName(R->getDataRegNum()) << ' '
            // Or simply the name of the output register.
            << VFUBRAM::getArrayName(R->getDataRegNum())
-           << " ] ]=] }";
+           << " ]";
         return true;
       }
 
     if (const char *N = NV->getName()) {
-      OS << " { NameSet =[=[ [ list " << N << " ] ]=] }";
+      OS << "[ list " << N << " ]";
       return true;
     }
   } else if (const VASTExpr *E = dyn_cast<VASTExpr>(V)) {
     std::string Name = E->getSubModName();
     if (!Name.empty()) {
-      OS << " { NameSet =[=[ [ list " << E->getSubModName() << " ] ]=] }";
+      OS << "[ list " << E->getSubModName() << " ]";
       return true;
     }
   }
@@ -221,139 +306,280 @@ static bool printBindingLuaCode(raw_ostream &OS, const VASTValue *V) {
   return false;
 }
 
-void PathDelayQueryCache::annotatePathDelay(CombPathDelayAnalysis &A,
-                                            VASTValue *Root,
-                                            ArrayRef<ValueAtSlot*> DstVAS) {
+static void printBindingLuaCode(raw_ostream &OS, StringRef NameSet) {
+  OS << " { NameSet =[=[ " << NameSet << " ]=] }";
+}
+
+static bool printBindingLuaCode(raw_ostream &OS, const VASTValue *V) {
+  std::string NameSet;
+  raw_string_ostream SS(NameSet);
+  if (!printNameSet(SS, V)) return false;
+
+  printBindingLuaCode(OS, SS.str());
+  return true;
+}
+
+int TimingPathTable::getNameSet(const VASTValue *V) {
+  std::pair<DenseMap<const VASTValue*, int>::iterator, bool> at
+    = NameSetIdx.insert(std::make_pair(V, -1));
+  if (!at.second) return at.first->second;
+
+  std::string NameSet;
+  raw_string_ostream SS(NameSet);
+  if (!printNameSet(SS, V)) return -1;
+
+  NameSets.push_back(SS.str());
+  return at.first->second = NameSets.size() - 1;
+}
+
+void TimingPathTable::printNodesTable(raw_ostream &OS, const Path &P) const {
+  OS << '{';
+  for (unsigned i = P.NodeBegin; i != P.NodeEnd; ++i) {
+    if (i != P.NodeBegin) OS << ',';
+    OS << " N[" << (PathNodes[i] + 1) << ']';
+  }
+  OS << " }";
+}
+
+void TimingPathTable::printPathTable(raw_ostream &OS, const Path &P) const {
+  // Path table:
+  // Datapath: {
+  //  unsigned Slack,
+  //  unsigned isCriticalPath,
+  //  table Nodes
+  // }
+  OS << "{ Slack = " << P.Slack
+     << ", isCriticalPath = " << unsigned(P.IsCritical) << ", Nodes = ";
+  printNodesTable(OS, P);
+  OS << " }";
+}
+
+void TimingPathTable::bindAllPaths2ScriptEngine() const {
+  std::string Script;
+  raw_string_ostream SS(Script);
+
+  // The name sets are shared by the paths.
+  SS << "local N = {\n";
+  for (unsigned i = 0, e = NameSets.size(); i != e; ++i) {
+    printBindingLuaCode(SS, NameSets[i]);
+    SS << ",\n";
+  }
+  SS << "}\n";
+
+  SS << "RTLDatapaths = {\n";
+  typedef std::vector<Path>::const_iterator path_it;
+  for (path_it I = Paths.begin(), E = Paths.end(); I != E; ++I) {
+    printPathTable(SS, *I);
+    SS << ",\n";
+  }
+  SS << "}\n";
+
+  SMDiagnostic Err;
+  if (!runScriptStr(SS.str(), Err))
+    llvm_unreachable("Cannot create RTLDatapaths table!");
+}
+
+void TimingPathTable::bindPath2ScriptEngine(const Path &P) const {
+  std::string Script;
+  raw_string_ostream SS(Script);
+
+  SS << "local N = {";
+  for (unsigned i = P.NodeBegin; i != P.NodeEnd; ++i)
+    SS << " [" << (PathNodes[i] + 1) << "] ="
+       << " { NameSet =[=[ " << getNode(i) << " ]=] },";
+  SS << " }\n";
+
+  SS << "RTLDatapath = ";
+  printPathTable(SS, P);
+  SS << '\n';
+
+  SMDiagnostic Err;
+  if (!runScriptStr(SS.str(), Err))
+    llvm_unreachable("Cannot create RTLDatapath table!");
+}
+
+const DatapathSupportCache::RegVecTy &
+DatapathSupportCache::getSupport(VASTValue *Root) {
   assert((isa<VASTWire>(Root) || isa<VASTExpr>(Root)) && "Bad root type!");
+  DenseMap<VASTValue*, unsigned>::iterator at = SupportIdx.find(Root);
+  if (at != SupportIdx.end()) return Supports[at->second];
+
   typedef VASTValue::dp_dep_it ChildIt;
   std::vector<std::pair<VASTValue*, ChildIt> > VisitStack;
-  std::set<VASTValue*> Visited;
-  RegSetTy LocalDelay;
-
-  unsigned ExtraDelay = 0;
-  if (VASTWire *W = dyn_cast<VASTWire>(Root))
-    ExtraDelay += W->getExtraDelayIfAny();
 
   VisitStack.push_back(std::make_pair(Root, VASTValue::dp_dep_begin(Root)));
   while (!VisitStack.empty()) {
     VASTValue *Node = VisitStack.back().first;
     ChildIt It = VisitStack.back().second;
 
-    RegSetTy &ParentReachableRegs = QueryCache[Node];
-
-    // All sources of this node is visited.
-    if (It == VASTValue::dp_dep_end(Node)) {
-      VisitStack.pop_back();
-      // Add the supporting register of current node to its parent's
-      // supporting register set.
-      if (!VisitStack.empty())
-        updateDelay(QueryCache[VisitStack.back().first], ParentReachableRegs,
-                    LocalDelay);
-
-      continue;
-    }
-
-    // Otherwise, remember the node and visit its children first.
-    VASTValue *ChildNode = It->getAsLValue<VASTValue>();
-    ++VisitStack.back().second;
+    if (It != VASTValue::dp_dep_end(Node)) {
+      VASTValue *ChildNode = It->getAsLValue<VASTValue>();
+      ++VisitStack.back().second;
 
-    // And do not visit a node twice.
-    if (!Visited.insert(ChildNode).second) {
-      // If there are tighter delay from the child, it means we had already
-      // visited the sub-tree.
-      updateDelay(ParentReachableRegs, QueryCache[ChildNode], LocalDelay);
+      // Visit the children first, and do not visit a node twice.
+      if ((isa<VASTWire>(ChildNode) || isa<VASTExpr>(ChildNode))
+          && !SupportIdx.count(ChildNode))
+        VisitStack.push_back(
+          std::make_pair(ChildNode, VASTValue::dp_dep_begin(ChildNode)));
       continue;
     }
 
-    if (VASTRegister *R = dyn_cast<VASTRegister>(ChildNode)) {
-      unsigned Delay = getMinimalDelay(A, R, DstVAS);
-
-      // If there are black box in the path.
-      if (ExtraDelay) {
-        // Only allow the wire and the black box expression, we only allocate
-        // 1 static slot for the black box that has very big delay, whose
-        // actually delay is available from getExtraDelayIfAny of the wire.
-        assert(Delay == 1 && VisitStack.size() == 2
-               && "Unexpected chained black box!");
-        Delay = ExtraDelay;
+    // All sources of this node are visited, merge their supporting registers.
+    VisitStack.pop_back();
+    // The node may be reached from more than one parent on the stack.
+    if (SupportIdx.count(Node)) continue;
+
+    RegVecTy Regs;
+    for (ChildIt CI = VASTValue::dp_dep_begin(Node),
+         CE = VASTValue::dp_dep_end(Node); CI != CE; ++CI) {
+      VASTValue *ChildNode = CI->getAsLValue<VASTValue>();
+      if (VASTRegister *R = dyn_cast<VASTRegister>(ChildNode)) {
+        Regs.push_back(R);
+        continue;
       }
 
-      bool inserted = LocalDelay.insert(std::make_pair(R, Delay)).second;
-      assert(inserted && "Node had already been visited?");
-      unsigned &ExistedDelay = ParentReachableRegs[R];
-      if (ExistedDelay == 0 || Delay < ExistedDelay)
-        ExistedDelay = Delay;
+      DenseMap<VASTValue*, unsigned>::iterator ChildAt
+        = SupportIdx.find(ChildNode);
+      if (ChildAt == SupportIdx.end()) continue;
 
-      // Add the information to statistics.
-      addDelayFromToStats(R, Delay, false);
-      continue;
+      const RegVecTy &ChildRegs = Supports[ChildAt->second];
+      Regs.insert(Regs.end(), ChildRegs.begin(), ChildRegs.end());
     }
 
-    if (!isa<VASTWire>(ChildNode) && !isa<VASTExpr>(ChildNode)) continue;
+    array_pod_sort(Regs.begin(), Regs.end());
+    Regs.erase(std::unique(Regs.begin(), Regs.end()), Regs.end());
 
-    VisitStack.push_back(std::make_pair(ChildNode,
-                                        VASTValue::dp_dep_begin(ChildNode)));
+    SupportIdx[Node] = Supports.size();
+    Supports.push_back(RegVecTy());
+    Supports.back().swap(Regs);
   }
 
-  // Check the result, debug only.
-  DEBUG(QueryCacheTy::iterator at = QueryCache.find(Root);
-  assert(at != QueryCache.end()
-         && "Timing path information for root not found!");
-  const RegSetTy &RootSet = at->second;
-  typedef RegSetTy::const_iterator it;
-  bool DelayMasked = false;
-  for (it I = LocalDelay.begin(), E = LocalDelay.end(); I != E; ++I) {
-    RegSetTy::const_iterator ActualDelayAt = RootSet.find(I->first);
-    assert(ActualDelayAt != RootSet.end() && "Timing path entire missed!");
-    assert(ActualDelayAt->second <= I->second
-           && "Delay information not applied?");
-    if (ActualDelayAt->second == I->second) continue;
-
-    dbgs() << "Timing path masked: Root is";
-    Root->printAsOperand(dbgs(), false);
-    dbgs() << " end node is " << I->first->getName()
-           << " masked delay: " << I->second
-           << " actual delay: " << ActualDelayAt->second << '\n';
-    DelayMasked = true;
-  }
+  return Supports[SupportIdx.lookup(Root)];
+}
+
+const DatapathSupportCache::NodeVecTy &
+DatapathSupportCache::getCone(VASTValue *Root) {
+  std::pair<DenseMap<VASTValue*, unsigned>::iterator, bool> inserted
+    = ConeIdx.insert(std::make_pair(Root, Cones.size()));
+  if (!inserted.second) return Cones[inserted.first->second];
 
-  if (DelayMasked) {
-    dbgs() << " going to dump the nodes in the tree:\n";
+  Cones.push_back(NodeVecTy());
+  NodeVecTy &Cone = Cones.back();
+  SmallPtrSet<VASTValue*, 32> Visited;
+  Cone.push_back(Root);
+  Visited.insert(Root);
 
-    typedef std::set<VASTValue*>::iterator node_it;
-    for (node_it NI = Visited.begin(), NE = Visited.end(); NI != NE; ++NI) {
-      (*NI)->printAsOperand(dbgs(), false);
-      dbgs() << ", ";
+  // The visited nodes are also the worklist.
+  typedef VASTValue::dp_dep_it ChildIt;
+  for (unsigned i = 0; i != Cone.size(); ++i) {
+    VASTValue *Node = Cone[i];
+    for (ChildIt CI = VASTValue::dp_dep_begin(Node),
+         CE = VASTValue::dp_dep_end(Node); CI != CE; ++CI) {
+      VASTValue *ChildNode = CI->getAsLValue<VASTValue>();
+      if ((isa<VASTWire>(ChildNode) || isa<VASTExpr>(ChildNode))
+          && Visited.insert(ChildNode))
+        Cone.push_back(ChildNode);
     }
-    dbgs() << '\n';
-  });
+  }
+
+  return Cone;
 }
 
-unsigned PathDelayQueryCache::printPathWithDelayFrom(raw_ostream &OS,
-                                                     VASTRegister *SrcReg,
-                                                     unsigned Delay) const {
-  unsigned NumNodesPrinted = 0;
+void PathDelayQueryCache::annotatePathDelay(CombPathDelayAnalysis &A,
+                                            VASTValue *Root,
+                                            ArrayRef<ValueAtSlot*> DstVAS) {
+  unsigned ExtraDelay = 0;
+  if (VASTWire *W = dyn_cast<VASTWire>(Root))
+    ExtraDelay += W->getExtraDelayIfAny();
 
-  typedef QueryCacheTy::const_iterator it;
-  for (it I = QueryCache.begin(), E = QueryCache.end(); I != E; ++I) {
-    const RegSetTy &Set = I->second;
-    RegSetTy::const_iterator at = Set.find(SrcReg);
-    // The register may be not reachable from this node.
-    if (at == Set.end() || at->second != Delay) continue;
+  Trees.push_back(std::make_pair(Root, RegSetTy()));
+  RegSetTy &LeafDelay = Trees.back().second;
+
+  typedef DatapathSupportCache::RegVecTy::const_iterator reg_it;
+  const DatapathSupportCache::RegVecTy &Regs = Support.getSupport(Root);
+  for (reg_it I = Regs.begin(), E = Regs.end(); I != E; ++I) {
+    VASTRegister *R = *I;
+    unsigned Delay = getMinimalDelay(A, R, DstVAS);
+
+    // If there are black box in the path.
+    if (ExtraDelay) {
+      // Only allow the wire and the black box expression, we only allocate
+      // 1 static slot for the black box that has very big delay, whose
+      // actually delay is available from getExtraDelayIfAny of the wire.
+      assert(Delay == 1 && "Unexpected chained black box!");
+      Delay = ExtraDelay;
+    }
 
-    if (printBindingLuaCode(OS, I->first)) {
-      OS << ", ";
-      ++NumNodesPrinted;
+    LeafDelay[R] = Delay;
+    // Add the information to statistics.
+    addDelayFromToStats(R, Delay, false);
+  }
+}
+
+void PathDelayQueryCache::buildThuNodeDelays() {
+  // The index of the node in the delay vector of the register.
+  DenseMap<std::pair<VASTRegister*, VASTValue*>, unsigned> NodeIdx;
+
+  typedef TreeVecTy::const_iterator tree_it;
+  for (tree_it I = Trees.begin(), E = Trees.end(); I != E; ++I) {
+    const RegSetTy &LeafDelay = I->second;
+    const DatapathSupportCache::NodeVecTy &Cone = Support.getCone(I->first);
+
+    typedef DatapathSupportCache::NodeVecTy::const_iterator node_it;
+    for (node_it NI = Cone.begin(), NE = Cone.end(); NI != NE; ++NI) {
+      VASTValue *Node = *NI;
+      // A node is on the paths from the registers that support it.
+      typedef DatapathSupportCache::RegVecTy::const_iterator reg_it;
+      const DatapathSupportCache::RegVecTy &Regs = Support.getSupport(Node);
+      for (reg_it RI = Regs.begin(), RE = Regs.end(); RI != RE; ++RI) {
+        VASTRegister *R = *RI;
+        RegSetTy::const_iterator at = LeafDelay.find(R);
+        assert(at != LeafDelay.end() && "Register not support the tree!");
+        unsigned Delay = at->second;
+
+        NodeDelayVecTy &Delays = ThuNodeDelays[R];
+        std::pair<DenseMap<std::pair<VASTRegister*, VASTValue*>,
+                           unsigned>::iterator, bool> inserted
+          = NodeIdx.insert(std::make_pair(std::make_pair(R, Node),
+                                          Delays.size()));
+        if (inserted.second) {
+          Delays.push_back(std::make_pair(Node, Delay));
+          continue;
+        }
+
+        unsigned &NodeDelay = Delays[inserted.first->second].second;
+        NodeDelay = std::min(NodeDelay, Delay);
+      }
     }
   }
+}
+
+unsigned PathDelayQueryCache::addThuNodesWithDelayFrom(TimingPathTable &T,
+                                                       VASTRegister *SrcReg,
+                                                       unsigned Delay) const {
+  DenseMap<VASTRegister*, NodeDelayVecTy>::const_iterator at
+    = ThuNodeDelays.find(SrcReg);
+  if (at == ThuNodeDelays.end()) return 0;
+
+  unsigned NumNodesAdded = 0;
+  typedef NodeDelayVecTy::const_iterator node_it;
+  for (node_it I = at->second.begin(), E = at->second.end(); I != E; ++I) {
+    if (I->second != Delay) continue;
+
+    int NameSet = T.getNameSet(I->first);
+    if (NameSet < 0) continue;
 
-  return NumNodesPrinted;
+    T.PathNodes.push_back(NameSet);
+    ++NumNodesAdded;
+  }
+
+  return NumNodesAdded;
 }
 
 void PathDelayQueryCache::dump() const {
   dbgs() << "\nCurrent data-path timing:\n";
-  typedef QueryCacheTy::const_iterator it;
-  for (it I = QueryCache.begin(), E = QueryCache.end(); I != E; ++I) {
+  typedef TreeVecTy::const_iterator it;
+  for (it I = Trees.begin(), E = Trees.end(); I != E; ++I) {
     const RegSetTy &Set = I->second;
     typedef RegSetTy::const_iterator reg_it;
 
@@ -373,57 +599,29 @@ void PathDelayQueryCache::dump() const {
 
 // The first node of the path is the use node and the last node of the path is
 // the define node.
-unsigned PathDelayQueryCache::bindPath2ScriptEngine(VASTRegister *DstReg,
-                                                    VASTRegister *SrcReg,
-                                                    unsigned Delay, bool SkipThu,
-                                                    bool IsCritical) const {
-  // Path table:
-  // Datapath: {
-  //  unsigned Slack,
-  //  table NodesInPath
-  // }
-  SMDiagnostic Err;
-
-  if (!runScriptStr("RTLDatapath = {}\n", Err))
-    llvm_unreachable("Cannot create RTLDatapath table in scripting pass!");
-
-  std::string Script;
-  raw_string_ostream SS(Script);
-  SS << "RTLDatapath.Slack = " << Delay << '\n';
-  SS << "RTLDatapath.isCriticalPath = " << (SkipThu || IsCritical) << '\n';
-  SS.flush();
-  if (!runScriptStr(Script, Err))
-    llvm_unreachable("Cannot create slack of RTLDatapath!");
-
-  Script.clear();
-
-  unsigned NumThuNodePrinted = 0;
-  SS << "RTLDatapath.Nodes = { ";
-  printBindingLuaCode(SS, DstReg);
-  SS << ", ";
-
+unsigned PathDelayQueryCache::addPath(TimingPathTable &T, VASTRegister *DstReg,
+                                      VASTRegister *SrcReg, unsigned Delay,
+                                      bool SkipThu, bool IsCritical) const {
+  int DstNameSet = T.getNameSet(DstReg), SrcNameSet = T.getNameSet(SrcReg);
+  // Cannot write constraints for the registers without name.
+  if (DstNameSet < 0 || SrcNameSet < 0) return 0;
+
+  T.Paths.push_back(TimingPathTable::Path(Delay, SkipThu || IsCritical,
+                                          T.PathNodes.size()));
+  T.PathNodes.push_back(DstNameSet);
+
+  unsigned NumThuNodeAdded = 0;
   if (!SkipThu)
-    NumThuNodePrinted = printPathWithDelayFrom(SS, SrcReg, Delay);
-
-  printBindingLuaCode(SS, SrcReg);
-  SS << " }";
+    NumThuNodeAdded = addThuNodesWithDelayFrom(T, SrcReg, Delay);
 
-  SS.flush();
-  if (!runScriptStr(Script, Err))
-    llvm_unreachable("Cannot create node table of RTLDatapath!");
-
-  // Get the script from script engine.
-  const char *DatapathScriptPath[] = { "Misc", "DatapathScript" };
-  if (!runScriptStr(getStrValueFromEngine(DatapathScriptPath), Err))
-    report_fatal_error("Error occur while running datapath script:\n"
-                       + Err.getMessage());
-  return NumThuNodePrinted;
+  T.PathNodes.push_back(SrcNameSet);
+  T.Paths.back().NodeEnd = T.PathNodes.size();
+  return NumThuNodeAdded;
 }
 
-void PathDelayQueryCache::bindAllPath2ScriptEngine(VASTRegister *Dst,
-                                                   bool IsSimple,
-                                                   DenseSet<VASTRegister*>
-                                                   &BoundSrc) const {
+void PathDelayQueryCache::addAllPaths(TimingPathTable &T, VASTRegister *Dst,
+                                      bool IsSimple,
+                                      DenseSet<VASTRegister*> &BoundSrc) const {
   DEBUG(dbgs() << "Binding path for dst register: "
                << Dst->getName() << '\n');
   for (delay_it I = stats_begin(IsSimple), E = stats_end(IsSimple);I != E;++I) {
@@ -443,21 +641,24 @@ void PathDelayQueryCache::bindAllPath2ScriptEngine(VASTRegister *Dst,
       // If we not visited the path before, this path is the critical path,
       // since we are iteration the path from the smallest delay to biggest
       // delay.
-      unsigned NumConstraints = bindPath2ScriptEngine(Dst, SrcReg, Delay,
-                                                      IsSimple, !Visited);
+      unsigned NumConstraints = addPath(T, Dst, SrcReg, Delay, IsSimple,
+                                        !Visited);
       if (NumConstraints == 0 && !IsSimple && Delay > 1)
         ++NumMaskedMultiCyclesTimingPath;
     }
   }
 }
 
-void PathDelayQueryCache::bindAllPath2ScriptEngine(VASTRegister *Dst) const {
+void PathDelayQueryCache::addAllPaths(TimingPathTable &T,
+                                      VASTRegister *Dst) {
+  buildThuNodeDelays();
+
   DenseSet<VASTRegister*> BoundSrc;
   DEBUG(dbgs() << "Going to bind delay information of graph: \n");
   DEBUG(dump());
   // Bind the simple paths first, which are the most general.
-  bindAllPath2ScriptEngine(Dst, true, BoundSrc);
-  bindAllPath2ScriptEngine(Dst, false, BoundSrc);
+  addAllPaths(T, Dst, true, BoundSrc);
+  addAllPaths(T, Dst, false, BoundSrc);
 }
 
 bool CombPathDelayAnalysis::runOnMachineFunction(MachineFunction &MF) {
@@ -469,15 +670,50 @@ bool CombPathDelayAnalysis::runOnMachineFunction(MachineFunction &MF) {
 
   RtlSSA = &getAnalysis<RtlSSAAnalysis>();
 
-  //Write the timing constraints.
+  // Collect the timing paths, the supporting registers of the data-path nodes
+  // are shared by all destination registers.
+  TimingPathTable Paths;
+  DatapathSupportCache Support;
   typedef VASTModule::reg_iterator reg_it;
   for (reg_it I = VM->reg_begin(), E = VM->reg_end(); I != E; ++I)
-    writeConstraintsForDstReg(*I);
+    writeConstraintsForDstReg(Paths, *I, Support);
+
+  //Write the timing constraints.
+  SMDiagnostic Err;
+  switch (TimingScriptMode) {
+  case BulkScript: {
+    Paths.bindAllPaths2ScriptEngine();
+
+    const char *TableScriptPath[] = { "Misc", "DatapathTableScript" };
+    if (!runScriptStr(getStrValueFromEngine(TableScriptPath), Err))
+      report_fatal_error("Error occur while running datapath table script:\n"
+                         + Err.getMessage());
+    break;
+  }
+  case PerPathScript: {
+    // Get the script from script engine.
+    const char *DatapathScriptPath[] = { "Misc", "DatapathScript" };
+    std::string DatapathScript = getStrValueFromEngine(DatapathScriptPath);
+
+    typedef std::vector<TimingPathTable::Path>::const_iterator path_it;
+    for (path_it I = Paths.Paths.begin(), E = Paths.Paths.end(); I != E; ++I) {
+      Paths.bindPath2ScriptEngine(*I);
+
+      if (!runScriptStr(DatapathScript, Err))
+        report_fatal_error("Error occur while running datapath script:\n"
+                           + Err.getMessage());
+    }
+    break;
+  }
+  }
 
   return false;
 }
 
-void CombPathDelayAnalysis::writeConstraintsForDstReg(VASTRegister *DstReg) {
+void
+CombPathDelayAnalysis::writeConstraintsForDstReg(TimingPathTable &T,
+                                                 VASTRegister *DstReg,
+                                                 DatapathSupportCache &Support) {
   // Virtual registers are not act as sink.
   if (DstReg->getRegType() == VASTRegister::Virtual) return;
 
@@ -494,12 +730,12 @@ void CombPathDelayAnalysis::writeConstraintsForDstReg(VASTRegister *DstReg) {
     DatapathMap[I->second->getAsLValue<VASTValue>()].push_back(DstVAS);
   }
 
-  PathDelayQueryCache Cache;
+  PathDelayQueryCache Cache(Support);
   typedef DenseMap<VASTValue*, SmallVector<ValueAtSlot*, 8> >::iterator it;
   for (it I = DatapathMap.begin(), E = DatapathMap.end(); I != E; ++I)
     extractTimingPaths(Cache, I->second, I->first);
 
-  Cache.bindAllPath2ScriptEngine(DstReg);
+  Cache.addAllPaths(T, DstReg);
 }
 
 void CombPathDelayAnalysis::extractTimingPaths(PathDelayQueryCache &Cache,
@@ -533,6 +769,6 @@ INITIALIZE_PASS_BEGIN(CombPathDelayAnalysis, "CombPathDelayAnalysis",
 INITIALIZE_PASS_END(CombPathDelayAnalysis, "CombPathDelayAnalysis",
                     "CombPathDelayAnalysis", false, false)
 
-Pass *llvm::createCombPathDelayAnalysisPass() {
-  return new CombPathDelayAnalysis();
+Pass *llvm::createCombPathDelayAnalysisPass(bool WriteHeader) {
+  return new CombPathDelayAnalysis(WriteHeader);
 }
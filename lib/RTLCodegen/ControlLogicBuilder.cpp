@@ -160,9 +160,15 @@ void VASTSlot::buildCtrlLogic(VASTModule &Mod, VASTExprBuilder &Builder) {
             << " bad Slot0 %b\\n\", Slot0r);  $finish(); end\n";
     }
 
-    CtrlS << "if (mem0en_r) begin $display(\"" << getName() << " in "
-          << Mod.getName()
-          << " bad mem0en_r %b\\n\", mem0en_r);  $finish(); end\n";
+    // The pipelined memory buses accept new requests in every slot.
+    VFUMemBus *MemBus = getFUDesc<VFUMemBus>();
+    unsigned NumBuses = MemBus->isPipelined() ? 0 : MemBus->getNumBuses();
+    for (unsigned i = 0; i != NumBuses; ++i) {
+      std::string En = VFUMemBus::getEnableName(i) + "_r";
+      CtrlS << "if (" << En << ") begin $display(\"" << getName() << " in "
+            << Mod.getName()
+            << " bad " << En << " %b\\n\", " << En << ");  $finish(); end\n";
+    }
     );
   }
 
@@ -15,6 +15,7 @@
 #include "IR2Datapath.h"
 #include "vtm/Passes.h"
 #include "vtm/DesignMetrics.h"
+#include "vtm/Utilities.h"
 
 #include "llvm/Pass.h"
 #include "llvm/Target/TargetData.h"
@@ -352,18 +353,28 @@ DesignMetrics::DesignCost DesignMetrics::getCost() const {
 
 void DesignMetrics::reset() { Impl->reset(); }
 
+// The memory accesses are spread over the buses, each bus has its own mux.
+static uint64_t getBusMuxCost(VFUMux *MUX, unsigned NumFanins,
+                              unsigned BitWidth, unsigned NumBuses) {
+  unsigned FaninsPerBus = (NumFanins + NumBuses - 1) / NumBuses;
+  return uint64_t(NumBuses) * MUX->getMuxCost(FaninsPerBus, BitWidth);
+}
+
 uint64_t DesignMetrics::DesignCost::getCostInc(unsigned Multiply, uint64_t Alpha,
                                                uint64_t Beta, uint64_t Gama) const {
   VFUMux *MUX = getFUDesc<VFUMux>();
   VFUMemBus *MemBus = getFUDesc<VFUMemBus>();
   unsigned AddrWidth = MemBus->getAddrWidth();
   unsigned DataWidth = MemBus->getDataWidth();
+  unsigned NumBuses = MemBus->getNumBuses();
 
   return Alpha * (uint64_t(Multiply) - 1) * DatapathCost
-         + Beta * (MUX->getMuxCost(Multiply * NumAddrBusFanin, AddrWidth)
-                   - MUX->getMuxCost(NumAddrBusFanin, AddrWidth))
-         + Beta * (MUX->getMuxCost(Multiply * NumDataBusFanin, DataWidth)
-                   - MUX->getMuxCost(NumDataBusFanin, DataWidth))
+         + Beta * (getBusMuxCost(MUX, Multiply * NumAddrBusFanin, AddrWidth,
+                                 NumBuses)
+                   - getBusMuxCost(MUX, NumAddrBusFanin, AddrWidth, NumBuses))
+         + Beta * (getBusMuxCost(MUX, Multiply * NumDataBusFanin, DataWidth,
+                                 NumBuses)
+                   - getBusMuxCost(MUX, NumDataBusFanin, DataWidth, NumBuses))
          + Gama * (uint64_t(Multiply) - 1) * StepLB;
 }
 
@@ -386,9 +397,13 @@ bool DesignMetricsPass::runOnFunction(Function &F) {
 
   Metrics.visit(F);
 
-  //DEBUG(dbgs() << "Data-path cost of function " << F.getName() << ':'
-  //             << Metrics.getResourceCost() << '\n');
-  
+  DesignMetrics::DesignCost Cost = Metrics.getCost();
+  DEBUG(dbgs() << "Data-path cost of function " << F.getName() << ':'
+               << Cost << '\n');
+
+  // Make the estimation available to the design space exploration.
+  recordMetricToEngine(F.getName(), "DatapathCost", Cost.DatapathCost);
+  recordMetricToEngine(F.getName(), "StepLB", Cost.StepLB);
   return false;
 }
 
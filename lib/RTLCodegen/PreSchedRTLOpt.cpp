@@ -26,6 +26,7 @@
 #include "llvm/CodeGen/MachineDominators.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Allocator.h"
 #define DEBUG_TYPE "vtm-pre-schedule-rtl-opt"
@@ -33,6 +34,22 @@
 
 using namespace llvm;
 
+static cl::opt<bool>
+EnableCompressorTree("vtm-enable-compressor-tree",
+                     cl::desc("Sum the multi-operand additions by carry-save"
+                              " compressor trees"),
+                     cl::init(true));
+
+static cl::opt<unsigned>
+MaxPartialProducts("vtm-max-const-mult-partial-products",
+                   cl::desc("The maximal number of partial products of the"
+                            " multiplication by constant that are summed by"
+                            " compressor tree instead of multiplier"),
+                   cl::init(4));
+
+STATISTIC(NumCompressorTrees,
+          "Number of multi-operand additions summed by compressor trees");
+
 namespace llvm {
 class VASTMachineOperand : public VASTValue {
   const MachineOperand MO;
@@ -85,6 +102,7 @@ struct PreSchedRTLOpt : public MachineFunctionPass,
   // Remember in which MachineBasicBlock the expression is first created, we can
   // simply write this expression in the MachineBasicBlock.
   typedef DenseMap<VASTExpr*, MachineBasicBlock*> ExprLocMapTy;
+  ExprLocMapTy ExprLoc;
 
   MachineBasicBlock *getDefMBB(VASTValPtr V) const;
   MachineBasicBlock *calculateInsertMBB(VASTExpr *Expr) const;
@@ -115,6 +133,12 @@ struct PreSchedRTLOpt : public MachineFunctionPass,
     return E->isInlinable();
   }
 
+  VASTExpr *getAddExprToCompress(VASTValPtr V, unsigned ResultSize);
+
+  unsigned getMaxPartialProductsToExpand() const {
+    return EnableCompressorTree ? unsigned(MaxPartialProducts) : 0;
+  }
+
   bool enableLUTMapping;
   PreSchedRTLOpt(bool enableLUTMapping) : MachineFunctionPass(ID), MRI(0),
                                           DT(0), Entry(0),
@@ -152,6 +176,7 @@ struct PreSchedRTLOpt : public MachineFunctionPass,
   unsigned rewriteRXor(VASTExpr *Expr, MachineInstr *IP);
   unsigned rewriteSel(VASTExpr *Expr, MachineInstr *IP);
   unsigned rewriteAdd(VASTExpr *Expr, MachineInstr *IP);
+  unsigned rewriteCompressorTree(VASTExpr *Expr, MachineInstr *IP);
   unsigned rewriteAssign(VASTExpr *Expr);
   template<unsigned Opcode, typename BitwidthFN>
   unsigned rewriteNAryExpr(VASTExpr *Expr, MachineInstr *IP, BitwidthFN F);
@@ -241,6 +266,7 @@ struct PreSchedRTLOpt : public MachineFunctionPass,
     Builder.reset();
     DeleteContainerSeconds(VASTMOs);
     Val2Reg.clear();
+    ExprLoc.clear();
     DPContainer.reset();
   }
 };
@@ -450,9 +476,36 @@ VASTValPtr PreSchedRTLOpt::buildDatapath(MachineInstr *MI) {
   if (FoldedReg == ResultReg)
     Builder->indexVASTExpr(FoldedReg, V);
 
+  if (VASTExpr *Expr = dyn_cast<VASTExpr>(V.get()))
+    ExprLoc.insert(std::make_pair(Expr, MI->getParent()));
+
   return V;
 }
 
+VASTExpr *PreSchedRTLOpt::getAddExprToCompress(VASTValPtr V,
+                                               unsigned ResultSize) {
+  if (!EnableCompressorTree) return 0;
+
+  // The addends can only be merged if all bits of the sum that used by this
+  // addition are available.
+  if (V.isInverted() || V->getBitWidth() < ResultSize) return 0;
+
+  V = stripZeroBasedBitSlize(V);
+  VASTExpr *Expr = dyn_cast<VASTExpr>(V.get());
+  if (V.isInverted() || !Expr || Expr->getOpcode() != VASTExpr::dpAdd)
+    return 0;
+
+  // Do not duplicate the addition if its result is also used by others.
+  unsigned RegNum = lookupRegNum(Expr);
+  if (RegNum == 0 || !MRI->hasOneNonDBGUse(RegNum)) return 0;
+
+  // Do not move the addition across the MachineBasicBlocks, e.g. into a loop.
+  MachineInstr &UseMI = *MRI->use_nodbg_begin(RegNum);
+  if (ExprLoc.lookup(Expr) != UseMI.getParent()) return 0;
+
+  return Expr;
+}
+
 unsigned PreSchedRTLOpt::rewriteExprTree(VASTExprPtr Expr, MachineInstr *IP) {
   typedef VASTValue::dp_dep_it ChildIt;
   std::vector<std::pair<VASTExprPtr, ChildIt> > VisitStack;
@@ -524,7 +577,13 @@ unsigned PreSchedRTLOpt::rewriteSel(VASTExpr *Expr, MachineInstr *IP) {
 }
 
 unsigned PreSchedRTLOpt::rewriteAdd(VASTExpr *Expr, MachineInstr *IP) {
-  assert(Expr->NumOps > 1 && Expr->NumOps < 4 && "Bad operand number!");
+  // Only the carry bit is allowed as the third operand of VOpAdd_c, sum the
+  // other multi-operand additions by compressor trees.
+  if (Expr->NumOps > 3
+      || (Expr->NumOps == 3 && Expr->getOperand(2)->getBitWidth() != 1))
+    return rewriteCompressorTree(Expr, IP);
+
+  assert(Expr->NumOps > 1 && "Bad operand number!");
   MachineOperand DefMO = allocateRegMO(Expr);
   MachineOperand LHS = getAsOperand(Expr->getOperand(0));
   MachineOperand RHS = getAsOperand(Expr->getOperand(1));
@@ -538,6 +597,27 @@ unsigned PreSchedRTLOpt::rewriteAdd(VASTExpr *Expr, MachineInstr *IP) {
   return DefMO.getReg();
 }
 
+unsigned PreSchedRTLOpt::rewriteCompressorTree(VASTExpr *Expr,
+                                               MachineInstr *IP) {
+  SmallVector<VASTValPtr, 8> Ops;
+  for (unsigned i = 0; i < Expr->NumOps; ++i)
+    Ops.push_back(Expr->getOperand(i));
+
+  VASTValPtr Tree = Builder->buildCompressorTree(Ops, Expr->getBitWidth());
+  DEBUG(dbgs() << "Sum " << Expr->NumOps << " addends by compressor tree: ";
+        Tree.printAsOperand(dbgs()); dbgs() << '\n');
+  ++NumCompressorTrees;
+
+  // The result of the tree should be written to the register allocated for
+  // the addition.
+  if (unsigned RegNum = lookupRegNum(Expr))
+    rememberRegNumForExpr<false>(Tree, RegNum);
+
+  VASTExprPtr TreeExpr = dyn_cast<VASTExprPtr>(Tree);
+  assert(TreeExpr && "Unexpected trivial compressor tree!");
+  return rewriteExprTree(TreeExpr, IP);
+}
+
 template<VFUs::ICmpFUType ICmpTy>
 unsigned PreSchedRTLOpt::rewriteICmp(VASTExpr *Expr, MachineInstr *IP) {
   MachineOperand DefMO = allocateRegMO(Expr);
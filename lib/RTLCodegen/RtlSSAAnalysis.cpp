@@ -25,14 +25,28 @@
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SetOperations.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/CommandLine.h"
 #define DEBUG_TYPE "vtm-rtl-ssa"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/GraphWriter.h"
 
 #include <map>
+#include <algorithm>
 
 using namespace llvm;
 
+static cl::opt<bool>
+UseMapBasedReachingDef("vtm-rtl-ssa-map-based",
+  cl::desc("Compute the RTL reaching definition with the map based In/Out "
+           "sets instead of bit-vectors"),
+  cl::init(false));
+
+static cl::opt<bool>
+VerifyDenseReachingDef("vtm-rtl-ssa-verify-dense",
+  cl::desc("Verify the bit-vector based RTL reaching definition against the "
+           "map based one"),
+  cl::init(false));
+
 namespace llvm {
 template<>
 struct DOTGraphTraits<RtlSSAAnalysis*> : public DefaultDOTGraphTraits{
@@ -141,10 +155,15 @@ void SlotInfo::print(raw_ostream &OS) const {
   }
 
   OS << "\n\nIn:\n";
-  for (VASCycMapTy::const_iterator I = in_begin(), E = in_end(); I != E; ++I) {
-    ValueAtSlot *VAS = I->first;
-    OS.indent(2) << VAS->getName() << '[' << I->second.getCycles() << "]\n";
-  }
+  if (isDense()) {
+    for (int i = InBits.find_first(); i >= 0; i = InBits.find_next(i))
+      OS.indent(2) << DenseVASs[i]->getName() << '['
+                   << InCycles.lookup(i) << "]\n";
+  } else
+    for (vascyc_iterator I = in_begin(), E = in_end(); I != E; ++I) {
+      ValueAtSlot *VAS = I->first;
+      OS.indent(2) << VAS->getName() << '[' << I->second.getCycles() << "]\n";
+    }
 
   OS << "\n\n";
 }
@@ -239,8 +258,10 @@ void RtlSSAAnalysis::buildAllVAS() {
       VASTSlot *S = VM->getSlot(I->first->getSlotNum());
       MachineInstr *DefMI = I->first->getDefMI();
       // Create the origin VAS.
-      ValueAtSlot *VAS = new (Allocator) ValueAtSlot(Reg, S, DefMI);
-      UniqueVASs.insert(std::make_pair(std::make_pair(Reg, S), VAS));
+      ValueAtSlot *VAS = new (Allocator) ValueAtSlot(Reg, S, DefMI,
+                                                     AllVASs.size());
+      if (UniqueVASs.insert(std::make_pair(std::make_pair(Reg, S), VAS)).second)
+        AllVASs.push_back(VAS);
     }
   }
 }
@@ -288,84 +309,104 @@ void RtlSSAAnalysis::visitDepTree(VASTValue *DepTree, ValueAtSlot *VAS){
   DepthFirstTraverseDepTree(DepTree, B);
 }
 
+namespace {
+enum LiveInKind { NotLive, LiveIn, LiveInAndOut };
+}
+
+// Compute how the VAS in the out set of FromSlot lives into ToSlot. Cycles is
+// the distance from the define slot of the VAS to ToSlot, and IsDefSlot is
+// true if the VAS is defined at FromSlot.
+static LiveInKind getLiveInKind(ValueAtSlot *PredOut, bool IsDefSlot,
+                                unsigned Cycles, const VASTSlot *FromSlot,
+                                const VASTSlot *ToSlot, bool FromAliasSlot,
+                                bool KilledAtTo) {
+  // Store the slot numbers in signed integer, we will perform subtraction on
+  // them and may produce negative result.
+  int FromSlotNum = FromSlot->SlotNum, ToSlotNum = ToSlot->SlotNum;
+  MachineBasicBlock *ToBB = ToSlot->getParentBB();
+  MachineBasicBlock *FromBB = FromSlot->getParentBB();
+  bool FromLaterAliasSlot = FromAliasSlot && FromSlotNum > ToSlotNum;
+
+  VASTRegister *R = PredOut->getValue();
+  VASTSlot *DefSlot = PredOut->getSlot();
+
+  bool LiveInToSlot = !FromLaterAliasSlot || R->isTimingUndef();
+  bool LiveOutToSlot = !KilledAtTo;
+
+  // Check if the register is killed according MachineFunction level liveness
+  // information.
+  switch (R->getRegType()) {
+  case VASTRegister::Data: {
+    unsigned RegNum = R->getDataRegNum();
+    // The registers are not propagate from the slot to its alias slot.
+    if (RegNum && FromAliasSlot) LiveInToSlot = false;
+
+    const MachineInstr *DefMI = PredOut->getDefMI();
+    // Do not add live out if data register R not live in the new BB.
+    if (RegNum && DefMI) {
+      if (DefMI->getOpcode() == VTM::VOpMvPhi && IsDefSlot) {
+        // The register is defined by the VOpMvPhi at FromSlot.
+        // However, the copy maybe disabled when jumping to ToBB.
+        // Then this define is even not live-in ToSlot, we can simply skip the
+        // rest of the code.
+        if (DefMI->getOperand(2).getMBB() != ToBB)
+          return NotLive;
+      }
+
+      // If the FromSlot is bigger than the ToSlot, then we are looping back.
+      bool ToNewBB = FromBB != ToBB || FromSlotNum >= ToSlotNum;
+
+      // The register may be defined at the first slot of current BB, which
+      // slot is alias with the last slot of Current BB's predecessor. In this
+      // case we should not believe the live-ins information of the BB.
+      // And if the register are not defined at the current slot (the last
+      // slot of current BB) then we can trust the live-ins information.
+      bool ShouldTrustBBLI = ToNewBB
+                             && (!IsDefSlot || DefMI->getParent() == FromBB);
+
+      if (ShouldTrustBBLI && !ToBB->isLiveIn(RegNum))
+        LiveOutToSlot = false;
+    }
+    break;
+  }
+  case VASTRegister::Slot:
+    // Ignore the assignment that reset the slot enable register, even the
+    // signal may take more than one cycles to propagation, the shortest path
+    // should be the path that propagating the "1" value of the enable
+    // register.
+    if (R->getSlotNum() == DefSlot->SlotNum && Cycles > 1)
+      LiveOutToSlot = false;
+    break;
+  default: break;
+  }
+
+  if (!LiveInToSlot) return NotLive;
+
+  return LiveOutToSlot ? LiveInAndOut : LiveIn;
+}
+
 bool RtlSSAAnalysis::addLiveIns(SlotInfo *From, SlotInfo *To,
                                 bool FromAliasSlot) {
   bool Changed = false;
   typedef SlotInfo::vascyc_iterator it;
-  // Store the slot numbers in signed integer, we will perform subtraction on
-  // them and may produce negative result.
-  int FromSlotNum = From->getSlot()->SlotNum,
-      ToSlotNum = To->getSlot()->SlotNum;
-  MachineBasicBlock *ToBB = To->getSlot()->getParentBB();
-  MachineBasicBlock *FromBB = From->getSlot()->getParentBB();
-  bool FromLaterAliasSlot = FromAliasSlot && FromSlotNum > ToSlotNum;
 
   for (it I = From->out_begin(), E = From->out_end(); I != E; ++I) {
     ValueAtSlot *PredOut = I->first;
-    VASTRegister *R = PredOut->getValue();
-
-    VASTSlot *DefSlot = PredOut->getSlot();
     ValueAtSlot::LiveInInfo LI = I->second;
 
     bool IsDefSlot = LI.getCycles() == 0;
     // Increase the cycles by 1 after the value lives to next slot.
     LI.incCycles();
 
-    bool LiveInToSlot = !FromLaterAliasSlot || R->isTimingUndef();
-    bool LiveOutToSlot = !To->isVASKilled(PredOut);
-
-    // Check if the register is killed according MachineFunction level liveness
-    // information.
-    switch (R->getRegType()) {
-    case VASTRegister::Data: {
-      unsigned RegNum = R->getDataRegNum();
-      // The registers are not propagate from the slot to its alias slot.
-      if (RegNum && FromAliasSlot) LiveInToSlot = false;
-
-      const MachineInstr *DefMI = PredOut->getDefMI();
-      // Do not add live out if data register R not live in the new BB.
-      if (RegNum && DefMI) {
-        if (DefMI->getOpcode() == VTM::VOpMvPhi && IsDefSlot) {
-          // The register is defined by the VOpMvPhi at FromSlot.
-          // However, the copy maybe disabled when jumping to ToBB.
-          // Then this define is even not live-in ToSlot, we can simply skip the
-          // rest of the code.
-          if (DefMI->getOperand(2).getMBB() != ToBB)
-            continue;
-        }
-
-        // If the FromSlot is bigger than the ToSlot, then we are looping back.
-        bool ToNewBB = FromBB != ToBB || FromSlotNum >= ToSlotNum;
-
-        // The register may be defined at the first slot of current BB, which
-        // slot is alias with the last slot of Current BB's predecessor. In this
-        // case we should not believe the live-ins information of the BB.
-        // And if the register are not defined at the current slot (the last
-        // slot of current BB) then we can trust the live-ins information.
-        bool ShouldTrustBBLI = ToNewBB
-                               && (!IsDefSlot || DefMI->getParent() == FromBB);
-
-        if (ShouldTrustBBLI && !ToBB->isLiveIn(RegNum))
-          LiveOutToSlot = false;
-      }
-      break;
-    }
-    case VASTRegister::Slot:
-      // Ignore the assignment that reset the slot enable register, even the
-      // signal may take more than one cycles to propagation, the shortest path
-      // should be the path that propagating the "1" value of the enable
-      // register.
-      if (R->getSlotNum() == DefSlot->SlotNum && LI.getCycles() > 1)
-        LiveOutToSlot = false;
-      break;
-    default: break;
-    }
+    LiveInKind K = getLiveInKind(PredOut, IsDefSlot, LI.getCycles(),
+                                 From->getSlot(), To->getSlot(), FromAliasSlot,
+                                 To->isVASKilled(PredOut));
 
-    if (!LiveInToSlot) continue;
+    if (K == NotLive) continue;
 
     Changed |= To->insertIn(PredOut, LI);
 
-    if (!LiveOutToSlot) continue;
+    if (K != LiveInAndOut) continue;
 
     Changed |= To->insertOut(PredOut, LI);
   }
@@ -373,6 +414,36 @@ bool RtlSSAAnalysis::addLiveIns(SlotInfo *From, SlotInfo *To,
   return Changed;
 }
 
+bool RtlSSAAnalysis::addDenseLiveIns(SlotInfo *From, SlotInfo *To,
+                                     bool FromAliasSlot) {
+  bool OutChanged = false;
+  const BitVector &FromOut = From->OutBits;
+
+  for (int i = FromOut.find_first(); i >= 0; i = FromOut.find_next(i)) {
+    ValueAtSlot *PredOut = AllVASs[i];
+    unsigned Cycles = From->OutCycles.lookup(i);
+
+    bool IsDefSlot = Cycles == 0;
+    // Increase the cycles by 1 after the value lives to next slot.
+    ++Cycles;
+
+    LiveInKind K = getLiveInKind(PredOut, IsDefSlot, Cycles, From->getSlot(),
+                                 To->getSlot(), FromAliasSlot,
+                                 To->KillBits.test(i));
+
+    if (K == NotLive) continue;
+
+    // The changes of the in set do not affect other slots.
+    To->insertDenseIn(i, Cycles);
+
+    if (K != LiveInAndOut) continue;
+
+    OutChanged |= To->insertDenseOut(i, Cycles);
+  }
+
+  return OutChanged;
+}
+
 bool RtlSSAAnalysis::addLiveInFromAliasSlots(VASTSlot *From, SlotInfo *To) {
   bool Changed = false;
   unsigned FromSlotNum = From->SlotNum;
@@ -393,6 +464,28 @@ bool RtlSSAAnalysis::addLiveInFromAliasSlots(VASTSlot *From, SlotInfo *To) {
 
 void RtlSSAAnalysis::ComputeReachingDefinition() {
   ComputeGenAndKill();
+
+  if (UseMapBasedReachingDef) {
+    ComputeMapBasedReachingDefinition();
+    return;
+  }
+
+  ComputeDenseReachingDefinition();
+
+  if (VerifyDenseReachingDef) {
+    ComputeMapBasedReachingDefinition();
+    verifyDenseReachingDefinition();
+  }
+
+  // The map based In/Out sets are not used anymore.
+  for (slot_vec_it I = SlotVec.begin(), E = SlotVec.end(); I != E; ++I) {
+    SlotInfo *SI = getSlotInfo(*I);
+    SI->SlotIn.clear();
+    SI->SlotOut.clear();
+  }
+}
+
+void RtlSSAAnalysis::ComputeMapBasedReachingDefinition() {
   // TODO: Simplify the data-flow, some slot may neither define new VAS nor
   // kill any VAS.
 
@@ -428,6 +521,174 @@ void RtlSSAAnalysis::ComputeReachingDefinition() {
   } while (Changed);
 }
 
+void RtlSSAAnalysis::ComputeDenseReachingDefinition() {
+  unsigned NumVASs = AllVASs.size(), NumSlots = SlotVec.size();
+
+  // The VASs defined by each register, to build the kill sets.
+  DenseMap<VASTValue*, SmallVector<unsigned, 4> > VASsOfValue;
+  for (unsigned i = 0; i != NumVASs; ++i)
+    VASsOfValue[AllVASs[i]->getValue()].push_back(i);
+
+  DenseMap<const VASTSlot*, unsigned> SlotIdx;
+  std::vector<SlotInfo*> SIs(NumSlots);
+  for (unsigned i = 0; i != NumSlots; ++i) {
+    SlotIdx[SlotVec[i]] = i;
+    SlotInfo *SI = SIs[i] = getSlotInfo(SlotVec[i]);
+
+    // Build the bit-vectors from the gen/kill sets and the initial In/Out
+    // sets computed by ComputeGenAndKill.
+    SI->DenseVASs = AllVASs;
+    SI->GenBits.resize(NumVASs);
+    SI->KillBits.resize(NumVASs);
+    SI->InBits.resize(NumVASs);
+    SI->OutBits.resize(NumVASs);
+
+    typedef SlotInfo::gen_iterator gen_it;
+    for (gen_it I = SI->gen_begin(), E = SI->gen_end(); I != E; ++I)
+      SI->GenBits.set((*I)->getIdx());
+
+    typedef SlotInfo::ValueSet::const_iterator value_it;
+    for (value_it I = SI->OverWrittenValue.begin(),
+         E = SI->OverWrittenValue.end(); I != E; ++I) {
+      const SmallVectorImpl<unsigned> &VASs = VASsOfValue[*I];
+      for (unsigned j = 0, e = VASs.size(); j != e; ++j)
+        SI->KillBits.set(VASs[j]);
+    }
+
+    typedef SlotInfo::vascyc_iterator vascyc_it;
+    for (vascyc_it I = SI->in_begin(), E = SI->in_end(); I != E; ++I)
+      SI->insertDenseIn(I->first->getIdx(), I->second.getCycles());
+
+    for (vascyc_it I = SI->out_begin(), E = SI->out_end(); I != E; ++I) {
+      unsigned Idx = I->first->getIdx();
+      SI->OutBits.set(Idx);
+      if (unsigned Cycles = I->second.getCycles())
+        SI->OutCycles[Idx] = Cycles;
+    }
+  }
+
+  // Build the data-flow edges, the in set of a slot is computed from the out
+  // sets of its predecessors and the alias slots of the predecessors.
+  typedef std::pair<unsigned, bool> SrcTy;
+  std::vector<SmallVector<SrcTy, 4> > Srcs(NumSlots);
+  std::vector<SmallVector<unsigned, 4> > Users(NumSlots);
+  for (unsigned i = 0; i != NumSlots; ++i) {
+    VASTSlot *S = SlotVec[i];
+
+    typedef VASTSlot::pred_it pred_it;
+    for (pred_it PI = S->pred_begin(), PE = S->pred_end(); PI != PE; ++PI) {
+      VASTSlot *PredSlot = *PI;
+
+      // No need to update the out set of Slot 0 according its incoming value.
+      // It is the first slot of the FSM.
+      if (S->SlotNum == 0 && PredSlot->SlotNum != 0) continue;
+
+      unsigned PredIdx = SlotIdx.lookup(PredSlot);
+      Srcs[i].push_back(SrcTy(PredIdx, false));
+      Users[PredIdx].push_back(i);
+
+      if (PredSlot->getParentBB() != S->getParentBB() ||
+          !PredSlot->hasAliasSlot())
+        continue;
+
+      for (unsigned j = PredSlot->alias_start(), e = PredSlot->alias_end(),
+           ii = PredSlot->alias_ii(); j < e; j += ii) {
+        if (j == PredSlot->SlotNum) continue;
+
+        unsigned AliasIdx = SlotIdx.lookup(VM->getSlot(j));
+        Srcs[i].push_back(SrcTy(AliasIdx, true));
+        Users[AliasIdx].push_back(i);
+      }
+    }
+  }
+
+  // Compute the reverse post-order of the slots, starting from the first slot
+  // of the FSM.
+  std::vector<unsigned> RPO;
+  RPO.reserve(NumSlots);
+  BitVector Visited(NumSlots);
+  SmallVector<std::pair<unsigned, unsigned>, 32> VisitStack;
+  for (unsigned Root = 0; Root != NumSlots; ++Root) {
+    if (Visited.test(Root)) continue;
+
+    Visited.set(Root);
+    VisitStack.push_back(std::make_pair(Root, 0u));
+    while (!VisitStack.empty()) {
+      unsigned Node = VisitStack.back().first;
+      unsigned &NextUser = VisitStack.back().second;
+
+      if (NextUser == Users[Node].size()) {
+        RPO.push_back(Node);
+        VisitStack.pop_back();
+        continue;
+      }
+
+      unsigned User = Users[Node][NextUser++];
+      if (Visited.test(User)) continue;
+
+      Visited.set(User);
+      VisitStack.push_back(std::make_pair(User, 0u));
+    }
+  }
+  std::reverse(RPO.begin(), RPO.end());
+
+  std::vector<unsigned> RPONum(NumSlots);
+  for (unsigned i = 0; i != NumSlots; ++i)
+    RPONum[RPO[i]] = i;
+
+  // Visit the slots in reverse post-order, and only revisit the slots whose
+  // sources changed.
+  BitVector Worklist(NumSlots, true);
+  while (Worklist.any()) {
+    for (int i = Worklist.find_first(); i >= 0; i = Worklist.find_next(i)) {
+      Worklist.reset(i);
+      unsigned CurIdx = RPO[i];
+      SlotInfo *CurSI = SIs[CurIdx];
+
+      bool OutChanged = false;
+      const SmallVectorImpl<SrcTy> &CurSrcs = Srcs[CurIdx];
+      for (unsigned j = 0, e = CurSrcs.size(); j != e; ++j)
+        OutChanged |= addDenseLiveIns(SIs[CurSrcs[j].first], CurSI,
+                                      CurSrcs[j].second);
+
+      if (!OutChanged) continue;
+
+      const SmallVectorImpl<unsigned> &CurUsers = Users[CurIdx];
+      for (unsigned j = 0, e = CurUsers.size(); j != e; ++j)
+        Worklist.set(RPONum[CurUsers[j]]);
+    }
+  }
+}
+
+void RtlSSAAnalysis::verifyDenseReachingDefinition() const {
+  typedef SlotInfoTy::const_iterator it;
+  for (it I = SlotInfos.begin(), E = SlotInfos.end(); I != E; ++I) {
+    const SlotInfo *SI = I->second;
+
+    bool Broken = SI->InBits.count() != SI->SlotIn.size()
+                  || SI->OutBits.count() != SI->SlotOut.size();
+
+    typedef SlotInfo::vascyc_iterator vascyc_it;
+    for (vascyc_it VI = SI->in_begin(), VE = SI->in_end(); VI != VE; ++VI) {
+      unsigned Idx = VI->first->getIdx();
+      Broken |= !SI->InBits.test(Idx)
+                || SI->InCycles.lookup(Idx) != VI->second.getCycles();
+    }
+
+    for (vascyc_it VI = SI->out_begin(), VE = SI->out_end(); VI != VE; ++VI) {
+      unsigned Idx = VI->first->getIdx();
+      Broken |= !SI->OutBits.test(Idx)
+                || SI->OutCycles.lookup(Idx) != VI->second.getCycles();
+    }
+
+    if (Broken) {
+      DEBUG(dbgs() << "Dense reaching definition mismatch at: ";
+            SI->dump(););
+      llvm_unreachable("Broken dense reaching definition!");
+    }
+  }
+}
+
 void RtlSSAAnalysis::ComputeGenAndKill() {
   // Collect the generated statements to the SlotGenMap.
   for (vas_iterator I = vas_begin(), E = vas_end(); I != E; ++I) {
@@ -17,6 +17,7 @@
 #include "vtm/Utilities.h"
 
 #include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/GraphTraits.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Support/Allocator.h"
@@ -44,6 +45,8 @@ class ValueAtSlot {
   VASTRegister *const V;
   VASTSlot *const Slot;
   const MachineInstr *const DefMI;
+  // The number of the VAS in the bit-vectors of the reaching definition.
+  const unsigned Idx;
 
   // Vector for the dependent ValueAtSlots which is a Predecessor VAS.
   typedef DenseMap<ValueAtSlot*, LiveInInfo> VASCycMapTy;
@@ -65,8 +68,9 @@ class ValueAtSlot {
       Info = NewLI;
   }
 
-  ValueAtSlot(VASTRegister *v, VASTSlot *slot, const MachineInstr *MI)
-    : V(v), Slot(slot), DefMI(MI) {}
+  ValueAtSlot(VASTRegister *v, VASTSlot *slot, const MachineInstr *MI,
+              unsigned Idx)
+    : V(v), Slot(slot), DefMI(MI), Idx(Idx) {}
   ValueAtSlot(const ValueAtSlot&); // Do not implement.
 
   LiveInInfo getDepInfo(ValueAtSlot *VAS) const {
@@ -80,6 +84,7 @@ public:
   VASTRegister *getValue() const { return V; }
   VASTSlot *getSlot() const { return Slot; }
   const MachineInstr *getDefMI() const { return DefMI; }
+  unsigned getIdx() const { return Idx; }
 
   std::string getName() const;
 
@@ -124,6 +129,16 @@ class SlotInfo {
   VASCycMapTy SlotIn;
   VASCycMapTy SlotOut;
 
+  // The same sets in bit-vectors indexed by the number of the VAS, which are
+  // used by the dense reaching definition engine.
+  BitVector GenBits, KillBits, InBits, OutBits;
+  // The cycles from the define slot of the VASs in the In/Out set, the VASs
+  // defined at this slot have a distance of 0 and are not recorded.
+  typedef DenseMap<unsigned, unsigned> CycleMapTy;
+  CycleMapTy InCycles, OutCycles;
+  // All VASs, indexed by their number, if the dense sets are used.
+  ArrayRef<ValueAtSlot*> DenseVASs;
+
   typedef VASSetTy::iterator gen_iterator;
   // get the iterator of the defining map of reaching definition.
   gen_iterator gen_begin() const { return SlotGen.begin(); }
@@ -148,7 +163,23 @@ class SlotInfo {
     return false;
   }
 
+  static bool updateLiveIn(unsigned Idx, unsigned NewCycles, BitVector &Bits,
+                           CycleMapTy &Cycles) {
+    assert(NewCycles && "It takes at least a cycle to live in!");
+    unsigned &C = Cycles[Idx];
+
+    if (C == 0 || C > NewCycles) {
+      C = NewCycles;
+      Bits.set(Idx);
+      return true;
+    }
+
+    return false;
+  }
+
   ValueAtSlot::LiveInInfo getLiveIn(ValueAtSlot *VAS) const {
+    if (isDense()) return InCycles.lookup(VAS->getIdx());
+
     vascyc_iterator at = SlotIn.find(VAS);
     return at == SlotIn.end() ? ValueAtSlot::LiveInInfo() : at->second;
   }
@@ -175,6 +206,16 @@ class SlotInfo {
     return updateLiveIn(VAS, NewLI, SlotOut);
   }
 
+  bool insertDenseIn(unsigned Idx, unsigned Cycles) {
+    return updateLiveIn(Idx, Cycles, InBits, InCycles);
+  }
+
+  bool insertDenseOut(unsigned Idx, unsigned Cycles) {
+    return updateLiveIn(Idx, Cycles, OutBits, OutCycles);
+  }
+
+  bool isDense() const { return !DenseVASs.empty(); }
+
   friend class RtlSSAAnalysis;
 public:
   SlotInfo(const VASTSlot *s) : S(s) {}
@@ -218,6 +259,8 @@ public:
 private:
   SlotInfoTy SlotInfos;
   SlotVecTy SlotVec;
+  // All VASs, indexed by their number.
+  std::vector<ValueAtSlot*> AllVASs;
 
   typedef DenseMap<std::pair<VASTValue*, VASTSlot*>, ValueAtSlot*> VASMapTy;
   VASMapTy UniqueVASs;
@@ -289,12 +332,21 @@ public:
 
   bool addLiveIns(SlotInfo *From, SlotInfo *To, bool FromAliasSlot);
   bool addLiveInFromAliasSlots(VASTSlot *From, SlotInfo *To);
+  // Add the live-ins to the dense sets of To, return true if the out set of
+  // To changed.
+  bool addDenseLiveIns(SlotInfo *From, SlotInfo *To, bool FromAliasSlot);
 
   // Using the reaching definition algorithm to sort out the ultimate
   // relationship of registers.
-  // Dirty hack: maybe there are two same statements is a slot, and we can use
-  // bit vector to implement the algorithm similar to the compiler principle.
   void ComputeReachingDefinition();
+  // Iterate over all slots with the map based In/Out sets until nothing
+  // changes.
+  void ComputeMapBasedReachingDefinition();
+  // Number the VASs and solve the data-flow with bit-vectors, only visit the
+  // slots whose predecessors changed, in reverse post-order.
+  void ComputeDenseReachingDefinition();
+  // Check the dense sets against the map based ones.
+  void verifyDenseReachingDefinition() const;
 
   // collect the Generated and Killed statements of the slot.
   void ComputeGenAndKill();
@@ -305,6 +357,10 @@ public:
 
   void releaseMemory() {
     UniqueVASs.clear();
+    AllVASs.clear();
+    // The SlotInfos are allocated by the allocator, destroy them explicitly.
+    for (slotinfo_it I = SlotInfos.begin(), E = SlotInfos.end(); I != E; ++I)
+      I->second->~SlotInfo();
     Allocator.Reset();
     SlotVec.clear();
     SlotInfos.clear();
@@ -794,14 +794,96 @@ VASTValPtr VASTExprBuilder::buildMulExpr(ArrayRef<VASTValPtr> Ops,
     return padLowerBits(NewMult, BitWidth, false);
   }
 
+  // Try to replace the multiplication by constant by the addition of its
+  // partial products.
+  if (NewOps.size() == 2) {
+    VASTValPtr V = NewOps[0], ImmOp = NewOps[1];
+    if (!isa<VASTImmediate>(ImmOp.get())) std::swap(V, ImmOp);
+
+    if (VASTImmPtr Imm = dyn_cast<VASTImmPtr>(ImmOp))
+      if (VASTValPtr PartialProductSum = expandConstantMult(V, Imm.getAPInt(),
+                                                            BitWidth))
+        return PartialProductSum;
+  }
+
   return getOrCreateCommutativeExpr(VASTExpr::dpMul, NewOps, BitWidth);
 }
 
+VASTValPtr VASTExprBuilder::expandConstantMult(VASTValPtr V, const APInt &Imm,
+                                               unsigned BitWidth) {
+  unsigned MaxPartialProducts = Context.getMaxPartialProductsToExpand();
+  if (MaxPartialProducts == 0 || BitWidth < 2) return 0;
+
+  // Recode the constant to canonical signed digits, i.e. replace the run of
+  // ones like 0111 by 1000 - 0001, to reduce the number of partial products.
+  // The digits are represented by the position of the non-zero digits, and
+  // whether they are -1.
+  SmallVector<std::pair<unsigned, bool>, 8> Digits;
+  APInt C = Imm.zextOrTrunc(BitWidth);
+  for (unsigned i = 0; i < BitWidth && C.getBoolValue(); ++i, C = C.lshr(1)) {
+    if (!C[0]) continue;
+
+    bool IsNegative = C[1];
+    Digits.push_back(std::make_pair(i, IsNegative));
+    if (Digits.size() > MaxPartialProducts) return 0;
+
+    if (IsNegative) ++C;
+    else            --C;
+  }
+
+  SmallVector<VASTValPtr, 8> PartialProducts;
+  APInt Correction = APInt::getNullValue(BitWidth);
+  for (unsigned i = 0, e = Digits.size(); i != e; ++i) {
+    unsigned Shift = Digits[i].first;
+    unsigned ProductSize = BitWidth - Shift;
+    VASTValPtr Product = V;
+    if (Product->getBitWidth() > ProductSize)
+      Product = buildBitSliceExpr(Product, ProductSize, 0);
+
+    // -(V << Shift) = (~V + 1) << Shift, the 1s are added by the correction
+    // constant.
+    if (Digits[i].second) {
+      Product = buildNotExpr(buildZExtExprOrSelf(Product, ProductSize));
+      Correction += APInt::getOneBitSet(BitWidth, Shift);
+    }
+
+    if (Shift)
+      Product = padLowerBits(Product, Product->getBitWidth() + Shift, false);
+
+    PartialProducts.push_back(Product);
+  }
+
+  if (Correction.getBoolValue())
+    PartialProducts.push_back(getOrCreateImmediate(Correction));
+
+  return buildAddExpr(PartialProducts, BitWidth);
+}
+
+void
+VASTExprBuilder::collectAddendsToCompress(VASTValPtr V, unsigned ResultSize,
+                                          SmallVectorImpl<VASTValPtr> &Ops) {
+  VASTExpr *Expr = Context.getAddExprToCompress(V, ResultSize);
+  if (Expr == 0) {
+    Ops.push_back(V);
+    return;
+  }
+
+  typedef const VASTUse *op_iterator;
+  for (op_iterator I = Expr->op_begin(), E = Expr->op_end(); I != E; ++I)
+    collectAddendsToCompress(I->getAsInlineOperand(), ResultSize, Ops);
+}
+
 VASTValPtr VASTExprBuilder::buildAddExpr(ArrayRef<VASTValPtr> Ops,
                                          unsigned BitWidth) {
+  // Merge the addends of the additions that only used by this addition, they
+  // are summed by the same compressor tree.
+  SmallVector<VASTValPtr, 8> Addends;
+  for (unsigned i = 0; i < Ops.size(); ++i)
+    collectAddendsToCompress(Ops[i], BitWidth, Addends);
+
   SmallVector<VASTValPtr, 8> NewOps;
   VASTExprOpInfo<VASTExpr::dpAdd> OpInfo(*this, BitWidth);
-  flattenExpr<VASTExpr::dpAdd>(Ops.begin(), Ops.end(),
+  flattenExpr<VASTExpr::dpAdd>(Addends.begin(), Addends.end(),
                                op_filler<VASTExpr::dpAdd>(NewOps, OpInfo));
 
   // Add the immediate value back to the operand list.
@@ -902,6 +984,68 @@ VASTValPtr VASTExprBuilder::buildAddExpr(ArrayRef<VASTValPtr> Ops,
   return Context.createExpr(VASTExpr::dpAdd, NewOps, BitWidth, 0);
 }
 
+void VASTExprBuilder::buildCarrySaveAdd(VASTValPtr A, VASTValPtr B,
+                                        VASTValPtr C, unsigned BitWidth,
+                                        SmallVectorImpl<VASTValPtr> &Rows) {
+  unsigned RowSize = std::max(A->getBitWidth(),
+                              std::max(B->getBitWidth(), C->getBitWidth()));
+  A = buildZExtExprOrSelf(A, RowSize);
+  B = buildZExtExprOrSelf(B, RowSize);
+  C = buildZExtExprOrSelf(C, RowSize);
+
+  // The sum bits: A ^ B ^ C.
+  VASTValPtr SumOps[] = { buildXor(A, B, RowSize, this), C };
+  Rows.push_back(buildXorExpr(SumOps, RowSize));
+
+  // The carry bits: the majority of A, B and C, which have the weight of the
+  // next bit.
+  unsigned CarrySize = std::min(RowSize + 1, BitWidth);
+  if (CarrySize < 2) return;
+
+  VASTValPtr MajorityOps[] = { buildAndExpr(A, B, RowSize),
+                               buildAndExpr(A, C, RowSize),
+                               buildAndExpr(B, C, RowSize) };
+  VASTValPtr Carry = buildOrExpr(MajorityOps, RowSize);
+  Carry = buildBitSliceExpr(Carry, CarrySize - 1, 0);
+  Rows.push_back(padLowerBits(Carry, CarrySize, false));
+}
+
+VASTValPtr VASTExprBuilder::buildCompressorTree(ArrayRef<VASTValPtr> Ops,
+                                                unsigned BitWidth) {
+  SmallVector<VASTValPtr, 8> Rows(Ops.begin(), Ops.end());
+  std::sort(Rows.begin(), Rows.end(), VASTExprOpInfo<VASTExpr::dpAdd>::sort);
+
+  // Leave the carry bit to the carry-propagate adder at the end.
+  VASTValPtr CarryIn;
+  if (Rows.back()->getBitWidth() == 1) CarryIn = Rows.pop_back_val();
+
+  while (Rows.size() > 2) {
+    // Reduce the number of rows to the biggest number in Dadda's sequence
+    // (2, 3, 4, 6, 9, 13, 19 ...) that is smaller than the current number of
+    // rows, each 3:2 compressor reduces the number of rows by 1. Doing so
+    // needs the same number of levels as the Wallace tree, but fewer
+    // compressors.
+    unsigned TargetRows = 2;
+    while (TargetRows + TargetRows / 2 < Rows.size())
+      TargetRows += TargetRows / 2;
+
+    // Compress the narrowest rows, the rows are sorted by their bitwidth.
+    unsigned NumCompressedRows = 3 * (Rows.size() - TargetRows);
+    SmallVector<VASTValPtr, 8> NewRows(Rows.begin(),
+                                       Rows.end() - NumCompressedRows);
+    for (unsigned i = Rows.size() - NumCompressedRows; i < Rows.size(); i += 3)
+      buildCarrySaveAdd(Rows[i], Rows[i + 1], Rows[i + 2], BitWidth, NewRows);
+
+    std::sort(NewRows.begin(), NewRows.end(),
+              VASTExprOpInfo<VASTExpr::dpAdd>::sort);
+    Rows.swap(NewRows);
+  }
+
+  if (CarryIn) Rows.push_back(CarryIn);
+
+  return buildAddExpr(Rows, BitWidth);
+}
+
 VASTValPtr VASTExprBuilder::buildOrExpr(ArrayRef<VASTValPtr> Ops,
                                         unsigned BitWidth) {
   if (Ops.size() == 1) return Ops[0];
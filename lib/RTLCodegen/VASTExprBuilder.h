@@ -73,6 +73,17 @@ public:
     return Expr;
   }
 
+  // If V is an addition whose addends can be summed by the same compressor
+  // tree as the addition that using its result, return the expression, or
+  // return null otherwise.
+  virtual VASTExpr *getAddExprToCompress(VASTValPtr V, unsigned ResultSize) {
+    return 0;
+  }
+
+  // Return the maximal number of partial products that a multiplication by
+  // constant is expanded to, 0 if the multiplication should not be expanded.
+  virtual unsigned getMaxPartialProductsToExpand() const { return 0; }
+
   VASTImmediate *getOrCreateImmediate(uint64_t Value, int8_t BitWidth) {
     return getOrCreateImmediate(APInt(BitWidth, Value));
   }
@@ -105,6 +116,13 @@ class VASTExprBuilder {
   template<VASTExpr::Opcode Opcode, typename iterator, typename visitor>
   void flattenExpr(iterator begin, iterator end, visitor F);
 
+  void collectAddendsToCompress(VASTValPtr V, unsigned ResultSize,
+                                SmallVectorImpl<VASTValPtr> &Ops);
+  VASTValPtr expandConstantMult(VASTValPtr V, const APInt &Imm,
+                                unsigned BitWidth);
+  void buildCarrySaveAdd(VASTValPtr A, VASTValPtr B, VASTValPtr C,
+                         unsigned BitWidth, SmallVectorImpl<VASTValPtr> &Rows);
+
   static bool isAllZeros(VASTValPtr V) {
     if (VASTImmPtr Imm = dyn_cast<VASTImmPtr>(V))
       return Imm->isAllZeros();
@@ -249,6 +267,9 @@ public:
                           unsigned BitWidth);
   VASTValPtr buildMulExpr(ArrayRef<VASTValPtr> Ops, unsigned BitWidth);
   VASTValPtr buildAddExpr(ArrayRef<VASTValPtr> Ops, unsigned BitWidth);
+  // Sum the operands of a multi-operand addition by a carry-save compressor
+  // tree, with only one carry-propagate adder at the end.
+  VASTValPtr buildCompressorTree(ArrayRef<VASTValPtr> Ops, unsigned BitWidth);
   VASTValPtr buildShiftExpr(VASTExpr::Opcode Opc, VASTValPtr LHS, VASTValPtr RHS,
                             unsigned BitWidth);
   VASTValPtr buildReduction(VASTExpr::Opcode Opc, VASTValPtr Op);
@@ -35,6 +35,7 @@
 #include "llvm/CodeGen/MachineModuleInfo.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/Statistic.h"
@@ -50,6 +51,7 @@
 
 using namespace llvm;
 STATISTIC(SlotsByPassed, "Number of slots are bypassed");
+STATISTIC(NumSlots, "Number of slots in the generated state machines");
 
 namespace {
 struct MemBusBuilder {
@@ -200,7 +202,8 @@ class VerilogASTBuilder : public MachineFunctionPass,
   MachineRegisterInfo *MRI;
   VASTModule *VM;
   OwningPtr<DatapathBuilder> Builder;
-  MemBusBuilder *MBBuilder;
+  // One builder per memory bus.
+  SmallVector<MemBusBuilder*, 2> MBBuilders;
   StringSet<> EmittedSubModules;
 
   bool isSubModuleEmitted(StringRef Name) {
@@ -358,6 +361,7 @@ class VerilogASTBuilder : public MachineFunctionPass,
   void emitAllSignals();
   VASTValPtr emitFUAdd(unsigned FUNum, unsigned BitWidth);
   VASTValPtr emitFUMult(unsigned FUNum, unsigned BitWidth, bool HasHi);
+  VASTValPtr emitFUDiv(unsigned FUNum, unsigned BitWidth);
   VASTValPtr emitFUShift(unsigned FUNum, unsigned BitWidth,
                          VASTExpr::Opcode Opc);
   VASTValPtr emitFUCmp(unsigned FUNum, unsigned BitWidth, bool isSigned);
@@ -382,6 +386,7 @@ class VerilogASTBuilder : public MachineFunctionPass,
   void emitOpAdd(MachineInstr *MI, VASTSlot *Slot, VASTValueVecTy &Cnds);
   void emitBinaryFUOp(MachineInstr *MI, VASTSlot *Slot, VASTValueVecTy &Cnds);
   void emitSignedCmpOp(MachineInstr *MI, VASTSlot *Slot, VASTValueVecTy &Cnds);
+  void emitOpDiv(MachineInstr *MI, VASTSlot *Slot, VASTValueVecTy &Cnds);
 
   VASTValPtr getAsOperand(MachineOperand &Op, bool GetAsInlineOperand = true);
 
@@ -440,6 +445,7 @@ public:
     EmittedSubModules.clear();
     Idx2Reg.clear();
     ExprLHS.clear();
+    DeleteContainerPointers(MBBuilders);
   }
 
   bool runOnMachineFunction(MachineFunction &MF);
@@ -484,6 +490,7 @@ bool VerilogASTBuilder::runOnMachineFunction(MachineFunction &F) {
   VerilogModuleAnalysis &VMA = getAnalysis<VerilogModuleAnalysis>();
   VM = VMA.createModule(FInfo->getInfo().getModName(), Builder.get());
   VM->allocaSlots(FInfo->getTotalSlots());
+  NumSlots += FInfo->getTotalSlots();
 
   emitFunctionSignature(F.getFunction());
 
@@ -491,8 +498,8 @@ bool VerilogASTBuilder::runOnMachineFunction(MachineFunction &F) {
   // memory bus implicitly. We should add these ports after function
   // "emitFunctionSignature" is called, which add some other ports that need to
   // be added before input/output ports of memory bus.
-  MemBusBuilder MBB(VM, *Builder, 0);
-  MBBuilder = &MBB;
+  for (unsigned i = 0, e = getFUDesc<VFUMemBus>()->getNumBuses(); i != e; ++i)
+    MBBuilders.push_back(new MemBusBuilder(VM, *Builder, i));
 
   // Emit all function units then emit all register/wires because function units
   // may alias with registers.
@@ -506,8 +513,9 @@ bool VerilogASTBuilder::runOnMachineFunction(MachineFunction &F) {
   for (iterator I = F.begin(), E = F.end(); I != E; ++I)
     emitBasicBlock(*I);
 
-  // Build the mux for memory bus.
-  MBBuilder->buildMemBusMux();
+  // Build the mux for memory buses.
+  for (unsigned i = 0, e = MBBuilders.size(); i != e; ++i)
+    MBBuilders[i]->buildMemBusMux();
 
   // Building the Slot active signals.
   VM->buildSlotLogic(*Builder);
@@ -654,6 +662,10 @@ void VerilogASTBuilder::addSlotReady(MachineInstr *MI, VASTSlot *Slot) {
 
   switch (Id.getFUType()) {
   case VFUs::MemoryBus:
+    // The result of the pipelined memory bus is always ready after its
+    // latency.
+    if (getFUDesc<VFUMemBus>()->isPipelined()) return;
+
     ReadyPort = VM->getSymbol(VFUMemBus::getReadyName(Id.getFUNum()));
     break;
   case VFUs::CalleeFN: {
@@ -721,6 +733,8 @@ void VerilogASTBuilder::emitAllocatedFUs() {
                                         DataWidth, InitVal, VASTRegister::Data,
                                         BramNum);
       indexVASTRegister(BramNum, R);
+      // Both ports access the same register.
+      if (Info.PortBRegNum) indexVASTRegister(Info.PortBRegNum, R);
       continue;
     }
 
@@ -732,6 +746,17 @@ void VerilogASTBuilder::emitAllocatedFUs() {
     BRAMArray->Pin();
     indexVASTRegister(BramNum, BRAMArray);
 
+    // The second port has its own address, data and output registers, but it
+    // accesses the array of the first port.
+    if (unsigned PortBNum = Info.PortBRegNum) {
+      std::string PortBOut = VFUBRAM::getOutDataBusName(PortBNum);
+      VASTRegister *PortB = VM->addRegister(PortBOut, DataWidth, NumElem,
+                                            VASTRegister::BRAM, BramNum);
+      PortB->Pin();
+      indexVASTRegister(PortBNum, PortB);
+      S << "reg  [" << (DataWidth - 1) << ":0]  " << PortBOut << ";\n";
+    }
+
     // Set the initialize file's name if there is any.
     if (Initializer)
       InitFilePath = VBEMangle(Initializer->getName()) + "_init.txt";
@@ -757,7 +782,8 @@ void VerilogASTBuilder::emitSubModule(StringRef CalleeName, unsigned FNNum) {
     if (!Callee->isDeclaration()) {
       S << getSynSetting(Callee->getName())->getModName() << ' '
         << CalleeName << "_inst" << "(\n\t";
-      MBBuilder->addSubModule(getSubModulePortName(FNNum, "_inst"), S);
+      for (unsigned i = 0, e = MBBuilders.size(); i != e; ++i)
+        MBBuilders[i]->addSubModule(getSubModulePortName(FNNum, "_inst"), S);
       emitFunctionSignature(Callee);
       S << ");\n";
       return;
@@ -837,6 +863,36 @@ VASTValPtr VerilogASTBuilder::emitFUMult(unsigned FUNum, unsigned BitWidth, bool
                     Builder->buildExpr(VASTExpr::dpMul, LHS, RHS, BitWidth));
 }
 
+VASTValPtr VerilogASTBuilder::emitFUDiv(unsigned FUNum, unsigned BitWidth) {
+  VFUDiv *Div = getFUDesc<VFUDiv>();
+  std::string ResultName = VFUDiv::getResultName(FUNum);
+  VASTWire *Result = VM->addWire(ResultName, BitWidth);
+
+  VASTValPtr Ops[] = {
+    VM->addOpRegister(ResultName + "_a", BitWidth, FUNum),
+    VM->addOpRegister(ResultName + "_b", BitWidth, FUNum),
+    VM->addOpRegister(ResultName + "_m", VFUDiv::ModeWidth, FUNum),
+    // The divider start a new division when the toggle register flips, so
+    // we do not need to disable the divider after the division is issued.
+    VM->addOpRegister(ResultName + "_t", 1, FUNum)
+  };
+
+  // The divider is instantiated from the shang_div module, the result wire
+  // is driven by the instance, which takes several cycles to compute the
+  // result.
+  raw_ostream &S = VM->getDataPathBuffer();
+  S << "shang_div #(.WIDTH(" << BitWidth << "), .RADIX_LOG2("
+    << Div->getBitsPerCycle() << "), .PIPELINED("
+    << (Div->isPipelined() ? 1 : 0) << ")) " << ResultName << "_inst(\n\t"
+    << ".clk(" << VM->getPortName(VASTModule::Clk) << "),\n\t"
+    << ".t(" << ResultName << "_t), .mode(" << ResultName << "_m),\n\t"
+    << ".a(" << ResultName << "_a), .b(" << ResultName << "_b),\n\t"
+    << ".q(" << ResultName << "));\n";
+
+  VASTValPtr Expr = Builder->buildExpr(VASTExpr::dpBlackBox, Ops, BitWidth);
+  return VM->assignWithExtraDelay(Result, Expr, Div->getLatency(BitWidth));
+}
+
 VASTValPtr VerilogASTBuilder::emitFUShift(unsigned FUNum, unsigned BitWidth,
                                           VASTExpr::Opcode Opc) {
   std::string ResultName = "shift" + utostr_32(FUNum) + "o";
@@ -898,6 +954,9 @@ void VerilogASTBuilder::emitAllSignals() {
     case VTM::RMULLHRegClassID:
       indexVASTRegister(RegNum, emitFUMult(RegNum, Info.getBitWidth(), true));
       break;
+    case VTM::RDIVRegClassID:
+      indexVASTRegister(RegNum, emitFUDiv(RegNum, Info.getBitWidth()));
+      break;
     case VTM::RASRRegClassID: {
       VASTValPtr V = emitFUShift(RegNum, Info.getBitWidth(), VASTExpr::dpSRA);
       indexVASTRegister(RegNum, V);
@@ -916,7 +975,8 @@ void VerilogASTBuilder::emitAllSignals() {
     case VTM::RINFRegClassID: {
       // FIXME: Do not use such magic number!
       // The offset of data input port is 3
-      unsigned DataInIdx = VM->getFUPortOf(FuncUnitId(VFUs::MemoryBus, 0)) + 3;
+      FuncUnitId ID(VFUs::MemoryBus, FInfo->getMemBusOfReg(RegNum));
+      unsigned DataInIdx = VM->getFUPortOf(ID) + 3;
       VASTValue *V = VM->getPort(DataInIdx);
       indexVASTRegister(RegNum, V);
       break;
@@ -977,6 +1037,7 @@ void VerilogASTBuilder::emitCtrlOp(MachineBasicBlock::instr_iterator ctrl_begin,
     case VTM::VOpSHL:
     case VTM::VOpSRL:
     case VTM::VOpSRA:           emitBinaryFUOp(MI, CurSlot, Cnds);        break;
+    case VTM::VOpDiv:           emitOpDiv(MI, CurSlot, Cnds);             break;
     case VTM::VOpReadFU:        emitOpReadFU(MI, CurSlot, Cnds);          break;
     case VTM::VOpDisableFU:     emitOpDisableFU(MI, CurSlot, Cnds);       break;
     case VTM::VOpInternalCall:  emitOpInternalCall(MI, CurSlot, Cnds);    break;
@@ -1035,6 +1096,7 @@ bool VerilogASTBuilder::emitFirstCtrlBundle(MachineBasicBlock *DstBB,
     case VTM::VOpSHL:
     case VTM::VOpSRL:
     case VTM::VOpSRA:           emitBinaryFUOp(MI, Slot, Cnds);        break;
+    case VTM::VOpDiv:           emitOpDiv(MI, Slot, Cnds);             break;
     default:  llvm_unreachable("Unexpected opcode!");         break;
     }
     Cnds.pop_back();
@@ -1148,6 +1210,34 @@ void VerilogASTBuilder::emitSignedCmpOp(MachineInstr *MI, VASTSlot *Slot,
   VM->addAssignment(R, Src, Slot, Cnds, MI);
 }
 
+void VerilogASTBuilder::emitOpDiv(MachineInstr *MI, VASTSlot *Slot,
+                                  VASTValueVecTy &Cnds) {
+  VASTWirePtr Result = getAsLValue<VASTWire>(MI->getOperand(0));
+  assert(Result && "FU result port replaced?");
+  VASTExprPtr Div = Result->getExpr();
+
+  unsigned Mode = MI->getOperand(3).getImm();
+  bool IsSigned = Mode & VFUDiv::Signed;
+
+  for (unsigned i = 0; i < 2; ++i) {
+    VASTRegister *R = cast<VASTRegister>(Div->getOperand(i));
+    // Make sure every bit of the operand register is updated in the
+    // assignment by extending the source value.
+    VASTValPtr Src = getAsOperand(MI->getOperand(i + 1));
+    Src = IsSigned ? Builder->buildSExtExprOrSelf(Src, R->getBitWidth())
+                   : Builder->buildZExtExprOrSelf(Src, R->getBitWidth());
+    VM->addAssignment(R, Src, Slot, Cnds, MI);
+  }
+
+  VASTRegister *R = cast<VASTRegister>(Div->getOperand(2));
+  VM->addAssignment(R, VM->getOrCreateImmediate(Mode, VFUDiv::ModeWidth),
+                    Slot, Cnds, MI);
+
+  // Flip the toggle register to start the division.
+  R = cast<VASTRegister>(Div->getOperand(3));
+  VM->addAssignment(R, Builder->buildNotExpr(R), Slot, Cnds, MI);
+}
+
 void VerilogASTBuilder::emitOpReadFU(MachineInstr *MI, VASTSlot *Slot,
                                      VASTValueVecTy &Cnds) {
   // The dst operand of ReadFU change to immediate if it is dead.
@@ -41,12 +41,14 @@ namespace {
   class VerilogASTWriter : public MachineFunctionPass {
     vlang_raw_ostream Out;
     TargetData *TD;
+    // Write the global code in doInitialization?
+    bool WriteGlobalCode;
 
   public:
     /// @name FunctionPass interface
     //{
     static char ID;
-    VerilogASTWriter(raw_ostream &O);
+    VerilogASTWriter(raw_ostream &O, bool WriteGlobalCode);
     VerilogASTWriter() : MachineFunctionPass(ID) {
       assert( 0 && "Cannot construct the class without the raw_stream!");
     }
@@ -69,8 +71,8 @@ namespace {
 //===----------------------------------------------------------------------===//
 char VerilogASTWriter::ID = 0;
 
-Pass *llvm::createVerilogASTWriterPass(raw_ostream &O) {
-  return new VerilogASTWriter(O);
+Pass *llvm::createVerilogASTWriterPass(raw_ostream &O, bool WriteGlobalCode) {
+  return new VerilogASTWriter(O, WriteGlobalCode);
 }
 
 INITIALIZE_PASS_BEGIN(VerilogASTWriter, "vtm-rtl-info",
@@ -81,13 +83,15 @@ INITIALIZE_PASS_END(VerilogASTWriter, "vtm-rtl-info",
                     "Build RTL Verilog module for synthesised function.",
                     false, true)
 
-VerilogASTWriter::VerilogASTWriter(raw_ostream &O)
-                : MachineFunctionPass(ID), Out(O) {
+VerilogASTWriter::VerilogASTWriter(raw_ostream &O, bool WriteGlobalCode)
+  : MachineFunctionPass(ID), Out(O), TD(0), WriteGlobalCode(WriteGlobalCode) {
   initializeVerilogASTWriterPass(*PassRegistry::getPassRegistry());
 }
 
 bool VerilogASTWriter::doInitialization(Module &Mod) {
   TD = getAnalysisIfAvailable<TargetData>();
+  if (!WriteGlobalCode) return false;
+
   SMDiagnostic Err;
   const char *GlobalScriptPath[] = { "Misc", "RTLGlobalScript" };
   std::string GlobalScript = getStrValueFromEngine(GlobalScriptPath);
@@ -121,7 +125,7 @@ bool VerilogASTWriter::runOnMachineFunction(MachineFunction &F) {
   Out << "\n\n";
   // Datapath
   Out << "// Datapath\n";
-  Out << VM->getDataPathStr();
+  VM->printDataPathBuffer(Out);
   VM->printDatapath(Out);
 
   // Sequential logic of the registers.
@@ -133,7 +137,7 @@ bool VerilogASTWriter::runOnMachineFunction(MachineFunction &F) {
 
   Out.else_begin();
 
-  Out << VM->getControlBlockStr();
+  VM->printControlBlock(Out);
 
   Out.always_ff_end();
 
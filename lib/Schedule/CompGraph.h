@@ -20,9 +20,12 @@
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/DataTypes.h"
 
+#include <algorithm>
+#include <functional>
+#include <queue>
 #include <vector>
-#include <map>
 
 namespace llvm {
 class raw_ostream;
@@ -39,31 +42,31 @@ class CompGraphNode {
   // The underlying data.
   T N;
 
-  typedef SmallPtrSet<Self*, 8> NodeVecTy;
-  // Predecessors and Successors.
-  NodeVecTy Preds, Succs;
-
-  typedef std::map<const Self*, int> WeightVecTy;
-  WeightVecTy SuccWeights;
-
+  // The successors and the weights of the edges to the successors, stored in
+  // flat arrays with the same order. The predecessors are not recorded, the
+  // edges are only traversed forward.
+  typedef std::vector<Self*> NodeVecTy;
+  NodeVecTy Succs;
+  std::vector<int> SuccWeights;
+
+  // The index of the node while the path cover is computed.
+  unsigned Idx;
+  // The weight of the edges from and to this node should be (re)computed.
+  bool WeightsDirty;
+  // The node is deleted from the graph, but may still appear in the successor
+  // arrays of the other nodes until the dead nodes are purged.
+  bool Dead;
+
+  template<typename, typename> friend class CompGraph;
 public:
-  explicit CompGraphNode(T Node = T()) : N(Node) {}
-
-  void dropAllEdges() {
-    Preds.clear();
-    Succs.clear();
-    SuccWeights.clear();
-  }
+  explicit CompGraphNode(T Node = T())
+    : N(Node), Idx(0), WeightsDirty(true), Dead(false) {}
 
   const T &get() const { return N; }
   const T &operator->() const { return N; }
   T &get() { return N; }
   T &operator->() { return N; }
 
-  //void print(raw_ostream &OS) const;
-  //void dump() const;
-
-  //typedef NodeVecTy::iterator iterator;
   typedef typename NodeVecTy::const_iterator iterator;
 
   iterator succ_begin() const { return Succs.begin(); }
@@ -71,125 +74,54 @@ public:
   unsigned num_succ()   const { return Succs.size(); }
   bool     succ_empty() const { return Succs.empty(); }
 
-  iterator pred_begin() const { return Preds.begin(); }
-  iterator pred_end()   const { return Preds.end(); }
-  unsigned num_pred()   const { return Preds.size(); }
-  bool     pred_empty() const { return Preds.empty(); }
-
-  unsigned degree() const { return num_succ() + num_pred(); }
-
-  bool isNeighbor(Self *RHS) const {
-    return Preds.count(RHS) || Succs.count(RHS);
-  }
+  int getWeight(iterator I) const { return SuccWeights[I - succ_begin()]; }
 
   int getWeightTo(const Self *To) const {
-    return SuccWeights.find(To)->second;
+    iterator at = std::find(succ_begin(), succ_end(), To);
+    assert(at != succ_end() && "To is not the successor of this!");
+    return getWeight(at);
   }
 
-  int computeNeighborWeight(Self *RHS = 0) const {
-    int Weight = 0;
+  bool isDead() const { return Dead; }
 
-    for (iterator I = pred_begin(), E = pred_end(); I != E; ++I) {
-      Self *NP = *I;
-      if (Traits::isTrivial(NP->get())) continue;
+  // Drop the edges to the dead nodes, and the edges that are marked dead by
+  // setting their weight to HUGE_NEG_VAL.
+  void purgeDeadEdges() {
+    unsigned NumLive = 0;
+    for (unsigned i = 0, e = Succs.size(); i != e; ++i) {
+      if (Succs[i]->Dead || SuccWeights[i] <= CompGraphWeights::HUGE_NEG_VAL)
+        continue;
 
-      // RHS is null means we want to compute all neighbor weight, otherwise
-      // means we want to compute the common neighbor weight only.
-      if (RHS == 0 || NP->isNeighbor(RHS)) Weight += NP->getWeightTo(this);
+      Succs[NumLive] = Succs[i];
+      SuccWeights[NumLive] = SuccWeights[i];
+      ++NumLive;
     }
 
-    for (iterator I = succ_begin(), E = succ_end(); I != E; ++I) {
-      Self *NS = *I;
-      if (Traits::isTrivial(NS->get())) continue;
-
-      // RHS is null means we want to compute all neighbor weight, otherwise
-      // means we want to compute the common neighbor weight only.
-      if (RHS == 0 || NS->isNeighbor(RHS)) Weight += getWeightTo(NS);
-    }
-
-    if (RHS && isNeighbor(RHS)) {
-      if (Succs.count(RHS)) Weight += getWeightTo(RHS);
-      else                  Weight += RHS->getWeightTo(this);
-    }
-
-    return Weight;
-  }
-
-  // Unlink the Succ from current node.
-  void unlinkSucc(Self *Succ) {
-    bool deleted = Succs.erase(Succ);
-    assert(deleted && "Succ is not the successor of this!");
-    SuccWeights.erase(Succ);
-
-    // Current node is not the predecessor of succ node too.
-    deleted = Succ->Preds.erase(this);
-    assert(deleted && "this is not the predecessor of succ!");
-    (void) deleted;
-  }
-
-  // Unlink the Pred from current node.
-  void unlinkPred(Self *Pred) {
-    bool deleted = Preds.erase(Pred);
-    assert(deleted && "Pred is not the predecessor of this!");
-
-    // Current node is not the successor of pred node too.
-    deleted = Pred->Succs.erase(this);
-    Pred->SuccWeights.erase(this);
-    assert(deleted && "this is not the successor of Pred!");
-    (void) deleted;
-  }
-
-  void deleteUncommonEdges(Self *RHS) {
-    // Delete edge from P and Q that are not connected to their common neighbors.
-    SmallVector<Self*, 8> ToUnlink;
-    // Unlink preds.
-    for (iterator I = pred_begin(), E = pred_end(); I != E; ++I) {
-      Self *N = *I;
-      if (!RHS->isNeighbor(N)) ToUnlink.push_back(N);
-    }
-
-    while (!ToUnlink.empty())
-      unlinkPred(ToUnlink.pop_back_val());
-
-    // Unlink succs.
-    for (iterator I = succ_begin(), E = succ_end(); I != E; ++I) {
-      Self *N = *I;
-      if (!RHS->isNeighbor(N)) ToUnlink.push_back(N);
-    }
-
-    while (!ToUnlink.empty())
-      unlinkSucc(ToUnlink.pop_back_val());
-  }
-
-  void unlink() {
-    while (!succ_empty())
-      unlinkSucc(*succ_begin());
-
-    while (!pred_empty())
-      unlinkPred(*pred_begin());
+    Succs.resize(NumLive);
+    SuccWeights.resize(NumLive);
   }
 
+  // Update the weights of the edges that touch the nodes whose weights are
+  // dirty, the weights of the other edges are still valid.
   template<class CompEdgeWeight>
   void updateEdgeWeight(CompEdgeWeight &C) {
-    SmallVector<Self*, 8> SuccToUnlink;
-    for (iterator I = succ_begin(), E = succ_end(); I != E; ++I) {
-      Self *Succ = *I;
-      // Not need to update the weight of the exit edge.
-      if (Succ->get()) {
-        int Weigth = C(this->get(), Succ->get());
-        if (Weigth <= CompGraphWeights::HUGE_NEG_VAL) {
-          SuccToUnlink.push_back(Succ);
-          continue;
-        }
+    bool AnyUnlinked = false;
+    for (unsigned i = 0, e = Succs.size(); i != e; ++i) {
+      Self *Succ = Succs[i];
+      if (!WeightsDirty && !Succ->WeightsDirty) continue;
+
+      // Make the path prefer to end with exit if possible.
+      if (!Succ->get()) {
+        SuccWeights[i] = CompGraphWeights::TINY_VAL;
+        continue;
+      }
 
-        SuccWeights[Succ] = Weigth;
-      } else
-        // Make find longest path prefer to end with exit if possible.
-        SuccWeights[Succ] = CompGraphWeights::TINY_VAL;
+      int Weigth = C(this->get(), Succ->get());
+      SuccWeights[i] = std::max(Weigth, CompGraphWeights::HUGE_NEG_VAL);
+      AnyUnlinked |= Weigth <= CompGraphWeights::HUGE_NEG_VAL;
     }
 
-    while (!SuccToUnlink.empty())
-      unlinkSucc(SuccToUnlink.pop_back_val());
+    if (AnyUnlinked) purgeDeadEdges();
   }
 
   // Make the edge with default weight, we will udate the weight later.
@@ -199,9 +131,8 @@ public:
     if (SrcN != T() && DstN != T() && Traits::isEarlier(DstN, SrcN))
       std::swap(Dst, Src);
 
-    Src->Succs.insert(Dst);
-    Src->SuccWeights.insert(std::make_pair(Dst, 0));
-    Dst->Preds.insert(Src);
+    Src->Succs.push_back(Dst);
+    Src->SuccWeights.push_back(0);
   }
 };
 
@@ -228,6 +159,21 @@ private:
   NodeTy Entry, Exit;
   // Nodes vector.
   NodeMapTy Nodes;
+  // The deleted nodes, which are freed when they are purged from the
+  // successor arrays.
+  std::vector<NodeTy*> DeadNodes;
+
+  // Remove the edges to the deleted nodes, including the edges from the entry
+  // node.
+  void purgeDeadNodes() {
+    if (DeadNodes.empty()) return;
+
+    Entry.purgeDeadEdges();
+    for (iterator I = begin(), E = end(); I != E; ++I)
+      (*I)->purgeDeadEdges();
+
+    DeleteContainerPointers(DeadNodes);
+  }
 
 public:
   const IDTy ID;
@@ -235,6 +181,7 @@ public:
 
   ~CompGraph() {
     DeleteContainerSeconds(Nodes);
+    DeleteContainerPointers(DeadNodes);
   }
 
   const NodeTy *getEntry() const { return &Entry; }
@@ -256,6 +203,8 @@ public:
     NodeTy *&Node = Nodes[N];
     // Create the node if it not exists yet.
     if (Node == 0) {
+      // Do not link the new node to the deleted nodes.
+      purgeDeadNodes();
       Node = new NodeTy(N);
       // And insert the node into the graph.
       for (iterator I = begin(), E = end(); I != E; ++I) {
@@ -274,101 +223,169 @@ public:
     return Node;
   }
 
+  // Only mark the node dead, the edges to the deleted nodes are removed at
+  // once before the graph is updated, so deleting a batch of nodes costs a
+  // single pass over the edges. The deleted nodes are still visited by
+  // begin()/end() until then.
   void deleteNode(NodeTy *N) {
     Nodes.erase(N->get());
-    N->unlink();
-    delete N;
+    N->Dead = true;
+    DeadNodes.push_back(N);
   }
 
-  // Return true if the longest path is not trivial (have more than 1 nodes).
-  int findLongestPath(SmallVectorImpl<T> &Path, bool DelNodes = false) {
-    std::map<NodeTy*, unsigned> LenMap;
-
-    std::map<NodeTy*, NodeTy*> PathPred;
-    std::map<NodeTy*, int> PathWeight;
-
-    //for each vertex v in topOrder(G) do
-    typedef typename NodeTy::iterator ChildIt;
-    SmallVector<std::pair<NodeTy*, ChildIt>, 32> WorkStack;
-    std::map<NodeTy*, unsigned> VisitCount;
-
-    WorkStack.push_back(std::make_pair(&Entry, Entry.succ_begin()));
-    PathWeight[&Entry] = 0;
-
-    while (!WorkStack.empty()) {
-      NodeTy *Node = WorkStack.back().first;
-      ChildIt It = WorkStack.back().second;
-
-      if (It == Node->succ_end())
-        WorkStack.pop_back();
-      else {
-        //
-        NodeTy *ChildNode = *It;
-        ++WorkStack.back().second;
-        unsigned VC = ++VisitCount[ChildNode];
-
-        // for each edge (Node, ChildNode) in E(G) do
-        int EdgeWeight = Node->getWeightTo(ChildNode);
-        // Do not introduce zero weight edge to the longest path.
-        if (EdgeWeight > 0) {
-          int NewPathWeight = PathWeight[Node] + EdgeWeight;
-          int &OldPathWeight = PathWeight[ChildNode];
-          if (OldPathWeight < NewPathWeight) {
-            // Update the weight
-            OldPathWeight = NewPathWeight;
-            // And the pred
-            PathPred[ChildNode] = Node;
-          }
-        }
+  // Compute the weights of the edges that touch the nodes created since the
+  // last update, and remove the edges with HUGE_NEG_VAL weight.
+  template<class CompEdgeWeight>
+  void updateEdgeWeight(CompEdgeWeight &C) {
+    purgeDeadNodes();
 
-        // Only move forward when we visit the node from all its preds.
-        if (VC == ChildNode->num_pred())
-          WorkStack.push_back(std::make_pair(ChildNode, ChildNode->succ_begin()));
-      }
-    }
+    for (iterator I = begin(), E = end(); I != E; ++I)
+      (*I)->updateEdgeWeight(C);
+
+    for (iterator I = begin(), E = end(); I != E; ++I)
+      (*I)->WeightsDirty = false;
+  }
 
-    unsigned FinalPathWeight = PathWeight[&Exit] - CompGraphWeights::TINY_VAL;
-    if (FinalPathWeight > 0) {
-      // Fill the result vector.
-      for (NodeTy *I = PathPred[&Exit]; I && I != &Entry; I = PathPred[I]) {
-        Path.push_back(I->get());
-        if (DelNodes) deleteNode(I);
+  // Find the vertex disjoint paths that maximize the total weight of the
+  // edges on the paths, i.e. the paths to merge at once. Because every node
+  // has at most one predecessor and one successor on the paths, this is the
+  // maximum weight matching between the nodes as the sources of the edges and
+  // the nodes as the sinks of the edges, which is computed by the successive
+  // shortest path min-cost flow algorithm. Only the edges with positive
+  // weight are considered, and only the paths with more than 1 nodes are
+  // returned. Return the total weight of the paths.
+  int findMaxWeightPathCover(std::vector<SmallVector<T, 8> > &Paths) {
+    purgeDeadNodes();
+
+    std::vector<NodeTy*> IdxToNode(begin(), end());
+    const unsigned NumNodes = IdxToNode.size();
+    for (unsigned i = 0; i < NumNodes; ++i)
+      IdxToNode[i]->Idx = i;
+
+    // Build the positive weight edges in the compressed sparse row form.
+    std::vector<unsigned> EdgeBegin(NumNodes + 1, 0), EdgeDst;
+    std::vector<int> EdgeWeight;
+    for (unsigned i = 0; i < NumNodes; ++i) {
+      NodeTy *Node = IdxToNode[i];
+      EdgeBegin[i] = EdgeDst.size();
+      for (iterator I = Node->succ_begin(), E = Node->succ_end(); I != E; ++I) {
+        NodeTy *Succ = *I;
+        int Weight = Node->getWeight(I);
+        // Do not introduce zero weight edge to the paths.
+        if (!Succ->get() || Weight <= 0) continue;
+
+        EdgeDst.push_back(Succ->Idx);
+        EdgeWeight.push_back(Weight);
       }
     }
+    EdgeBegin[NumNodes] = EdgeDst.size();
+
+    // The vertices of the flow network: the source of the edges in [0, N),
+    // the sink of the edges in [N, 2N), and the super sink 2N. The super
+    // source is implicit, it connects to every unmatched source vertex.
+    const unsigned Sink = 2 * NumNodes, None = ~0u;
+    const int64_t Inf = INT64_MAX / 4;
+    std::vector<unsigned> MatchSrc(NumNodes, None), MatchDst(NumNodes, None),
+                          PredSrc(NumNodes, None);
+    std::vector<int> MatchWeight(NumNodes, 0), PredWeight(NumNodes, 0);
+    // The potentials, which make the reduced costs non-negative, the cost of
+    // an edge is the negative of its weight.
+    std::vector<int64_t> Potential(Sink + 1, 0), Dist(Sink + 1);
+    for (unsigned i = 0, e = EdgeDst.size(); i != e; ++i) {
+      int64_t &P = Potential[NumNodes + EdgeDst[i]];
+      P = std::min(P, -int64_t(EdgeWeight[i]));
+      Potential[Sink] = std::min(Potential[Sink], P);
+    }
 
-    return FinalPathWeight;
-  }
-
-  void recomputeCompatibility() {
-    Entry.dropAllEdges();
-    Exit.dropAllEdges();
+    typedef std::pair<int64_t, unsigned> QueueEntry;
+    int TotalWeight = 0;
+    for (;;) {
+      std::fill(Dist.begin(), Dist.end(), Inf);
+      std::priority_queue<QueueEntry, std::vector<QueueEntry>,
+                          std::greater<QueueEntry> > Queue;
+      for (unsigned i = 0; i < NumNodes; ++i)
+        if (MatchDst[i] == None) {
+          Dist[i] = -Potential[i];
+          Queue.push(QueueEntry(Dist[i], i));
+        }
 
-    typedef typename NodeMapTy::iterator node_iterator;
-    for (node_iterator I = Nodes.begin(), E = Nodes.end(); I != E; ++I)
-      I->second->dropAllEdges();
+      unsigned LastDst = None;
+      while (!Queue.empty()) {
+        QueueEntry Top = Queue.top();
+        Queue.pop();
+        unsigned V = Top.second;
+        if (Top.first != Dist[V] || V == Sink) continue;
+
+        if (V < NumNodes) {
+          // Relax the unmatched edges from the source vertex.
+          for (unsigned i = EdgeBegin[V], e = EdgeBegin[V + 1]; i != e; ++i) {
+            unsigned Dst = EdgeDst[i];
+            if (MatchDst[V] == Dst) continue;
+
+            int64_t D = Dist[V] - EdgeWeight[i] + Potential[V]
+                        - Potential[NumNodes + Dst];
+            if (D >= Dist[NumNodes + Dst]) continue;
+
+            Dist[NumNodes + Dst] = D;
+            PredSrc[Dst] = V;
+            PredWeight[Dst] = EdgeWeight[i];
+            Queue.push(QueueEntry(D, NumNodes + Dst));
+          }
+          continue;
+        }
 
-    for (node_iterator I = Nodes.begin(), E = Nodes.end(); I != E; ++I) {
-      NodeTy *Node = I->second;
+        unsigned Dst = V - NumNodes;
+        unsigned Src = MatchSrc[Dst];
+        // Go to the super sink from the unmatched sink vertex, or go back to
+        // the source vertex of the matched edge.
+        unsigned To = Src == None ? Sink : Src;
+        int64_t D = Dist[V] + (Src == None ? 0 : MatchWeight[Dst])
+                    + Potential[V] - Potential[To];
+        if (D >= Dist[To]) continue;
+
+        Dist[To] = D;
+        if (To == Sink) LastDst = Dst;
+        Queue.push(QueueEntry(D, To));
+      }
 
-      // And insert the node into the graph.
-      for (iterator I = begin(), E = end(); I != E; ++I) {
-        NodeTy *Other = *I;
+      // Stop if there is no augmenting path, or the path do not increase the
+      // total weight.
+      if (LastDst == None || Dist[Sink] + Potential[Sink] >= 0) break;
+
+      int64_t SinkDist = Dist[Sink];
+      for (unsigned i = 0; i <= Sink; ++i)
+        Potential[i] += std::min(Dist[i], SinkDist);
+
+      // Augment along the path.
+      for (unsigned Dst = LastDst; Dst != None;) {
+        unsigned Src = PredSrc[Dst];
+        // The source vertex is matched to the sink vertex before Dst in the
+        // path, unless it is the first vertex in the path.
+        unsigned PrevDst = MatchDst[Src];
+        if (PrevDst != None) {
+          TotalWeight -= MatchWeight[PrevDst];
+          MatchSrc[PrevDst] = None;
+        }
 
-        // Make edge between compatible nodes.
-        if (Traits::compatible(Node->get(), Other->get()))
-          NodeTy::MakeEdge(Node, Other);
+        MatchDst[Src] = Dst;
+        MatchSrc[Dst] = Src;
+        MatchWeight[Dst] = PredWeight[Dst];
+        TotalWeight += PredWeight[Dst];
+        Dst = PrevDst;
       }
+    }
 
-      // There will always edge from entry to a node and from node to exit.
-      NodeTy::MakeEdge(&Entry, Node);
-      NodeTy::MakeEdge(Node, &Exit);
+    // Build the paths from the matching, the heads of the paths are the nodes
+    // without matched predecessor.
+    for (unsigned i = 0; i < NumNodes; ++i) {
+      if (MatchSrc[i] != None || MatchDst[i] == None) continue;
+
+      Paths.push_back(SmallVector<T, 8>());
+      for (unsigned j = i; j != None; j = MatchDst[j])
+        Paths.back().push_back(IdxToNode[j]->get());
     }
-  }
 
-  template<class CompEdgeWeight>
-  void updateEdgeWeight(CompEdgeWeight &C) {
-    for (iterator I = begin(), E = end(); I != E; ++I)
-      (*I)->updateEdgeWeight(C);
+    return TotalWeight;
   }
 
   // TOOD: Add function: Rebuild graph.
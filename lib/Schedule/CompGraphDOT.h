@@ -33,7 +33,7 @@ struct DOTGraphTraits<CompGraph<T1, T2>*> : public DefaultDOTGraphTraits{
   DOTGraphTraits(bool isSimple=false) : DefaultDOTGraphTraits(isSimple) {}
 
   static std::string getEdgeSourceLabel(const NodeTy *Node,NodeIterator I){
-    return itostr(Node->getWeightTo(*I));
+    return itostr(Node->getWeight(I));
   }
 
   std::string getNodeLabel(const NodeTy *Node, const GraphTy *Graph) {
@@ -48,6 +48,7 @@ struct DOTGraphTraits<CompGraph<T1, T2>*> : public DefaultDOTGraphTraits{
 
 template<typename T1, typename T2>
 void CompGraph<T1, T2>::viewGraph() {
+  purgeDeadNodes();
   ViewGraph(this, "CompatibilityGraph" + utostr_32(ID));
 }
 
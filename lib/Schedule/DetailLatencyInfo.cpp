@@ -12,6 +12,7 @@
 //===----------------------------------------------------------------------===//
 #include "vtm/DetailLatencyInfo.h"
 #include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
 #define DEBUG_TYPE "detail-latency"
 #include "llvm/Support/Debug.h"
 
@@ -22,6 +23,11 @@ DisableBLC("vtm-disable-blc",
           cl::desc("Disable bit-level chaining"),
           cl::init(false));
 
+STATISTIC(NumDepLatEntries, "Number of entries in the detail latency tables");
+STATISTIC(NumDepLatBytes, "Number of bytes allocated for the latency tables");
+STATISTIC(NumSharedDepLatTables,
+          "Number of bitslices sharing the latency table of their source");
+
 INITIALIZE_PASS_BEGIN(DetialLatencyInfo, "detail-latency-info",
                       "Calculating the latency of instructions",
                       false, true)
@@ -125,14 +131,29 @@ LatInfoTy getParallelLatency(LatInfoTy SrcLatency, LatInfoTy Inc, float /*BitInc
   return std::make_pair(MSBLatency, LSBLatency);
 }
 
-template<typename FuncTy>
+namespace {
+// Compute the latency from the source through the datapath operation.
+struct LatencyAccumulator {
+  typedef LatInfoTy (*FuncTy)(LatInfoTy, LatInfoTy, float);
+  FuncTy F;
+  LatInfoTy Inc;
+  float BitInc;
+
+  LatencyAccumulator(FuncTy F, LatInfoTy Inc, float BitInc)
+    : F(F), Inc(Inc), BitInc(BitInc) {}
+
+  LatInfoTy operator()(LatInfoTy SrcLatency) const {
+    return F(SrcLatency, Inc, BitInc);
+  }
+};
+}
+
 static void accumulateDatapathLatency(DepLatInfoTy &CurLatInfo,
                                       const DepLatInfoTy *SrcLatInfo,
-                                      LatInfoTy Inc, float BitInc, FuncTy F) {
-  typedef DepLatInfoTy::const_iterator src_it;
+                                      LatInfoTy Inc, float BitInc,
+                                      LatencyAccumulator::FuncTy F) {
   // Compute minimal delay for all possible pathes.
-  for (src_it I = SrcLatInfo->begin(), E = SrcLatInfo->end(); I != E; ++I)
-    updateLatency(CurLatInfo, I->first, F(I->second, Inc, BitInc));
+  CurLatInfo.mergeMax(*SrcLatInfo, LatencyAccumulator(F, Inc, BitInc));
 }
 
 static bool NeedExtraStepToLatchResult(const MachineInstr *MI,
@@ -391,15 +412,14 @@ DetialLatencyInfo::addInstrInternal(const MachineInstr *MI,
     unsigned OpSize = VInstrInfo::getBitWidth(MO);
 
     if (Opcode == VTM::VOpBitSlice) {
-      // Directly copy the dependencies latency information, because when
+      // Directly share the dependencies latency information, because when
       // calculating latency, we treat it as the alias of SrcMI, exepct the
       // latencies are scaled according to the lower bound and upper bound of
       // the bitslice.
-      CurLatInfo = *getDepLatInfo(SrcMI);
       // The latency of SrcMI is included into the latency of the bitslice.
       // Hence we need to set the latency of SrcMI to 0.0f to avoid accumulating
       // it more than once.
-      CurLatInfo[SrcMI] = LatInfoTy(0.0f, 0.0f);
+      CurLatInfo.shareWith(*getDepLatInfo(SrcMI), SrcMI, LatInfoTy(0.0f, 0.0f));
       continue;
     }
 
@@ -446,8 +466,16 @@ bool DetialLatencyInfo::runOnMachineFunction(MachineFunction &MF) {
   typedef MachineFunction::iterator iterator;
   typedef MachineBasicBlock::instr_iterator instr_iterator;
   for (iterator BI = MF.begin(), BE = MF.end(); BI != BE; ++BI)
-    for (instr_iterator I = BI->instr_begin(), E = BI->instr_end(); I != E; ++I)
-      addInstrInternal(I,  LatencyMap[I]);
+    for (instr_iterator I = BI->instr_begin(), E = BI->instr_end(); I != E; ++I){
+      DepLatInfoTy &LatInfo = LatencyMap[I];
+      addInstrInternal(I, LatInfo);
+
+      // The table will not change anymore.
+      size_t Bytes = LatInfo.freeze(TableAllocator);
+      NumDepLatBytes += Bytes;
+      NumDepLatEntries += Bytes / sizeof(DepLatInfoTy::value_type);
+      if (LatInfo.isShared()) ++NumSharedDepLatTables;
+    }
 
   return false;
 }
@@ -14,6 +14,13 @@
 // Robert Tarjan: Depth-first search and linear graph algorithms. In: SIAM
 // Journal on Computing. Volume 1, Nr. 2 (1972), pp. 146-160.<br>
 //
+// Enumerating the circuits is exponential in the worst case, so the RecMII used
+// by the schedulers is computed as a maximum cycle ratio problem on each strong
+// connected component instead, the ratio is estimated by Howard's policy
+// iteration and then rounded to the exact II by the Bellman-Ford check. See:
+// Ali Dasdan: Experimental analysis of the fastest optimum cycle ratio and mean
+// algorithms. In: ACM TODAES. Volume 9, Nr. 4 (2004), pp. 385-418.
+//
 //===----------------------------------------------------------------------===//
 
 #include "VSUnit.h"
@@ -24,14 +31,33 @@
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/IndexedMap.h"
 #include "llvm/ADT/SparseBitVector.h"
+#include "llvm/Config/config.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #define DEBUG_TYPE "vtm-rec-finder"
 #include "llvm/Support/Debug.h"
 
+#include <algorithm>
+#include <cmath>
 #include <map>
 
+#if LLVM_MULTITHREADED && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#define RECMII_USE_PTHREADS
+#endif
+
 using namespace llvm;
 
+static cl::opt<unsigned>
+RecMIIThreads("vtm-recmii-threads",
+              cl::desc("Number of threads to compute the RecMII of the "
+                       "independent strongly connected components"),
+              cl::init(4));
+
+// Do not bother to spawn the threads for small graphs.
+static const unsigned MinEdgesPerThread = 512;
+
 //===----------------------------------------------------------------------===//
 namespace {
 class SubGraph;
@@ -371,3 +397,430 @@ unsigned SchedulingBase::computeRecMII() {
   // Dirty Hack: RecII must bigger than zero.
   return std::max(MaxRecII, 1u);
 }
+
+//===----------------------------------------------------------------------===//
+namespace {
+// A strongly connected component of the compacted dependence graph, the edges
+// are stored in compressed sparse row format.
+class RecurrenceSCC {
+  struct Edge {
+    unsigned Dst;
+    int Latency, Distance;
+
+    Edge(unsigned Dst, int Latency, int Distance)
+      : Dst(Dst), Latency(Latency), Distance(Distance) {}
+  };
+
+  std::vector<Edge> Edges;
+  // The edges from node i are in [FirstEdge[i], FirstEdge[i + 1]).
+  std::vector<unsigned> FirstEdge;
+  // Every circuit with positive distance has a cycle ratio not bigger than the
+  // sum of the positive latencies.
+  unsigned MaxRecMII;
+
+  unsigned num_nodes() const { return FirstEdge.size() - 1; }
+
+  void evaluatePolicy(const std::vector<unsigned> &Policy,
+                      std::vector<double> &Ratio,
+                      std::vector<double> &Potential) const;
+  double estimateMaxCycleRatio() const;
+  bool hasPositiveCycle(unsigned II) const;
+public:
+  unsigned RecMII;
+
+  RecurrenceSCC() : MaxRecMII(1), RecMII(0) {}
+
+  // Build the graph node by node, in the order of the local index.
+  void addNode() { FirstEdge.push_back(Edges.size()); }
+  void addEdge(unsigned Dst, int Latency, int Distance) {
+    Edges.push_back(Edge(Dst, Latency, Distance));
+    if (Latency > 0) MaxRecMII += Latency;
+  }
+  void finalize() { FirstEdge.push_back(Edges.size()); }
+
+  unsigned num_edges() const { return Edges.size(); }
+
+  void computeRecMII(unsigned MinRecMII);
+
+  static void *runWorker(void *Arg);
+};
+
+struct RecMIIWorker {
+  std::vector<RecurrenceSCC*> *SCCs;
+  unsigned FirstSCC, Stride, MinRecMII;
+};
+}
+
+// The cycle ratio of the circuits that can never be satisfied, and that never
+// constrain the II.
+static const double InfiniteRatio = 1e9;
+
+// Compute the cycle ratio of each node under the policy, i.e. the ratio of the
+// circuit reached by following the policy edges, together with the potential
+// of the node relative to the first node of that circuit.
+void RecurrenceSCC::evaluatePolicy(const std::vector<unsigned> &Policy,
+                                   std::vector<double> &Ratio,
+                                   std::vector<double> &Potential) const {
+  const unsigned N = num_nodes(), Unvisited = ~0u;
+  std::vector<unsigned> VisitedFrom(N, Unvisited);
+  std::vector<unsigned> Path;
+
+  for (unsigned Root = 0; Root < N; ++Root) {
+    if (VisitedFrom[Root] != Unvisited) continue;
+
+    // Walk along the policy until we reach a visited node.
+    Path.clear();
+    unsigned V = Root;
+    while (VisitedFrom[V] == Unvisited) {
+      VisitedFrom[V] = Root;
+      Path.push_back(V);
+      V = Edges[Policy[V]].Dst;
+    }
+
+    // The nodes in [0, TreeEnd) of the path are not in the circuit.
+    unsigned TreeEnd = Path.size();
+    if (VisitedFrom[V] == Root) {
+      // We found a new circuit starting from V.
+      TreeEnd = std::find(Path.begin(), Path.end(), V) - Path.begin();
+      int64_t Latency = 0, Distance = 0;
+      for (unsigned i = TreeEnd, e = Path.size(); i != e; ++i) {
+        const Edge &E = Edges[Policy[Path[i]]];
+        Latency += E.Latency;
+        Distance += E.Distance;
+      }
+
+      double R = Distance ? double(Latency) / double(Distance)
+                          : (Latency > 0 ? InfiniteRatio : -InfiniteRatio);
+      Ratio[V] = R;
+      Potential[V] = 0.0;
+      for (unsigned i = Path.size() - 1; i > TreeEnd; --i) {
+        unsigned U = Path[i];
+        const Edge &E = Edges[Policy[U]];
+        Ratio[U] = R;
+        Potential[U] = E.Latency - R * E.Distance + Potential[E.Dst];
+      }
+    }
+
+    // Propagate the ratio and the potential to the nodes in the tree.
+    for (unsigned i = TreeEnd; i > 0; --i) {
+      unsigned U = Path[i - 1];
+      const Edge &E = Edges[Policy[U]];
+      Ratio[U] = Ratio[E.Dst];
+      Potential[U] = E.Latency - Ratio[U] * E.Distance + Potential[E.Dst];
+    }
+  }
+}
+
+// Estimate the maximum cycle ratio with Howard's policy iteration.
+double RecurrenceSCC::estimateMaxCycleRatio() const {
+  const unsigned N = num_nodes();
+  const double Eps = 1e-6;
+  std::vector<unsigned> Policy(N);
+  std::vector<double> Ratio(N), Potential(N);
+
+  // Start from the edges with the biggest latency.
+  for (unsigned V = 0; V < N; ++V) {
+    unsigned Best = FirstEdge[V];
+    for (unsigned i = Best + 1, e = FirstEdge[V + 1]; i != e; ++i)
+      if (Edges[i].Latency > Edges[Best].Latency) Best = i;
+    Policy[V] = Best;
+  }
+
+  // The policy iteration usually converges in a few iterations, the estimation
+  // is refined by the caller anyway if we give up.
+  for (unsigned Iter = 0, MaxIter = 4 * N + 16; Iter < MaxIter; ++Iter) {
+    evaluatePolicy(Policy, Ratio, Potential);
+
+    bool Changed = false;
+    // Try to reach a circuit with bigger ratio first.
+    for (unsigned V = 0; V < N; ++V) {
+      unsigned Best = Policy[V];
+      double BestRatio = Ratio[V];
+      for (unsigned i = FirstEdge[V], e = FirstEdge[V + 1]; i != e; ++i)
+        if (Ratio[Edges[i].Dst] > BestRatio + Eps) {
+          Best = i;
+          BestRatio = Ratio[Edges[i].Dst];
+        }
+
+      if (Best == Policy[V]) continue;
+      Policy[V] = Best;
+      Changed = true;
+    }
+
+    if (Changed) continue;
+
+    // Then try to increase the potential.
+    for (unsigned V = 0; V < N; ++V) {
+      unsigned Best = Policy[V];
+      double BestPotential = Potential[V];
+      for (unsigned i = FirstEdge[V], e = FirstEdge[V + 1]; i != e; ++i) {
+        const Edge &E = Edges[i];
+        if (Ratio[E.Dst] < Ratio[V] - Eps) continue;
+
+        double P = E.Latency - Ratio[V] * E.Distance + Potential[E.Dst];
+        if (P > BestPotential + Eps) {
+          Best = i;
+          BestPotential = P;
+        }
+      }
+
+      if (Best == Policy[V]) continue;
+      Policy[V] = Best;
+      Changed = true;
+    }
+
+    if (!Changed) break;
+  }
+
+  return *std::max_element(Ratio.begin(), Ratio.end());
+}
+
+// Apply the Bellman-Ford algorithm to see if the longest paths convergence.
+bool RecurrenceSCC::hasPositiveCycle(unsigned II) const {
+  const unsigned N = num_nodes();
+  std::vector<int64_t> Dist(N, 0);
+
+  for (unsigned Iter = 0; Iter < N; ++Iter) {
+    bool Changed = false;
+    for (unsigned V = 0; V < N; ++V)
+      for (unsigned i = FirstEdge[V], e = FirstEdge[V + 1]; i != e; ++i) {
+        const Edge &E = Edges[i];
+        int64_t D = Dist[V] + E.Latency - int64_t(II) * E.Distance;
+        if (D <= Dist[E.Dst]) continue;
+
+        Dist[E.Dst] = D;
+        Changed = true;
+      }
+
+    if (!Changed) return false;
+  }
+
+  return true;
+}
+
+void RecurrenceSCC::computeRecMII(unsigned MinRecMII) {
+  // Most components do not constrain the II at all.
+  if (!hasPositiveCycle(MinRecMII)) {
+    RecMII = MinRecMII;
+    return;
+  }
+
+  // Circuit with zero distance and positive latency.
+  unsigned Hi = std::max(MaxRecMII, MinRecMII);
+  if (hasPositiveCycle(Hi)) {
+    RecMII = 0;
+    return;
+  }
+
+  // Now the II is infeasible at Lo and feasible at Hi, the ceiling of the
+  // maximum cycle ratio is the minimal feasible II.
+  unsigned Lo = MinRecMII;
+  double Ratio = estimateMaxCycleRatio();
+  if (Ratio > double(Lo) && Ratio < double(Hi)) {
+    unsigned Hint = unsigned(std::ceil(Ratio - 1e-6));
+    if (Hint > Lo && Hint < Hi) {
+      if (hasPositiveCycle(Hint)) Lo = Hint;
+      else                        Hi = Hint;
+    }
+
+    // The estimation is exact unless the policy iteration gave up, check the
+    // neighbor to close the interval.
+    unsigned Neighbor = Hi == Hint ? Hint - 1 : Hint + 1;
+    if (Neighbor > Lo && Neighbor < Hi) {
+      if (hasPositiveCycle(Neighbor)) Lo = Neighbor;
+      else                            Hi = Neighbor;
+    }
+  }
+
+  while (Hi - Lo > 1) {
+    unsigned Mid = Lo + (Hi - Lo) / 2;
+    if (hasPositiveCycle(Mid)) Lo = Mid;
+    else                       Hi = Mid;
+  }
+
+  RecMII = Hi;
+}
+
+void *RecurrenceSCC::runWorker(void *Arg) {
+  RecMIIWorker *W = reinterpret_cast<RecMIIWorker*>(Arg);
+  for (unsigned i = W->FirstSCC, e = W->SCCs->size(); i < e; i += W->Stride)
+    (*W->SCCs)[i]->computeRecMII(W->MinRecMII);
+
+  return 0;
+}
+
+static bool sort_by_size(const RecurrenceSCC *LHS, const RecurrenceSCC *RHS) {
+  return LHS->num_edges() > RHS->num_edges();
+}
+
+// Compute the strongly connected components with Tarjan's algorithm, return the
+// number of components.
+static unsigned computeSCCs(const std::vector<unsigned> &FirstEdge,
+                           const std::vector<unsigned> &Succs,
+                           std::vector<unsigned> &SCCIds) {
+  const unsigned N = FirstEdge.size() - 1, Unvisited = ~0u;
+  std::vector<unsigned> Index(N, Unvisited), LowLink(N, 0);
+  std::vector<bool> OnStack(N, false);
+  std::vector<unsigned> Stack;
+  // The node and the next edge to visit.
+  std::vector<std::pair<unsigned, unsigned> > VisitStack;
+  unsigned NextIndex = 0, NumSCCs = 0;
+
+  SCCIds.assign(N, 0);
+  for (unsigned Root = 0; Root < N; ++Root) {
+    if (Index[Root] != Unvisited) continue;
+
+    Index[Root] = LowLink[Root] = NextIndex++;
+    Stack.push_back(Root);
+    OnStack[Root] = true;
+    VisitStack.push_back(std::make_pair(Root, FirstEdge[Root]));
+
+    while (!VisitStack.empty()) {
+      unsigned V = VisitStack.back().first;
+      unsigned EdgeIdx = VisitStack.back().second;
+
+      if (EdgeIdx < FirstEdge[V + 1]) {
+        ++VisitStack.back().second;
+        unsigned W = Succs[EdgeIdx];
+        if (Index[W] == Unvisited) {
+          Index[W] = LowLink[W] = NextIndex++;
+          Stack.push_back(W);
+          OnStack[W] = true;
+          VisitStack.push_back(std::make_pair(W, FirstEdge[W]));
+        } else if (OnStack[W])
+          LowLink[V] = std::min(LowLink[V], Index[W]);
+
+        continue;
+      }
+
+      VisitStack.pop_back();
+      if (!VisitStack.empty()) {
+        unsigned Parent = VisitStack.back().first;
+        LowLink[Parent] = std::min(LowLink[Parent], LowLink[V]);
+      }
+
+      if (LowLink[V] != Index[V]) continue;
+
+      // V is the root of a component.
+      unsigned W;
+      do {
+        W = Stack.back();
+        Stack.pop_back();
+        OnStack[W] = false;
+        SCCIds[W] = NumSCCs;
+      } while (W != V);
+      ++NumSCCs;
+    }
+  }
+
+  return NumSCCs;
+}
+
+unsigned llvm::computeCycleRatioRecMII(unsigned NumNodes,
+                                       const std::vector<RecMIIEdge> &Edges,
+                                       unsigned MinRecMII) {
+  MinRecMII = std::max(1u, MinRecMII);
+  if (NumNodes == 0) return MinRecMII;
+
+  // Sort the edges by source node.
+  std::vector<unsigned> FirstEdge(NumNodes + 1, 0);
+  for (unsigned i = 0, e = Edges.size(); i != e; ++i)
+    ++FirstEdge[Edges[i].Src + 1];
+  for (unsigned i = 0; i < NumNodes; ++i)
+    FirstEdge[i + 1] += FirstEdge[i];
+
+  std::vector<unsigned> SortedEdges(Edges.size()), Succs(Edges.size());
+  std::vector<unsigned> InsertPos(FirstEdge.begin(), FirstEdge.end() - 1);
+  for (unsigned i = 0, e = Edges.size(); i != e; ++i) {
+    unsigned Pos = InsertPos[Edges[i].Src]++;
+    SortedEdges[Pos] = i;
+    Succs[Pos] = Edges[i].Dst;
+  }
+
+  std::vector<unsigned> SCCIds;
+  unsigned NumSCCs = computeSCCs(FirstEdge, Succs, SCCIds);
+
+  // Build the components, single node component has no circuit since there is
+  // no self loop in the dependence graph.
+  std::vector<unsigned> SCCSize(NumSCCs, 0), LocalIdx(NumNodes);
+  for (unsigned V = 0; V < NumNodes; ++V)
+    LocalIdx[V] = SCCSize[SCCIds[V]]++;
+
+  std::vector<RecurrenceSCC*> SCCMap(NumSCCs, 0), SCCs;
+  for (unsigned V = 0; V < NumNodes; ++V) {
+    unsigned Id = SCCIds[V];
+    if (SCCSize[Id] < 2) continue;
+
+    RecurrenceSCC *&SCC = SCCMap[Id];
+    if (SCC == 0) {
+      SCC = new RecurrenceSCC();
+      SCCs.push_back(SCC);
+    }
+
+    SCC->addNode();
+    for (unsigned i = FirstEdge[V], e = FirstEdge[V + 1]; i != e; ++i) {
+      const RecMIIEdge &E = Edges[SortedEdges[i]];
+      if (SCCIds[E.Dst] != Id) continue;
+
+      SCC->addEdge(LocalIdx[E.Dst], E.Latency, E.Distance);
+    }
+  }
+
+  unsigned TotalEdges = 0;
+  for (unsigned i = 0, e = SCCs.size(); i != e; ++i) {
+    SCCs[i]->finalize();
+    TotalEdges += SCCs[i]->num_edges();
+  }
+
+  // Process the big components first to balance the workload.
+  std::sort(SCCs.begin(), SCCs.end(), sort_by_size);
+
+  unsigned NumWorkers = std::min<unsigned>(RecMIIThreads, SCCs.size());
+  NumWorkers = std::min(NumWorkers, TotalEdges / MinEdgesPerThread);
+  NumWorkers = std::max(NumWorkers, 1u);
+  std::vector<RecMIIWorker> Workers(NumWorkers);
+  for (unsigned i = 0; i < NumWorkers; ++i) {
+    Workers[i].SCCs = &SCCs;
+    Workers[i].FirstSCC = i;
+    Workers[i].Stride = NumWorkers;
+    Workers[i].MinRecMII = MinRecMII;
+  }
+
+#ifdef RECMII_USE_PTHREADS
+  // The components only read their own copy of the graph, the current thread
+  // is also a worker.
+  std::vector<pthread_t> Threads;
+  for (unsigned i = 1; i < NumWorkers; ++i) {
+    pthread_t T;
+    if (::pthread_create(&T, 0, RecurrenceSCC::runWorker, &Workers[i]) == 0)
+      Threads.push_back(T);
+    else // Run the job in the current thread if we cannot create the thread.
+      RecurrenceSCC::runWorker(&Workers[i]);
+  }
+
+  RecurrenceSCC::runWorker(&Workers[0]);
+
+  for (unsigned i = 0, e = Threads.size(); i != e; ++i)
+    ::pthread_join(Threads[i], 0);
+#else
+  for (unsigned i = 0; i < NumWorkers; ++i)
+    RecurrenceSCC::runWorker(&Workers[i]);
+#endif
+
+  unsigned RecMII = MinRecMII;
+  for (unsigned i = 0, e = SCCs.size(); i != e; ++i) {
+    // Some recurrence cannot be satisfied.
+    if (SCCs[i]->RecMII == 0) {
+      RecMII = 0;
+      break;
+    }
+
+    RecMII = std::max(RecMII, SCCs[i]->RecMII);
+  }
+
+  DEBUG(dbgs() << "RecMII " << RecMII << " from " << SCCs.size()
+               << " recurrence components with " << TotalEdges << " edges, "
+               << NumWorkers << " worker(s)\n");
+  DeleteContainerPointers(SCCs);
+  return RecMII;
+}
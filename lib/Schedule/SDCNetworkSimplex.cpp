@@ -0,0 +1,482 @@
+//===- SDCNetworkSimplex.cpp - Network simplex solver for SDC ---*- C++ -*-===//
+//
+//                      The Shang HLS frameowrk                               //
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implement the network simplex solver for the SDC scheduler. The
+// dual of a system of difference constraints with a linear objective is a
+// min-cost flow problem, which is solved by the primal network simplex, and
+// the schedule is read from the node potentials of the optimal spanning tree.
+//
+// For each difference constraint x_v - x_u >= l, there is an arc u -> v with
+// cost -l. The constant is represented by the node 0 whose potential is fixed
+// to 0. The soft constraint x_d - x_s + t >= l, t >= 0 is handled by treating
+// the slack column as an auxiliary node y = x_d + t, which is constrained by
+// y - x_d >= 0 and y - x_s >= l, and its penalty becomes the cost of y - x_d.
+//
+// The pivoting rules (block search for the entering arc, and the leaving arc
+// selection that keeps the spanning tree strongly feasible) follow the network
+// simplex implementation of the LEMON graph library.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SDCSolver.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/raw_ostream.h"
+#define DEBUG_TYPE "sdc-network-simplex"
+#include "llvm/Support/Debug.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+class NetworkSimplexSDCSolver : public SDCSolver {
+  // The model.
+  struct Row {
+    SmallVector<int, 3> Cols;
+    SmallVector<int, 3> Coeffs;
+    bool IsEq;
+    int RHS;
+  };
+  std::vector<Row> Rows;
+
+  struct Column {
+    int LB;
+    bool IsSlack;
+    // The column which the auxiliary node of the slack variable is based on.
+    unsigned Base;
+  };
+  // The columns are indexed from 1, Columns[0] is the constant node.
+  std::vector<Column> Columns;
+  std::map<unsigned, double> Obj;
+
+  /// @name The flow network
+  //{
+  enum {
+    DIR_UP = -1,
+    DIR_DOWN = 1
+  };
+
+  // The arcs in the network, the artificial arc connecting node v and the
+  // artificial root is placed at NumRealArcs + v.
+  std::vector<unsigned> Source, Target;
+  std::vector<int64_t> Cost, Flow;
+  std::vector<bool> InTree;
+  unsigned NumRealArcs;
+
+  // The demand (inflow - outflow) of the nodes.
+  std::vector<int64_t> Demand;
+
+  // The spanning tree.
+  std::vector<unsigned> Parent, PredArc, Depth;
+  std::vector<int> PredDir;
+  std::vector<int64_t> Potential;
+  // The children of the tree nodes, stored in double linked list.
+  std::vector<int> FirstChild, NextSibling, PrevSibling;
+  unsigned Root;
+  //}
+
+  void addArc(unsigned Src, unsigned Dst, int64_t C) {
+    Source.push_back(Src);
+    Target.push_back(Dst);
+    Cost.push_back(C);
+  }
+
+  // Add the constraint x_Dst - x_Src >= L.
+  void addDiffConstraint(unsigned Src, unsigned Dst, int L) {
+    addArc(Src, Dst, -int64_t(L));
+  }
+
+  bool buildNetwork();
+
+  void detachNode(unsigned N);
+  void attachNode(unsigned N, unsigned P, unsigned Arc, int Dir);
+  void updateSubtree(unsigned N);
+
+  int64_t getReducedCost(unsigned Arc) const {
+    return Cost[Arc] + Potential[Source[Arc]] - Potential[Target[Arc]];
+  }
+
+  // Find the arc entering the spanning tree by the block search pivot rule,
+  // return false if the current solution is optimal.
+  bool findEnteringArc(unsigned &Arc, unsigned &NextArc) const;
+  // Augment the flow along the cycle formed by the entering arc, and update
+  // the spanning tree. Return false if the flow is unbounded.
+  bool pivot(unsigned InArc);
+
+public:
+  NetworkSimplexSDCSolver() : NumRealArcs(0), Root(0) {
+    Column C = { 0, false, 0 };
+    Columns.push_back(C);
+  }
+
+  const char *getName() const { return "network simplex"; }
+
+  void createVariable(unsigned Col, const std::string &Name, int LB,
+                      bool IsSlack) {
+    assert(Col == Columns.size() && "Bad column index!");
+    Column C = { LB, IsSlack, 0 };
+    Columns.push_back(C);
+  }
+
+  unsigned getNumVariables() const { return Columns.size() - 1; }
+  unsigned getNumRows() const { return Rows.size(); }
+
+  unsigned addRow(ArrayRef<int> Cols, ArrayRef<int> Coeffs, bool IsEq,
+                  int RHS) {
+    Row R;
+    R.Cols.assign(Cols.begin(), Cols.end());
+    R.Coeffs.assign(Coeffs.begin(), Coeffs.end());
+    R.IsEq = IsEq;
+    R.RHS = RHS;
+    Rows.push_back(R);
+    return Rows.size();
+  }
+
+  void setRHS(unsigned Idx, int RHS) { Rows[Idx - 1].RHS = RHS; }
+
+  void deleteRows(ArrayRef<unsigned> Dead) {
+    // Compact the rows that are not deleted.
+    unsigned NumRows = 0;
+    const unsigned *D = Dead.begin();
+    for (unsigned i = 0, e = Rows.size(); i < e; ++i) {
+      if (D != Dead.end() && *D == i + 1) {
+        ++D;
+        continue;
+      }
+
+      if (NumRows != i) Rows[NumRows] = Rows[i];
+      ++NumRows;
+    }
+
+    Rows.resize(NumRows);
+  }
+
+  void setObjective(const std::map<unsigned, double> &O) { Obj = O; }
+
+  ResultTy solve();
+
+  int getValue(unsigned Col) const {
+    // The potential is the negative of the variable.
+    int64_t V = Potential[0] - Potential[Col];
+    if (Columns[Col].IsSlack)
+      V -= Potential[0] - Potential[Columns[Col].Base];
+    return int(V);
+  }
+};
+}
+
+bool NetworkSimplexSDCSolver::buildNetwork() {
+  unsigned NumNodes = Columns.size();
+  Source.clear();
+  Target.clear();
+  Cost.clear();
+  Demand.assign(NumNodes + 1, 0);
+
+  for (unsigned i = 1; i < NumNodes; ++i)
+    Columns[i].Base = 0;
+
+  std::vector<bool> SlackUsed(NumNodes, false);
+
+  for (unsigned i = 0, e = Rows.size(); i < e; ++i) {
+    const Row &R = Rows[i];
+    // The difference constraint x_Dst - x_Src >= RHS, 0 means the constant.
+    unsigned Src = 0, Dst = 0, Slack = 0;
+
+    for (unsigned j = 0, je = R.Cols.size(); j < je; ++j) {
+      unsigned Col = R.Cols[j];
+      int Coeff = R.Coeffs[j];
+      unsigned &N = Columns[Col].IsSlack ? Slack : (Coeff > 0 ? Dst : Src);
+
+      if (N || std::abs(Coeff) != 1 || (Columns[Col].IsSlack && Coeff != 1))
+        return false;
+
+      N = Col;
+    }
+
+    if (Slack == 0) {
+      if (Src == 0 && Dst == 0) return false;
+
+      addDiffConstraint(Src, Dst, R.RHS);
+      if (R.IsEq) addDiffConstraint(Dst, Src, -R.RHS);
+      continue;
+    }
+
+    // Each slack variable only appears in a single soft constraint.
+    if (R.IsEq || SlackUsed[Slack]) return false;
+    SlackUsed[Slack] = true;
+
+    // y = x_Dst + t, y - x_Dst >= 0 and y - x_Src >= RHS.
+    Columns[Slack].Base = Dst;
+    addDiffConstraint(Dst, Slack, 0);
+    addDiffConstraint(Src, Slack, R.RHS);
+  }
+
+  // Scale the objective to integer, the weights are usually small integers or
+  // fractions with small power of 2 denominators, which are preserved exactly.
+  double MaxWeight = 0.0;
+  typedef std::map<unsigned, double>::const_iterator obj_it;
+  for (obj_it I = Obj.begin(), E = Obj.end(); I != E; ++I)
+    MaxWeight = std::max(MaxWeight, std::fabs(I->second));
+
+  double Scale = 1 << 20;
+  while (MaxWeight * Scale > double(1 << 20))
+    Scale /= 2.0;
+
+  for (obj_it I = Obj.begin(), E = Obj.end(); I != E; ++I) {
+    unsigned Col = I->first;
+    if (Col == 0 || Col >= NumNodes) return false;
+
+    // We are maximizing the objective, but the network simplex minimizes the
+    // cost, hence negate the weights.
+    int64_t W = -int64_t(floor(I->second * Scale + 0.5));
+    if (W == 0) continue;
+
+    Demand[Col] += W;
+    // The penalty of the slack variable is the cost of y - x_Base.
+    if (Columns[Col].IsSlack) Demand[Columns[Col].Base] -= W;
+  }
+
+  for (unsigned i = 1; i < NumNodes; ++i) {
+    const Column &C = Columns[i];
+
+    if (!C.IsSlack) {
+      addDiffConstraint(0, i, C.LB);
+      continue;
+    }
+
+    // The slack variable is not used by any soft constraint.
+    if (!SlackUsed[i]) addDiffConstraint(0, i, 0);
+  }
+
+  // The constant node balance the demand of the other nodes.
+  int64_t TotalDemand = 0;
+  for (unsigned i = 1; i < NumNodes; ++i)
+    TotalDemand += Demand[i];
+  Demand[0] = -TotalDemand;
+
+  return true;
+}
+
+void NetworkSimplexSDCSolver::detachNode(unsigned N) {
+  int Prev = PrevSibling[N], Next = NextSibling[N];
+  if (Prev >= 0) NextSibling[Prev] = Next;
+  else           FirstChild[Parent[N]] = Next;
+  if (Next >= 0) PrevSibling[Next] = Prev;
+}
+
+void NetworkSimplexSDCSolver::attachNode(unsigned N, unsigned P, unsigned Arc,
+                                         int Dir) {
+  Parent[N] = P;
+  PredArc[N] = Arc;
+  PredDir[N] = Dir;
+  PrevSibling[N] = -1;
+  NextSibling[N] = FirstChild[P];
+  if (FirstChild[P] >= 0) PrevSibling[FirstChild[P]] = N;
+  FirstChild[P] = N;
+}
+
+void NetworkSimplexSDCSolver::updateSubtree(unsigned N) {
+  SmallVector<unsigned, 32> WorkStack;
+  WorkStack.push_back(N);
+
+  while (!WorkStack.empty()) {
+    unsigned U = WorkStack.pop_back_val();
+    unsigned P = Parent[U];
+    // The reduced cost of the tree arcs is 0.
+    Depth[U] = Depth[P] + 1;
+    Potential[U] = PredDir[U] == DIR_DOWN ? Potential[P] + Cost[PredArc[U]]
+                                          : Potential[P] - Cost[PredArc[U]];
+
+    for (int C = FirstChild[U]; C >= 0; C = NextSibling[C])
+      WorkStack.push_back(C);
+  }
+}
+
+bool NetworkSimplexSDCSolver::findEnteringArc(unsigned &Arc,
+                                              unsigned &NextArc) const {
+  unsigned BlockSize = std::max(10u, unsigned(std::sqrt(double(NumRealArcs))));
+  int64_t Min = 0;
+  unsigned Cnt = BlockSize;
+
+  for (unsigned i = 0; i < NumRealArcs; ++i) {
+    unsigned A = (NextArc + i) % NumRealArcs;
+
+    if (!InTree[A]) {
+      int64_t RC = getReducedCost(A);
+      if (RC < Min) {
+        Min = RC;
+        Arc = A;
+      }
+    }
+
+    if (--Cnt == 0) {
+      if (Min < 0) {
+        NextArc = (A + 1) % NumRealArcs;
+        return true;
+      }
+
+      Cnt = BlockSize;
+    }
+  }
+
+  return Min < 0;
+}
+
+bool NetworkSimplexSDCSolver::pivot(unsigned InArc) {
+  const int64_t Inf = INT64_MAX;
+  unsigned First = Source[InArc], Second = Target[InArc];
+
+  // Find the join node of the cycle.
+  unsigned Join = First, V = Second;
+  while (Join != V) {
+    if (Depth[Join] >= Depth[V]) Join = Parent[Join];
+    else                         V = Parent[V];
+  }
+
+  // Find the leaving arc, the flow is pushed along the entering arc, from
+  // Second up to Join and then from Join down to First.
+  int64_t Delta = Inf;
+  unsigned OutNode = 0;
+  bool OutOnFirstSide = true;
+
+  for (unsigned U = First; U != Join; U = Parent[U]) {
+    int64_t D = PredDir[U] == DIR_UP ? Flow[PredArc[U]] : Inf;
+    if (D < Delta) {
+      Delta = D;
+      OutNode = U;
+    }
+  }
+
+  for (unsigned U = Second; U != Join; U = Parent[U]) {
+    int64_t D = PredDir[U] == DIR_DOWN ? Flow[PredArc[U]] : Inf;
+    if (D <= Delta && D != Inf) {
+      Delta = D;
+      OutNode = U;
+      OutOnFirstSide = false;
+    }
+  }
+
+  // There is a negative cycle in the network, i.e. a positive cycle in the
+  // difference constraints.
+  if (Delta == Inf) return false;
+
+  // Augment the flow.
+  if (Delta) {
+    Flow[InArc] += Delta;
+    for (unsigned U = First; U != Join; U = Parent[U])
+      Flow[PredArc[U]] += PredDir[U] == DIR_UP ? -Delta : Delta;
+    for (unsigned U = Second; U != Join; U = Parent[U])
+      Flow[PredArc[U]] += PredDir[U] == DIR_DOWN ? -Delta : Delta;
+  }
+
+  // Hang the subtree containing the leaving arc to the other endpoint of the
+  // entering arc, and reverse the tree path from the entering endpoint to the
+  // leaving node.
+  unsigned UIn = OutOnFirstSide ? First : Second;
+  unsigned VIn = OutOnFirstSide ? Second : First;
+
+  InTree[PredArc[OutNode]] = false;
+  InTree[InArc] = true;
+
+  unsigned U = UIn, NewParent = VIn, Arc = InArc;
+  int Dir = Source[InArc] == UIn ? DIR_UP : DIR_DOWN;
+  for (;;) {
+    unsigned OldParent = Parent[U], OldArc = PredArc[U];
+    int OldDir = PredDir[U];
+
+    detachNode(U);
+    attachNode(U, NewParent, Arc, Dir);
+
+    if (U == OutNode) break;
+
+    NewParent = U;
+    Arc = OldArc;
+    Dir = -OldDir;
+    U = OldParent;
+  }
+
+  updateSubtree(UIn);
+  return true;
+}
+
+SDCSolver::ResultTy NetworkSimplexSDCSolver::solve() {
+  if (!buildNetwork()) return Unsupported;
+
+  unsigned NumNodes = Columns.size();
+  NumRealArcs = Source.size();
+  Root = NumNodes;
+
+  // The cost of the artificial arcs, which is larger than the cost of any
+  // simple path in the network.
+  int64_t MaxCost = 0;
+  for (unsigned i = 0; i < NumRealArcs; ++i)
+    MaxCost = std::max(MaxCost, Cost[i] < 0 ? -Cost[i] : Cost[i]);
+  int64_t ArtCost = (MaxCost + 1) * int64_t(NumNodes + 1);
+
+  Flow.assign(NumRealArcs, 0);
+  InTree.assign(NumRealArcs, false);
+  Parent.assign(NumNodes + 1, Root);
+  PredArc.assign(NumNodes + 1, 0);
+  PredDir.assign(NumNodes + 1, DIR_UP);
+  Depth.assign(NumNodes + 1, 0);
+  Potential.assign(NumNodes + 1, 0);
+  FirstChild.assign(NumNodes + 1, -1);
+  NextSibling.assign(NumNodes + 1, -1);
+  PrevSibling.assign(NumNodes + 1, -1);
+
+  // Build the initial spanning tree with the artificial arcs, the nodes with
+  // positive demand get their flow from the root, and the others send their
+  // supply to the root.
+  for (unsigned i = 0; i < NumNodes; ++i) {
+    unsigned Arc = Source.size();
+    int Dir;
+
+    if (Demand[i] > 0) {
+      addArc(Root, i, ArtCost);
+      Flow.push_back(Demand[i]);
+      Dir = DIR_DOWN;
+      Potential[i] = ArtCost;
+    } else {
+      addArc(i, Root, ArtCost);
+      Flow.push_back(-Demand[i]);
+      Dir = DIR_UP;
+      Potential[i] = -ArtCost;
+    }
+
+    InTree.push_back(true);
+    Depth[i] = 1;
+    attachNode(i, Root, Arc, Dir);
+  }
+
+  unsigned InArc = 0, NextArc = 0, NumPivots = 0;
+  while (NumRealArcs && findEnteringArc(InArc, NextArc)) {
+    if (!pivot(InArc)) return Infeasible;
+    ++NumPivots;
+  }
+
+  DEBUG(dbgs() << "Network simplex: " << NumNodes << " nodes, " << NumRealArcs
+               << " arcs, " << NumPivots << " pivots.\n");
+
+  // There is still flow on the artificial arcs, which means the flow problem is
+  // infeasible, i.e. the SDC model is unbounded. Let the LP solver to report
+  // the problem.
+  for (unsigned i = NumRealArcs, e = Flow.size(); i < e; ++i)
+    if (Flow[i]) return Unsupported;
+
+  return Optimal;
+}
+
+SDCSolver *SDCSolver::createNetworkSimplexSolver() {
+  return new NetworkSimplexSDCSolver();
+}
@@ -15,11 +15,50 @@
 #include "SchedulingBase.h"
 #include "vtm/VInstrInfo.h"
 #include "lpsolve/lp_lib.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Mutex.h"
 #define DEBUG_TYPE "sdc-scheduler"
 #include "llvm/Support/Debug.h"
 
 using namespace llvm;
 
+static cl::opt<bool>
+EnableIncrementalSDC("vtm-sdc-incremental",
+                     cl::desc("Keep the SDC model alive across the schedule "
+                              "iterations of the modulo SDC scheduler and only "
+                              "update the changed constraints"),
+                     cl::init(true));
+
+static cl::opt<SDCSolver::SolverKind>
+SDCSolverKind("vtm-sdc-solver",
+              cl::desc("The solver used by the SDC scheduler"),
+              cl::values(clEnumValN(SDCSolver::LPSolve, "lpsolve",
+                                    "The general ILP solver lp_solve"),
+                         clEnumValN(SDCSolver::NetworkSimplex, "network",
+                                    "The network simplex solver, fall back to "
+                                    "lp_solve if the model is not supported"),
+                         clEnumValEnd),
+              cl::init(SDCSolver::LPSolve));
+
+STATISTIC(NumRowsReused, "Number of SDC constraint rows reused");
+STATISTIC(NumRowsRebuilt, "Number of SDC constraint rows (re)built");
+STATISTIC(NumRowsDeleted, "Number of SDC constraint rows deleted");
+STATISTIC(NumWarmStarts, "Number of SDC solves warm started from last basis");
+STATISTIC(NumSolverFallbacks,
+          "Number of SDC models rebuilt for lp_solve after the solver failed");
+STATISTIC(NumSDCSolves, "Number of SDC models solved");
+STATISTIC(MaxSDCColumns, "Number of columns in the largest SDC model");
+STATISTIC(MaxSDCRows, "Number of rows in the largest SDC model");
+STATISTIC(NumModuloSchedules,
+          "Number of loop schedules computed by modulo SDC scheduler");
+STATISTIC(NumModuloLinOrdEdges,
+          "Number of linear order edges added to resolve modulo FU conflicts");
+
+static ManagedStatic<sys::SmartMutex<true> > MaxModelSizeLock;
+
 namespace {
 struct alap_less {
   SchedulingBase &Info;
@@ -114,35 +153,55 @@ void BasicLinearOrderGenerator::addLinOrdEdge(ConflictListTy &List) {
     std::vector<VSUnit*> &SUs = I->second;
     std::sort(SUs.begin(), SUs.end(), alap_less(S));
 
-    VSUnit *FirstSU;
-    FirstSU = addLinOrdEdge(I->second);
-
-    MachineBasicBlock *ParentBB = FirstSU->getParentBB();
-    if (!isFUConflictedAtFirstSlot(ParentBB, I->first)) continue;
-
-    // Prevent the First SU from being scheduled to the first slot if there is
-    // FU conflict.
-    VSUnit *BBEntry = S->lookupSUnit(ParentBB);
-    assert(BBEntry && "EntrySU not found!");
-    VDEdge Edge = VDEdge::CreateDep<VDEdge::LinearOrder>(1);
-    FirstSU->addDep<true>(BBEntry, Edge);
+    // Distribute the SUs to the ports of the FU in turn, and only order the
+    // SUs on the same port. Then no more than NumPorts SUs are scheduled to
+    // the same slot.
+    unsigned NumPorts = std::min<unsigned>(I->first.getNumPorts(), SUs.size());
+    MachineBasicBlock *ParentBB = SUs.front()->getParentBB();
+    bool ConflictedAtFirstSlot = isFUConflictedAtFirstSlot(ParentBB, I->first);
+
+    for (unsigned Port = 0; Port < NumPorts; ++Port) {
+      VSUnit *FirstSU = addLinOrdEdge(SUs, Port, NumPorts);
+
+      if (!ConflictedAtFirstSlot) continue;
+
+      // Prevent the First SU from being scheduled to the first slot if there is
+      // FU conflict.
+      VSUnit *BBEntry = S->lookupSUnit(ParentBB);
+      assert(BBEntry && "EntrySU not found!");
+      VDEdge Edge = VDEdge::CreateDep<VDEdge::LinearOrder>(1);
+      S->addDep<true>(FirstSU, BBEntry, Edge);
+      updateTimeFrame(BBEntry, FirstSU);
+    }
   }
 }
 
-VSUnit *BasicLinearOrderGenerator::addLinOrdEdge(SUVecTy &SUs) {
-  VSUnit *LaterSU = SUs.back();
-  SUs.pop_back();
+void BasicLinearOrderGenerator::updateTimeFrame(const VSUnit *Src,
+                                                const VSUnit *Dst) {
+  // Keep the time frames up to date, so the SUs in the conflict lists sorted
+  // after are ordered by the time frames with the edges added so far.
+  bool HasNegativeCycle = S.updateTimeFrame(Src, Dst);
+  assert(!HasNegativeCycle && "Linear order edge introduced negative cycle!");
+  (void) HasNegativeCycle;
+}
+
+VSUnit *BasicLinearOrderGenerator::addLinOrdEdge(const SUVecTy &SUs,
+                                                 unsigned FirstIdx,
+                                                 unsigned Stride) {
+  unsigned Idx = FirstIdx + (SUs.size() - 1 - FirstIdx) / Stride * Stride;
+  VSUnit *LaterSU = SUs[Idx];
 
-  while (!SUs.empty()) {
-    VSUnit *EalierSU = SUs.back();
-    SUs.pop_back();
+  while (Idx != FirstIdx) {
+    Idx -= Stride;
+    VSUnit *EalierSU = SUs[Idx];
 
     // Build a dependence edge from EalierSU to LaterSU.
     // TODO: Add an new kind of edge: Constraint Edge, and there should be
     // hard constraint and soft constraint.
-    unsigned Latency = EalierSU->getLatency();
+    unsigned Latency = EalierSU->getFUOccupancy();
     VDEdge Edge = VDEdge::CreateDep<VDEdge::LinearOrder>(Latency);
-    LaterSU->addDep<true>(EalierSU, Edge);
+    S->addDep<true>(LaterSU, EalierSU, Edge);
+    updateTimeFrame(EalierSU, LaterSU);
 
     LaterSU = EalierSU;
   }
@@ -150,93 +209,453 @@ VSUnit *BasicLinearOrderGenerator::addLinOrdEdge(SUVecTy &SUs) {
   return LaterSU;
 }
 
-void SDCSchedulingBase::LPObjFn::setLPObj(lprec *lp) const {
-  std::vector<int> Indices;
-  std::vector<REAL> Coefficients;
+// Helper function
+static const char *transSolveResult(int result) {
+  if (result == -2) return "NOMEMORY";
+  else if (result > 13) return "Unknown result!";
 
-  //Build the ASAP object function.
-  for(const_iterator I = begin(), E = end(); I != E; ++I) {
-    Indices.push_back(I->first);
-    Coefficients.push_back(I->second);
+  static const char *ResultTable[] = {
+    "OPTIMAL",
+    "SUBOPTIMAL",
+    "INFEASIBLE",
+    "UNBOUNDED",
+    "DEGENERATE",
+    "NUMFAILURE",
+    "USERABORT",
+    "TIMEOUT",
+    "PRESOLVED",
+    "PROCFAIL",
+    "PROCBREAK",
+    "FEASFOUND",
+    "NOFEASFOUND"
+  };
+
+  return ResultTable[result];
+}
+
+namespace {
+// Solve the SDC model with the general (I)LP solver, lp_solve.
+class LPSolveSDCSolver : public SDCSolver {
+  lprec *lp;
+  // The number of rows when the model is solved, the result of the variables
+  // are stored after the rows.
+  unsigned SolvedRows;
+  // Is the model going to be updated and solved again?
+  const bool Incremental;
+
+  // The basis of the last solve, used to warm start the next solve.
+  std::vector<int> LastBasis;
+  unsigned LastBasisRows, LastBasisCols;
+  // Mapping the row index in the last solve to the current row index, 0 means
+  // the row is deleted.
+  std::vector<unsigned> RowRemap;
+
+  // Try to restart the simplex from the basis of the last solve.
+  void restoreBasis();
+  void rememberBasis();
+
+public:
+  explicit LPSolveSDCSolver(bool Incremental)
+    : lp(make_lp(0, 0)), SolvedRows(0), Incremental(Incremental),
+      LastBasisRows(0), LastBasisCols(0) {}
+
+  ~LPSolveSDCSolver() { delete_lp(lp); }
+
+  const char *getName() const { return "lp_solve"; }
+
+  void createVariable(unsigned Col, const std::string &Name, int LB,
+                      bool IsSlack) {
+    set_col_name(lp, Col, const_cast<char*>(Name.c_str()));
+    set_int(lp, Col, TRUE);
+    // The lower bound of the slack variables is 0, which is the default lower
+    // bound in lp_solve.
+    if (!IsSlack) set_lowbo(lp, Col, LB);
+  }
+
+  unsigned getNumVariables() const { return get_Ncolumns(lp); }
+  unsigned getNumRows() const { return get_Nrows(lp); }
+
+  // Add the rows in row mode, which is much faster.
+  void beginAddRows() { set_add_rowmode(lp, TRUE); }
+  void endAddRows() { set_add_rowmode(lp, FALSE); }
+
+  unsigned addRow(ArrayRef<int> Cols, ArrayRef<int> Coeffs, bool IsEq,
+                  int RHS) {
+    SmallVector<REAL, 3> Coefficients(Coeffs.begin(), Coeffs.end());
+    if (!add_constraintex(lp, Cols.size(), Coefficients.data(),
+                          const_cast<int*>(Cols.data()), IsEq ? EQ : GE, RHS))
+      return 0;
+
+    return get_Nrows(lp);
+  }
+
+  void setRHS(unsigned Row, int RHS) { set_rh(lp, Row, RHS); }
+
+  void deleteRows(ArrayRef<unsigned> Rows);
+
+  void setObjective(const std::map<unsigned, double> &Obj) {
+    std::vector<int> Indices;
+    std::vector<REAL> Coefficients;
+
+    //Build the ASAP object function.
+    typedef std::map<unsigned, double>::const_iterator iterator;
+    for(iterator I = Obj.begin(), E = Obj.end(); I != E; ++I) {
+      Indices.push_back(I->first);
+      Coefficients.push_back(I->second);
+    }
+
+    set_obj_fnex(lp, Obj.size(), Coefficients.data(), Indices.data());
+    set_maxim(lp);
+    DEBUG(write_lp(lp, "log.lp"));
+  }
+
+  ResultTy solve();
+
+  int getValue(unsigned Col) const {
+    int j = get_var_primalresult(lp, SolvedRows + Col);
+    DEBUG(dbgs() << "At row:" << SolvedRows + Col
+                 << " the result is:" << j << "\n");
+    return j;
+  }
+};
+}
+
+void LPSolveSDCSolver::deleteRows(ArrayRef<unsigned> Rows) {
+  if (Rows.empty()) return;
+
+  // Compute the row index after the dead rows are deleted, the rows that are
+  // added after the last solve are not in the basis, hence we do not care about
+  // them.
+  for (unsigned i = 1, e = RowRemap.size(); i < e; ++i) {
+    unsigned &Row = RowRemap[i];
+    if (Row == 0) continue;
+
+    const unsigned *at = std::lower_bound(Rows.begin(), Rows.end(), Row);
+    if (at != Rows.end() && *at == Row) Row = 0;
+    else                                Row -= at - Rows.begin();
+  }
+
+  // Delete the rows from the last one, so the index of the remaining dead rows
+  // are not changed.
+  for (unsigned i = Rows.size(); i > 0; --i)
+    del_constraint(lp, Rows[i - 1]);
+}
+
+void LPSolveSDCSolver::rememberBasis() {
+  LastBasisRows = get_Nrows(lp);
+  LastBasisCols = get_Ncolumns(lp);
+  LastBasis.assign(LastBasisRows + 1, 0);
+  RowRemap.clear();
+
+  if (!get_basis(lp, &LastBasis[0], FALSE)) {
+    LastBasis.clear();
+    LastBasisRows = 0;
+    return;
+  }
+
+  RowRemap.resize(LastBasisRows + 1);
+  for (unsigned i = 0; i <= LastBasisRows; ++i)
+    RowRemap[i] = i;
+}
+
+void LPSolveSDCSolver::restoreBasis() {
+  if (LastBasis.empty()) return;
+
+  unsigned NumRows = get_Nrows(lp), NumCols = get_Ncolumns(lp);
+  // The rows (slack variables) and the columns in the new basis.
+  std::vector<bool> IsBasic(NumRows + NumCols + 1, false);
+  std::vector<int> Basis(1, 0);
+
+  for (unsigned i = 1, e = LastBasis.size(); i < e; ++i) {
+    unsigned Var = std::abs(LastBasis[i]);
+    unsigned NewVar = 0;
+
+    // Translate the index of the basic variable.
+    if (Var <= LastBasisRows)
+      NewVar = RowRemap[Var];
+    else if (Var - LastBasisRows <= LastBasisCols)
+      NewVar = NumRows + Var - LastBasisRows;
+
+    // The row of the basic variable is deleted.
+    if (NewVar == 0 || IsBasic[NewVar]) continue;
+
+    IsBasic[NewVar] = true;
+    Basis.push_back(-int(NewVar));
+  }
+
+  // The newly added rows are not in the basis of the last solve, make their
+  // slack variables basic, and fill the basis with slack variables if some
+  // basic variables are deleted.
+  for (unsigned i = 1; i <= NumRows && Basis.size() <= NumRows; ++i) {
+    if (IsBasic[i]) continue;
+
+    IsBasic[i] = true;
+    Basis.push_back(-int(i));
+  }
+
+  // Too much basic variables because some rows with non-basic slack variables
+  // are deleted, drop the basic columns.
+  for (unsigned i = Basis.size() - 1; i > 0 && Basis.size() > NumRows + 1; --i)
+    if (unsigned(-Basis[i]) > NumRows)
+      Basis.erase(Basis.begin() + i);
+
+  if (Basis.size() == NumRows + 1 && set_basis(lp, &Basis[0], FALSE)) {
+    ++NumWarmStarts;
+    return;
   }
 
-  set_obj_fnex(lp, size(), Coefficients.data(), Indices.data());
-  set_maxim(lp);
+  // Cannot reuse the basis, start from the slack basis.
+  default_basis(lp);
+}
+
+SDCSolver::ResultTy LPSolveSDCSolver::solve() {
+  set_verbose(lp, CRITICAL);
+  DEBUG(set_verbose(lp, FULL));
+
+  // The presolve removes rows and columns from the model permanently, which
+  // prevent us from reusing the model in the next solve.
+  if (!Incremental)
+    set_presolve(lp, PRESOLVE_ROWS | PRESOLVE_COLS | PRESOLVE_LINDEP
+                     | PRESOLVE_IMPLIEDFREE | PRESOLVE_REDUCEGCD
+                     | PRESOLVE_PROBEFIX | PRESOLVE_PROBEREDUCE
+                     | PRESOLVE_ROWDOMINATE /*| PRESOLVE_COLDOMINATE lpsolve bug*/
+                     | PRESOLVE_MERGEROWS
+                     | PRESOLVE_BOUNDS,
+                 get_presolveloops(lp));
+  else
+    // Start from the basis of the last solve if possible.
+    restoreBasis();
+
   DEBUG(write_lp(lp, "log.lp"));
+
+  SolvedRows = get_Nrows(lp);
+  DEBUG(dbgs() << "Timeout is set to " << get_timeout(lp) << "secs.\n");
+
+  int result = ::solve(lp);
+
+  DEBUG(dbgs() << "ILP result is: "<< transSolveResult(result) << "\n");
+  DEBUG(dbgs() << "Time elapsed: " << time_elapsed(lp) << "\n");
+
+  switch (result) {
+  case INFEASIBLE:
+    return Infeasible;
+  case SUBOPTIMAL:
+    if (Incremental) rememberBasis();
+    return SubOptimal;
+  case OPTIMAL:
+  case PRESOLVED:
+    if (Incremental) rememberBasis();
+    return Optimal;
+  default:
+    report_fatal_error(Twine("ILPScheduler Schedule fail: ")
+                       + Twine(transSolveResult(result)));
+  }
+
+  return Infeasible;
+}
+
+SDCSolver *SDCSolver::createLPSolveSolver(bool Incremental) {
+  return new LPSolveSDCSolver(Incremental);
+}
+
+SDCSolver *SDCSolver::create(SolverKind Kind, bool Incremental) {
+  switch (Kind) {
+  case NetworkSimplex: return createNetworkSimplexSolver();
+  case LPSolve:        return createLPSolveSolver(Incremental);
+  }
+
+  llvm_unreachable("Unknown SDC solver!");
+  return 0;
 }
 
 namespace {
 struct ConstraintHelper {
   int SrcSlot, DstSlot;
   unsigned SrcIdx, DstIdx;
+  const VSUnit *Src, *Dst;
+
+  // The constraint built by buildConstraint.
+  SmallVector<int, 3> Col;
+  SmallVector<int, 3> Coeff;
+  int RHS;
 
   ConstraintHelper()
-    : SrcSlot(0), DstSlot(0), SrcIdx(0), DstIdx(0) {}
+    : SrcSlot(0), DstSlot(0), SrcIdx(0), DstIdx(0), Src(0), Dst(0), RHS(0) {}
 
   void resetSrc(const VSUnit *Src, const SDCSchedulingBase *S) {
+    this->Src = Src;
     SrcSlot = Src->getSlot();
     SrcIdx = SrcSlot == 0 ? S->getSUIdx(Src) : 0;
   }
 
   void resetDst(const VSUnit *Dst, const SDCSchedulingBase *S) {
+    this->Dst = Dst;
     DstSlot = Dst->getSlot();
     DstIdx = DstSlot == 0 ? S->getSUIdx(Dst) : 0;
   }
 
-  void addConstraintToLP(VDEdge Edge, lprec *lp, int ExtraLatency) {
-    SmallVector<int, 2> Col;
-    SmallVector<REAL, 2> Coeff;
+  // Build the constraint Dst - Src >= Latency, return false if both SU are
+  // scheduled, i.e. there is nothing to constrain.
+  bool buildConstraint(int Latency) {
+    Col.clear();
+    Coeff.clear();
 
-    int RHS = Edge.getLatency() - DstSlot + SrcSlot + ExtraLatency;
+    RHS = Latency - DstSlot + SrcSlot;
 
     // Both SU is scheduled.
-    if (SrcSlot && DstSlot) {
-      assert(0 >= RHS && "Bad schedule!");
-      return;
-    }
+    if (SrcSlot && DstSlot) return false;
 
     // Build the constraint.
     if (SrcSlot == 0) {
       assert(SrcIdx && "Bad SrcIdx!");
       Col.push_back(SrcIdx);
-      Coeff.push_back(-1.0);
+      Coeff.push_back(-1);
     }
 
     if (DstSlot == 0) {
       assert(DstIdx && "Bad DstIdx!");
       Col.push_back(DstIdx);
-      Coeff.push_back(1.0);
+      Coeff.push_back(1);
     }
 
-    int EqTy = (Edge.getEdgeType() == VDEdge::FixedTiming) ? EQ : GE;
+    return true;
+  }
 
+  bool buildConstraint(VDEdge Edge, unsigned II, int ExtraLatency) {
+    bool NeedConstraint = buildConstraint(Edge.getLatency(II) + ExtraLatency);
+    assert((NeedConstraint || 0 >= RHS) && "Bad schedule!");
+    return NeedConstraint;
+  }
 
-    if(!add_constraintex(lp, Col.size(), Coeff.data(), Col.data(), EqTy, RHS))
-      report_fatal_error("SDCScheduler: Can NOT add dependency constraints"
-                         " at VSUnit " + utostr_32(DstIdx));
+  static bool isEq(VDEdge Edge) {
+    return Edge.getEdgeType() == VDEdge::FixedTiming;
   }
 };
 }
 
+SDCSchedulingBase::~SDCSchedulingBase() {
+  delete Solver;
+}
+
+bool SDCSchedulingBase::SDCRow::hasSameStructure(ArrayRef<int> C,
+                                                 ArrayRef<int> Coeff,
+                                                 bool Eq) const {
+  if (IsEq != Eq || Cols.size() != C.size()) return false;
+
+  return std::equal(C.begin(), C.end(), Cols.begin())
+         && std::equal(Coeff.begin(), Coeff.end(), Coeffs.begin());
+}
+
+void SDCSchedulingBase::addConstraint(RowKeyTy Key, ArrayRef<int> Cols,
+                                      ArrayRef<int> Coeffs, bool IsEq, int RHS) {
+  RowMapTy::iterator at = Rows.find(Key);
+
+  if (at != Rows.end()) {
+    SDCRow &R = at->second;
+    assert(!R.Live && "Constraint added more than once!");
+
+    if (R.hasSameStructure(Cols, Coeffs, IsEq)) {
+      R.Live = true;
+      ++NumRowsReused;
+      // Only the right hand side of the constraint is changed, e.g. the
+      // latency of the edge or the slot of a scheduled SU, simply update it.
+      if (R.RHS != RHS) {
+        Solver->setRHS(R.Row, RHS);
+        R.RHS = RHS;
+      }
+
+      return;
+    }
+
+    // The structure of the constraint is changed, e.g. one of the SU become
+    // scheduled, we need to delete the old row and add a new one.
+    DeadRows.push_back(R.Row);
+    Rows.erase(at);
+  }
+
+  unsigned Row = Solver->addRow(Cols, Coeffs, IsEq, RHS);
+  if (Row == 0)
+    report_fatal_error("SDCScheduler: Can NOT add dependency constraints"
+                       " at VSUnit " + utostr_32(Key.first.second->getIdx()));
+  ++NumRowsRebuilt;
+
+  SDCRow &R = Rows[Key];
+  R.Row = Row;
+  R.RHS = RHS;
+  R.IsEq = IsEq;
+  R.Cols.assign(Cols.begin(), Cols.end());
+  R.Coeffs.assign(Coeffs.begin(), Coeffs.end());
+  R.Live = true;
+}
+
+void SDCSchedulingBase::beginConstraintUpdate() {
+  DeadRows.clear();
+  BuildingFromScratch = Rows.empty();
+
+  for (RowMapTy::iterator I = Rows.begin(), E = Rows.end(); I != E; ++I)
+    I->second.Live = false;
+
+  // Add the rows in row mode, which is much faster, if we are building the
+  // model from scratch.
+  if (BuildingFromScratch) Solver->beginAddRows();
+}
+
+void SDCSchedulingBase::endConstraintUpdate() {
+  if (BuildingFromScratch) {
+    // Turn off the add rowmode and start to solve the model.
+    Solver->endAddRows();
+    return;
+  }
+
+  // Collect the rows that are not used anymore.
+  for (RowMapTy::iterator I = Rows.begin(), E = Rows.end(); I != E; /*++I*/) {
+    RowMapTy::iterator at = I++;
+    if (at->second.Live) continue;
+
+    DeadRows.push_back(at->second.Row);
+    Rows.erase(at);
+  }
+
+  if (DeadRows.empty()) return;
+
+  std::sort(DeadRows.begin(), DeadRows.end());
+  Solver->deleteRows(DeadRows);
+  NumRowsDeleted += DeadRows.size();
+
+  // Renumber the rows that are still alive.
+  for (RowMapTy::iterator I = Rows.begin(), E = Rows.end(); I != E; ++I) {
+    unsigned &Row = I->second.Row;
+    Row -= std::lower_bound(DeadRows.begin(), DeadRows.end(), Row)
+           - DeadRows.begin();
+  }
+}
+
+void SDCSchedulingBase::addVariable(unsigned Col, const std::string &Name,
+                                    int LB, bool IsSlack) {
+  assert(Col == Columns.size() + 1 && "Bad column index!");
+  DEBUG(dbgs() <<"Col#" << Col << " name: " << Name << "\n");
+  SDCColumn C = { Name, LB, IsSlack };
+  Columns.push_back(C);
+  Solver->createVariable(Col, Name, LB, IsSlack);
+}
+
 unsigned SDCSchedulingBase::createStepVariable(const VSUnit* U, unsigned Col) {
   // Set up the step variable for the VSUnit.
   bool inserted = SUIdx.insert(std::make_pair(U, Col)).second;
   assert(inserted && "Index already existed!");
   (void) inserted;
-  std::string SVStart = "sv" + utostr_32(U->getIdx());
-  DEBUG(dbgs() <<"Col#" << Col << " name: " <<SVStart << "\n");
-  set_col_name(lp, Col, const_cast<char*>(SVStart.c_str()));
-  set_int(lp, Col, TRUE);
-  set_lowbo(lp, Col, ScheduleLB);
+  addVariable(Col, "sv" + utostr_32(U->getIdx()), ScheduleLB, false);
   return Col + 1;
 }
 
 unsigned SDCSchedulingBase::createLPAndVariables(iterator I, iterator E) {
-  lp = make_lp(0, 0);
-  unsigned Col =  1;
+  // Reuse the model, only create the variables for the new SUs.
+  if (Solver == 0) Solver = SDCSolver::create(SDCSolverKind, Incremental);
+
+  unsigned Col = Solver->getNumVariables() + 1;
   while (I != E) {
     const VSUnit* U = *I++;
-    if (U->isScheduled()) continue;
+    if (U->isScheduled() || SUIdx.count(U)) continue;
 
     Col = createStepVariable(U, Col);
   }
@@ -248,60 +667,33 @@ unsigned SDCSchedulingBase::addSoftConstraint(const VSUnit *Src, const VSUnit *D
                                                unsigned Slack, double Penalty) {
   if (Src->isScheduled() && Dst->isScheduled()) return 0;
 
-  unsigned NextCol = get_Ncolumns(lp) + 1;
+  unsigned NextCol = Solver->getNumVariables() + 1;
   SoftConstraint C = { Penalty, Src, Dst, NextCol, Slack };
   SoftCstrs.push_back(C);
-  std::string SlackName = "slack" + utostr_32(NextCol);
-  DEBUG(dbgs() <<"Col#" << NextCol << " name: " <<SlackName << "\n");
-  set_col_name(lp, NextCol, const_cast<char*>(SlackName.c_str()));
-  set_int(lp, NextCol, TRUE);
+  addVariable(NextCol, "slack" + utostr_32(NextCol), 0, true);
   return NextCol;
 }
 
-void SDCSchedulingBase::addSoftConstraints(lprec *lp) {
+void SDCSchedulingBase::addSoftConstraints() {
   typedef SoftCstrVecTy::iterator iterator;
-  SmallVector<int, 3> Col;
-  SmallVector<REAL, 3> Coeff;
+  ConstraintHelper H;
 
   // Build the constraint Dst - Src <= Latency - Slack
-  // FIXME: Use ConstraintHelper.
   for (iterator I = SoftCstrs.begin(), E = SoftCstrs.end(); I != E; ++I) {
     SoftConstraint &C = *I;
 
-    unsigned DstIdx = 0;
-    int DstSlot = C.Dst->getSlot();
-    if (DstSlot == 0) DstIdx = getSUIdx(C.Dst);
-
-    unsigned SrcIdx = 0;
-    int SrcSlot = C.Src->getSlot();
-    if (SrcSlot == 0) SrcIdx = getSUIdx(C.Src);
-
-    int RHS = C.Slack - DstSlot + SrcSlot;
+    H.resetSrc(C.Src, this);
+    H.resetDst(C.Dst, this);
 
     // Both SU is scheduled.
-    if (SrcSlot && DstSlot) continue;
-
-    Col.clear();
-    Coeff.clear();
-
-    // Build the constraint.
-    if (SrcSlot == 0) {
-      Col.push_back(SrcIdx);
-      Coeff.push_back(-1.0);
-    }
-
-    if (DstSlot == 0) {
-      Col.push_back(DstIdx);
-      Coeff.push_back(1.0);
-    }
+    if (!H.buildConstraint(C.Slack)) continue;
 
     // Add the slack variable.
-    Col.push_back(C.SlackIdx);
-    Coeff.push_back(1.0);
+    H.Col.push_back(C.SlackIdx);
+    H.Coeff.push_back(1);
 
-    if(!add_constraintex(lp, Col.size(), Coeff.data(), Col.data(), GE, RHS))
-      report_fatal_error("SDCScheduler: Can NOT step soft Constraints"
-                         " SlackIdx:" + utostr_32(C.SlackIdx));
+    addConstraint(getRowKey(C.Src, C.Dst, C.SlackIdx), H.Col, H.Coeff, false,
+                  H.RHS);
   }
 }
 
@@ -343,91 +735,107 @@ void SDCSchedulingBase::buildOptSlackObject(iterator I, iterator E, double weigh
   }
 }
 
-void SDCSchedulingBase::buildSchedule(lprec *lp, unsigned TotalRows,
-                                      iterator I, iterator E) {
+void SDCSchedulingBase::buildSchedule(iterator I, iterator E) {
   while (I != E) {
     VSUnit *U = *I++;
 
     if (U->isScheduled()) continue;
 
     unsigned Idx = getSUIdx(U);
-    unsigned j = get_var_primalresult(lp, TotalRows + Idx);
-    DEBUG(dbgs() << "At row:" << TotalRows + Idx
-                 << " the result is:" << j << "\n");
+    int j = Solver->getValue(Idx);
+    DEBUG(dbgs() << "Col#" << Idx << " the result is:" << j << "\n");
 
-    assert(j && "Bad result!");
+    assert(j > 0 && "Bad result!");
     U->scheduledTo(j);
   }
 }
 
-// Helper function
-static const char *transSolveResult(int result) {
-  if (result == -2) return "NOMEMORY";
-  else if (result > 13) return "Unknown result!";
+void SDCSchedulingBase::switchToLPSolve() {
+  SDCSolver *LP = SDCSolver::createLPSolveSolver(Incremental);
 
-  static const char *ResultTable[] = {
-    "OPTIMAL",
-    "SUBOPTIMAL",
-    "INFEASIBLE",
-    "UNBOUNDED",
-    "DEGENERATE",
-    "NUMFAILURE",
-    "USERABORT",
-    "TIMEOUT",
-    "PRESOLVED",
-    "PROCFAIL",
-    "PROCBREAK",
-    "FEASFOUND",
-    "NOFEASFOUND"
-  };
+  for (unsigned i = 0, e = Columns.size(); i < e; ++i) {
+    const SDCColumn &C = Columns[i];
+    LP->createVariable(i + 1, C.Name, C.LB, C.IsSlack);
+  }
 
-  return ResultTable[result];
-}
+  LP->setObjective(ObjFn);
 
-bool SDCSchedulingBase::solveLP(lprec *lp) {
-  set_verbose(lp, CRITICAL);
-  DEBUG(set_verbose(lp, FULL));
-
-  set_presolve(lp, PRESOLVE_ROWS | PRESOLVE_COLS | PRESOLVE_LINDEP
-                   | PRESOLVE_IMPLIEDFREE | PRESOLVE_REDUCEGCD
-                   | PRESOLVE_PROBEFIX | PRESOLVE_PROBEREDUCE
-                   | PRESOLVE_ROWDOMINATE /*| PRESOLVE_COLDOMINATE lpsolve bug*/
-                   | PRESOLVE_MERGEROWS
-                   | PRESOLVE_BOUNDS,
-               get_presolveloops(lp));
+  // Replay the rows in the same order, so the index of the rows are preserved.
+  std::vector<const SDCRow*> RowsByIdx(Rows.size() + 1, 0);
+  for (RowMapTy::const_iterator I = Rows.begin(), E = Rows.end(); I != E; ++I){
+    assert(I->second.Row < RowsByIdx.size() && !RowsByIdx[I->second.Row]
+           && "Bad row index!");
+    RowsByIdx[I->second.Row] = &I->second;
+  }
 
-  DEBUG(write_lp(lp, "log.lp"));
+  LP->beginAddRows();
+  for (unsigned i = 1, e = RowsByIdx.size(); i < e; ++i) {
+    const SDCRow *R = RowsByIdx[i];
+    if (LP->addRow(R->Cols, R->Coeffs, R->IsEq, R->RHS) != i)
+      report_fatal_error("SDCScheduler: Can NOT rebuild the model for "
+                         + Twine(LP->getName()));
+  }
+  LP->endAddRows();
 
-  unsigned TotalRows = get_Nrows(lp), NumVars = get_Ncolumns(lp);
-  DEBUG(dbgs() << "The model has " << NumVars
-               << "x" << TotalRows << '\n');
+  delete Solver;
+  Solver = LP;
+}
 
-  DEBUG(dbgs() << "Timeout is set to " << get_timeout(lp) << "secs.\n");
+bool SDCSchedulingBase::solveLP() {
+  DEBUG(dbgs() << "The model has " << Solver->getNumVariables()
+               << "x" << Solver->getNumRows() << '\n');
+  ++NumSDCSolves;
+  {
+    // Only the increments of the statistics are atomic, guard the compare and
+    // assign, the functions may be scheduled in parallel (sync -j).
+    sys::SmartScopedLock<true> Guard(*MaxModelSizeLock);
+    if (Solver->getNumVariables() > MaxSDCColumns)
+      MaxSDCColumns = Solver->getNumVariables();
+    if (Solver->getNumRows() > MaxSDCRows)
+      MaxSDCRows = Solver->getNumRows();
+  }
 
-  int result = solve(lp);
+  SDCSolver::ResultTy Result = Solver->solve();
 
-  DEBUG(dbgs() << "ILP result is: "<< transSolveResult(result) << "\n");
-  DEBUG(dbgs() << "Time elapsed: " << time_elapsed(lp) << "\n");
+  // The solver cannot handle the model, fall back to the general LP solver,
+  // the LP solver will be used by the following schedule iterations.
+  if (Result == SDCSolver::Unsupported) {
+    DEBUG(dbgs() << Solver->getName() << " cannot solve the model, "
+                    "fall back to lp_solve.\n");
+    ++NumSolverFallbacks;
+    switchToLPSolve();
+    Result = Solver->solve();
+  }
 
-  switch (result) {
-  case INFEASIBLE:
-    delete_lp(lp);
+  switch (Result) {
+  case SDCSolver::Infeasible:
     return false;
-  case SUBOPTIMAL:
+  case SDCSolver::SubOptimal:
     DEBUG(dbgs() << "Note: suboptimal schedule found!\n");
-  case OPTIMAL:
-  case PRESOLVED:
+  case SDCSolver::Optimal:
     break;
-  default:
-    report_fatal_error(Twine("ILPScheduler Schedule fail: ")
-                       + Twine(transSolveResult(result)));
+  case SDCSolver::Unsupported:
+    llvm_unreachable("lp_solve should support all models!");
   }
 
   return true;
 }
 
+void SDCSchedulingBase::releaseModel() {
+  delete Solver;
+  Solver = 0;
+  SUIdx.clear();
+  Columns.clear();
+  Rows.clear();
+  ObjFn.clear();
+}
+
 template<bool IsCtrlPath>
-void SDCScheduler<IsCtrlPath>::addDependencyConstraints(lprec *lp) {
+void SDCScheduler<IsCtrlPath>::addDependencyConstraints() {
+  // The II of the loop, if we are performing modulo scheduling.
+  const unsigned II = this->getMII();
+  const VSchedGraphCSR &CSR = getCSR();
+
   for(VSchedGraph::const_iterator I = begin(), E = end(); I != E; ++I) {
     const VSUnit *U = *I;
 
@@ -436,10 +844,11 @@ void SDCScheduler<IsCtrlPath>::addDependencyConstraints(lprec *lp) {
     ConstraintHelper H;
     H.resetDst(U, this);
 
-    // Build the constraint for Dst_SU_startStep - Src_SU_endStep >= Latency.
-    for (const_dep_it DI = dep_begin(U), DE = dep_end(U); DI != DE; ++DI) {
-      assert(!DI.isLoopCarried()
-        && "Loop carried dependencies cannot handled by SDC scheduler!");
+    // Build the constraint for Dst_SU_startStep - Src_SU_endStep >= Latency,
+    // the latency of the loop-carried dependencies is Latency - II * Distance.
+    for (csr_it DI = CSR.dep_begin(U), DE = CSR.dep_end(U); DI != DE; ++DI) {
+      assert((II || !DI.isLoopCarried())
+        && "Loop carried dependencies need modulo scheduling!");
       const VSUnit *Src = *DI;
       VDEdge Edge = DI.getEdge();
 
@@ -449,7 +858,9 @@ void SDCScheduler<IsCtrlPath>::addDependencyConstraints(lprec *lp) {
         continue;
 
       H.resetSrc(Src, this);
-      H.addConstraintToLP(Edge, lp, 0);
+      if (H.buildConstraint(Edge, II, 0))
+        addConstraint(getRowKey(Src, U), H.Col, H.Coeff,
+                      ConstraintHelper::isEq(Edge), H.RHS);
     }
 
     if (IsCtrlPath) continue;
@@ -458,41 +869,151 @@ void SDCScheduler<IsCtrlPath>::addDependencyConstraints(lprec *lp) {
     // scheduling units.
     H.resetSrc(U, this);
 
-    for (const_use_it UI = use_begin(U), UE = use_end(U); UI != UE; ++UI) {
+    for (csr_it UI = CSR.use_begin(U), UE = CSR.use_end(U); UI != UE; ++UI) {
       const VSUnit *Use = *UI;
       if (!Use->isControl()) continue;
 
       H.resetDst(Use, this);
-      H.addConstraintToLP(Use->getEdgeFrom<IsCtrlPath>(U), lp, 0);
+      VDEdge Edge = UI.getEdge();
+      if (H.buildConstraint(Edge, II, 0))
+        addConstraint(getRowKey(U, Use), H.Col, H.Coeff,
+                      ConstraintHelper::isEq(Edge), H.RHS);
     }
   }
 }
 
 template<bool IsCtrlPath>
 bool SDCScheduler<IsCtrlPath>::schedule() {
-  ObjFn.setLPObj(lp);
-
-  set_add_rowmode(lp, TRUE);
+  Solver->setObjective(ObjFn);
 
-  // Build the constraints.
-  addDependencyConstraints(lp);
-  addSoftConstraints(lp);
+  // Build the constraints, or only update the changed constraints if the model
+  // is built by the previous schedule iteration.
+  beginConstraintUpdate();
+  addDependencyConstraints();
+  addExtraConstraints();
+  addSoftConstraints();
+  endConstraintUpdate();
 
-  // Turn off the add rowmode and start to solve the model.
-  set_add_rowmode(lp, FALSE);
-  unsigned TotalRows = get_Nrows(lp);
-
-  if (!solveLP(lp)) return false;
+  if (!solveLP()) return false;
 
   // Schedule the state with the ILP result.
-  buildSchedule(lp, TotalRows, begin(), end());
+  buildSchedule(begin(), end());
+
+  // Throw away the model if it is not reused by the next schedule iteration.
+  if (!Incremental) releaseModel();
 
-  delete_lp(lp);
-  lp = 0;
-  SUIdx.clear();
-  ObjFn.clear();
   return true;
 }
 
 template class SDCScheduler<false>;
 template class SDCScheduler<true>;
+
+namespace {
+struct slot_less {
+  bool operator() (const VSUnit *LHS, const VSUnit *RHS) const {
+    return LHS->getSlot() < RHS->getSlot();
+  }
+};
+}
+
+SDCModuloScheduler::SDCModuloScheduler(VSchedGraph &S)
+  : SDCScheduler<true>(S) {
+  // The loop is scheduled again and again with the new linear order edges,
+  // only a few constraints are changed between the schedule iterations.
+  Incremental = EnableIncrementalSDC;
+}
+
+bool SDCModuloScheduler::scheduleLoop() {
+  VSUnit *LoopOp = G.getLoopOp();
+  assert(LoopOp && "Cannot find LoopOp in modulo SDC scheduler!");
+
+  G.resetCPSchedule();
+  // Reject the II early if there is negative cycle, or the LoopOp cannot be
+  // scheduled at the end of the first stage. The linear order edges are not in
+  // the graph, the cycles introduced by them make the model infeasible.
+  resetTimeFrame();
+  if (buildASAPStep()) return false;
+
+  unsigned LoopOpSlot = G.EntrySlot + getMII();
+  if (getASAPStep(LoopOp) > LoopOpSlot) return false;
+
+  for (;;) {
+    // Schedule the LoopOp to the end of the first stage, so it is a constant
+    // instead of a variable in the model.
+    LoopOp->scheduledTo(LoopOpSlot);
+    createLPAndVariables();
+    // The objective is thrown away together with the model, if the model is
+    // not reused across the schedule iterations.
+    if (ObjFn.empty()) buildASAPObject(1.0);
+
+    if (!schedule()) return false;
+
+    ++NumModuloSchedules;
+    if (resolveFUConflicts()) return true;
+
+    // Schedule the loop again with the new linear order edges.
+    G.resetCPSchedule();
+  }
+}
+
+bool SDCModuloScheduler::resolveFUConflicts() {
+  // Visit the SUs in the order of their schedule, so that the linear order
+  // edges respect the current schedule. The stable sort preserve the
+  // topological order of the SUs that are scheduled to the same slot.
+  std::vector<VSUnit*> SUs;
+  for (iterator I = cp_begin(&G), E = cp_end(&G); I != E; ++I)
+    if (!(*I)->getFUId().isTrivial())
+      SUs.push_back(*I);
+
+  std::stable_sort(SUs.begin(), SUs.end(), slot_less());
+
+  resetRT();
+  bool AnyConflict = false;
+  typedef std::vector<VSUnit*>::iterator su_it;
+  for (su_it I = SUs.begin(), E = SUs.end(); I != E; ++I) {
+    VSUnit *U = *I;
+    unsigned Step = U->getSlot();
+
+    if (const MachineInstr *MI = getConflictedInst(U, Step)) {
+      VSUnit *Earlier = G.lookupSUnit(MI);
+      assert(Earlier && Earlier->getSlot() <= Step && "Bad conflicted SU!");
+      addModuloLinOrdEdge(Earlier, U);
+      AnyConflict = true;
+      continue;
+    }
+
+    takeFU(U, Step);
+  }
+
+  return !AnyConflict;
+}
+
+void SDCModuloScheduler::addModuloLinOrdEdge(VSUnit *Earlier, VSUnit *Later) {
+  DEBUG(dbgs() << "Order conflicted SUs at II " << getMII() << ": ";
+        Earlier->print(dbgs()); dbgs() << " -> "; Later->print(dbgs());
+        dbgs() << '\n');
+  // Later should start after Earlier released the FU, and Earlier in the next
+  // iteration, which starts II slots later, should start after Later released
+  // the FU, i.e. Earlier + II - Later >= Occupancy(Later). Hence the two SUs
+  // occupy the FU in disjoint slots modulo II.
+  ModuloLinOrdEdges.push_back(ModuloLinOrdEdge(Earlier, Later,
+    VDEdge::CreateDep<VDEdge::LinearOrder>(Earlier->getFUOccupancy())));
+  ModuloLinOrdEdges.push_back(ModuloLinOrdEdge(Later, Earlier,
+    VDEdge::CreateDep<VDEdge::LinearOrder>(Later->getFUOccupancy(), 1)));
+  ++NumModuloLinOrdEdges;
+}
+
+void SDCModuloScheduler::addExtraConstraints() {
+  const unsigned II = getMII();
+  ConstraintHelper H;
+
+  typedef std::vector<ModuloLinOrdEdge>::const_iterator edge_it;
+  for (edge_it I = ModuloLinOrdEdges.begin(), E = ModuloLinOrdEdges.end();
+       I != E; ++I) {
+    H.resetSrc(I->Src, this);
+    H.resetDst(I->Dst, this);
+    if (H.buildConstraint(I->Edge, II, 0))
+      addConstraint(getRowKey(I->Src, I->Dst, ModuloLinOrdRow), H.Col, H.Coeff,
+                    false, H.RHS);
+  }
+}
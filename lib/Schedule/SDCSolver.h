@@ -0,0 +1,77 @@
+//===------ SDCSolver.h - The solvers of the SDC scheduler ------*- C++ -*-===//
+//
+//                      The Shang HLS frameowrk                               //
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file define the SDCSolver interface, which solve the system of
+// difference constraints built by the SDC scheduler. The model is stored in
+// the lp_solve style: The columns (variables) and the rows (constraints) are
+// numbered from 1, and deleting a row shifts the rows after it.
+//
+//===----------------------------------------------------------------------===//
+#ifndef VBE_SDC_SOLVER_H
+#define VBE_SDC_SOLVER_H
+
+#include "llvm/ADT/ArrayRef.h"
+
+#include <map>
+#include <string>
+
+namespace llvm {
+class SDCSolver {
+public:
+  enum SolverKind {
+    LPSolve,
+    NetworkSimplex
+  };
+
+  enum ResultTy {
+    Optimal,
+    SubOptimal,
+    Infeasible,
+    // The model contains constraints that cannot be handled by the solver.
+    Unsupported
+  };
+
+  virtual ~SDCSolver() {}
+
+  virtual const char *getName() const = 0;
+
+  // Create the variable at column Col, which should be the next column of the
+  // model. The slack variables of the soft constraints have a lower bound of 0.
+  virtual void createVariable(unsigned Col, const std::string &Name, int LB,
+                              bool IsSlack) = 0;
+  virtual unsigned getNumVariables() const = 0;
+  virtual unsigned getNumRows() const = 0;
+
+  // Rows are added in a batch when we are building the model from scratch.
+  virtual void beginAddRows() {}
+  virtual void endAddRows() {}
+
+  // Add the constraint: Sum(Coeffs[i] * Cols[i]) (>= or ==) RHS, and return
+  // the index of the new row, or 0 if the row cannot be added.
+  virtual unsigned addRow(ArrayRef<int> Cols, ArrayRef<int> Coeffs, bool IsEq,
+                          int RHS) = 0;
+  virtual void setRHS(unsigned Row, int RHS) = 0;
+  // Delete the rows, the indices of the rows are in ascending order.
+  virtual void deleteRows(ArrayRef<unsigned> Rows) = 0;
+
+  // Set the objective function, which is going to be maximized.
+  virtual void setObjective(const std::map<unsigned, double> &Obj) = 0;
+
+  virtual ResultTy solve() = 0;
+  virtual int getValue(unsigned Col) const = 0;
+
+  // If Incremental is true, the model is going to be updated and solved again,
+  // so the solver should not change the model permanently, e.g. by presolve.
+  static SDCSolver *createLPSolveSolver(bool Incremental);
+  static SDCSolver *createNetworkSimplexSolver();
+  static SDCSolver *create(SolverKind Kind, bool Incremental);
+};
+}
+
+#endif
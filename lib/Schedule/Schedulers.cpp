@@ -14,36 +14,105 @@
 
 #include "SchedulingBase.h"
 
+#include "llvm/ADT/DenseMap.h"
+
 #define DEBUG_TYPE "vbe-fds"
 #include "llvm/Support/Debug.h"
 
+#include <queue>
+
 using namespace llvm;
 
 //===----------------------------------------------------------------------===//
+namespace {
+// The entry of the IMS queue, the time frame of the SU is captured when the
+// entry is pushed, so the order of the entries in the heap is not broken by
+// the time frame updates.
+struct IMSQueueEntry {
+  VSUnit *U;
+  unsigned ASAP, ALAP, Version;
+
+  IMSQueueEntry(VSUnit *U, const SchedulingBase &S, unsigned Version)
+    : U(U), ASAP(S.getASAPStep(U)), ALAP(S.getALAPStep(U)), Version(Version) {}
+};
+
 struct ims_sort {
-  SchedulingBase &Info;
-  ims_sort(SchedulingBase &s) : Info(s) {}
-  bool operator() (const VSUnit *LHS, const VSUnit *RHS) const;
+  bool operator() (const IMSQueueEntry &LHS, const IMSQueueEntry &RHS) const;
 };
+}
 
-bool ims_sort::operator()(const VSUnit* LHS, const VSUnit* RHS) const {
+bool ims_sort::operator()(const IMSQueueEntry &LHS,
+                          const IMSQueueEntry &RHS) const {
   // Schedule the sunit that taking non-trivial function unit first.
-  FuncUnitId LHSID = LHS->getFUId(), RHSID = RHS->getFUId();
+  FuncUnitId LHSID = LHS.U->getFUId(), RHSID = RHS.U->getFUId();
   if (!LHSID.isTrivial() && RHSID.isTrivial()) return false;
   if (LHSID.isTrivial() && !RHSID.isTrivial()) return true;
   // Schedule the schedule unit with less available function unit first.
   if (!LHSID.isBound() && RHSID.isBound()) return true;
   if (LHSID.isBound() && !RHSID.isBound()) return false;
 
-  unsigned LALAP = Info.getALAPStep(LHS), RALAP = Info.getALAPStep(RHS);
-  if (LALAP > RALAP) return true;
-  if (LALAP < RALAP) return false;
+  if (LHS.ALAP > RHS.ALAP) return true;
+  if (LHS.ALAP < RHS.ALAP) return false;
+
+  if (LHS.ASAP > RHS.ASAP) return true;
+  if (LHS.ASAP < RHS.ASAP) return false;
+
+  return LHS.U->getIdx() > RHS.U->getIdx();
+}
+
+namespace {
+// The queue of the SUs to be scheduled by IMS. Instead of rebuilding the time
+// frames and reheapifying the whole queue after each SU is placed, the time
+// frames are updated incrementally and only the SUs whose time frames are
+// touched are pushed again, the entries pushed before are dropped lazily.
+class IMSQueue {
+  std::priority_queue<IMSQueueEntry, std::vector<IMSQueueEntry>, ims_sort> Q;
+  DenseMap<const VSUnit*, unsigned> Versions;
+  SmallVector<const VSUnit*, 32> Changed;
+  SchedulingBase &S;
+
+public:
+  IMSQueue(SchedulingBase &S) : S(S) {}
+
+  void push(const VSUnit *U) {
+    // Only the SUs in the schedule graph are pushed, and we are going to
+    // schedule them.
+    Q.push(IMSQueueEntry(const_cast<VSUnit*>(U), S, ++Versions[U]));
+  }
+
+  // Return the SU with the highest priority, or null if the queue is empty.
+  VSUnit *pop() {
+    while (!Q.empty()) {
+      IMSQueueEntry E = Q.top();
+      Q.pop();
+
+      unsigned &Version = Versions[E.U];
+      // The time frame of the SU is changed after the entry is pushed.
+      if (E.Version != Version) continue;
+
+      // Invalidate the remaining entries of the SU.
+      ++Version;
+      return E.U;
+    }
+
+    return 0;
+  }
+
+  // Update the time frames after U is scheduled or unscheduled.
+  void update(const VSUnit *U) {
+    bool HasNegativeCycle = S.updateTimeFrame(U, &Changed);
+    assert(!HasNegativeCycle && "Unexpected negative cycle!");
+    (void) HasNegativeCycle;
+
+    if (!U->isScheduled()) push(U);
 
-  unsigned LASAP = Info.getASAPStep(LHS), RASAP = Info.getASAPStep(RHS);
-  if (LASAP > RASAP) return true;
-  if (LASAP < RASAP) return false;
+    for (unsigned i = 0, e = Changed.size(); i != e; ++i)
+      if (!Changed[i]->isScheduled())
+        push(Changed[i]);
 
-  return LHS->getIdx() > RHS->getIdx();
+    Changed.clear();
+  }
+};
 }
 
 typedef IterativeModuloScheduling::ScheduleResult ScheduleResult;
@@ -63,12 +132,12 @@ ScheduleResult IterativeModuloScheduling::scheduleLoop(){
   resetRT();
   ExcludeSlots.clear();
 
-  typedef PriorityQueue<VSUnit*, std::vector<VSUnit*>, ims_sort> IMSQueueType;
-  IMSQueueType ToSched(cp_begin(&G) + 1, cp_end(&G), ims_sort(*this));
-  while (!ToSched.empty()) {
-    VSUnit *A = ToSched.top();
-    ToSched.pop();
+  IMSQueue ToSched(*this);
+  ToSched.update(LoopOp);
+  for (iterator I = cp_begin(&G) + 1, E = cp_end(&G); I != E; ++I)
+    ToSched.push(*I);
 
+  while (VSUnit *A = ToSched.pop()) {
     unsigned EarliestUntry = 0;
     for (unsigned i = getASAPStep(A), e = getALAPStep(A) + 1; i != e; ++i) {
       if (!A->getFUId().isTrivial() && isStepExcluded(A, i))
@@ -101,14 +170,13 @@ ScheduleResult IterativeModuloScheduling::scheduleLoop(){
         excludeStep(Blocking, Blocking->getSlot());
 
         unscheduleSU(Blocking);
-        ToSched.push(Blocking);
+        ToSched.update(Blocking);
       }
 
       scheduleSU(A, EarliestUntry);
     }
 
-    buildTimeFrame();
-    ToSched.reheapify();
+    ToSched.update(A);
   }
   DEBUG(buildTimeFrame());
   DEBUG(dumpTimeFrame());
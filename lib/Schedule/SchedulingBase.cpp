@@ -17,11 +17,29 @@
 #include "vtm/Passes.h"
 
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Twine.h"
 
 #define DEBUG_TYPE "vbe-fd-info"
 #include "llvm/Support/Debug.h"
 
 using namespace llvm;
+
+static cl::opt<bool>
+VerifyRecMII("vtm-verify-recmii",
+             cl::desc("Cross check the RecMII computed by the cycle ratio "
+                      "solver against the Bellman-Ford bisection and the "
+                      "circuits enumerated by Johnson's algorithm"),
+             cl::Hidden, cl::init(false));
+
+static cl::opt<bool>
+VerifyTimeFrame("vtm-verify-time-frame",
+                cl::desc("Check the incrementally updated time frames against"
+                         " the time frames built from scratch"),
+                cl::Hidden, cl::init(false));
 //===----------------------------------------------------------------------===//
 template<bool IsCtrlPath>
 void Scheduler<IsCtrlPath>::resetTimeFrame() {
@@ -46,14 +64,15 @@ void Scheduler<IsCtrlPath>::buildTimeFrame() {
 
 template<bool IsCtrlPath>
 unsigned Scheduler<IsCtrlPath>::calculateASAP(const VSUnit * A) {
+  const VSchedGraphCSR &CSR = getCSR();
   unsigned NewStep = 0;
-  for (const_dep_it DI = dep_begin(A), DE = dep_end(A); DI != DE; ++DI) {
+  for (csr_it DI = CSR.dep_begin(A), DE = CSR.dep_end(A); DI != DE; ++DI) {
     const VSUnit *Dep = *DI;
     // Ignore the back-edges when we are not pipelining the BB.
     if (DI.isLoopCarried() && !MII) continue;
 
     unsigned DepASAP = Dep->isScheduled() ? Dep->getSlot() : getASAPStep(Dep);
-    int Step = DepASAP + DI.getLatency(MII);
+    int Step = DepASAP + DI.getLatency();
     DEBUG(dbgs() << "From ";
           if (DI.isLoopCarried()) dbgs() << "BackEdge ";
           Dep->print(dbgs());
@@ -67,6 +86,7 @@ unsigned Scheduler<IsCtrlPath>::calculateASAP(const VSUnit * A) {
 
 template<bool IsCtrlPath>
 bool Scheduler<IsCtrlPath>::buildASAPStep() {
+  const VSchedGraphCSR &CSR = getCSR();
   bool NeedToReCalc = true;
   unsigned NumCalcTimes = 0;
   const unsigned GraphSize = G.size<IsCtrlPath>();
@@ -98,7 +118,7 @@ bool Scheduler<IsCtrlPath>::buildASAPStep() {
 
       // We need to re-calculate the ASAP steps if the sink of the back-edges,
       // need to be update.
-      for (const_use_it UI = use_begin(A), UE = use_end(A); UI != UE; ++UI) {
+      for (csr_it UI = CSR.use_begin(A), UE = CSR.use_end(A); UI != UE; ++UI) {
         const VSUnit *Use = *UI;
         NeedToReCalc |= Use->getIdx() < A->getIdx()
                         && calculateASAP(Use) != getASAPStep(Use);
@@ -121,7 +141,7 @@ bool Scheduler<IsCtrlPath>::buildASAPStep() {
 }
 
 template<bool IsCtrlPath>
-unsigned Scheduler<IsCtrlPath>::computeRecMII(unsigned MinRecMII) {
+unsigned Scheduler<IsCtrlPath>::computeRecMIIByBisection(unsigned MinRecMII) {
   unsigned CriticalPathLength = getCriticalPathLength();
   unsigned MaxRecMII = CriticalPathLength;
   unsigned RecMII = 0;
@@ -150,26 +170,80 @@ unsigned Scheduler<IsCtrlPath>::computeRecMII(unsigned MinRecMII) {
   return RecMII;
 }
 
+template<bool IsCtrlPath>
+unsigned Scheduler<IsCtrlPath>::computeRecMII(unsigned MinRecMII) {
+  MinRecMII = std::max(1u, MinRecMII);
+  G.resetSchedule<IsCtrlPath>();
+
+  // Compact the graph, the scheduled nodes are not moved by the Bellman-Ford
+  // iteration and hence do not contribute to the recurrences.
+  DenseMap<const VSUnit*, unsigned> NodeIdx;
+  for (iterator I = begin(), E = end(); I != E; ++I)
+    if (!(*I)->isScheduled())
+      NodeIdx.insert(std::make_pair(*I, unsigned(NodeIdx.size())));
+
+  // The edge selected from the bundle does not depend on II once II is not
+  // zero.
+  const VSchedGraphCSR &CSR = G.getCSR<IsCtrlPath>(MinRecMII);
+  std::vector<RecMIIEdge> Edges;
+  for (iterator I = begin(), E = end(); I != E; ++I) {
+    const VSUnit *A = *I;
+    DenseMap<const VSUnit*, unsigned>::iterator DstAt = NodeIdx.find(A);
+    if (DstAt == NodeIdx.end()) continue;
+
+    for (csr_it DI = CSR.dep_begin(A), DE = CSR.dep_end(A); DI != DE; ++DI) {
+      DenseMap<const VSUnit*, unsigned>::iterator SrcAt = NodeIdx.find(*DI);
+      if (SrcAt == NodeIdx.end()) continue;
+
+      const VDEdge &Edge = DI.getEdge();
+      Edges.push_back(RecMIIEdge(SrcAt->second, DstAt->second,
+                                 Edge.getLatency(), Edge.getDistance()));
+    }
+  }
+
+  unsigned RecMII = computeCycleRatioRecMII(NodeIdx.size(), Edges, MinRecMII);
+  DEBUG(dbgs() << "RecMII: " << RecMII << '\n');
+
+  if (VerifyRecMII) {
+    unsigned BisectionRecMII = computeRecMIIByBisection(MinRecMII);
+    if (BisectionRecMII != RecMII)
+      report_fatal_error("RecMII mismatch: cycle ratio " + Twine(RecMII)
+                         + " vs. bisection " + Twine(BisectionRecMII));
+
+    // Johnson's algorithm ignores the back-edges that are hidden by
+    // intra-iteration edges in the same bundle, so only report the result.
+    DEBUG(if (IsCtrlPath) dbgs() << "RecMII from elementary circuits: "
+                                 << SchedulingBase::computeRecMII() << '\n');
+  }
+
+  assert(RecMII && RecMII <= getCriticalPathLength()
+         && "Negative cycle found even pipeline is disabled!");
+
+  return RecMII;
+}
+
 template<bool IsCtrlPath>
 unsigned Scheduler<IsCtrlPath>::calculateALAP(const VSUnit *A) {
+  const VSchedGraphCSR &CSR = getCSR();
   unsigned NewStep = VSUnit::MaxSlot;
-  for (const_use_it UI = use_begin(A), UE = use_end(A); UI != UE; ++UI) {
+  // The edges from A are also available in the use list of the CSR, so we do
+  // not need to look them up from the dependencies of the users.
+  for (csr_it UI = CSR.use_begin(A), UE = CSR.use_end(A); UI != UE; ++UI) {
     const VSUnit *Use = *UI;
-    VDEdge UseEdge = Use->getEdgeFrom<IsCtrlPath>(A, MII);
 
     // Ignore the back-edges when we are not pipelining the BB.
-    if (UseEdge.isLoopCarried() && !MII) continue;
+    if (UI.isLoopCarried() && !MII) continue;
 
     unsigned UseALAP = Use->isScheduled() ?
                        Use->getSlot() : getALAPStep(Use);
     if (UseALAP == 0) {
-      assert(UseEdge.isLoopCarried() && "Broken time frame!");
+      assert(UI.isLoopCarried() && "Broken time frame!");
       UseALAP = VSUnit::MaxSlot;
     }
 
-    unsigned Step = UseALAP - UseEdge.getLatency(MII);
+    unsigned Step = UseALAP - UI.getLatency();
     DEBUG(dbgs() << "From ";
-          if (UseEdge.isLoopCarried()) dbgs() << "BackEdge ";
+          if (UI.isLoopCarried()) dbgs() << "BackEdge ";
           Use->print(dbgs());
           dbgs() << " Step " << Step << '\n');
     NewStep = std::min(Step, NewStep);
@@ -180,6 +254,7 @@ unsigned Scheduler<IsCtrlPath>::calculateALAP(const VSUnit *A) {
 
 template<bool IsCtrlPath>
 void Scheduler<IsCtrlPath>::buildALAPStep() {
+  const VSchedGraphCSR &CSR = getCSR();
   const VSUnit *Exit = G.getExitRoot();
   int LastSlot = CriticalPathEnd;
   SUnitToTF[Exit].second = LastSlot;
@@ -211,7 +286,7 @@ void Scheduler<IsCtrlPath>::buildALAPStep() {
       assert(getASAPStep(A) <= NewStep && "Broken ALAP step!");
       ALAPStep = NewStep;
 
-      for (const_dep_it DI = dep_begin(A), DE = dep_end(A); DI != DE; ++DI) {
+      for (csr_it DI = CSR.dep_begin(A), DE = CSR.dep_end(A); DI != DE; ++DI) {
         const VSUnit *Dep = *DI;
         NeedToReCalc |= A->getIdx() < Dep->getIdx()
                         && calculateALAP(Dep) != getALAPStep(Dep);
@@ -220,6 +295,234 @@ void Scheduler<IsCtrlPath>::buildALAPStep() {
   }
 }
 
+template<bool IsCtrlPath>
+void Scheduler<IsCtrlPath>::resetASAPRegion(const VSUnit *U,
+                                            TFWorklistTy &Worklist,
+                                            TFChangeListTy *Changed) {
+  const VSchedGraphCSR &CSR = getCSR();
+  SmallVector<const VSUnit*, 32> Stack;
+  SmallPtrSet<const VSUnit*, 32> Visited;
+  Stack.push_back(U);
+  Visited.insert(U);
+
+  while (!Stack.empty()) {
+    const VSUnit *A = Stack.pop_back_val();
+    Worklist.insert(A);
+
+    if (!A->isScheduled()) {
+      SUnitToTF[A].first = 0;
+      if (Changed) Changed->push_back(A);
+    } else if (A != U)
+      // The ASAP steps of the scheduled SUs are fixed, and so are the steps
+      // only reachable through them.
+      continue;
+
+    for (csr_it UI = CSR.use_begin(A), UE = CSR.use_end(A); UI != UE; ++UI)
+      if (Visited.insert(*UI))
+        Stack.push_back(*UI);
+  }
+}
+
+template<bool IsCtrlPath>
+void Scheduler<IsCtrlPath>::resetALAPRegion(const VSUnit *U,
+                                            TFWorklistTy &Worklist,
+                                            TFChangeListTy *Changed) {
+  const VSchedGraphCSR &CSR = getCSR();
+  const VSUnit *Exit = G.getExitRoot();
+  SmallVector<const VSUnit*, 32> Stack;
+  SmallPtrSet<const VSUnit*, 32> Visited;
+  Stack.push_back(U);
+  Visited.insert(U);
+
+  while (!Stack.empty()) {
+    const VSUnit *A = Stack.pop_back_val();
+    Worklist.insert(A);
+
+    // The ALAP step of the exit root is always the end of the critical path.
+    if (!A->isScheduled() && A != Exit) {
+      SUnitToTF[A].second = VSUnit::MaxSlot;
+      if (Changed) Changed->push_back(A);
+    } else if (A != U)
+      continue;
+
+    for (csr_it DI = CSR.dep_begin(A), DE = CSR.dep_end(A); DI != DE; ++DI)
+      if (Visited.insert(*DI))
+        Stack.push_back(*DI);
+  }
+}
+
+template<bool IsCtrlPath>
+bool Scheduler<IsCtrlPath>::propagateASAP(TFWorklistTy &Worklist,
+                                          TFChangeListTy *Changed) {
+  const VSchedGraphCSR &CSR = getCSR();
+  const unsigned GraphSize = G.size<IsCtrlPath>();
+  DenseMap<const VSUnit*, unsigned> NumUpdates;
+
+  while (!Worklist.empty()) {
+    const VSUnit *A = *Worklist.begin();
+    Worklist.erase(Worklist.begin());
+
+    unsigned NewStep = A->isScheduled() ? A->getSlot() : calculateASAP(A);
+    unsigned &ASAPStep = SUnitToTF[A].first;
+    if (ASAPStep == NewStep) continue;
+
+    // Like the Bellman-Ford algorithm, the step of a SU keeps increasing if it
+    // is in a negative cycle.
+    if (++NumUpdates[A] > GraphSize) return true;
+
+    DEBUG(dbgs() << "Update ASAP step from " << ASAPStep << " to " << NewStep
+                 << " for ";
+          A->print(dbgs());
+          dbgs() << '\n');
+    ASAPStep = NewStep;
+    if (Changed) Changed->push_back(A);
+
+    for (csr_it UI = CSR.use_begin(A), UE = CSR.use_end(A); UI != UE; ++UI)
+      if (!UI->isScheduled())
+        Worklist.insert(*UI);
+  }
+
+  return false;
+}
+
+template<bool IsCtrlPath>
+bool Scheduler<IsCtrlPath>::propagateALAP(TFWorklistTy &Worklist,
+                                          TFChangeListTy *Changed) {
+  const VSchedGraphCSR &CSR = getCSR();
+  const VSUnit *Exit = G.getExitRoot();
+
+  while (!Worklist.empty()) {
+    TFWorklistTy::iterator Last = llvm::prior(Worklist.end());
+    const VSUnit *A = *Last;
+    Worklist.erase(Last);
+
+    unsigned NewStep;
+    if (A == Exit)
+      NewStep = CriticalPathEnd;
+    else if (A->isScheduled())
+      NewStep = A->getSlot();
+    else
+      NewStep = calculateALAP(A);
+
+    unsigned &ALAPStep = SUnitToTF[A].second;
+    if (ALAPStep == NewStep) continue;
+    assert((A == Exit || A->isScheduled() || getASAPStep(A) <= NewStep)
+           && "Broken ALAP step!");
+
+    DEBUG(dbgs() << "Update ALAP step from " << ALAPStep << " to " << NewStep
+                 << " for ";
+          A->print(dbgs());
+          dbgs() << '\n');
+    ALAPStep = NewStep;
+    if (Changed) Changed->push_back(A);
+
+    for (csr_it DI = CSR.dep_begin(A), DE = CSR.dep_end(A); DI != DE; ++DI)
+      if (!DI->isScheduled() && *DI != Exit)
+        Worklist.insert(*DI);
+  }
+
+  return false;
+}
+
+template<bool IsCtrlPath>
+bool Scheduler<IsCtrlPath>::propagateTimeFrame(TFWorklistTy &ASAPWorklist,
+                                               TFWorklistTy &ALAPWorklist,
+                                               TFChangeListTy *Changed) {
+  if (propagateASAP(ASAPWorklist, Changed)) return true;
+
+  const VSUnit *Exit = G.getExitRoot();
+  if (IsCtrlPath && getASAPStep(Exit) > CriticalPathEnd) {
+    CriticalPathEnd = getASAPStep(Exit);
+    // The ALAP steps are bounded by the end of the critical path, and they
+    // increase together with it.
+    resetALAPRegion(Exit, ALAPWorklist, Changed);
+  }
+
+  return propagateALAP(ALAPWorklist, Changed);
+}
+
+template<bool IsCtrlPath>
+bool Scheduler<IsCtrlPath>::updateTimeFrame(const VSUnit *U,
+                                            TFChangeListTy *Changed) {
+  TFWorklistTy ASAPWorklist, ALAPWorklist;
+
+  if (U->isScheduled()) {
+    unsigned Slot = U->getSlot();
+    // Scheduling U inside its time frame only shrinks the time frames, which
+    // is handled by propagating the changes from U. Otherwise some steps
+    // may move away from their bounds and need to be recomputed.
+    if (Slot >= getASAPStep(U)) ASAPWorklist.insert(U);
+    else                        resetASAPRegion(U, ASAPWorklist, Changed);
+
+    if (Slot <= getALAPStep(U)) ALAPWorklist.insert(U);
+    else                        resetALAPRegion(U, ALAPWorklist, Changed);
+  } else {
+    // The time frames reachable from U may grow after U is unscheduled.
+    resetASAPRegion(U, ASAPWorklist, Changed);
+    resetALAPRegion(U, ALAPWorklist, Changed);
+  }
+
+  if (propagateTimeFrame(ASAPWorklist, ALAPWorklist, Changed)) {
+    // The update bound is not tight for the order of the worklist, confirm
+    // the negative cycle by the Bellman-Ford like algorithm.
+    resetTimeFrame();
+    if (buildASAPStep()) return true;
+    buildALAPStep();
+    if (Changed) Changed->append(begin(), end());
+  }
+
+  if (VerifyTimeFrame) verifyTimeFrame();
+
+  return false;
+}
+
+template<bool IsCtrlPath>
+bool Scheduler<IsCtrlPath>::updateTimeFrame(const VSUnit *Src,
+                                            const VSUnit *Dst,
+                                            TFChangeListTy *Changed) {
+  TFWorklistTy ASAPWorklist, ALAPWorklist;
+  // The new edge can only push Dst later and pull Src earlier.
+  ASAPWorklist.insert(Dst);
+  ALAPWorklist.insert(Src);
+
+  if (propagateTimeFrame(ASAPWorklist, ALAPWorklist, Changed)) {
+    resetTimeFrame();
+    if (buildASAPStep()) return true;
+    buildALAPStep();
+    if (Changed) Changed->append(begin(), end());
+  }
+
+  if (VerifyTimeFrame) verifyTimeFrame();
+
+  return false;
+}
+
+template<bool IsCtrlPath>
+void Scheduler<IsCtrlPath>::verifyTimeFrame() {
+  TFMapTy IncrementalTF(SUnitToTF);
+  unsigned IncrementalCPEnd = CriticalPathEnd;
+
+  buildTimeFrame();
+
+  if (CriticalPathEnd != IncrementalCPEnd)
+    report_fatal_error("Critical path end mismatch: incremental "
+                       + Twine(IncrementalCPEnd) + " vs. rebuilt "
+                       + Twine(CriticalPathEnd));
+
+  for (iterator I = begin(), E = end(); I != E; ++I) {
+    const VSUnit *A = *I;
+    const TimeFrame &Expected = SUnitToTF[A], &TF = IncrementalTF[A];
+    if (TF == Expected) continue;
+
+    DEBUG(printTimeFrame(dbgs()));
+    report_fatal_error("Time frame mismatch for SU " + Twine(unsigned(A->getIdx()))
+                       + ": incremental {" + Twine(TF.first) + ","
+                       + Twine(TF.second) + "} vs. rebuilt {"
+                       + Twine(Expected.first) + "," + Twine(Expected.second)
+                       + "}");
+  }
+}
+
 template<bool IsCtrlPath>
 void Scheduler<IsCtrlPath>::printSUTimeFrame(raw_ostream &OS,
                                              const VSUnit *A) const {
@@ -260,32 +563,43 @@ template class Scheduler<false>;
 unsigned SchedulingBase::computeResMII() {
   // FIXME: Compute the resource area cost
   std::map<FuncUnitId, unsigned> TotalResUsage;
+  unsigned MaxResII = 0;
   for (iterator I = cp_begin(&G), E = cp_end(&G); I != E; ++I) {
     const VSUnit *SU = *I;
-    if (!SU->getFUId().isBound()) continue;
+    if (!SU->getFUId().isBound()) {
+      // The divider is not bound before scheduling, but the division of the
+      // next iteration cannot start before the iterative divider finish the
+      // division of the current iteration, because both of them are bound to
+      // the same divider.
+      if (SU->getFUType() == VFUs::Div)
+        MaxResII = std::max(MaxResII, SU->getFUOccupancy());
+      continue;
+    }
 
-    ++TotalResUsage[SU->getFUId()];
+    TotalResUsage[SU->getFUId()] += SU->getFUOccupancy();
   }
 
-  unsigned MaxResII = 0;
   typedef std::map<FuncUnitId, unsigned>::iterator UsageIt;
   for (UsageIt I = TotalResUsage.begin(), E = TotalResUsage.end(); I != E; ++I){
-    /*There is only 1 resource avaialbe for Prebound function unit kind*/
-    const unsigned NumFUs = 1;
-    MaxResII = std::max(MaxResII, I->second / NumFUs);
+    // There is only 1 resource avaialbe for Prebound function unit kind, but
+    // it may have more than 1 port.
+    const unsigned NumPorts = I->first.getNumPorts();
+    MaxResII = std::max(MaxResII, (I->second + NumPorts - 1) / NumPorts);
   }
   DEBUG(dbgs() << "ResMII: " << MaxResII << '\n');
   return MaxResII;
 }
 
 SchedulingBase::InstSetTy::const_iterator
-SchedulingBase::findConflictedInst(const InstSetTy &Set, const MachineInstr *MI) {
+SchedulingBase::findConflictedInst(const InstSetTy &Set, const MachineInstr *MI,
+                                   unsigned NumPorts) {
   typedef InstSetTy::const_iterator it;
   it I = Set.begin(), E = Set.end();
   const MachineBasicBlock *MIParent = MI->getParent();
 
   while (I != E) {
-    if (MIParent == (*I)->getParent() && !VInstrInfo::isPredicateMutex(MI, *I))
+    if (MIParent == (*I)->getParent() && !VInstrInfo::isPredicateMutex(MI, *I)
+        && --NumPorts == 0)
       return I;
 
     ++I;
@@ -299,7 +613,8 @@ void SchedulingBase::takeFU(const MachineInstr *MI, unsigned step,
   for (unsigned i = step, e = step + Latency; i != e; ++i) {
     unsigned s = computeStepKey(i);
     InstSetTy &InstSet = getRTFor(s, FU);
-    assert(!hasConflictedInst(InstSet, MI) && "FU conflict detected!");
+    assert(!hasConflictedInst(InstSet, MI, FU.getNumPorts())
+           && "FU conflict detected!");
     InstSet.push_back(MI);
   }
 }
@@ -311,7 +626,7 @@ void SchedulingBase::takeFU(const VSUnit *U, unsigned step) {
   FuncUnitId FU = VInstrInfo::getPreboundFUId(MI);
   if (FU.isTrivial()) return;
 
-  takeFU(MI, step, U->getLatency(), FU);
+  takeFU(MI, step, U->getFUOccupancy(), FU);
 
   // Take the FU of DstMux.
   //for (unsigned i = 1, e = U->num_instrs(); i < e; ++i) {
@@ -330,7 +645,8 @@ SchedulingBase::getConflictedInst(const MachineInstr *MI,unsigned step,
   for (unsigned i = step, e = step + Latency; i != e; ++i) {
     unsigned CurSlot = computeStepKey(i);
     InstSetTy &InstSet = getRTFor(CurSlot, FU);
-    if (const MachineInstr *OtherMI = getConflictedInst(InstSet, MI))
+    if (const MachineInstr *OtherMI =
+          getConflictedInst(InstSet, MI, FU.getNumPorts()))
       return OtherMI;
   }
 
@@ -345,7 +661,7 @@ const MachineInstr *SchedulingBase::getConflictedInst(const VSUnit *U,
   FuncUnitId FU = VInstrInfo::getPreboundFUId(MI);
   if (FU.isTrivial()) return 0;
 
-  return getConflictedInst(MI, step, U->getLatency(), FU);
+  return getConflictedInst(MI, step, U->getFUOccupancy(), FU);
 }
 
 bool SchedulingBase::tryTakeResAtStep(const VSUnit *U, unsigned step) {
@@ -380,7 +696,7 @@ void SchedulingBase::revertFUUsage(const VSUnit *U, unsigned step) {
   // We will always have enough trivial resources.
   if (FU.isTrivial()) return;
 
-  revertFUUsage(U->getRepresentativePtr(), step, U->getLatency(), FU);
+  revertFUUsage(U->getRepresentativePtr(), step, U->getFUOccupancy(), FU);
   // Revert the Usage of DstMux.
   //for (unsigned i = 1, e = U->num_instrs(); i < e; ++i) {
   //  MachineInstr *MI = U->getInstrAt(i);
@@ -15,18 +15,34 @@
 #define VBE_FORCE_DIRECTED_INFO
 
 #include "VSUnit.h"
+#include "SDCSolver.h"
 
 #include "llvm/ADT/PriorityQueue.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/SmallSet.h"
 #include <map>
+#include <set>
+#include <vector>
 using namespace llvm;
 
-//Dirty Hack
-struct _lprec;
-typedef _lprec lprec;
-
 namespace llvm {
+// The recurrence edge in the compacted dependence graph for RecMII computation.
+struct RecMIIEdge {
+  unsigned Src, Dst;
+  int Latency, Distance;
+
+  RecMIIEdge(unsigned Src, unsigned Dst, int Latency, int Distance)
+    : Src(Src), Dst(Dst), Latency(Latency), Distance(Distance) {}
+};
+
+// Compute the minimal II, not smaller than MinRecMII, that satisfies all
+// recurrences in the graph by solving the maximum cycle ratio problem on each
+// strongly connected component, return 0 if some recurrence cannot be
+// satisfied by any II.
+unsigned computeCycleRatioRecMII(unsigned NumNodes,
+                                 const std::vector<RecMIIEdge> &Edges,
+                                 unsigned MinRecMII);
+
 class SchedulingBase {
 protected:
   // MII in modulo schedule.
@@ -37,23 +53,28 @@ public:
   typedef std::pair<unsigned, unsigned> TimeFrame;
 private:
   typedef SmallVector<const MachineInstr*, 4> InstSetTy;
+  // Find the instruction in the set that takes the last free port of the FU,
+  // i.e. MI conflicts with it and NumPorts - 1 other instructions in the set.
   static InstSetTy::const_iterator findConflictedInst(const InstSetTy &Set,
-                                                      const MachineInstr *MI);
+                                                      const MachineInstr *MI,
+                                                      unsigned NumPorts);
   static const MachineInstr *getConflictedInst(const InstSetTy &S,
-                                               const MachineInstr *MI) {
-    InstSetTy::const_iterator at = findConflictedInst(S, MI);
+                                               const MachineInstr *MI,
+                                               unsigned NumPorts) {
+    InstSetTy::const_iterator at = findConflictedInst(S, MI, NumPorts);
     return at != S.end() ? *at : 0;
   }
 
-  bool hasConflictedInst(const InstSetTy &Set, const MachineInstr *MI) {
-    // Nothing to conflict if the set is empty.
-    if (Set.empty()) return false;
+  bool hasConflictedInst(const InstSetTy &Set, const MachineInstr *MI,
+                         unsigned NumPorts) {
+    // Nothing to conflict if there is any free port.
+    if (Set.size() < NumPorts) return false;
 
     // Even the two MIs not in the same trace, the different trace may active at
     // the same time in different iterations.
     if (G.enablePipeLine()) return true;
 
-    return findConflictedInst(Set, MI) != Set.end();
+    return findConflictedInst(Set, MI, NumPorts) != Set.end();
   }
 
   // Remember the Instructions those are scheduled to a particular step.
@@ -107,6 +128,19 @@ public:
   unsigned getTimeFrame(const VSUnit *A) const {
     return getALAPStep(A) - getASAPStep(A) + 1;
   }
+
+  // The SUs whose time frames are touched by an incremental update, a SU may
+  // appear more than once, or even end up with its original time frame.
+  typedef SmallVectorImpl<const VSUnit*> TFChangeListTy;
+
+  // Update the time frames after U is scheduled or unscheduled, only the SUs
+  // that are affected by U are visited instead of rebuilding the time frames
+  // of the whole graph. Return true if negative cycle found.
+  virtual bool updateTimeFrame(const VSUnit *U, TFChangeListTy *Changed = 0)
+    = 0;
+  // Update the time frames after a dependence edge from Src to Dst is added.
+  virtual bool updateTimeFrame(const VSUnit *Src, const VSUnit *Dst,
+                               TFChangeListTy *Changed = 0) = 0;
   //}
 
   void resetRT() {
@@ -177,6 +211,13 @@ protected:
     return U->use_end<IsCtrlPath>();
   }
 
+  // The CSR form of the frozen dependencies graph, with the edges selected for
+  // the current MII, the time frames are built by traversing this form.
+  typedef VSchedGraphCSR::edge_iterator csr_it;
+  const VSchedGraphCSR &getCSR() const {
+    return G.getCSR<IsCtrlPath>(MII);
+  }
+
   unsigned calculateASAP(const VSUnit *A);
   // Apply the Bellman-Ford like algorithm at most |V|-1 times, return true if
   // negative cycle found.
@@ -184,6 +225,35 @@ protected:
   unsigned calculateALAP(const VSUnit *A);
   void buildALAPStep();
 
+  /// @name Incremental time frame maintenance
+  //{
+  // The worklist of the incremental update, the SUs are visited in the
+  // topological order when we propagate the ASAP steps, and in the reverse
+  // topological order when we propagate the ALAP steps.
+  struct idx_less {
+    bool operator()(const VSUnit *LHS, const VSUnit *RHS) const {
+      if (LHS->getIdx() != RHS->getIdx()) return LHS->getIdx() < RHS->getIdx();
+      return LHS < RHS;
+    }
+  };
+  typedef std::set<const VSUnit*, idx_less> TFWorklistTy;
+
+  // The steps of the SUs reachable from U may decrease after U is unscheduled,
+  // reset them to the bound so that they are recomputed from scratch,
+  // otherwise the recurrences keep the old steps of each other.
+  void resetASAPRegion(const VSUnit *U, TFWorklistTy &Worklist,
+                       TFChangeListTy *Changed);
+  void resetALAPRegion(const VSUnit *U, TFWorklistTy &Worklist,
+                       TFChangeListTy *Changed);
+  // Recompute the steps of the SUs in the worklist and propagate the changes
+  // until nothing changes, return true if negative cycle found.
+  bool propagateASAP(TFWorklistTy &Worklist, TFChangeListTy *Changed);
+  bool propagateALAP(TFWorklistTy &Worklist, TFChangeListTy *Changed);
+  bool propagateTimeFrame(TFWorklistTy &ASAPWorklist,
+                          TFWorklistTy &ALAPWorklist,
+                          TFChangeListTy *Changed);
+  //}
+
   using SchedulingBase::scheduleCriticalPath;
 public:
 
@@ -198,6 +268,13 @@ public:
   unsigned buildTimeFrameAndResetSchedule(bool reset);
   void resetTimeFrame();
   void buildTimeFrame();
+
+  bool updateTimeFrame(const VSUnit *U, TFChangeListTy *Changed = 0);
+  bool updateTimeFrame(const VSUnit *Src, const VSUnit *Dst,
+                       TFChangeListTy *Changed = 0);
+  // Check the incrementally updated time frames against the time frames
+  // built from scratch.
+  void verifyTimeFrame();
   void printSUTimeFrame(raw_ostream &OS, const VSUnit *A) const;
 
   void printTimeFrame(raw_ostream &OS) const {
@@ -216,6 +293,10 @@ public:
   // Find the minimal II which can eliminate the negative cycles. Where we
   // detect negative cycles by applying Bellman-Ford like algorithm at most
   // |V|-1 times to see if the ASAP steps convergence.
+  unsigned computeRecMIIByBisection(unsigned MinRecMII);
+
+  // Find the minimal II which can eliminate the negative cycles by computing
+  // the maximum cycle ratio of the dependence graph.
   unsigned computeRecMII(unsigned MinRecMII);
 
   void viewGraph() {
@@ -277,9 +358,11 @@ protected:
   }
 
   void addLinOrdEdge(ConflictListTy &ConflictList);
-  // Add the linear ordering edges to the SUs in the vector and return the first
-  // SU.
-  VSUnit *addLinOrdEdge(SUVecTy &SUs);
+  // Add the linear ordering edges to the SUs in the vector whose index is
+  // FirstIdx + k * Stride, and return the first SU.
+  VSUnit *addLinOrdEdge(const SUVecTy &SUs, unsigned FirstIdx, unsigned Stride);
+  // Update the time frames after the linear order edge from Src to Dst added.
+  void updateTimeFrame(const VSUnit *Src, const VSUnit *Dst);
 
   explicit BasicLinearOrderGenerator(SchedulingBase &S) : S(S) {}
 
@@ -326,7 +409,7 @@ public:
 
 protected:
   const unsigned ScheduleLB;
-  lprec *lp;
+  SDCSolver *Solver;
 
   // Helper class to build the object function for lp.
   struct LPObjFn : public std::map<unsigned, double> {
@@ -343,8 +426,6 @@ protected:
 
       return *this;
     }
-
-    void setLPObj(lprec *lp) const;
   };
 
   LPObjFn ObjFn;
@@ -354,7 +435,67 @@ protected:
   typedef SUI2IdxMapTy::const_iterator SUIdxIt;
   SUI2IdxMapTy SUIdx;
 
-  SDCSchedulingBase(unsigned ScheduleLB) : ScheduleLB(ScheduleLB), lp(0) {}
+  // The variables in the model, we need them to rebuild the model when we fall
+  // back to the general LP solver.
+  struct SDCColumn {
+    std::string Name;
+    int LB;
+    bool IsSlack;
+  };
+  std::vector<SDCColumn> Columns;
+  void addVariable(unsigned Col, const std::string &Name, int LB, bool IsSlack);
+
+  /// @name Incremental model maintenance
+  //{
+  // The difference constraint currently stored in a row of the model, the row
+  // is identified by the source, the sink and the slack column (0 for the hard
+  // constraints) of the constraint.
+  struct SDCRow {
+    unsigned Row;
+    int RHS;
+    bool IsEq;
+    // The columns and the coefficients, there are at most 3 columns in a row:
+    // Dst, Src and the slack variable.
+    SmallVector<int, 3> Cols;
+    SmallVector<int, 3> Coeffs;
+    // Is the row still used by the current set of constraints?
+    bool Live;
+
+    bool hasSameStructure(ArrayRef<int> C, ArrayRef<int> Coeff, bool Eq) const;
+  };
+
+  typedef std::pair<std::pair<const VSUnit*, const VSUnit*>, unsigned> RowKeyTy;
+  static RowKeyTy getRowKey(const VSUnit *Src, const VSUnit *Dst,
+                            unsigned SlackIdx = 0) {
+    return std::make_pair(std::make_pair(Src, Dst), SlackIdx);
+  }
+
+  typedef std::map<RowKeyTy, SDCRow> RowMapTy;
+  RowMapTy Rows;
+  // Are we building the model from scratch?
+  bool BuildingFromScratch;
+  // Keep the model alive after the schedule is built, so the next schedule
+  // iteration only updates the changed constraints. Only enabled by the
+  // schedulers that solve the model again and again.
+  bool Incremental;
+  // The rows to be deleted at the end of the update.
+  std::vector<unsigned> DeadRows;
+
+  // Add or update the difference constraint identified by Key.
+  void addConstraint(RowKeyTy Key, ArrayRef<int> Cols, ArrayRef<int> Coeffs,
+                     bool IsEq, int RHS);
+  // Prepare the row table before the constraints are synchronized with the
+  // scheduling graph.
+  void beginConstraintUpdate();
+  // Delete the rows that are not used by the current constraints.
+  void endConstraintUpdate();
+  //}
+
+  SDCSchedulingBase(unsigned ScheduleLB)
+    : ScheduleLB(ScheduleLB), Solver(0), BuildingFromScratch(true),
+      Incremental(false) {}
+
+  ~SDCSchedulingBase();
 
   typedef std::vector<SoftConstraint> SoftCstrVecTy;
   SoftCstrVecTy SoftCstrs;
@@ -363,18 +504,29 @@ protected:
   // scheduled to.
   unsigned createStepVariable(const VSUnit *U, unsigned Col);
 
-  void addSoftConstraints(lprec *lp);
+  void addSoftConstraints();
+
+  // Rebuild the current model with the general LP solver.
+  void switchToLPSolve();
 
-  bool solveLP(lprec *lp);
+  bool solveLP();
 
   // Build the schedule form the result of ILP.
-  void buildSchedule(lprec *lp, unsigned TotalRows, iterator I, iterator E);
+  void buildSchedule(iterator I, iterator E);
+
+  // Throw away the model after the schedule is built.
+  void releaseModel();
 };
 
 template<bool IsCtrlPath>
 class SDCScheduler : public SDCSchedulingBase, public Scheduler<IsCtrlPath> {
   // The schedule should satisfy the dependences.
-  void addDependencyConstraints(lprec *lp);
+  void addDependencyConstraints();
+
+protected:
+  // Add the constraints that are not carried by the edges of the scheduling
+  // graph.
+  virtual void addExtraConstraints() {}
 
   using Scheduler<IsCtrlPath>::G;
   typedef typename Scheduler<IsCtrlPath>::const_dep_it const_dep_it;
@@ -383,6 +535,8 @@ class SDCScheduler : public SDCSchedulingBase, public Scheduler<IsCtrlPath> {
   typedef typename Scheduler<IsCtrlPath>::const_use_it const_use_it;
   using Scheduler<IsCtrlPath>::use_begin;
   using Scheduler<IsCtrlPath>::use_end;
+  typedef typename Scheduler<IsCtrlPath>::csr_it csr_it;
+  using Scheduler<IsCtrlPath>::getCSR;
 
   using Scheduler<IsCtrlPath>::begin;
   using Scheduler<IsCtrlPath>::end;
@@ -407,5 +561,51 @@ public:
 
 EXTERN_TEMPLATE_INSTANTIATION(class SDCScheduler<false>);
 EXTERN_TEMPLATE_INSTANTIATION(class SDCScheduler<true>);
+
+// The modulo SDC scheduler, which schedule the loop body with the loop-carried
+// dependencies formulated as sv_dst - sv_src >= latency - II * distance, and
+// resolve the conflicts in the modulo reservation table by adding linear order
+// edges incrementally.
+class SDCModuloScheduler : public SDCScheduler<true> {
+  // The linear order edges that order the conflicted SUs, they are only valid
+  // for the current II, so they are added to the model as constraints instead
+  // of being added to the scheduling graph.
+  struct ModuloLinOrdEdge {
+    const VSUnit *Src, *Dst;
+    VDEdge Edge;
+
+    ModuloLinOrdEdge(const VSUnit *Src, const VSUnit *Dst, VDEdge Edge)
+      : Src(Src), Dst(Dst), Edge(Edge) {}
+  };
+  std::vector<ModuloLinOrdEdge> ModuloLinOrdEdges;
+
+  // The slack index in the row key of the modulo linear order constraints,
+  // which distinguishes them from the constraints of the graph edges between
+  // the same SUs.
+  enum { ModuloLinOrdRow = ~0u };
+
+  // Order the SUs that conflict in the modulo reservation table, so that they
+  // occupy the FU in disjoint slots modulo II, return true if no conflict is
+  // found.
+  bool resolveFUConflicts();
+  void addModuloLinOrdEdge(VSUnit *Earlier, VSUnit *Later);
+
+protected:
+  void addExtraConstraints();
+
+public:
+  explicit SDCModuloScheduler(VSchedGraph &S);
+
+  // The conflicts are resolved again for each II, drop the linear order edges
+  // of the previous II.
+  void setMII(unsigned II) {
+    SDCScheduler<true>::setMII(II);
+    ModuloLinOrdEdges.clear();
+  }
+
+  // Schedule the loop with the current MII, return false if the MII is too
+  // small.
+  bool scheduleLoop();
+};
 } // End namespace.
 #endif
@@ -18,11 +18,13 @@
 #include "vtm/Passes.h"
 #include "vtm/VFInfo.h"
 #include "vtm/VerilogBackendMCTargetDesc.h"
+#include "vtm/BBProfile.h"
 
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/CodeGen/MachineMemOperand.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
 #include "llvm/CodeGen/MachineFunction.h"
@@ -33,6 +35,7 @@
 #include "llvm/CodeGen/MachineDominators.h"
 #include "llvm/CodeGen/PseudoSourceValue.h"
 #include "llvm/CodeGen/MachineBlockFrequencyInfo.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/DepthFirstIterator.h"
@@ -49,7 +52,24 @@ EnableDangling("vtm-enable-dangling",
           cl::desc("Enable cross BasicBlock chain"),
           cl::init(true));
 
+static cl::opt<unsigned>
+MemDepWindow("vtm-mem-dep-window",
+             cl::desc("Number of preceding memory operations in the same "
+                      "bucket to query the alias information, the earlier "
+                      "ones are chained through a barrier"),
+             cl::init(256));
+
 STATISTIC(MutexPredNoAlias, "Number of no-alias because of mutex predicate");
+STATISTIC(NumAliasQueries, "Number of alias queries for memory dependencies");
+STATISTIC(NumAliasCacheHits, "Number of alias queries answered by the cache");
+STATISTIC(NumMemDepBarriers,
+          "Number of memory operations that chain the earlier operations in "
+          "the same bucket");
+STATISTIC(NumPHIChains,
+          "Number of PHI-of-PHI recurrences in the pipelined loops");
+STATISTIC(NumProfiledBlocks,
+          "Number of blocks weighted by the profiled frequency in the SDC "
+          "objective");
 //===----------------------------------------------------------------------===//
 namespace {
 /// @brief Schedule the operations.
@@ -68,6 +88,10 @@ struct VPreRegAllocSched : public MachineFunctionPass {
   // Also remember the operations that do not use by any others operations in
   // the same bb.
   std::set<const MachineInstr*> MIsToWait, MIsToRead;
+  // The alias results shared between the global scheduling graph and the local
+  // graphs built for software pipelining.
+  typedef std::pair<MachineMemOperand*, MachineMemOperand*> MemOpPairTy;
+  DenseMap<MemOpPairTy, bool> AliasCache;
 
   VPreRegAllocSched() : MachineFunctionPass(ID), TII(0), MRI(0), FInfo(0),
       MLI(0), MDT(0), LI(0), AA(0), SE(0) {
@@ -119,6 +143,28 @@ struct VPreRegAllocSched : public MachineFunctionPass {
            ? 0 : G.lookupSUnit(Dep);
   }
 
+  bool isMemOpAlias(MachineMemOperand *LHS, MachineMemOperand *RHS);
+
+  void addMemDep(VSchedGraph &G, MachineMemOperand *SrcMO, VSUnit *SrcU,
+                 MachineMemOperand *DstMO, VSUnit *DstU, Loop *IRL);
+
+  // The schedule unit and the corresponding memory operand.
+  typedef std::vector<std::pair<MachineMemOperand*, VSUnit*> > MemOpVecTy;
+  // The memory operations that may alias with each other, in program order.
+  // Only the operations since the last barrier are queried, the earlier
+  // operations are ordered before the barrier.
+  struct MemOpBucket {
+    MemOpVecTy Ops;
+    VSUnit *Barrier;
+
+    MemOpBucket() : Barrier(0) {}
+  };
+
+  void addMemDepsInBucket(VSchedGraph &G, MemOpBucket &B,
+                          MachineMemOperand *DstMO, VSUnit *DstU, Loop *IRL);
+  void insertIntoBucket(VSchedGraph &G, MemOpBucket &B,
+                        MachineMemOperand *DstMO, VSUnit *DstU);
+
   void buildMemDepEdges(VSchedGraph &G, ArrayRef<VSUnit*> SUs);
 
   bool couldBePipelined(const MachineBasicBlock *MBB);
@@ -142,6 +188,9 @@ struct VPreRegAllocSched : public MachineFunctionPass {
   void buildDataPathGraph(VSchedGraph &G, ArrayRef<VSUnit*> NewSUs);
 
   void buildPipeLineDepEdges(VSchedGraph &G);
+  // Add the dependences for the PHIs whose loop carried incoming value is
+  // another PHI in the pipelined block.
+  void addPHIChainDeps(VSchedGraph &G, VSUnit *PHISU);
 
   typedef MachineBasicBlock::iterator instr_it;
   void buildExitRoot(VSchedGraph &G, MachineInstr *FirstTerminator,
@@ -169,6 +218,10 @@ struct VPreRegAllocSched : public MachineFunctionPass {
                          MachineBasicBlock *VExit);
   void schedule(VSchedGraph &G);
 
+  // Record the slots and the estimated cycles of the schedule to the script
+  // engine.
+  void recordScheduleMetrics(MachineFunction &MF) const;
+
   // Remove redundant code after schedule emitted.
   void cleanUpSchedule();
   bool cleanUpRegisterClass(unsigned RegNum, const TargetRegisterClass *RC);
@@ -228,6 +281,7 @@ bool VPreRegAllocSched::runOnMachineFunction(MachineFunction &MF) {
   MDT= &getAnalysis<MachineDominatorTree>();
   LI = &getAnalysis<LoopInfo>();
   SE = &getAnalysis<ScalarEvolution>();
+  AliasCache.clear();
 
   // Create a place holder for the virtual exit for the scheduling graph.
   MachineBasicBlock *VirtualExit = MF.CreateMachineBasicBlock();
@@ -247,14 +301,56 @@ bool VPreRegAllocSched::runOnMachineFunction(MachineFunction &MF) {
 
   unsigned TotalCycles = G.emitSchedule();
   FInfo->setTotalSlots(TotalCycles);
+  recordScheduleMetrics(MF);
 
   cleanUpSchedule();
+  AliasCache.clear();
 
   return true;
 }
 
 void VPreRegAllocSched::print(raw_ostream &O, const Module *M) const {}
 
+void VPreRegAllocSched::recordScheduleMetrics(MachineFunction &MF) const {
+  MachineBlockFrequencyInfo &MBFI = getAnalysis<MachineBlockFrequencyInfo>();
+  // Prefer the block entry counts from the RTL profile, if there is any.
+  const BBProfile *Profile = BBProfile::get();
+  uint64_t EntryFreq = 0;
+  if (Profile && !Profile->getEntryCount(&MF.front(), EntryFreq))
+    Profile = 0;
+  if (Profile == 0)
+    EntryFreq = MBFI.getBlockFreq(&MF.front()).getFrequency();
+
+  double Cycles = 0;
+  unsigned CriticalPathSlots = 0;
+
+  typedef MachineFunction::iterator iterator;
+  for (iterator I = MF.begin(), E = MF.end(); I != E; ++I) {
+    MachineBasicBlock *MBB = I;
+    // A pipelined block starts a new iteration every II cycles, the other
+    // blocks are left when the terminator is issued. The blocks inserted by
+    // the scheduler do not have a frequency, and the blocks that are not
+    // found in the profile are not reached, they are not counted.
+    unsigned Latency = std::max(FInfo->getIIFor(MBB), 1u);
+    uint64_t BlockFreq = 0;
+    if (Profile) Profile->getEntryCount(MBB, BlockFreq);
+    else         BlockFreq = MBFI.getBlockFreq(MBB).getFrequency();
+
+    if (EntryFreq)
+      Cycles += double(BlockFreq) / EntryFreq * Latency;
+
+    // The longest schedule of the blocks, in slots, the delay of the
+    // combinational paths is not taken into account.
+    CriticalPathSlots = std::max(CriticalPathSlots,
+                                 FInfo->getTotalSlotFor(MBB));
+  }
+
+  std::string FnName = MF.getFunction()->getName();
+  recordMetricToEngine(FnName, "Slots", FInfo->getTotalSlots());
+  recordMetricToEngine(FnName, "Cycles", Cycles);
+  recordMetricToEngine(FnName, "CriticalPathSlots", CriticalPathSlots);
+}
+
 VPreRegAllocSched::~VPreRegAllocSched() {}
 
 //===----------------------------------------------------------------------===//
@@ -270,7 +366,7 @@ int VPreRegAllocSched::analyzeLoopDep(MachineMemOperand *SrcAddr,
         << *SrcAddr->getValue() << "+" << SrcAddr->getOffset() << " and "
         << *DstAddr->getValue() << "+" << DstAddr->getOffset() << ": ");
 
-  if (!isMachineMemOperandAlias(SrcAddr, DstAddr, AA, SE))
+  if (!isMemOpAlias(SrcAddr, DstAddr))
     return -1;
 
   if (L.isLoopInvariant(SrcAddrVal) && L.isLoopInvariant(DstAddrVal)) {
@@ -297,10 +393,139 @@ static inline bool mayAccessMemory(const MCInstrDesc &TID) {
   return TID.mayLoad() || TID.mayStore() || TID.isCall();
 }
 
+bool VPreRegAllocSched::isMemOpAlias(MachineMemOperand *LHS,
+                                     MachineMemOperand *RHS) {
+  // The alias relation is symmetric.
+  if (RHS < LHS) std::swap(LHS, RHS);
+
+  std::pair<DenseMap<MemOpPairTy, bool>::iterator, bool> at
+    = AliasCache.insert(std::make_pair(std::make_pair(LHS, RHS), false));
+  if (!at.second) {
+    ++NumAliasCacheHits;
+    return at.first->second;
+  }
+
+  ++NumAliasQueries;
+  return at.first->second = isMachineMemOperandAlias(LHS, RHS, AA, SE);
+}
+
+void VPreRegAllocSched::addMemDep(VSchedGraph &G, MachineMemOperand *SrcMO,
+                                  VSUnit *SrcU, MachineMemOperand *DstMO,
+                                  VSUnit *DstU, Loop *IRL) {
+  MachineInstr *SrcMI = SrcU->getRepresentativePtr(),
+               *DstMI = DstU->getRepresentativePtr();
+
+  bool MayBothActive = !VInstrInfo::isPredicateMutex(SrcMI, DstMI);
+  if (!MayBothActive) ++MutexPredNoAlias;
+
+  // Handle unanalyzable memory access.
+  if (DstMO == 0 || SrcMO == 0) {
+    // Build the Src -> Dst dependence.
+    unsigned Latency = G.getStepsToFinish(SrcMI);
+    //if (MayBothActive || SrcMO != DstMO)
+    DstU->addDep<true>(SrcU, VDEdge::CreateMemDep(Latency, 0));
+
+    // Build the Dst -> Src (in next iteration) dependence, the dependence
+    // occur even if SrcMI and DstMI are mutual exclusive.
+    if (G.enablePipeLine()) {
+      Latency = G.getStepsToFinish(SrcMI);
+      SrcU->addDep<true>(DstU, VDEdge::CreateMemDep(Latency, 1));
+    }
+    return;
+  }
+
+  bool isSrcWrite = VInstrInfo::mayStore(SrcMI),
+       isDstWrite = VInstrInfo::mayStore(DstMI);
+
+  // Ignore RAR dependence.
+  if (!isDstWrite && !isSrcWrite) return;
+
+  if (!isMemOpAlias(SrcMO, DstMO)) return;
+
+  if (G.enablePipeLine()) {
+    assert(IRL && "Can not handle machine loop without IR loop!");
+    DEBUG(SrcMI->dump();  dbgs() << "vs\n"; DstMI->dump(); dbgs() << '\n');
+
+    // Dst not depend on Src if they are mutual exclusive.
+    if (MayBothActive) {
+      // Compute the iterate distance.
+      int DepDst = analyzeLoopDep(SrcMO, DstMO, *IRL, true);
+
+      if (DepDst >= 0) {
+        unsigned Latency = G.getStepsToFinish(SrcMI);
+        DstU->addDep<true>(SrcU, VDEdge::CreateMemDep(Latency, DepDst));
+      }
+    }
+
+    // We need to compute if Src depend on Dst even if Dst not depend on Src.
+    // Because dependence depends on execute order, if SrcMI and DstMI are
+    // mutual exclusive.
+    int DepDst = analyzeLoopDep(DstMO, SrcMO, *IRL, false);
+
+    if (DepDst >=0 ) {
+      unsigned Latency = G.getStepsToFinish(SrcMI);
+      SrcU->addDep<true>(DstU, VDEdge::CreateMemDep(Latency, DepDst));
+    }
+  } else if (MayBothActive) {
+    unsigned Latency = G.getStepsToFinish(SrcMI);
+    DstU->addDep<true>(SrcU, VDEdge::CreateMemDep(Latency, 0));
+  }
+}
+
+void VPreRegAllocSched::addMemDepsInBucket(VSchedGraph &G, MemOpBucket &B,
+                                           MachineMemOperand *DstMO,
+                                           VSUnit *DstU, Loop *IRL) {
+  // The operations before the barrier are ordered before the barrier.
+  if (B.Barrier) {
+    unsigned Latency = G.getStepsToFinish(B.Barrier->getRepresentativePtr());
+    DstU->addDep<true>(B.Barrier, VDEdge::CreateMemDep(Latency, 0));
+  }
+
+  typedef MemOpVecTy::iterator it;
+  for (it I = B.Ops.begin(), E = B.Ops.end(); I != E; ++I)
+    addMemDep(G, I->first, I->second, DstMO, DstU, IRL);
+}
+
+void VPreRegAllocSched::insertIntoBucket(VSchedGraph &G, MemOpBucket &B,
+                                         MachineMemOperand *DstMO,
+                                         VSUnit *DstU) {
+  // Make the operation a barrier if there are too many operations to query
+  // in the bucket. The barrier is ordered after all earlier operations in the
+  // bucket regardless of the alias information, and all later operations are
+  // ordered after the barrier, so the later operations only need to query
+  // the operations since the barrier. The loop carried dependencies are not
+  // chained by the barrier, hence we query all operations when pipelining.
+  if (G.enablePipeLine() || B.Ops.size() < MemDepWindow) {
+    B.Ops.push_back(std::make_pair(DstMO, DstU));
+    return;
+  }
+
+  ++NumMemDepBarriers;
+  if (B.Barrier) {
+    unsigned Latency = G.getStepsToFinish(B.Barrier->getRepresentativePtr());
+    DstU->addDep<true>(B.Barrier, VDEdge::CreateMemDep(Latency, 0));
+  }
+
+  typedef MemOpVecTy::iterator it;
+  for (it I = B.Ops.begin(), E = B.Ops.end(); I != E; ++I) {
+    unsigned Latency = G.getStepsToFinish(I->second->getRepresentativePtr());
+    DstU->addDep<true>(I->second, VDEdge::CreateMemDep(Latency, 0));
+  }
+
+  B.Ops.clear();
+  B.Barrier = DstU;
+}
+
 void VPreRegAllocSched::buildMemDepEdges(VSchedGraph &G, ArrayRef<VSUnit*> SUs){
-  // The schedule unit and the corresponding memory operand.
-  typedef std::vector<std::pair<MachineMemOperand*, VSUnit*> > MemOpMapTy;
-  MemOpMapTy VisitedOps;
+  // The memory operations are partitioned by the address space, i.e. the block
+  // RAM, and the underlying object. The operations on different identified
+  // objects never alias, while the operations on unknown objects (the null
+  // object) may alias with any operation in the same address space.
+  typedef std::pair<unsigned, const Value*> BucketKeyTy;
+  DenseMap<BucketKeyTy, MemOpBucket> Buckets;
+  DenseMap<unsigned, MemOpBucket> AddrSpaceOps;
+  // The unanalyzable operations and all operations visited.
+  MemOpVecTy UnknownOps, VisitedOps;
   Loop *IRL = LI->getLoopFor(G.getEntryBB()->getBasicBlock());
 
   typedef ArrayRef<VSUnit*>::iterator it;
@@ -310,12 +535,14 @@ void VPreRegAllocSched::buildMemDepEdges(VSchedGraph &G, ArrayRef<VSUnit*> SUs){
     // Skip the non-memory operation and non-call operation.
     if (!mayAccessMemory(DstMI->getDesc())) continue;
 
-    bool isDstWrite = VInstrInfo::mayStore(DstMI);
-
     // Dirty Hack: Is the const_cast safe?
     MachineMemOperand *DstMO = 0;
     // TODO: Also try to get the address information for call instruction.
-    if (!DstMI->memoperands_empty() && !DstMI->hasVolatileMemoryRef()) {
+    // The memory operand of the block transfer only describes the first byte
+    // of the accessed range, treat it as unanalyzable, so it is ordered against
+    // the accesses on all memory buses.
+    if (!DstMI->memoperands_empty() && !DstMI->hasVolatileMemoryRef()
+        && !VInstrInfo::isBlockTransfer(DstMI)) {
       assert(DstMI->hasOneMemOperand() && "Can not handle multiple mem ops!");
       assert(!DstMI->hasVolatileMemoryRef() && "Can not handle volatile op!");
 
@@ -326,73 +553,48 @@ void VPreRegAllocSched::buildMemDepEdges(VSchedGraph &G, ArrayRef<VSUnit*> SUs){
       }
     }
 
-    typedef MemOpMapTy::iterator visited_it;
-    for (visited_it I = VisitedOps.begin(), E = VisitedOps.end(); I != E; ++I) {
-      MachineMemOperand *SrcMO = I->first;
-      VSUnit *SrcU = I->second;
+    typedef MemOpVecTy::iterator visited_it;
+    std::pair<MachineMemOperand*, VSUnit*> DstOp(DstMO, DstU);
 
-      MachineInstr *SrcMI = SrcU->getRepresentativePtr();
+    // The unanalyzable operation depends on all visited operations.
+    if (DstMO == 0) {
+      for (visited_it I = VisitedOps.begin(), E = VisitedOps.end(); I != E; ++I)
+        addMemDep(G, I->first, I->second, DstMO, DstU, IRL);
 
-      bool MayBothActive = !VInstrInfo::isPredicateMutex(SrcMI, DstMI);
-      if (!MayBothActive) ++MutexPredNoAlias;
-
-      // Handle unanalyzable memory access.
-      if (DstMO == 0 || SrcMO == 0) {
-        // Build the Src -> Dst dependence.
-        unsigned Latency = G.getStepsToFinish(SrcMI);
-        //if (MayBothActive || SrcMO != DstMO)
-        DstU->addDep<true>(SrcU, VDEdge::CreateMemDep(Latency, 0));
-
-        // Build the Dst -> Src (in next iteration) dependence, the dependence
-        // occur even if SrcMI and DstMI are mutual exclusive.
-        if (G.enablePipeLine()) {
-          Latency = G.getStepsToFinish(SrcMI);
-          SrcU->addDep<true>(DstU, VDEdge::CreateMemDep(Latency, 1));
-        }
-        // Go on handle next visited SUnit.
-        continue;
-      }
-
-      bool isSrcWrite = VInstrInfo::mayStore(SrcMI);
-
-      // Ignore RAR dependence.
-      if (!isDstWrite && !isSrcWrite) continue;
-
-      if (!isMachineMemOperandAlias(SrcMO, DstMO, AA, SE))
-        continue;
-
-      if (G.enablePipeLine()) {
-        assert(IRL && "Can not handle machine loop without IR loop!");
-        DEBUG(SrcMI->dump();  dbgs() << "vs\n"; DstMI->dump(); dbgs() << '\n');
-
-        // Dst not depend on Src if they are mutual exclusive.
-        if (MayBothActive) {
-          // Compute the iterate distance.
-          int DepDst = analyzeLoopDep(SrcMO, DstMO, *IRL, true);
-
-          if (DepDst >= 0) {
-            unsigned Latency = G.getStepsToFinish(SrcMI);
-            DstU->addDep<true>(SrcU, VDEdge::CreateMemDep(Latency, DepDst));
-          }
-        }
-
-        // We need to compute if Src depend on Dst even if Dst not depend on Src.
-        // Because dependence depends on execute order, if SrcMI and DstMI are
-        // mutual exclusive.
-        int DepDst = analyzeLoopDep(DstMO, SrcMO, *IRL, false);
-
-        if (DepDst >=0 ) {
-          unsigned Latency = G.getStepsToFinish(SrcMI);
-          SrcU->addDep<true>(DstU, VDEdge::CreateMemDep(Latency, DepDst));
-        }
-      } else if (MayBothActive) {
-        unsigned Latency = G.getStepsToFinish(SrcMI);
-        DstU->addDep<true>(SrcU, VDEdge::CreateMemDep(Latency, 0));
-      }
+      UnknownOps.push_back(DstOp);
+      VisitedOps.push_back(DstOp);
+      continue;
     }
 
+    for (visited_it I = UnknownOps.begin(), E = UnknownOps.end(); I != E; ++I)
+      addMemDep(G, I->first, I->second, DstMO, DstU, IRL);
+
+    const Value *Ptr = DstMO->getValue();
+    unsigned AddrSpace = cast<PointerType>(Ptr->getType())->getAddressSpace();
+    const Value *Obj = GetUnderlyingObject(Ptr->stripPointerCasts());
+    if (!isIdentifiedObject(Obj)) Obj = 0;
+
+    // Create the buckets before taking the references, because the insertion
+    // may reallocate the buckets in the map.
+    BucketKeyTy ObjKey(AddrSpace, Obj), UnknownObjKey(AddrSpace, 0);
+    Buckets[ObjKey];
+    Buckets[UnknownObjKey];
+    MemOpBucket &ObjOps = Buckets[ObjKey],
+                &UnknownObjOps = Buckets[UnknownObjKey],
+                &AllOps = AddrSpaceOps[AddrSpace];
+
+    // Collect the dependencies from the buckets that may alias with the
+    // current operation.
+    if (Obj) {
+      addMemDepsInBucket(G, ObjOps, DstMO, DstU, IRL);
+      addMemDepsInBucket(G, UnknownObjOps, DstMO, DstU, IRL);
+    } else
+      addMemDepsInBucket(G, AllOps, DstMO, DstU, IRL);
+
     // Add the schedule unit to visited map.
-    VisitedOps.push_back(std::make_pair(DstMO, DstU));
+    insertIntoBucket(G, ObjOps, DstMO, DstU);
+    insertIntoBucket(G, AllOps, DstMO, DstU);
+    VisitedOps.push_back(DstOp);
   }
 }
 
@@ -671,21 +873,14 @@ bool VPreRegAllocSched::couldBePipelined(const MachineBasicBlock *MBB) {
   MachineLoop *L = MLI->getLoopFor(MBB);
   // Not in any loop.
   if (!L) return false;
-  // Dirty Hack: Only support one block loop at this moment.
+  // Only the single block loops are pipelined, the multi-block loop bodies
+  // are if-converted into a single block by HyperBlockFormation.
   if (L->getBlocks().size() != 1) return false;
 
   for (MachineBasicBlock::const_iterator I = MBB->begin(), E = MBB->end();
        I != E; ++I) {
-    if (I->isPHI()) {
-      for (unsigned i = 1, e = I->getNumOperands(); i < e; i +=2) {
-        MachineBasicBlock *TargetBB = I->getOperand(i + 1).getMBB();
-        if (TargetBB != MBB) continue;
-        // Dirty Hack: PHI depends on PHI is not supported at the moment.
-        if (MRI->getVRegDef(I->getOperand(i).getReg())->isPHI())
-          return false;
-      }
-      continue;
-    }
+    // The PHIs that depend on other PHIs are handled by buildPipeLineDepEdges.
+    if (I->isPHI()) continue;
 
     // Do not pipeline the loops with call.
     if (I->getDesc().isCall()) return false;
@@ -719,6 +914,40 @@ void VPreRegAllocSched::buildPipeLineDepEdges(VSchedGraph &G) {
     // Add the dependence edge PHI -> Loop back -> PHI_at_iteration.
     PHISU->addDep<true>(LoopOp, VDEdge::CreateMemDep(0, 1));
     //LoopOp->addDep(VDValDep::CreateValDep(PHISU, 0));
+
+    addPHIChainDeps(G, PHISU);
+  }
+}
+
+void VPreRegAllocSched::addPHIChainDeps(VSchedGraph &G, VSUnit *PHISU) {
+  MachineInstr *PN = PHISU->getRepresentativePtr();
+  MachineBasicBlock *CurBB = G.getEntryBB();
+
+  for (unsigned i = 1, e = PN->getNumOperands(); i < e; i += 2) {
+    if (PN->getOperand(i + 1).getMBB() != CurBB) continue;
+
+    // The loop carried incoming value is copied by the PHIMove.
+    MachineInstr *IncomingCopy = MRI->getVRegDef(PN->getOperand(i).getReg());
+    if (!IncomingCopy || IncomingCopy->getOpcode() != VTM::VOpMvPhi) continue;
+
+    const MachineOperand &SrcMO = IncomingCopy->getOperand(1);
+    if (!SrcMO.isReg() || !SrcMO.getReg()) continue;
+
+    MachineInstr *SrcPN = MRI->getVRegDef(SrcMO.getReg());
+    if (!SrcPN || !SrcPN->isPHI() || SrcPN->getParent() != CurBB) continue;
+
+    VSUnit *SrcPHISU = G.lookupSUnit(SrcPN);
+    VSUnit *PHIMove = G.lookupSUnit(IncomingCopy);
+    assert(SrcPHISU && PHIMove && "Schedule units for PHI chain not found!");
+
+    // The PHI takes the value of another PHI from the previous iteration, i.e.
+    // PN(i + 1) = SrcPN(i). The PHIMove must read SrcPN after it is defined in
+    // the current iteration, and before it is overwritten by the next
+    // iteration:
+    // SrcPN -(RAW dep)-> PHIMove -(WAR dep)-> SrcPN_at_next_iteration.
+    PHIMove->addDep<true>(SrcPHISU, VDEdge::CreateCtrlDep(0));
+    SrcPHISU->addDep<true>(PHIMove, VDEdge::CreateMemDep(0, 1));
+    ++NumPHIChains;
   }
 }
 
@@ -1061,6 +1290,7 @@ bool VPreRegAllocSched::pipelineBBLocally(VSchedGraph &G, MachineBasicBlock *MBB
   // Todo: Simply set the terminator SU as the exit root?
   LocalG.createExitRoot(VExit);
   LocalG.verify();
+  LocalG.freeze();
   // Do not merge the local graph into the global graph if we fail to pipeline
   // the block.
   if (!LocalG.scheduleLoop()) return false;
@@ -1100,16 +1330,35 @@ void VPreRegAllocSched::buildGlobalSchedulingGraph(VSchedGraph &G,
   G.createExitRoot(VExit);
   // Verify the schedule graph.
   G.verify();
+  G.freeze();
 }
 
 void VPreRegAllocSched::schedule(VSchedGraph &G) {
   MachineBlockFrequencyInfo &MBFI = getAnalysis<MachineBlockFrequencyInfo>();
-  double FreqSum = 0.0;
+  // Prefer the block frequencies from the RTL profile, if there is any.
   MachineBasicBlock *EntryBB = G.getEntryBB(), *ExitBB = G.getExitBB();
-  typedef MachineFunction::iterator iterator;
+  const BBProfile *Profile = BBProfile::get();
+  if (Profile && !Profile->hasProfile(*EntryBB->getParent()->getFunction()))
+    Profile = 0;
 
-  for (iterator I = EntryBB, E = ExitBB; I != E; ++I)
-    FreqSum += std::max(MBFI.getBlockFreq(I).getFrequency(), UINT64_C(1));
+  double FreqSum = 0.0;
+  typedef MachineFunction::iterator iterator;
+  std::vector<uint64_t> BlockFreqs;
+
+  for (iterator I = EntryBB, E = ExitBB; I != E; ++I) {
+    uint64_t BlockFreq = 0;
+    // The blocks that are not found in the profile are not reached in the
+    // profiled simulation, or are created by the transformations after the
+    // profile is collected, give them the smallest weight.
+    if (Profile) {
+      if (Profile->getEntryCount(I, BlockFreq))
+        ++NumProfiledBlocks;
+    } else
+      BlockFreq = MBFI.getBlockFreq(I).getFrequency();
+
+    BlockFreqs.push_back(std::max(BlockFreq, UINT64_C(1)));
+    FreqSum += BlockFreqs.back();
+  }
 
   SDCScheduler<true> Scheduler(G);
 
@@ -1118,11 +1367,10 @@ void VPreRegAllocSched::schedule(VSchedGraph &G) {
   // Build the step variables, and no need to schedule at all if all SUs have
   // been scheduled.
   if (Scheduler.createLPAndVariables()) {
+    unsigned Idx = 0;
     for (iterator I = EntryBB, E = ExitBB; I != E; ++I) {
       MachineBasicBlock *MBB = I;
-      uint64_t BlockFreq
-        = std::max(MBFI.getBlockFreq(I).getFrequency(), UINT64_C(1));
-      double BBFreq = double(BlockFreq) / FreqSum;
+      double BBFreq = double(BlockFreqs[Idx++]) / FreqSum;
 
       DEBUG(dbgs() << "MBB#" << MBB->getNumber() << ' ' << BBFreq << '\n');
       // Minimize the latency of the BB.
@@ -21,6 +21,7 @@
 #include "vtm/VRegisterInfo.h"
 #include "vtm/Passes.h"
 #include "vtm/VInstrInfo.h"
+#include "vtm/Utilities.h"
 
 //Dirty Hack:
 #include "llvm/../../lib/CodeGen/VirtRegMap.h"
@@ -54,6 +55,12 @@ using namespace llvm;
 
 STATISTIC(LIMerged,
           "Number of live intervals merged in resource binding pass");
+STATISTIC(NumRegsBound,
+          "Number of registers allocated in resource binding pass");
+STATISTIC(NumFUsBound,
+          "Number of function units allocated in resource binding pass");
+STATISTIC(NumCompGraphSolves,
+          "Number of path covers computed on the compatibility graphs");
 static cl::opt<bool> DisableFUSharing("vtm-disable-fu-sharing",
                                       cl::desc("Disable function unit sharing"),
                                       cl::init(false));
@@ -153,6 +160,13 @@ struct VRASimple : public MachineFunctionPass {
   void bindCompGraph(LICGraph &G);
   void bindICmps(LICGraph &G);
 
+  // The estimated cost of the registers and function units bound by the
+  // compatibility graphs, recorded for the design space exploration.
+  uint64_t RegCost, FUCost;
+  unsigned NumRegs, NumFUs;
+  void addBoundCost(unsigned RC, unsigned BitWidth);
+  void recordBindingMetrics() const;
+
   bool runOnMachineFunction(MachineFunction &F);
 
   void rewrite();
@@ -482,8 +496,10 @@ struct CompRegEdgeWeight : public CompEdgeWeightBase<VFUDesc, 1> {
 };
 
 // Weight computation functor for commutable binary operation Compatibility
-// Graph.
-template<class FUDescTy, unsigned OpCode, unsigned OpIdx>
+// Graph. Only merge the function units with the same operands, unless the
+// function unit is so big that it pays off to multiplex its operands.
+template<class FUDescTy, unsigned OpCode, unsigned OpIdx,
+         bool MuxOperands = false>
 struct CompBinOpEdgeWeight : public CompEdgeWeightBase<FUDescTy, 2> {
   // Is there a copy between the src and dst of the edge?
   //bool hasCopy;
@@ -535,7 +551,7 @@ struct CompBinOpEdgeWeight : public CompEdgeWeightBase<FUDescTy, 2> {
     if (Base::VRA->iterateUseDefChain(Dst->reg, *this))
       return CompGraphWeights::HUGE_NEG_VAL;
 
-    if (Base::getMaxMergedSrcMuxSize() > 1) 
+    if (!MuxOperands && Base::getMaxMergedSrcMuxSize() > 1)
       return CompGraphWeights::HUGE_NEG_VAL;
 
     return Base::computeWeight(Base::getWidth());
@@ -664,7 +680,8 @@ FunctionPass *llvm::createSimpleRegisterAllocator() {
 
 char VRASimple::ID = 0;
 
-VRASimple::VRASimple() : MachineFunctionPass(ID) {
+VRASimple::VRASimple()
+  : MachineFunctionPass(ID), RegCost(0), FUCost(0), NumRegs(0), NumFUs(0) {
   initializeAdjustLIForBundlesPass(*PassRegistry::getPassRegistry());
   initializeLiveIntervalsPass(*PassRegistry::getPassRegistry());
   initializeSlotIndexesPass(*PassRegistry::getPassRegistry());
@@ -710,6 +727,8 @@ bool VRASimple::runOnMachineFunction(MachineFunction &F) {
   VFI = F.getInfo<VFInfo>();
 
   init(getAnalysis<VirtRegMap>(), getAnalysis<LiveIntervals>());
+  RegCost = FUCost = 0;
+  NumRegs = NumFUs = 0;
 
   DEBUG(dbgs() << "Before simple register allocation:\n";F.dump());
 
@@ -725,6 +744,7 @@ bool VRASimple::runOnMachineFunction(MachineFunction &F) {
            ICmpCG(VTM::RUCMPRegClassID),
            MulCG(VTM::RMULRegClassID),
            MulLHCG(VTM::RMULLHRegClassID),
+           DivCG(VTM::RDIVRegClassID),
            AsrCG(VTM::RASRRegClassID),
            LsrCG(VTM::RLSRRegClassID),
            ShlCG(VTM::RSHLRegClassID);
@@ -733,6 +753,7 @@ bool VRASimple::runOnMachineFunction(MachineFunction &F) {
   buildCompGraph(ICmpCG);
   buildCompGraph(MulCG);
   buildCompGraph(MulLHCG);
+  buildCompGraph(DivCG);
   buildCompGraph(AsrCG);
   buildCompGraph(LsrCG);
   buildCompGraph(ShlCG);
@@ -743,6 +764,10 @@ bool VRASimple::runOnMachineFunction(MachineFunction &F) {
   //CompSelEdgeWeight SelWeight(this, VFUs::SelCost);
   CompBinOpEdgeWeight<VFUMult, VTM::VOpMult, 1> MulWeiht(this);
   CompBinOpEdgeWeight<VFUMult, VTM::VOpMultLoHi, 1> MulLHWeiht(this);
+  // The lifetime of the result of the division covers the whole division,
+  // so the divisions that are compatible never use the divider at the same
+  // time, no matter it is iterative or pipelined.
+  CompBinOpEdgeWeight<VFUDiv, VTM::VOpDiv, 1, true> DivWeight(this);
   CompBinOpEdgeWeight<VFUShift, VTM::VOpSRA, 1> SRAWeight(this);
   CompBinOpEdgeWeight<VFUShift, VTM::VOpSRL, 1> SRLWeight(this);
   CompBinOpEdgeWeight<VFUShift, VTM::VOpSHL, 1> SHLWeight(this);
@@ -756,6 +781,7 @@ bool VRASimple::runOnMachineFunction(MachineFunction &F) {
                   || reduceCompGraph(ShlCG, SHLWeight)
                   || reduceCompGraph(MulCG, MulWeiht)
                   || reduceCompGraph(MulLHCG, MulLHWeiht)
+                  || reduceCompGraph(DivCG, DivWeight)
                   || reduceCompGraph(AdderCG, AddWeight)
                   || reduceCompGraph(ICmpCG, ICmpWeight)
                   || reduceCompGraph(RCG, RegWeight);
@@ -767,9 +793,11 @@ bool VRASimple::runOnMachineFunction(MachineFunction &F) {
   bindICmps(ICmpCG);
   bindCompGraph(MulCG);
   bindCompGraph(MulLHCG);
+  bindCompGraph(DivCG);
   bindCompGraph(AsrCG);
   bindCompGraph(LsrCG);
   bindCompGraph(ShlCG);
+  recordBindingMetrics();
 
   // Run rewriter
   LIS->addKillFlags();
@@ -933,7 +961,7 @@ void VRASimple::mergeLI(LiveInterval *FromLI, LiveInterval *ToLI,
 }
 
 void VRASimple::bindMemoryBus() {
-  LiveInterval *MemBusLI = 0;
+  std::map<unsigned, LiveInterval*> RepLIs;
 
   for (unsigned i = 0, e = MRI->getNumVirtRegs(); i != e; ++i) {
     unsigned RegNum = TargetRegisterInfo::index2VirtReg(i);
@@ -941,13 +969,21 @@ void VRASimple::bindMemoryBus() {
       continue;
 
     if (LiveInterval *LI = getInterval(RegNum)) {
+      MachineInstr *MI = MRI->getVRegDef(RegNum);
+      assert(MI && MI->getOpcode() == VTM::VOpMemTrans && "Unexpected opcode!");
+      unsigned BusNum = VInstrInfo::getPreboundFUId(MI).getFUNum();
+
+      LiveInterval *&MemBusLI = RepLIs[BusNum];
+      // Had we allocate a register for this memory bus?
       if (MemBusLI == 0) {
-        assign(*LI, TRI->allocateFN(VTM::RINFRegClassID));
+        unsigned PhyReg = TRI->allocateFN(VTM::RINFRegClassID);
+        VFI->rememberMemBusReg(PhyReg, BusNum);
+        assign(*LI, PhyReg);
         MemBusLI = LI;
         continue;
       }
 
-      // Merge all others LI to MemBusLI.
+      // Merge all others LI of the same bus to MemBusLI.
       mergeLI(LI, MemBusLI, true);
     }
   }
@@ -988,8 +1024,43 @@ void VRASimple::bindDstMux() {
   }
 }
 
+// Get the slot of the block RAM access, the slots of the pipelined block are
+// folded by the II, since the slots in different iterations are active at the
+// same time.
+static unsigned getModuloSlot(MachineInstr *MI, const VFInfo *VFI) {
+  MachineBasicBlock *MBB = MI->getParent();
+  unsigned Slot = VInstrInfo::getInstrSlotNum(MI);
+  unsigned StartSlot = VFI->getStartSlotFor(MBB);
+  unsigned II = VFI->getIIFor(MBB);
+  if (StartSlot + II < VFI->getEndSlotFor(MBB))
+    Slot = StartSlot + (Slot - StartSlot) % II;
+
+  return Slot;
+}
+
+// Can MI be bound to the port that is already used by Users at the same slot?
+static bool isPortAvailable(ArrayRef<MachineInstr*> Users, MachineInstr *MI,
+                            const VFInfo *VFI) {
+  MachineBasicBlock *MBB = MI->getParent();
+  // The accesses in different iterations are not mutually exclusive.
+  bool Pipelined =
+    VFI->getStartSlotFor(MBB) + VFI->getIIFor(MBB) < VFI->getEndSlotFor(MBB);
+
+  for (unsigned i = 0, e = Users.size(); i != e; ++i)
+    if (Pipelined || !VInstrInfo::isPredicateMutex(MI, Users[i]))
+      return false;
+
+  return true;
+}
+
 void VRASimple::bindBlockRam() {
   std::map<unsigned, LiveInterval*> RepLIs;
+  // The accesses bound to each port of the block RAMs at each slot,
+  // (port register, slot) -> accesses.
+  typedef std::map<std::pair<unsigned, unsigned>,
+                   SmallVector<MachineInstr*, 2> > PortUsersMapTy;
+  PortUsersMapTy PortUsers;
+  bool DualPort = getFUDesc<VFUBRAM>()->getNumPorts() > 1;
 
   for (unsigned i = 0, e = MRI->getNumVirtRegs(); i != e; ++i) {
     unsigned RegNum = TargetRegisterInfo::index2VirtReg(i);
@@ -1002,17 +1073,46 @@ void VRASimple::bindBlockRam() {
       unsigned BRamNum = VInstrInfo::getPreboundFUId(MI).getFUNum();
 
       VFInfo::BRamInfo &Info = VFI->getBRamInfo(BRamNum);
-      unsigned &PhyReg = Info.PhyRegNum;
+      unsigned BitWidth = Info.ElemSizeInBytes * 8;
+      unsigned Slot = DualPort ? getModuloSlot(MI, VFI) : 0;
+      unsigned PhyReg = Info.PhyRegNum;
 
       // Had we allocate a register for this bram?
       if (PhyReg == 0) {
-        unsigned BitWidth = Info.ElemSizeInBytes * 8;
-        PhyReg = TRI->allocateFN(VTM::RBRMRegClassID, BitWidth);
+        PhyReg = Info.PhyRegNum
+               = TRI->allocateFN(VTM::RBRMRegClassID, BitWidth);
+        PortUsers[std::make_pair(PhyReg, Slot)].push_back(MI);
         RepLIs[PhyReg] = LI;
         assign(*LI, PhyReg);
         continue;
       }
 
+      // Bind the access to the second port if the first port is used by
+      // another access at the same slot. The scheduler allows at most 2 such
+      // accesses, unless they are mutually exclusive.
+      if (DualPort
+          && !isPortAvailable(PortUsers[std::make_pair(PhyReg, Slot)], MI,
+                              VFI)) {
+        if (Info.PortBRegNum == 0) {
+          PhyReg = Info.PortBRegNum
+                 = TRI->allocateFN(VTM::RBRMRegClassID, BitWidth);
+          PortUsers[std::make_pair(PhyReg, Slot)].push_back(MI);
+          RepLIs[PhyReg] = LI;
+          assign(*LI, PhyReg);
+          continue;
+        }
+
+        // Both ports are used at this slot, merging the access to either
+        // port results in a port conflict in the hardware.
+        if (!isPortAvailable(PortUsers[std::make_pair(Info.PortBRegNum, Slot)],
+                             MI, VFI))
+          report_fatal_error("Both ports of block RAM are used at the same"
+                             " slot!");
+
+        PhyReg = Info.PortBRegNum;
+      }
+
+      PortUsers[std::make_pair(PhyReg, Slot)].push_back(MI);
       // Merge to the representative live interval.
       LiveInterval *RepLI = RepLIs[PhyReg];
       // FIXME: Check overlap of the results of VOpPipeStage.
@@ -1090,42 +1190,58 @@ void VRASimple::buildCompGraph(LICGraph &G) {
 
 template<class CompEdgeWeight>
 bool VRASimple::reduceCompGraph(LICGraph &G, CompEdgeWeight &C) {
-  SmallVector<LiveInterval*, 8> LongestPath, MergedLIs;
+  // Only the weights of the edges that touch the nodes merged by the previous
+  // reduction are computed.
   G.updateEdgeWeight(C);
 
-  bool AnyReduced = false;
-
-  for (int PathWeight = G.findLongestPath(LongestPath, true); PathWeight > 0;
-       PathWeight = G.findLongestPath(LongestPath, true)) {
-    DEBUG(dbgs() << "// longest path in graph: {"
-      << TRI->getRegClass(G.ID)->getName() << "} weight:" << PathWeight << "\n";
-    for (unsigned i = 0; i < LongestPath.size(); ++i) {
-      LiveInterval *LI = LongestPath[i];
+  // Find all paths to merge at once.
+  std::vector<SmallVector<LiveInterval*, 8> > Paths;
+  int TotalWeight = G.findMaxWeightPathCover(Paths);
+  ++NumCompGraphSolves;
+  if (Paths.empty()) return false;
+
+  DEBUG(dbgs() << "// " << Paths.size() << " paths in graph: {"
+               << TRI->getRegClass(G.ID)->getName() << "} weight:"
+               << TotalWeight << "\n");
+  (void) TotalWeight;
+
+  SmallVector<LiveInterval*, 8> MergedLIs;
+  typedef std::vector<SmallVector<LiveInterval*, 8> >::iterator path_it;
+  for (path_it I = Paths.begin(), E = Paths.end(); I != E; ++I) {
+    SmallVectorImpl<LiveInterval*> &Path = *I;
+    DEBUG(for (unsigned i = 0; i < Path.size(); ++i) {
+      LiveInterval *LI = Path[i];
       dbgs() << *LI << " bitwidth:" << getBitWidthOf(LI->reg) << '\n';
     });
 
-    LiveInterval *RepLI = LongestPath.pop_back_val();
+    for (unsigned i = 0; i < Path.size(); ++i)
+      G.deleteNode(G[Path[i]]);
 
     // Merge the other LIs in the path to the first LI.
-    while (!LongestPath.empty())
-      mergeLI(LongestPath.pop_back_val(), RepLI);
+    LiveInterval *RepLI = Path.front();
+    for (unsigned i = 1; i < Path.size(); ++i)
+      mergeLI(Path[i], RepLI);
+
     // Add the merged LI back to the graph later.
     MergedLIs.push_back(RepLI);
-    AnyReduced = true;
   }
 
   // Re-add the merged LI to the graph.
   while (!MergedLIs.empty())
     G.GetOrCreateNode(MergedLIs.pop_back_val());
 
-  return AnyReduced;
+  return true;
 }
 
 void VRASimple::bindCompGraph(LICGraph &G) {
   unsigned RC = G.ID;
   for (LICGraph::iterator I = G.begin(), E = G.end(); I != E; ++I) {
     LiveInterval *LI = (*I)->get();
-    assign(*LI, TRI->allocatePhyReg(RC, getBitWidthOf(LI->reg)));
+    unsigned BitWidth = getBitWidthOf(LI->reg);
+    assign(*LI, TRI->allocatePhyReg(RC, BitWidth));
+    addBoundCost(RC, BitWidth);
+    if (RC == VTM::DRRegClassID) ++NumRegsBound;
+    else                         ++NumFUsBound;
   }
 }
 
@@ -1144,5 +1260,49 @@ void VRASimple::bindICmps(LICGraph &G) {
                                               : VTM::RUCMPRegClassID;
     unsigned CmpFU = TRI->allocateFN(FUType, ICmpChecker.CurMaxWidth);
     assign(*LI, CmpFU);
+    addBoundCost(FUType, ICmpChecker.CurMaxWidth);
+    ++NumFUsBound;
   }
 }
+
+void VRASimple::addBoundCost(unsigned RC, unsigned BitWidth) {
+  if (RC == VTM::DRRegClassID) {
+    RegCost += BitWidth * VFUs::RegCost;
+    ++NumRegs;
+    return;
+  }
+
+  unsigned Size = std::min(BitWidth, 64u);
+  switch (RC) {
+  default: llvm_unreachable("Unexpected register class!");
+  case VTM::RADDRegClassID:
+    FUCost += getFUDesc<VFUAddSub>()->lookupCost(Size);
+    break;
+  case VTM::RUCMPRegClassID:
+  case VTM::RSCMPRegClassID:
+    FUCost += getFUDesc<VFUICmp>()->lookupCost(Size);
+    break;
+  case VTM::RMULRegClassID:
+  case VTM::RMULLHRegClassID:
+    FUCost += getFUDesc<VFUMult>()->lookupCost(Size);
+    break;
+  case VTM::RDIVRegClassID:
+    FUCost += getFUDesc<VFUDiv>()->lookupCost(Size);
+    break;
+  case VTM::RASRRegClassID:
+  case VTM::RLSRRegClassID:
+  case VTM::RSHLRegClassID:
+    FUCost += getFUDesc<VFUShift>()->lookupCost(Size);
+    break;
+  }
+
+  ++NumFUs;
+}
+
+void VRASimple::recordBindingMetrics() const {
+  std::string FnName = MF->getFunction()->getName();
+  recordMetricToEngine(FnName, "Registers", NumRegs);
+  recordMetricToEngine(FnName, "RegisterCost", RegCost);
+  recordMetricToEngine(FnName, "FUs", NumFUs);
+  recordMetricToEngine(FnName, "FUCost", FUCost);
+}
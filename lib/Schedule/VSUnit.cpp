@@ -19,16 +19,24 @@
 #include "vtm/SynSettings.h"
 #include "vtm/VFInfo.h"
 
+#include "llvm/BasicBlock.h"
+#include "llvm/Constants.h"
+#include "llvm/Metadata.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineDominators.h"
 #include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/OwningPtr.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Mutex.h"
 #define DEBUG_TYPE "vtm-sunit"
 #include "llvm/Support/Debug.h"
 
+#include <numeric>
+
 using namespace llvm;
 
 static cl::opt<bool>
@@ -44,12 +52,86 @@ DisableMultiCyclesChain("vtm-disable-multi-cycles-chain",
                                  "0 is need)"),
                         cl::init(false));
 
+static cl::opt<bool>
+UseIMS("vtm-use-ims",
+       cl::desc("Pipeline the loops with the iterative modulo scheduler "
+                "instead of the modulo SDC scheduler"),
+       cl::init(false));
+
+static cl::opt<bool>
+ReportPipelining("vtm-report-pipelining",
+                 cl::desc("Report the II of the software pipelined loops, "
+                          "against their ResMII and RecMII, and the estimated "
+                          "cycles saved by loop flattening to the info output "
+                          "file"),
+                 cl::init(false));
+
 STATISTIC(NumSUs, "Number of scheduling units");
 STATISTIC(NumEdges, "Number of edges between scheduling units");
 STATISTIC(NumCPSUs, "Number of control-path scheduling units");
 STATISTIC(NumCPEdges, "Number of control-path edges between scheduling units");
 STATISTIC(NumDPSUs, "Number of data-path scheduling units");
 STATISTIC(NumDPEdges, "Number of data-path edges between scheduling units");
+STATISTIC(NumLoopsPipelined, "Number of loops software pipelined");
+STATISTIC(NumLoopsNotPipelined,
+          "Number of loops not pipelined because the II is too big");
+STATISTIC(NumLoopsPipelinedAtMII,
+          "Number of loops pipelined with II equals to max(ResMII, RecMII)");
+
+namespace llvm {
+// Defined in lib/Support/Timer.cpp, the file that -stats write to.
+extern raw_ostream *CreateInfoOutputFile();
+}
+
+// Serialize the reports of the functions that are compiled in parallel, the
+// info output file is opened and appended by each report.
+static ManagedStatic<sys::SmartMutex<true> > ReportLock;
+
+static void reportPipelining(MachineBasicBlock *MBB, unsigned II,
+                             unsigned ResMII, unsigned RecMII,
+                             unsigned Latency) {
+  if (!ReportPipelining) return;
+
+  // Build the whole line before writing it, so the lock is only held while
+  // the line is written.
+  std::string Line;
+  raw_string_ostream SS(Line);
+  SS << "Software pipelining: " << MBB->getParent()->getFunction()->getName()
+     << " BB#" << MBB->getNumber() << ' ' << MBB->getName() << ": ";
+  if (II) SS << "II " << II;
+  else    SS << "not pipelined";
+  SS << " ResMII " << ResMII << " RecMII " << RecMII
+     << " Latency " << Latency << '\n';
+
+  // Also report the estimated cycles saved if the loop is flattened from a
+  // perfect loop nest by the LoopFlattening pass, which attached the outer and
+  // inner trip counts to the latch. The nest is not scheduled, so the cycles
+  // are estimated from the schedule of the flattened loop.
+  const BasicBlock *BB = MBB->getBasicBlock();
+  if (MDNode *MD = BB ? BB->getTerminator()->getMetadata("vtm.flattened") : 0) {
+    ConstantInt *Outer = cast<ConstantInt>(MD->getOperand(0)),
+                *Inner = cast<ConstantInt>(MD->getOperand(1));
+    uint64_t OuterTripCount = Outer->getZExtValue();
+    // Each outer iteration of the nest paid the fill and drain of the inner
+    // pipeline, and the state transitions through the outer header and latch.
+    uint64_t Drain = II && Latency > II ? Latency - II : 0;
+    uint64_t Saved = 2 + Drain;
+    if (OuterTripCount)
+      Saved = OuterTripCount * 2 + (OuterTripCount - 1) * Drain;
+
+    SS << "Loop flattening: " << MBB->getParent()->getFunction()->getName()
+       << " BB#" << MBB->getNumber() << ' ' << MBB->getName() << ": Outer "
+       << OuterTripCount << " Inner " << Inner->getZExtValue()
+       << " EstimatedCyclesSaved " << Saved;
+    if (!OuterTripCount) SS << " per outer iteration";
+    SS << '\n';
+  }
+  SS.flush();
+
+  sys::SmartScopedLock<true> Guard(*ReportLock);
+  OwningPtr<raw_ostream> OS(CreateInfoOutputFile());
+  *OS << Line;
+}
 
 //===----------------------------------------------------------------------===//
 void VSchedGraph::print(raw_ostream &OS) const {
@@ -155,9 +237,11 @@ VSUnit *VSchedGraph::createVSUnit(InstPtrTy Ptr, unsigned fuid) {
 
 VSchedGraph::iterator
 VSchedGraph::mergeSUsInSubGraph(VSchedGraph &SubGraph) {
+  assert(!Frozen && "Cannot merge the SUs into a frozen graph!");
   // 1. Merge the MI2SU map.
   // Prevent the virtual exit root from being inserted to the current MI2SU map.
-  SubGraph.InstToSUnits.erase(SubGraph.getExitRoot()->getRepresentativePtr());
+  InstPtrTy ExitPtr = SubGraph.getExitRoot()->getRepresentativePtr();
+  SubGraph.InstToSUnits.erase(ExitPtr.getOpaqueValue());
 
   InstToSUnits.insert(SubGraph.InstToSUnits.begin(),
                       SubGraph.InstToSUnits.end());
@@ -239,6 +323,82 @@ void VSchedGraph::topologicalSortCPSUs() {
   assert(Idx == num_cps(this) && "Bad topological sort!");
 }
 
+void VSchedGraph::freeze() {
+  assert(!Frozen && "Graph already frozen!");
+  Frozen = true;
+
+  CPCSR.build(*this, true, 0);
+  DPCSR.build(*this, false, 0);
+}
+
+void VSchedGraphCSR::build(const VSchedGraph &G, bool IsCtrlPath,
+                           unsigned NewII) {
+  typedef VSchedGraph::const_iterator iterator;
+  typedef VSUnit::const_dep_iterator dep_it;
+
+  II = NewII;
+  Valid = true;
+
+  unsigned NumSUs = G.getNextSUIdx();
+  SUs.assign(NumSUs, 0);
+  for (iterator I = cp_begin(&G), E = cp_end(&G); I != E; ++I)
+    SUs[(*I)->getIdx()] = *I;
+  for (iterator I = dp_begin(&G), E = dp_end(&G); I != E; ++I)
+    SUs[(*I)->getIdx()] = *I;
+
+  // Count the edges of each SU, and then compute the beginning of the edges
+  // of each SU by the prefix sum.
+  std::vector<unsigned> DepBegin(NumSUs + 1, 0), UseBegin(NumSUs + 1, 0);
+  for (unsigned Idx = 0; Idx != NumSUs; ++Idx) {
+    const VSUnit *U = SUs[Idx];
+    if (U == 0) continue;
+
+    dep_it DI = IsCtrlPath ? U->dep_begin<true>() : U->dep_begin<false>();
+    dep_it DE = IsCtrlPath ? U->dep_end<true>() : U->dep_end<false>();
+    for (; DI != DE; ++DI) {
+      assert(SUs[DI->getIdx()] == *DI && "Dependence not in the graph!");
+      ++DepBegin[Idx + 1];
+      ++UseBegin[DI->getIdx() + 1];
+    }
+  }
+
+  std::partial_sum(DepBegin.begin(), DepBegin.end(), DepBegin.begin());
+  std::partial_sum(UseBegin.begin(), UseBegin.end(), UseBegin.begin());
+  Deps.resize(DepBegin.back());
+  Uses.resize(UseBegin.back());
+
+  // Chain the consecutive edges of each SU.
+  Deps.Head.assign(NumSUs, NoEdge);
+  Deps.Tail.assign(NumSUs, NoEdge);
+  Uses.Head.assign(NumSUs, NoEdge);
+  Uses.Tail.assign(NumSUs, NoEdge);
+  for (unsigned Idx = 0; Idx != NumSUs; ++Idx) {
+    Deps.chain(Idx, DepBegin[Idx], DepBegin[Idx + 1]);
+    Uses.chain(Idx, UseBegin[Idx], UseBegin[Idx + 1]);
+  }
+
+  // Fill the edges, visiting the SUs in the order of their indices also sorts
+  // the users of each SU by their indices.
+  std::vector<unsigned> UsePos(UseBegin.begin(), UseBegin.end() - 1);
+  for (unsigned Idx = 0; Idx != NumSUs; ++Idx) {
+    const VSUnit *U = SUs[Idx];
+    if (U == 0) continue;
+
+    unsigned DepPos = DepBegin[Idx];
+    dep_it DI = IsCtrlPath ? U->dep_begin<true>() : U->dep_begin<false>();
+    dep_it DE = IsCtrlPath ? U->dep_end<true>() : U->dep_end<false>();
+    for (; DI != DE; ++DI) {
+      const VDEdge &Edge = DI.getEdge(II);
+      Deps.set(DepPos++, *DI, Edge);
+      Uses.set(UsePos[DI->getIdx()]++, U, Edge);
+    }
+  }
+
+  DEBUG(dbgs() << "Built " << (IsCtrlPath ? "control" : "data")
+               << "-path CSR with " << NumSUs << " SUs and " << num_edges()
+               << " edges at II " << II << '\n');
+}
+
 VSUnit *VSchedGraph::createTerminator(const MachineBasicBlock *MBB,
                                       const MachineDominatorTree *MDT) {
   BBInfo Info;
@@ -282,7 +442,67 @@ void VSchedGraph::resetDPSchedule() {
   }
 }
 
+bool VSchedGraph::acceptLoopSchedule(unsigned II, unsigned MII,
+                                     unsigned ResMII, unsigned RecMII) {
+  MachineBasicBlock *MBB = getEntryBB();
+  // Fail to pipeline the BB if the II is not small enough.
+  if (7 * II >= 8 * getTotalSlot(MBB)) {
+    ++NumLoopsNotPipelined;
+    reportPipelining(MBB, 0, ResMII, RecMII, getTotalSlot(MBB));
+    return false;
+  }
+
+  DEBUG(dbgs() << "SchedII: " << II
+               << " Latency: " << getTotalSlot(MBB) << '\n');
+  assert(getLoopOp()->getSlot() - EntrySlot == II
+         && "LoopOp was not scheduled to the right slot!");
+  assert(getLoopOp()->getSlot() <= getEndSlot(MBB)
+         && "Expect MII is not bigger then critical path length!");
+
+  BBInfo &Info = getBBInfo(MBB);
+  assert(Info.II == 0 && "MBB already pipelined?");
+  Info.II = II;
+  ++NumLoopsPipelined;
+  if (Info.II == MII) ++NumLoopsPipelinedAtMII;
+  reportPipelining(MBB, Info.II, ResMII, RecMII, getTotalSlot(MBB));
+  return true;
+}
+
 bool VSchedGraph::scheduleLoop() {
+  if (UseIMS) return scheduleLoopWithIMS();
+
+  MachineBasicBlock *MBB = getEntryBB();
+  MachineFunction *F = MBB->getParent();
+  DEBUG(dbgs() << "Try to pipeline MBB#" << MBB->getNumber()
+               << " MF#" << F->getFunctionNumber() << " with SDC\n");
+  SDCModuloScheduler Scheduler(*this);
+
+  unsigned ResMII = Scheduler.computeResMII();
+  // Compute the latency of the loop body without the loop-carried
+  // dependencies.
+  Scheduler.setCriticalPathLength(std::max(ResMII, 1u));
+  Scheduler.buildTimeFrameAndResetSchedule(true);
+  unsigned BodyLatency = Scheduler.getCriticalPathLength();
+
+  unsigned RecMII = Scheduler.computeRecMII(1);
+  unsigned MII = std::max(RecMII, ResMII);
+  // The iterations hardly overlap if the body cannot be scheduled with an II
+  // that is bigger than its latency, software pipelining do not pay off.
+  unsigned MaxII = BodyLatency + ResMII;
+
+  for (unsigned II = MII; II <= MaxII; ++II) {
+    DEBUG(dbgs() << "MII: " << II << "...\n");
+    Scheduler.setMII(II);
+    if (Scheduler.scheduleLoop())
+      return acceptLoopSchedule(II, MII, ResMII, RecMII);
+  }
+
+  ++NumLoopsNotPipelined;
+  reportPipelining(MBB, 0, ResMII, RecMII, BodyLatency);
+  return false;
+}
+
+bool VSchedGraph::scheduleLoopWithIMS() {
   MachineBasicBlock *MBB = getEntryBB();
   MachineFunction *F = MBB->getParent();
   DEBUG(dbgs() << "Try to pipeline MBB#" << MBB->getNumber()
@@ -299,7 +519,10 @@ bool VSchedGraph::scheduleLoop() {
                << " in function " << MBB->getParent()->getFunction()->getName()
                << " #" << MBB->getParent()->getFunctionNumber() << '\n');
 
-  unsigned MII = Scheduler.computeRecMII(ResMII);
+  // The feasibility of II is monotone, so the smallest feasible II that is
+  // not smaller than ResMII is max(ResMII, RecMII).
+  unsigned RecMII = Scheduler.computeRecMII(1);
+  unsigned MII = std::max(RecMII, ResMII);
 
   Scheduler.setMII(MII);
   unsigned OriginalCriticalPathLength = std::max(Scheduler.getCriticalPathLength(),
@@ -321,23 +544,8 @@ bool VSchedGraph::scheduleLoop() {
 
   for (;;) {
     switch (Scheduler.scheduleLoop()) {
-    case IterativeModuloScheduling::Success:{
-      // Fail to pipeline the BB if the II is not small enough.
-      if (7 * Scheduler.getMII() >= 8 * Scheduler->getTotalSlot(MBB))
-        return false;
-
-      DEBUG(dbgs() << "SchedII: " << Scheduler.getMII()
-        << " Latency: " << getTotalSlot(MBB) << '\n');
-      assert(getLoopOp()->getSlot() - EntrySlot == Scheduler.getMII()
-        && "LoopOp was not scheduled to the right slot!");
-      assert(getLoopOp()->getSlot() <= getEndSlot(MBB)
-        && "Expect MII is not bigger then critical path length!");
-
-      BBInfo &Info = getBBInfo(MBB);
-      assert(Info.II == 0 && "MBB already pipelined?");
-      Info.II = Scheduler.getMII();
-      return true;
-    }
+    case IterativeModuloScheduling::Success:
+      return acceptLoopSchedule(Scheduler.getMII(), MII, ResMII, RecMII);
     case IterativeModuloScheduling::MIITooSmall:{
       Scheduler.increaseMII();
       // Make sure MII smaller than the critical path length.
@@ -623,6 +831,21 @@ VFUs::FUTypes VSUnit::getFUType() const {
   return VFUs::Trivial;
 }
 
+unsigned VSUnit::getFUOccupancy() const {
+  if (getFUType() == VFUs::MemoryBus) {
+    // The pipelined memory bus accept a new request after the start interval.
+    VFUMemBus *MemBus = getFUDesc<VFUMemBus>();
+    if (MemBus->isPipelined())
+      return std::min(getLatency(), MemBus->getStartInt());
+  }
+
+  // The pipelined divider accept a new division every cycle.
+  if (getFUType() == VFUs::Div && getFUDesc<VFUDiv>()->isPipelined())
+    return std::min(getLatency(), 1u);
+
+  return getLatency();
+}
+
 bool VSUnit::isDatapath() const {
   if (MachineInstr *Instr = getRepresentativePtr())
     return VInstrInfo::isDatapath(Instr->getOpcode());
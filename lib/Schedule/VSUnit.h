@@ -120,6 +120,15 @@ public:
   static VDEdge CreateDep(int Latency) {
     return VDEdge(Type, Latency, 0);
   }
+
+  template<Types Type>
+  static VDEdge CreateDep(int Latency, int Distance) {
+    return VDEdge(Type, Latency, Distance);
+  }
+
+  static VDEdge Create(Types Type, int Latency, int Distance) {
+    return VDEdge(Type, Latency, Distance);
+  }
 };
 
 template<VDEdge::Types Type>
@@ -453,6 +462,10 @@ public:
     assert(getLatency() == L && "Latency overflow!");
   }
 
+  // The number of steps that the function unit is occupied by this SU, which
+  // is shorter than the latency if the function unit is pipelined.
+  unsigned getFUOccupancy() const;
+
   unsigned getSlot() const { return SchedSlot; }
   unsigned getFinSlot() const { return getSlot() + getLatency(); }
 
@@ -618,6 +631,161 @@ template<bool IsCtrlPath> struct ConstVSUnitUseGraphTraits {
   }
 };
 
+/// @brief The compressed sparse row (CSR) form of the dependencies graph.
+///
+/// The dependencies and the users of the SUs are kept in DenseMaps and
+/// std::sets while the graph is built. The schedulers, which traverse the
+/// graph again and again, traverse this form of the frozen graph instead. The
+/// SUs are identified by their indices, the edges of a SU are stored in
+/// consecutive entries of the edge arrays, and the edges selected from the
+/// edge bundles for the II are stored in struct of arrays. The edges added
+/// after the CSR is built are appended to the edge arrays and chained after
+/// the edges of the SU, so adding an edge does not rebuild the whole CSR.
+class VSchedGraphCSR {
+public:
+  enum { NoEdge = ~0u };
+
+private:
+
+  struct EdgeArrays {
+    // The first and the last edge of the SU with index Idx, NoEdge if the SU
+    // has no edge.
+    std::vector<unsigned> Head, Tail;
+    // The next edge of the same SU, the edges built at once are consecutive.
+    std::vector<unsigned> Next;
+    // The index of the SU at the other end of the edge.
+    std::vector<uint16_t> Node;
+    std::vector<int16_t> Latency, Distance;
+    std::vector<uint8_t> Type;
+
+    void resize(unsigned NumEdges) {
+      Next.resize(NumEdges);
+      Node.resize(NumEdges);
+      Latency.resize(NumEdges);
+      Distance.resize(NumEdges);
+      Type.resize(NumEdges);
+    }
+
+    void set(unsigned Pos, const VSUnit *U, const VDEdge &Edge) {
+      Node[Pos] = U->getIdx();
+      Latency[Pos] = Edge.getLatency();
+      Distance[Pos] = Edge.getDistance();
+      Type[Pos] = Edge.getEdgeType();
+    }
+
+    // Chain the edges in [Begin, End) to the SU with index Idx.
+    void chain(unsigned Idx, unsigned Begin, unsigned End) {
+      if (Begin == End) return;
+
+      for (unsigned Pos = Begin; Pos + 1 < End; ++Pos)
+        Next[Pos] = Pos + 1;
+      Next[End - 1] = NoEdge;
+      Head[Idx] = Begin;
+      Tail[Idx] = End - 1;
+    }
+
+    // Append an edge to the end of the edges of the SU with index Idx.
+    void append(unsigned Idx, const VSUnit *U, const VDEdge &Edge) {
+      unsigned Pos = Node.size();
+      resize(Pos + 1);
+      set(Pos, U, Edge);
+      Next[Pos] = NoEdge;
+
+      if (Tail[Idx] == NoEdge) Head[Idx] = Pos;
+      else                     Next[Tail[Idx]] = Pos;
+      Tail[Idx] = Pos;
+    }
+  };
+
+  // Mapping the index to the SU.
+  std::vector<VSUnit*> SUs;
+  EdgeArrays Deps, Uses;
+  // The II used to select the edges from the edge bundles.
+  unsigned II;
+  bool Valid;
+
+public:
+  VSchedGraphCSR() : II(0), Valid(false) {}
+
+  class edge_iterator {
+    const VSchedGraphCSR *CSR;
+    const EdgeArrays *Edges;
+    unsigned Pos;
+  public:
+    edge_iterator(const VSchedGraphCSR *CSR, const EdgeArrays *Edges,
+                  unsigned Pos)
+      : CSR(CSR), Edges(Edges), Pos(Pos) {}
+
+    VSUnit *operator*() const { return CSR->SUs[Edges->Node[Pos]]; }
+    VSUnit *operator->() const { return operator*(); }
+
+    bool operator==(const edge_iterator &RHS) const { return Pos == RHS.Pos; }
+    bool operator!=(const edge_iterator &RHS) const { return Pos != RHS.Pos; }
+
+    edge_iterator &operator++() {       // Preincrement
+      Pos = Edges->Next[Pos];
+      return *this;
+    }
+
+    edge_iterator operator++(int) {     // Postincrement
+      edge_iterator Tmp = *this;
+      Pos = Edges->Next[Pos];
+      return Tmp;
+    }
+
+    VDEdge::Types getEdgeType() const {
+      return VDEdge::Types(Edges->Type[Pos]);
+    }
+    int getDistance() const { return Edges->Distance[Pos]; }
+    bool isLoopCarried() const { return getDistance() != 0; }
+    // The latency considering the distance between iterations, with the II
+    // that the CSR is built for.
+    int getLatency() const {
+      return Edges->Latency[Pos] - int(CSR->II) * getDistance();
+    }
+
+    VDEdge getEdge() const {
+      return VDEdge::Create(getEdgeType(), Edges->Latency[Pos], getDistance());
+    }
+  };
+
+  edge_iterator dep_begin(const VSUnit *U) const {
+    return edge_iterator(this, &Deps, Deps.Head[U->getIdx()]);
+  }
+  edge_iterator dep_end(const VSUnit *U) const {
+    return edge_iterator(this, &Deps, NoEdge);
+  }
+
+  edge_iterator use_begin(const VSUnit *U) const {
+    return edge_iterator(this, &Uses, Uses.Head[U->getIdx()]);
+  }
+  edge_iterator use_end(const VSUnit *U) const {
+    return edge_iterator(this, &Uses, NoEdge);
+  }
+
+  unsigned num_edges() const { return Deps.Node.size(); }
+  unsigned getII() const { return II; }
+
+  bool isValid() const { return Valid; }
+  bool isValid(unsigned NewII) const { return Valid && II == NewII; }
+  void invalidate() { Valid = false; }
+
+  // Build the CSR from the control-path or the data-path dependencies, the
+  // edges are selected from the edge bundles with NewII.
+  void build(const VSchedGraph &G, bool IsCtrlPath, unsigned NewII);
+
+  // Add the edge from Src to Dst to the built CSR. The edge is added as an
+  // extra edge even if Dst already depends on Src, this is fine because the
+  // edge bundle only replaces an edge by a tighter one.
+  void addEdge(VSUnit *Dst, VSUnit *Src, const VDEdge &Edge) {
+    assert(Valid && "Add the edge to an invalid CSR!");
+    assert(SUs[Dst->getIdx()] == Dst && SUs[Src->getIdx()] == Src
+           && "SU not in the CSR!");
+    Deps.append(Dst->getIdx(), Src, Edge);
+    Uses.append(Src->getIdx(), Dst, Edge);
+  }
+};
+
 class VSchedGraph {
 public:
   typedef std::vector<VSUnit*> SUnitVecTy;
@@ -639,8 +807,14 @@ private:
   // The schedule unit that jump back to current fsm state.
   PointerIntPair<MachineInstr*, 1, bool> LoopOp;
 
-  typedef std::map<InstPtrTy, VSUnit*> SUnitMapType;
+  // Mapping the opaque value of InstPtrTy to the SU.
+  typedef DenseMap<void*, VSUnit*> SUnitMapType;
   SUnitMapType InstToSUnits;
+
+  // The CSR form of the control-path and the data-path dependencies graph,
+  // which are available after the graph is frozen.
+  VSchedGraphCSR CPCSR, DPCSR;
+  bool Frozen;
   struct BBInfo {
     // The entry and exit node of the current BB.
     VSUnit *Entry, *Exit;
@@ -758,7 +932,8 @@ public:
   VSchedGraph(DetialLatencyInfo &DLInfo, bool AllowDangling,
               bool EnablePipeline, unsigned EntrySlot)
     : DLInfo(DLInfo), AllowDangling(AllowDangling), Exit(0),
-      NextSUIdx(FirstSUIdx), LoopOp(0, EnablePipeline), EntrySlot(EntrySlot) {}
+      NextSUIdx(FirstSUIdx), LoopOp(0, EnablePipeline), Frozen(false),
+      EntrySlot(EntrySlot) {}
 
   ~VSchedGraph() {
     std::for_each(DPSUs.begin(), DPSUs.end(), deleter<VSUnit>);
@@ -815,7 +990,8 @@ public:
     SU->addPtr(Ptr, latency);
     SUnitMapType::iterator where;
     bool inserted;
-    tie(where, inserted) = InstToSUnits.insert(std::make_pair(Ptr, SU));
+    tie(where, inserted)
+      = InstToSUnits.insert(std::make_pair(Ptr.getOpaqueValue(), SU));
     assert(inserted && "Mapping from I already exist!");
     return true;
   }
@@ -823,6 +999,34 @@ public:
   // Extend the to schedule SU list to all SU in current schedule graph.
   void prepareForDatapathSched();
 
+  /// @name Frozen graph
+  //{
+  // Freeze the graph after it is built and verified, and build the CSR form
+  // for the schedulers. The edges added after that should be added by
+  // VSchedGraph::addDep, so the CSR is kept up to date.
+  void freeze();
+  bool isFrozen() const { return Frozen; }
+
+  template<bool IsCtrlPath>
+  void addDep(VSUnit *Dst, VSUnit *Src, VDEdge Edge) {
+    assert(Frozen && "Add the edges to the SUs directly during building!");
+    Dst->addDep<IsCtrlPath>(Src, Edge);
+    VSchedGraphCSR &CSR = IsCtrlPath ? CPCSR : DPCSR;
+    // The loop-carried edges are selected by the II, rebuild the CSR for them.
+    if (CSR.isValid() && !Edge.isLoopCarried()) CSR.addEdge(Dst, Src, Edge);
+    else                                         CSR.invalidate();
+  }
+
+  // Get the CSR form of the dependencies graph with the edges selected for II.
+  template<bool IsCtrlPath>
+  const VSchedGraphCSR &getCSR(unsigned II) {
+    assert(Frozen && "Graph not frozen yet!");
+    VSchedGraphCSR &CSR = IsCtrlPath ? CPCSR : DPCSR;
+    if (!CSR.isValid(II)) CSR.build(*this, IsCtrlPath, II);
+    return CSR;
+  }
+  //}
+
   void topologicalSortCPSUs();
 
   VSUnit *createTerminator(const MachineBasicBlock *MBB,
@@ -880,7 +1084,7 @@ public:
   /// the dependences between schedule unit based on dependences between machine
   /// instructions.
   VSUnit *lookupSUnit(InstPtrTy Ptr) const {
-    SUnitMapType::const_iterator at = InstToSUnits.find(Ptr);
+    SUnitMapType::const_iterator at = InstToSUnits.find(Ptr.getOpaqueValue());
     return at == InstToSUnits.end() ? 0 : at->second;
   }
 
@@ -978,6 +1182,13 @@ public:
 
   /// @name Scheduling
   //{
+private:
+  bool scheduleLoopWithIMS();
+  // Set the II of the pipelined BB if the schedule is good enough, return true
+  // if the BB is pipelined.
+  bool acceptLoopSchedule(unsigned II, unsigned MII, unsigned ResMII,
+                          unsigned RecMII);
+public:
   bool scheduleLoop();
   // Schedule datapath operations as late as possible after control operations
   // scheduled, this can reduce register usage.
@@ -0,0 +1,119 @@
+//===---------- BBProfile.cpp - The RTL basic block profile -----*- C++ -*-===//
+//
+//                      The Shang HLS frameowrk                               //
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implement the BBProfile class, which read back the basic block
+// entry counts that are dumped by the RTL profile counters.
+//
+//===----------------------------------------------------------------------===//
+
+#include "vtm/BBProfile.h"
+#include "vtm/SynSettings.h"
+
+#include "llvm/BasicBlock.h"
+#include "llvm/CodeGen/MachineBasicBlock.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/system_error.h"
+#define DEBUG_TYPE "vtm-bb-profile"
+#include "llvm/Support/Debug.h"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+ProfileUse("vtm-profile-use",
+           cl::desc("Read the basic block profile dumped by the RTL profile"
+                    " counters (-vtm-enable-bb-profile) from the file, and use"
+                    " it to guide the optimizations"),
+           cl::value_desc("filename"), cl::init(""));
+
+static ManagedStatic<BBProfile> Profile;
+
+BBProfile::BBProfile() {
+  if (ProfileUse.empty()) return;
+
+  OwningPtr<MemoryBuffer> Buffer;
+  if (error_code ec = MemoryBuffer::getFile(ProfileUse, Buffer))
+    report_fatal_error("Cannot open profile file '" + ProfileUse + "': "
+                       + ec.message());
+
+  StringRef Rest = Buffer->getBuffer();
+  while (!Rest.empty()) {
+    std::pair<StringRef, StringRef> LineAndRest = Rest.split('\n');
+    parseLine(LineAndRest.first.rtrim());
+    Rest = LineAndRest.second;
+  }
+}
+
+void BBProfile::parseLine(StringRef Line) {
+  // Only the block entry lines are interesting:
+  //   Module: <module name> MBB#<number>: <block name> entries-><count>
+  if (!Line.startswith("Module: ")) return;
+  Line = Line.substr(8);
+
+  std::pair<StringRef, StringRef> ModAndBB = Line.split(" MBB#");
+  std::pair<StringRef, StringRef> BBAndCount = ModAndBB.second.rsplit("->");
+  if (!BBAndCount.first.endswith(" entries")) return;
+
+  // Drop the block number, the blocks are identified by their names.
+  StringRef BBName = BBAndCount.first.drop_back(8).split(": ").second;
+
+  uint64_t Count;
+  if (BBName.empty() || BBAndCount.second.trim().getAsInteger(10, Count))
+    report_fatal_error("Malformed profile line: '" + Line + "'");
+
+  DEBUG(dbgs() << "Profile: " << ModAndBB.first << ' ' << BBName
+               << " entries " << Count << '\n');
+  // The block may be entered from different instances of the same module, sum
+  // up the counts.
+  Modules[ModAndBB.first][BBName] += Count;
+}
+
+const BBProfile *BBProfile::get() {
+  if (ProfileUse.empty()) return 0;
+
+  return &*Profile;
+}
+
+const BBProfile::BlockCountMapTy *
+BBProfile::getModuleProfile(const Function &F) const {
+  StringRef ModName = F.getName();
+  if (SynSettings *Setting = getSynSetting(F.getName()))
+    ModName = Setting->getModName();
+
+  StringMap<BlockCountMapTy>::const_iterator at = Modules.find(ModName);
+  return at == Modules.end() ? 0 : &at->second;
+}
+
+bool BBProfile::getEntryCount(const Function &F, StringRef BBName,
+                              uint64_t &Count) const {
+  const BlockCountMapTy *Counts = getModuleProfile(F);
+  if (Counts == 0 || BBName.empty()) return false;
+
+  BlockCountMapTy::const_iterator at = Counts->find(BBName);
+  if (at == Counts->end()) return false;
+
+  Count = at->second;
+  return true;
+}
+
+bool BBProfile::getEntryCount(const BasicBlock *BB, uint64_t &Count) const {
+  return getEntryCount(*BB->getParent(), BB->getName(), Count);
+}
+
+bool BBProfile::getEntryCount(const MachineBasicBlock *MBB,
+                              uint64_t &Count) const {
+  const BasicBlock *BB = MBB->getBasicBlock();
+  if (BB == 0) return false;
+
+  return getEntryCount(BB, Count);
+}
@@ -52,7 +52,7 @@ void VFUDesc::print(raw_ostream &OS) const {
 namespace llvm {
   namespace VFUs {
     const char *VFUNames[] = {
-      "Trivial", "AddSub", "Shift", "Mult", "ICmp", "Sel", "Reduction", 
+      "Trivial", "AddSub", "Shift", "Mult", "ICmp", "Sel", "Reduction", "Div",
       "MemoryBus", "BRam", "Mux", "CalleeFN"
     };
 
@@ -169,15 +169,36 @@ VFUMemBus::VFUMemBus(luabind::object FUTable)
   : VFUDesc(VFUs::MemoryBus, getProperty<unsigned>(FUTable, "StartInterval")),
     AddrWidth(getProperty<unsigned>(FUTable, "AddressWidth")),
     DataWidth(getProperty<unsigned>(FUTable, "DataWidth")),
-    Latency(getProperty<float>(FUTable, "Latency")) {}
+    Latency(getProperty<float>(FUTable, "Latency")),
+    NumBuses(std::max(getProperty<unsigned>(FUTable, "NumBuses", 1), 1u)),
+    Pipelined(getProperty<bool>(FUTable, "Pipelined", false)) {}
+
+VFUDiv::VFUDiv(luabind::object FUTable)
+  : VFUDesc(VFUs::Div, 1), Radix(2), Pipelined(false),
+    Available(luabind::type(FUTable) == LUA_TTABLE) {
+  if (!Available) return;
+
+  Radix = getProperty<unsigned>(FUTable, "Radix", 2);
+  if (Radix != 2 && Radix != 4)
+    report_fatal_error("Unsupported divider radix " + utostr(Radix) + "!");
+
+  Pipelined = getProperty<bool>(FUTable, "Pipelined", false);
+  luabind::object CostTable = FUTable["Costs"];
+  VFUs::initCostTable(CostTable, Cost, 5);
+}
 
 VFUBRAM::VFUBRAM(luabind::object FUTable)
   : VFUDesc(VFUs::BRam, getProperty<unsigned>(FUTable, "StartInterval")),
     DataWidth(getProperty<unsigned>(FUTable, "DataWidth")),
+    NumPorts(getProperty<unsigned>(FUTable, "NumPorts", 1)),
     Latency(getProperty<float>(FUTable, "Latency")),
     Prefix(getProperty<std::string>(FUTable, "Prefix")),
     Template(getProperty<std::string>(FUTable, "Template")),
-    InitFileDir(getProperty<std::string>(FUTable, "InitFileDir")) {}
+    InitFileDir(getProperty<std::string>(FUTable, "InitFileDir")) {
+  // The accesses are bound to at most 2 ports by the resource binding.
+  if (NumPorts != 1 && NumPorts != 2)
+    report_fatal_error("Block RAM should have 1 or 2 ports!");
+}
 
 // Dirty Hack: anchor from SynSettings.h
 SynSettings::SynSettings(StringRef Name, SynSettings &From)
@@ -211,6 +232,12 @@ SynSettings::SynSettings(luabind::object SettingTable)
     IsTopLevelModule = Result.get();
 }
 
+unsigned FuncUnitId::getNumPorts() const {
+  if (getFUType() == VFUs::BRam) return getFUDesc<VFUBRAM>()->getNumPorts();
+
+  return 1;
+}
+
 void FuncUnitId::print(raw_ostream &OS) const {
   OS << VFUs::VFUNames[getFUType()];
   // Print the function unit id if necessary.
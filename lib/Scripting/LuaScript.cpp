@@ -22,6 +22,7 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/ThreadLocal.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/ADT/STLExtras.h"
@@ -99,6 +100,10 @@ void LuaScript::init() {
   luabind::globals(State)["SynAttr"] = luabind::newtable(State);
   // Table for Miscellaneous information
   luabind::globals(State)["Misc"] = luabind::newtable(State);
+  // The array partition directives.
+  luabind::globals(State)["ArrayPartition"] = luabind::newtable(State);
+  // The metrics of the synthesized functions.
+  luabind::globals(State)["Metrics"] = luabind::newtable(State);
 }
 
 bool LuaScript::runScriptStr(const std::string &ScriptStr, SMDiagnostic &Err) {
@@ -160,6 +165,83 @@ raw_ostream &LuaScript::getOutputFileStream(std::string &Name) {
   return NewFile->os();
 }
 
+void LuaScript::inheritSynSettings(const LuaScript &From, bool Override) {
+  typedef StringMap<SynSettings*>::const_iterator it;
+  for (it I = From.FunctionSettings.begin(), E = From.FunctionSettings.end();
+       I != E; ++I) {
+    SynSettings *&S = FunctionSettings.GetOrCreateValue(I->getKey()).second;
+    if (!S)            S = new SynSettings(*I->second);
+    else if (Override) *S = *I->second;
+  }
+}
+
+void LuaScript::recordMetric(const std::string &FnName, const char *Name,
+                             double Value) {
+  luabind::object Metrics = getMetrics();
+  if (luabind::type(Metrics[FnName]) != LUA_TTABLE)
+    Metrics[FnName] = luabind::newtable(State);
+
+  Metrics[FnName][Name] = Value;
+}
+
+bool LuaScript::setValue(StringRef Path, const luabind::object &V) {
+  luabind::object o = luabind::globals(State);
+  std::pair<StringRef, StringRef> KeyAndRest = Path.split('.');
+  while (!KeyAndRest.second.empty()) {
+    std::string Key = KeyAndRest.first;
+    if (luabind::type(o[Key]) != LUA_TTABLE)
+      o[Key] = luabind::newtable(State);
+
+    o = o[Key];
+    KeyAndRest = KeyAndRest.second.split('.');
+  }
+
+  std::string Key = KeyAndRest.first;
+  switch (luabind::type(V)) {
+  case LUA_TNUMBER:  o[Key] = luabind::object_cast<double>(V);      break;
+  case LUA_TSTRING:  o[Key] = luabind::object_cast<std::string>(V); break;
+  case LUA_TBOOLEAN: o[Key] = luabind::object_cast<bool>(V);        break;
+  default:           return false;
+  }
+
+  return true;
+}
+
+void
+LuaScript::redirectPerFunctionOutputs(const std::string &Suffix,
+                                      std::vector<RedirectedOutput> &Redirected) {
+  luabind::object Outputs
+    = luabind::globals(State)["Misc"]["PerFunctionOutputs"];
+  if (luabind::type(Outputs) != LUA_TTABLE) return;
+
+  typedef luabind::iterator tab_it;
+  for (tab_it I = tab_it(Outputs), E = tab_it(); I != E; ++I) {
+    std::string Name = luabind::object_cast<std::string>(*I);
+    std::string Path = getValueStr(Name);
+    if (Path.empty()) continue;
+
+    std::string PrivatePath = Path + Suffix;
+    luabind::globals(State)[Name] = PrivatePath;
+    Redirected.push_back(std::make_pair(Path, PrivatePath));
+  }
+}
+
+bool LuaScript::getArrayPartition(const std::string &Name, std::string &Scheme,
+                                  unsigned &Factor) const {
+  luabind::object Directive = luabind::globals(State)["ArrayPartition"][Name];
+  if (luabind::type(Directive) != LUA_TTABLE) return false;
+
+  boost::optional<std::string> S =
+    luabind::object_cast_nothrow<std::string>(Directive["Scheme"]);
+  if (!S) return false;
+
+  Scheme = S.get();
+  boost::optional<unsigned> F =
+    luabind::object_cast_nothrow<unsigned>(Directive["Factor"]);
+  Factor = F ? F.get() : 0;
+  return true;
+}
+
 template<enum VFUs::FUTypes T>
 void LuaScript::initSimpleFU(luabind::object FUs) {
   FUSet[T] = new VSimpleFUDesc<T>(FUs[VFUDesc::getTypeName(T)]);
@@ -184,6 +266,8 @@ void LuaScript::updateFUs() {
 
   initSimpleFU<VFUs::Reduction>(FUs);
 
+  FUSet[VFUs::Div] = new VFUDiv(FUs[VFUDesc::getTypeName(VFUs::Div)]);
+
   FUSet[VFUs::Mux] = new VFUMux(FUs[VFUDesc::getTypeName(VFUs::Mux)]);
 
   // Read other parameters.
@@ -238,13 +322,15 @@ void LuaScript::updateStatus() {
 }
 
 ManagedStatic<LuaScript> Script;
+// The script engine bound to the current thread by the parallel backend.
+static ManagedStatic<sys::ThreadLocal<const LuaScript> > ThreadScript;
 
 VFUDesc *llvm::getFUDesc(enum VFUs::FUTypes T) {
-  return Script->FUSet[T];
+  return scriptEngin().FUSet[T];
 }
 
 SynSettings *llvm::getSynSetting(StringRef Name, SynSettings *ParentSetting) {
-  StringMap<SynSettings*> *SynSettingMap = &Script->FunctionSettings;
+  StringMap<SynSettings*> *SynSettingMap = &scriptEngin().FunctionSettings;
   StringMapEntry<SynSettings*> &Entry = SynSettingMap->GetOrCreateValue(Name);
   SynSettings *&S = Entry.second;
   if (S) return S;
@@ -258,27 +344,45 @@ SynSettings *llvm::getSynSetting(StringRef Name, SynSettings *ParentSetting) {
 }
 
 LuaScript &llvm::scriptEngin() {
+  if (const LuaScript *S = ThreadScript->get())
+    return *const_cast<LuaScript*>(S);
+
   return *Script;
 }
 
+void llvm::setThreadScriptEngine(LuaScript *S) {
+  if (S) ThreadScript->set(S);
+  else   ThreadScript->erase();
+}
+
 // Dirty Hack: Allow we invoke some scripting function in the libraries
 // compiled with no-rtti
 void llvm::bindToScriptEngine(const char *name, VASTModule *M) {
-  Script->bindToGlobals(name, M);
+  scriptEngin().bindToGlobals(name, M);
 }
 
 unsigned llvm::getIntValueFromEngine(ArrayRef<const char*> Path) {
-  return Script->getValue<unsigned>(Path);
+  return scriptEngin().getValue<unsigned>(Path);
 }
 
 std::string llvm::getStrValueFromEngine(ArrayRef<const char*> Path) {
-  return Script->getValue<std::string>(Path);
+  return scriptEngin().getValue<std::string>(Path);
+}
+
+void llvm::recordMetricToEngine(const std::string &FnName, const char *Name,
+                                double Value) {
+  scriptEngin().recordMetric(FnName, Name, Value);
+}
+
+bool llvm::getArrayPartitionFromEngine(const std::string &Name,
+                                       std::string &Scheme, unsigned &Factor) {
+  return scriptEngin().getArrayPartition(Name, Scheme, Factor);
 }
 
 bool llvm::runScriptFile(const std::string &ScriptPath, SMDiagnostic &Err) {
-  return Script->runScriptFile(ScriptPath, Err);
+  return scriptEngin().runScriptFile(ScriptPath, Err);
 }
 
 bool llvm::runScriptStr(const std::string &ScriptStr, SMDiagnostic &Err) {
-  return Script->runScriptStr(ScriptStr, Err);
+  return scriptEngin().runScriptStr(ScriptStr, Err);
 }
@@ -401,7 +401,8 @@ void VASTRegister::printSelector(raw_ostream &OS) const {
   typedef std::map<VASTValPtr, OrVec> CSEMapTy;
   typedef CSEMapTy::const_iterator it;
   if (getRegType() == VASTRegister::BRAM) {
-    const std::string &BRAMArray = VFUBRAM::getArrayName(getDataRegNum());
+    // The ports of the block RAM are named after their output registers.
+    const char *BRAMPort = getName();
 
     CSEMapTy AddrCSEMap, DataCSEMap;
     for (assign_itertor I = assign_begin(), E = assign_end(); I != E; ++I) {
@@ -419,11 +420,11 @@ void VASTRegister::printSelector(raw_ostream &OS) const {
     assert(!AddrCSEMap.empty() && "Unexpected zero address bus fanin!");
     unsigned BlockRAMSize = InitVal;
     unsigned AddrWidth = Log2_32_Ceil(BlockRAMSize);
-    PrintSelector(OS, Twine(BRAMArray) + "_addr", AddrWidth, AddrCSEMap);
+    PrintSelector(OS, Twine(BRAMPort) + "_addr", AddrWidth, AddrCSEMap);
 
     // Only create the selector if there is any fanin to the data port.
     if (!DataCSEMap.empty())
-      PrintSelector(OS, Twine(BRAMArray) + "_data", getBitWidth(), DataCSEMap);
+      PrintSelector(OS, Twine(BRAMPort) + "_data", getBitWidth(), DataCSEMap);
   } else {
     CSEMapTy SrcCSEMap;
 
@@ -440,12 +441,13 @@ void VASTRegister::printAssignment(vlang_raw_ostream &OS,
 
   if (getRegType() == VASTRegister::BRAM) {
     const std::string &BRAMArray = VFUBRAM::getArrayName(getDataRegNum());
+    const char *BRAMPort = getName();
 
     // DIRTYHACK: The size of address bus is stored in the InitVal.
     unsigned BlockRAMSize = InitVal;
     unsigned AddrWidth = Log2_32_Ceil(BlockRAMSize);
     // The block RAM is active if the address bus is active.
-    OS.if_begin(Twine(BRAMArray) + "_addr" + "_selector_enable");
+    OS.if_begin(Twine(BRAMPort) + "_addr" + "_selector_enable");
     // Check if there is any write to the block RAM.
     bool HasAnyWrite = false;
 
@@ -460,10 +462,10 @@ void VASTRegister::printAssignment(vlang_raw_ostream &OS,
     // Only print the write port if there is any write.
     if (HasAnyWrite) {
       // It is a write if the data bus is active.
-      OS.if_begin(Twine(BRAMArray) + "_data" + "_selector_enable");
-      OS << BRAMArray << '[' << BRAMArray << "_addr_selector_wire"
+      OS.if_begin(Twine(BRAMPort) + "_data" + "_selector_enable");
+      OS << BRAMArray << '[' << BRAMPort << "_addr_selector_wire"
          << printBitRange(AddrWidth, 0, false) << ']' << " <= "
-         << BRAMArray << "_data_selector_wire"
+         << BRAMPort << "_data_selector_wire"
          << printBitRange(getBitWidth(), 0, false) << ";\n";
       OS.exit_block();
     }
@@ -471,9 +473,9 @@ void VASTRegister::printAssignment(vlang_raw_ostream &OS,
     // Else is is a read, write to the output port.
     // To let the synthesis tools correctly infer a block RAM, the write to
     // result register is active even the current operation is a write access.
-    OS << VFUBRAM::getOutDataBusName(getDataRegNum())
+    OS << BRAMPort
        << printBitRange(getBitWidth(), 0, false) << " <= "
-       << BRAMArray << '[' << BRAMArray << "_addr_selector_wire"
+       << BRAMArray << '[' << BRAMPort << "_addr_selector_wire"
        << printBitRange(AddrWidth, 0, false) << "];\n";
     OS.exit_block();
   } else {
@@ -595,9 +597,6 @@ void VASTModule::reset() {
 
 VASTModule::~VASTModule() {
   reset();
-
-  delete &(DataPath.str());
-  delete &(ControlBlock.str());
 }
 
 void VASTModule::printDatapath(raw_ostream &OS) const{
@@ -871,6 +870,22 @@ void VASTModule::writeProfileCounters(VASTSlot *S, bool isFirstSlot) {
 
       CtrlS << ' ' << "->%d\"," << BBCounter << ");\n";
       CtrlS.exit_block() << "\n";
+
+      // Also count the times the BB is entered, which is read back by
+      // -vtm-profile-use as the frequency of the BB.
+      std::string EntryCounter = BBCounter + "entry";
+      addRegister(EntryCounter, 64)->Pin();
+      if (BB) {
+        CtrlS.if_begin(getPortName(VASTModule::Finish));
+        CtrlS << "$display(\"Module: " << getName() << " MBB#"
+              << BB->getNumber() << ": " << BB->getName()
+              << " entries->%d\"," << EntryCounter << ");\n";
+        CtrlS.exit_block() << "\n";
+      }
+
+      CtrlS.if_begin(S->getRegister()->getName());
+      CtrlS << EntryCounter << " <= " << EntryCounter << " +1;\n";
+      CtrlS.exit_block() << "\n";
     }
 
     // Increase the profile counter.
@@ -77,6 +77,23 @@ if message ~= nil then print(message) end
 SlackFile:close()
 ]=]
 
+-- Run RunOnDatapath on all paths in RTLDatapaths, used by -vtm-timing-script=bulk.
+Misc.DatapathTableScript = [=[
+local SlackFile = assert(io.open (MainSDCOutput, "a+"))
+local preprocess = require "luapp" . preprocess
+for i, p in ipairs(RTLDatapaths) do
+  RTLDatapath = p
+  local _, message = preprocess {input=RunOnDatapath, output=SlackFile}
+  if message ~= nil then print(message) end
+end
+SlackFile:close()
+]=]
+
+-- The files appended by the per-function scripts, the parallel backend (sync -j)
+-- gives each function a private copy and concatenates them in function order.
+-- The scripts that append to other files should add them to this list.
+Misc.PerFunctionOutputs = { 'MainSDCOutput' }
+
 Misc.TimingConstraintsHeaderScript = [=[
 local SlackFile = assert(io.open (MainSDCOutput, "w"))
 local preprocess = require "luapp" . preprocess
@@ -4,6 +4,7 @@ $('#')include "systemc.h"
 $('#')include "verilated.h"
 $('#')include <iostream>
 $('#')include <fstream>
+$('#')include <cstring>
 using namespace std;
 
 // GlobalVariables
@@ -82,24 +83,28 @@ $('#')ifdef __cplusplus
 }
 $('#')endif
 
+#local NumBuses = FUs.MemoryBus.NumBuses or 1
+#local Pipelined = FUs.MemoryBus.Pipelined or false
 //Top module here
 SC_MODULE(V$(RTLModuleName)_tb){
   public:
     sc_in_clk clk;
     sc_signal<bool> fin;
-    sc_signal<bool> mem0en;
-    sc_signal<uint32_t> mem0cmd;
-    sc_signal<uint32_t> mem0be;
     $(getRetPort(FuncInfo.ReturnSize));
-    sc_signal<uint$(FUs.MemoryBus.AddressWidth)_t> mem0addr;
-    sc_signal<uint64_t> mem0out;
     sc_signal<bool> rstN;
     sc_signal<bool> start;
-    sc_signal<bool> mem0rdy;
+#for i = 0, NumBuses - 1 do
+    sc_signal<bool> mem$(i)en;
+    sc_signal<uint32_t> mem$(i)cmd;
+    sc_signal<uint32_t> mem$(i)be;
+    sc_signal<uint$(FUs.MemoryBus.AddressWidth)_t> mem$(i)addr;
+    sc_signal<uint64_t> mem$(i)out;
+    sc_signal<bool> mem$(i)rdy;
 
-    sc_signal<bool> mem0waitrequest;
+    sc_signal<bool> mem$(i)waitrequest;
 
-    sc_signal<uint64_t>mem0in;
+    sc_signal<uint64_t>mem$(i)in;
+#end
 #for i,v in ipairs(FuncInfo.Args) do
     sc_signal<$(getBitWidth(v.Size))>$(v.Name);
 #end
@@ -131,55 +136,192 @@ SC_MODULE(V$(RTLModuleName)_tb){
       outfile.close();
       exit(0);
     }
+    // The memory buses, bus N serves the mem{N}* ports of the module.
+    enum { NumBuses = $(NumBuses) };
+#if Pipelined then
+    // The pipelined memory buses accept a request every StartInterval cycles,
+    // and the data of a read request is valid exactly Latency cycles after the
+    // request, see VLTIfCodegen.lua for the details.
+    enum {
+      BusLatency = $(math.ceil(FUs.MemoryBus.Latency)),
+      BusStartInterval = $(FUs.MemoryBus.StartInterval)
+    };
+#end
+
+    // The address ranges fetched by the stream read commands, see
+    // VLTIfCodegen.lua for the details.
+    enum { NumStreams = 4, StreamBytes = 128 };
+
+    // The state of a memory bus.
+    struct MemBus {
+      // The destination and the size of the block transfer command sequence.
+      unsigned long long seq_dst, seq_num;
+      unsigned long long stream_begin[NumStreams], stream_end[NumStreams];
+      unsigned stream_idx;
+    };
+    MemBus buses[NumBuses];
+
+    void clear_streams(MemBus &B) {
+      for (unsigned i = 0; i < NumStreams; ++i)
+        B.stream_begin[i] = B.stream_end[i] = 0;
+      B.stream_idx = 0;
+    }
+
+    bool in_stream(MemBus &B, unsigned long long addr) {
+      for (unsigned i = 0; i < NumStreams; ++i)
+        if (B.stream_begin[i] <= addr && addr < B.stream_end[i])
+          return true;
+
+      return false;
+    }
+
+    // Serve the block transfer commands (memset, memcpy, memmove and stream
+    // read), see VLTIfCodegen.lua for the protocol, return the cycles to wait.
+    unsigned block_transfer(MemBus &B, unsigned cmd, unsigned be,
+                            unsigned long long addr, unsigned long long out) {
+      if (cmd == 5) { // Stream read
+        if (out > StreamBytes) out = StreamBytes;
+        B.stream_begin[B.stream_idx] = addr;
+        B.stream_end[B.stream_idx] = addr + out;
+        B.stream_idx = (B.stream_idx + 1) % NumStreams;
+        return 1 + (out + 7) / 8;
+      }
+
+      clear_streams(B);
+
+      if (be == 0) { // SeqBegin
+        B.seq_dst = addr;
+        B.seq_num = out;
+        return 1;
+      }
+
+      assert(be == 2 && "Unexpected command sequence!");
+      switch (cmd) {
+      case 2: memset((void *)B.seq_dst, (int)(out & 0xff), B.seq_num); break;
+      case 3: memcpy((void *)B.seq_dst, (void *)addr, B.seq_num); break;
+      case 4: memmove((void *)B.seq_dst, (void *)addr, B.seq_num); break;
+      default: assert(0 && "Unsupported command!"); break;
+      }
+
+      // Memcpy and memmove read and write every word.
+      unsigned long long beats = (B.seq_num + 7) / 8;
+      return 1 + beats * (cmd == 2 ? 1 : 2);
+    }
+
+    // Perform the load or the store, return the loaded data.
+    unsigned long long access_memory(unsigned cmd, unsigned char cur_be,
+                                     long long cur_addr,
+                                     unsigned long long out) {
+      unsigned long long data = 0;
+      unsigned char addrmask = 0;
+      if (cmd) { // Write memory
+        switch (cur_be){
+        case 1:  *((unsigned char *)(cur_addr)) = ((unsigned char ) (out));   addrmask = 0; break;
+        case 3:  *((unsigned short *)(cur_addr)) = ((unsigned short ) (out)); addrmask = 1; break;
+        case 15: *((unsigned int *)(cur_addr)) = ((unsigned int ) (out));     addrmask = 3; break;
+        case 255: *((unsigned long long *)(cur_addr)) = ((unsigned long long ) (out)); addrmask = 7; break;
+        default: assert(0 && "Unsupported size!"); break;
+        }
+      } else { // Read memory
+        switch (cur_be){
+        case 1:  data = *((unsigned char *)(cur_addr));  addrmask = 0; break;
+        case 3:  data = *((unsigned short *)(cur_addr)); addrmask = 1; break;
+        case 15: data = *((unsigned int *)(cur_addr));   addrmask = 3; break;
+        case 255: data = *((unsigned long long *)(cur_addr)); addrmask = 7; break;
+        default: assert(0 && "Unsupported size!"); break;
+        }
+      }
+
+      assert((cur_addr & addrmask) == 0 && "Unexpected unalign access!");
+      return data;
+    }
+
     //Memory bus function
-    void bus_transation(){
-      mem0waitrequest = 0;
+    void bus_transation(MemBus &B, sc_signal<bool> &en,
+                        sc_signal<uint32_t> &cmd, sc_signal<uint32_t> &be,
+                        sc_signal<uint$(FUs.MemoryBus.AddressWidth)_t> &addr,
+                        sc_signal<uint64_t> &out, sc_signal<uint64_t> &in,
+                        sc_signal<bool> &waitrequest) {
+#if Pipelined then
+      // The data of the reads in flight, indexed by the cycle that the module
+      // reads them.
+      unsigned long long read_data[BusLatency];
+      for (unsigned i = 0; i < BusLatency; ++i)
+        read_data[i] = 0xcdcdcdcdcdcdcdcdull;
+      long long cycle = 0, last_request = -BusStartInterval;
+
+      waitrequest = 0;
       while (true){
-        if(mem0en){
+        if(en){
+          assert(cmd.read() <= 1 && "Unexpected block transfer on the pipelined bus!");
+          assert(cycle - last_request >= BusStartInterval
+                 && "Memory request sent before the start interval!");
+          last_request = cycle;
+
+          unsigned long long data = access_memory(cmd.read(), be.read(),
+                                                  addr.read(), out.read());
+          if (cmd.read() == 0)
+            read_data[(cycle + BusLatency - 1) % BusLatency] = data;
+        }
+
+        // Return the data of the read sent BusLatency - 1 cycles before.
+        unsigned long long &data = read_data[cycle % BusLatency];
+        in = data;
+        data = 0xcdcdcdcdcdcdcdcdull;
+        ++cycle;
+        wait();
+      }
+#else
+      waitrequest = 0;
+      while (true){
+        if(en){
           unsigned CyclesToWait = 0;
-		      unsigned char cur_be = mem0be.read(), addrmask = 0;
-          long long cur_addr = mem0addr.read();
-          if(mem0cmd) { // Write memory
+          unsigned char cur_be = be.read();
+          long long cur_addr = addr.read();
+          if (cmd.read() > 1) { // Block transfer
+            CyclesToWait = block_transfer(B, cmd.read(), cur_be, cur_addr,
+                                          out.read());
+          } else if(cmd.read()) { // Write memory
             CyclesToWait = 1;
-            switch (cur_be){
-            case 1:  *((unsigned char *)(cur_addr)) = ((unsigned char ) (mem0out.read()));   addrmask = 0; break;
-            case 3:  *((unsigned short *)(cur_addr)) = ((unsigned short ) (mem0out.read())); addrmask = 1; break;
-            case 15: *((unsigned int *)(cur_addr)) = ((unsigned int ) (mem0out.read()));     addrmask = 3; break;
-            case 255: *((unsigned long long *)(cur_addr)) = ((unsigned long long ) (mem0out.read())); addrmask = 7; break;
-            default: assert(0 && "Unsupported size!"); break;
-            }
+            access_memory(cmd.read(), cur_be, cur_addr, out.read());
           } else { // Read memory
-            CyclesToWait = 2;
-            switch (cur_be){
-            case 1:  (mem0in) = *((unsigned char *)(cur_addr));  addrmask = 0; break;
-            case 3:  (mem0in) = *((unsigned short *)(cur_addr)); addrmask = 1; break;
-            case 15: (mem0in) = *((unsigned int *)(cur_addr));   addrmask = 3; break;
-            case 255: (mem0in)= *((unsigned long long *)(cur_addr)); addrmask = 7; break;
-            default: assert(0 && "Unsupported size!"); break;
-            }
+            CyclesToWait = in_stream(B, cur_addr) ? 1 : 2;
+            in = access_memory(cmd.read(), cur_be, cur_addr, out.read());
           }
 
-          assert((cur_addr & addrmask) == 0 && "Unexpected unalign access!");
-
           for (unsigned i = 0; i < CyclesToWait; ++i) {
-            mem0waitrequest = 1;
+            waitrequest = 1;
             ++memcnt;
             wait();
-            assert(!mem0en && "Please disable memory while waiting it ready!");
+            assert(!en && "Please disable memory while waiting it ready!");
           }
 
-          mem0waitrequest = 0;
+          waitrequest = 0;
           wait();
         } else {
-          mem0in = 0xcdcdcdcdcdcdcdcd;
+          in = 0xcdcdcdcdcdcdcdcd;
           // Wait for next cycle.
           wait();
         }
       }
+#end
+    }
+
+#for i = 0, NumBuses - 1 do
+    void bus$(i)_transation() {
+      bus_transation(buses[$(i)], mem$(i)en, mem$(i)cmd, mem$(i)be, mem$(i)addr,
+                     mem$(i)out, mem$(i)in, mem$(i)waitrequest);
     }
 
+#end
     void memrdyLogic() {
-      mem0rdy = !(mem0en || mem0waitrequest);
+#for i = 0, NumBuses - 1 do
+#if Pipelined then
+      mem$(i)rdy = 1;
+#else
+      mem$(i)rdy = !(mem$(i)en || mem$(i)waitrequest);
+#end
+#end
     }
 
     static V$(RTLModuleName)_tb* Instance() {
@@ -203,17 +345,23 @@ SC_MODULE(V$(RTLModuleName)_tb){
 #end
         DUT.start(start);
         DUT.rstN(rstN);
-        DUT.mem0en(mem0en);
-        DUT.mem0cmd(mem0cmd);
-        DUT.mem0rdy(mem0rdy);
-        DUT.mem0in(mem0in);
-        DUT.mem0out(mem0out);
-        DUT.mem0be(mem0be);
-        DUT.mem0addr(mem0addr);
+#for i = 0, NumBuses - 1 do
+        DUT.mem$(i)en(mem$(i)en);
+        DUT.mem$(i)cmd(mem$(i)cmd);
+        DUT.mem$(i)rdy(mem$(i)rdy);
+        DUT.mem$(i)in(mem$(i)in);
+        DUT.mem$(i)out(mem$(i)out);
+        DUT.mem$(i)be(mem$(i)be);
+        DUT.mem$(i)addr(mem$(i)addr);
+#end
         SC_CTHREAD(sw_main_entry,clk.pos());
-        SC_CTHREAD(bus_transation,clk.pos());
+#for i = 0, NumBuses - 1 do
+        SC_CTHREAD(bus$(i)_transation,clk.pos());
+#end
         SC_METHOD(memrdyLogic);
-        sensitive << mem0en << mem0waitrequest;
+#for i = 0, NumBuses - 1 do
+        sensitive << mem$(i)en << mem$(i)waitrequest;
+#end
       }
     private:
       V$(RTLModuleName)_tb(const V$(RTLModuleName)_tb&) ;
@@ -227,6 +375,8 @@ SC_MODULE(V$(RTLModuleName)_tb){
     end
   )){
     V$(RTLModuleName)_tb *tb_ptr = V$(RTLModuleName)_tb::Instance();
+    for (unsigned i = 0; i < V$(RTLModuleName)_tb::NumBuses; ++i)
+      tb_ptr->clear_streams(tb_ptr->buses[i]);
 #for i,v in ipairs(FuncInfo.Args) do
     tb_ptr->$(v.Name)=$(v.Name);
 #end       
@@ -276,3 +426,7 @@ local _, message = preprocess {input=SCIFGScript, output=IfFile}
 if message ~= nil then print(message) end
 IfFile:close()
 ]=]}
+
+-- The function scripts append the interfaces to IFFileName.
+Misc.PerFunctionOutputs = Misc.PerFunctionOutputs or {}
+table.insert(Misc.PerFunctionOutputs, 'IFFileName')
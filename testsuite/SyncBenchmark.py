@@ -0,0 +1,209 @@
+#! /usr/bin/python
+#
+# Run sync on the benchmarks and record the compile time and the quality of
+# results that are known by sync itself, no vendor tool is required.
+#
+# Usage:
+#   SyncBenchmark.py run <sync> <report.json> <name>:<config.lua>... [-- <sync options>]
+#   SyncBenchmark.py compare <baseline.json> <report.json> [threshold]
+#
+# The report contains the wall time, the peak RSS and the size of the emitted
+# RTL of each benchmark, together with the per-pass wall time (-time-passes)
+# and the statistics (-stats) printed by sync, e.g. the size of the VSchedGraph,
+# the dimensions of the SDC model, the number of slots and the number of
+# registers and function units bound by VRASimple. The II of the software
+# pipelined loops are also recorded, against their ResMII and RecMII, together
+# with the estimated cycles saved by flattening the perfect loop nests.
+
+from __future__ import print_function
+
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+# The statistics that are compared against the baseline, smaller is better.
+TrackedStats = [
+  'Number of scheduling units',
+  'Number of edges between scheduling units',
+  'Number of columns in the largest SDC model',
+  'Number of rows in the largest SDC model',
+  'Number of slots in the generated state machines',
+  'Number of registers allocated in resource binding pass',
+  'Number of function units allocated in resource binding pass',
+  'Number of loops not pipelined because the II is too big',
+]
+
+# Ignore the compile time changes smaller than this, in seconds.
+MinTimeDelta = 0.5
+
+StatsLine = re.compile(r'^\s*(\d+)\s+(\S+)\s+- (.*)$')
+TimeColumn = re.compile(r'(\d+\.\d+) \(\s*\d+\.\d+%\)')
+RTLOutputLine = re.compile(r'^\s*RTLOutput\s*=\s*\[\[(.*)\]\]')
+PipeliningLine = re.compile(r'^Software pipelining: (\S+) BB#(\d+) (.*): '
+                            r'(?:II (\d+)|not pipelined) ResMII (\d+) '
+                            r'RecMII (\d+) Latency (\d+)$')
+FlatteningLine = re.compile(r'^Loop flattening: (\S+) BB#(\d+) (.*): '
+                            r'Outer (\d+) Inner (\d+) '
+                            r'EstimatedCyclesSaved (\d+)'
+                            r'( per outer iteration)?$')
+
+def parse_info_output(path):
+  stats = {}
+  passes = {}
+  loops = []
+  nests = []
+  with open(path, 'r') as f:
+    for line in f:
+      m = PipeliningLine.match(line.rstrip('\n'))
+      if m:
+        loops.append({ 'function' : m.group(1),
+                       'block' : '%s#%s' % (m.group(3), m.group(2)),
+                       'ii' : int(m.group(4)) if m.group(4) else 0,
+                       'res_mii' : int(m.group(5)),
+                       'rec_mii' : int(m.group(6)),
+                       'latency' : int(m.group(7)) })
+        continue
+
+      m = FlatteningLine.match(line.rstrip('\n'))
+      if m:
+        nests.append({ 'function' : m.group(1),
+                       'block' : '%s#%s' % (m.group(3), m.group(2)),
+                       'outer_trip_count' : int(m.group(4)),
+                       'inner_trip_count' : int(m.group(5)),
+                       'estimated_cycles_saved' : int(m.group(6)),
+                       'per_outer_iteration' : m.group(7) is not None })
+        continue
+
+      m = StatsLine.match(line)
+      if m:
+        stats[m.group(3).strip()] = int(m.group(1))
+        continue
+
+      # Pass timing line, the wall time is the last column before the name.
+      columns = list(TimeColumn.finditer(line))
+      if not columns:
+        continue
+      name = line[columns[-1].end():].strip()
+      if name and name != 'Total':
+        passes[name] = passes.get(name, 0.0) + float(columns[-1].group(1))
+  return stats, passes, loops, nests
+
+def get_rtl_output(config):
+  with open(config, 'r') as f:
+    for line in f:
+      m = RTLOutputLine.match(line)
+      if m:
+        return m.group(1)
+  return None
+
+def run_benchmark(sync, name, config, options):
+  info_fd, info_path = tempfile.mkstemp(suffix = '.sync-info')
+  os.close(info_fd)
+
+  cmd = [sync, config, '-stats', '-time-passes', '-vtm-report-pipelining',
+         '-info-output-file=' + info_path] + options
+  start = time.time()
+  p = subprocess.Popen(cmd, cwd = os.path.dirname(os.path.abspath(config)))
+  # Wait for this child only, to get its own peak RSS.
+  _, status, usage = os.wait4(p.pid, 0)
+  wall = time.time() - start
+
+  result = { 'name' : name,
+             'config' : config,
+             'exit_code' : os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1,
+             'wall_time' : wall,
+             # ru_maxrss is in kilobytes on linux.
+             'peak_rss_kb' : usage.ru_maxrss }
+
+  stats, passes, loops, nests = parse_info_output(info_path)
+  os.remove(info_path)
+  result['stats'] = stats
+  result['pass_wall_time'] = passes
+  result['pipelined_loops'] = loops
+  result['flattened_loops'] = nests
+
+  rtl = get_rtl_output(config)
+  if rtl and os.path.exists(rtl):
+    result['rtl_bytes'] = os.path.getsize(rtl)
+
+  return result
+
+def run(argv):
+  if '--' in argv:
+    options = argv[argv.index('--') + 1:]
+    argv = argv[:argv.index('--')]
+  else:
+    options = []
+
+  sync, report = argv[0], argv[1]
+  results = []
+  for bench in argv[2:]:
+    name, config = bench.split(':', 1)
+    print('Running sync on', name)
+    results.append(run_benchmark(sync, name, config, options))
+
+  with open(report, 'w') as f:
+    json.dump(results, f, indent = 2, sort_keys = True)
+
+  return 0 if all(r['exit_code'] == 0 for r in results) else 1
+
+def get_metrics(result):
+  metrics = { 'wall_time' : result['wall_time'],
+              'peak_rss_kb' : result['peak_rss_kb'] }
+  if 'rtl_bytes' in result:
+    metrics['rtl_bytes'] = result['rtl_bytes']
+  for stat in TrackedStats:
+    if stat in result['stats']:
+      metrics[stat] = result['stats'][stat]
+  return metrics
+
+def compare(argv):
+  with open(argv[0], 'r') as f:
+    baseline = dict((r['name'], r) for r in json.load(f))
+  with open(argv[1], 'r') as f:
+    current = json.load(f)
+  threshold = float(argv[2]) if len(argv) > 2 else 0.1
+
+  regressions = 0
+  for result in current:
+    name = result['name']
+    if result['exit_code'] != 0:
+      print('%s: FAILED with exit code %d' % (name, result['exit_code']))
+      regressions += 1
+      continue
+
+    if name not in baseline:
+      print('%s: not in baseline' % name)
+      continue
+
+    old = get_metrics(baseline[name])
+    new = get_metrics(result)
+    for metric in sorted(new):
+      if metric not in old:
+        continue
+      delta = new[metric] - old[metric]
+      if metric == 'wall_time' and delta < MinTimeDelta:
+        continue
+      if delta > old[metric] * threshold:
+        print('%s: %s regressed from %s to %s' % (name, metric, old[metric],
+                                                  new[metric]))
+        regressions += 1
+
+  print('%d regression(s) found' % regressions)
+  return 1 if regressions else 0
+
+if __name__ == '__main__':
+  if len(sys.argv) < 4 or sys.argv[1] not in ('run', 'compare'):
+    print('Usage: %s run <sync> <report.json> <name>:<config.lua>... '
+          '[-- <sync options>]' % sys.argv[0])
+    print('       %s compare <baseline.json> <report.json> [threshold]'
+          % sys.argv[0])
+    sys.exit(2)
+
+  if sys.argv[1] == 'run':
+    sys.exit(run(sys.argv[2:]))
+  sys.exit(compare(sys.argv[2:]))
@@ -1,9 +1,17 @@
+-- The Verilator harness, which drives the generated module without SystemC.
+-- The memory bus is modeled in the same way as SCIfCodegen.lua, so the cycle
+-- counts of the two harnesses are comparable.
 VLTIFGScript = [=[
 // Include the verilator header.
 $('#')include "verilated.h"
+$('#')include <cassert>
+$('#')include <cstdio>
+$('#')include <cstring>
+$('#')include <fstream>
+using namespace std;
 
 // Current simulation time
-static long sim_time = 0;
+static long long sim_time = 0;
 
 // Called by $time in Verilog
 double sc_time_stamp () {
@@ -16,22 +24,27 @@ extern "C" {
 $('#')endif
 
 #for k,v in pairs(GlobalVariables) do
+#if v.AddressSpace == 0 then
 void *vlt_$(escapeNumber(k))() {
-  $(if v.isLocal == 1 then _put('static') else _put('extern')
-    end) $(getType(v.ElemSize)) $(k)$(if v.NumElems > 1 then  _put('[' .. v.NumElems .. ']') end) $(if v.Initializer ~= nil then
+  $(if v.isLocal == 1 then _put('static') else _put('extern') end)
+#if v.Alignment~=0 then
+  __attribute__((aligned($(v.Alignment))))
+#end
+  $(getType(v.ElemSize)) $(k)$(if v.NumElems > 1 then  _put('[' .. v.NumElems .. ']') end)
+  $(if v.Initializer ~= nil then
     _put(' = {')
     for i,n in ipairs(v.Initializer) do
       if i ~= 1 then _put(', ') end
-	    _put(n)
-		  if v.ElemSize == 32 then _put('u')
-		  elseif v.ElemSize > 32 then _put('ull')
-		  end
-	  end
+      _put(n)
+      if v.ElemSize == 32 then _put('u')
+      elseif v.ElemSize > 32 then _put('ull')
+      end
+    end
     _put('}')
   end);
   return (void *)$(if v.NumElems == 1 then  _put('&') end)$(k);
 }
-
+#end --end addresssapce == 0
 #end
 
 // Wrapper functions.
@@ -60,10 +73,247 @@ VLTIFFScript = [=[
 // And the header file of the generated module.
 $('#')include "V$(RTLModuleName).h"
 
+// The cycles that the module is running, and the cycles that the module is
+// waiting for the memory bus.
+static long long cnt = 0;
+static long long memcnt = 0;
+
+static V$(RTLModuleName) *DUT = 0;
+
+#local NumBuses = FUs.MemoryBus.NumBuses or 1
+#local Pipelined = FUs.MemoryBus.Pipelined or false
+// The memory buses, bus N serves the mem{N}* ports of the module.
+enum { NumBuses = $(NumBuses) };
+#if Pipelined then
+// The pipelined memory buses accept a request every StartInterval cycles, and
+// the data of a read request is valid exactly Latency cycles after the request.
+// The module does not wait for mem{N}rdy.
+enum {
+  BusLatency = $(math.ceil(FUs.MemoryBus.Latency)),
+  BusStartInterval = $(FUs.MemoryBus.StartInterval)
+};
+#end
+
+// The address ranges fetched by the stream read commands, the bus keeps the
+// fetched data coherent with the stores (write through), so the reads from
+// the ranges always get the data in the memory. Like the stream buffer of the
+// Avalon wrapper, there are NumStreams slots of StreamBytes bytes, and the
+// block transfers invalidate all of them.
+enum { NumStreams = 4, StreamBytes = 128 };
+
+// The state of a memory bus.
+enum BusState { BusIdle, BusWaiting, BusRelease };
+struct MemBus {
+  BusState state;
+  unsigned cycles_left;
+  bool waitrequest;
+  // The data read by the bus.
+  unsigned long long in;
+  // The destination and the size of the block transfer command sequence.
+  unsigned long long seq_dst, seq_num;
+  unsigned long long stream_begin[NumStreams], stream_end[NumStreams];
+  unsigned stream_idx;
+#if Pipelined then
+  // The data of the reads in flight, indexed by the cycle that the module
+  // reads them, and the cycle of the last request.
+  unsigned long long read_data[BusLatency];
+  long long last_request;
+#end
+};
+static MemBus buses[NumBuses];
+// The number of rising edges since the simulation start.
+static long long bus_cycle = 0;
+
+// The memory request sampled at the rising edge.
+struct BusRequest {
+  bool en;
+  unsigned cmd, be;
+  unsigned long long addr, out;
+};
+
+static void clear_streams(MemBus &B) {
+  for (unsigned i = 0; i < NumStreams; ++i)
+    B.stream_begin[i] = B.stream_end[i] = 0;
+  B.stream_idx = 0;
+}
+
+static bool in_stream(MemBus &B, unsigned long long addr) {
+  for (unsigned i = 0; i < NumStreams; ++i)
+    if (B.stream_begin[i] <= addr && addr < B.stream_end[i])
+      return true;
+
+  return false;
+}
+
+$('#')ifdef __cplusplus
+extern "C" {
+$('#')endif
+#if FuncInfo.Name ~= "main" then
+int sw_main();
+#end
+$('#')ifdef __cplusplus
+}
+$('#')endif
+
+static void eval_comb() {
+  DUT->eval();
+  // The bus is ready if it is not active and not waiting.
+#for i = 0, NumBuses - 1 do
+  DUT->mem$(i)rdy = !(DUT->mem$(i)en || buses[$(i)].waitrequest);
+#end
+  DUT->eval();
+}
+
+// Serve the block transfer commands (memset, memcpy and memmove), which are
+// sent in two requests: the first one carries the destination and the number
+// of bytes, the second one carries the value to set or the source. The bus
+// performs them with burst transfers, one bus word per cycle after the first
+// cycle. The stream read command is sent in a single request which carries
+// the start address and the number of bytes to fetch. Return the cycles to
+// wait.
+static unsigned block_transfer(MemBus &B, const BusRequest &R) {
+  unsigned long long out = R.out;
+  if (R.cmd == 5) { // Stream read
+    if (out > StreamBytes) out = StreamBytes;
+    B.stream_begin[B.stream_idx] = R.addr;
+    B.stream_end[B.stream_idx] = R.addr + out;
+    B.stream_idx = (B.stream_idx + 1) % NumStreams;
+    return 1 + (out + 7) / 8;
+  }
+
+  clear_streams(B);
+
+  if ((R.be & 0xff) == 0) { // SeqBegin
+    B.seq_dst = R.addr;
+    B.seq_num = out;
+    return 1;
+  }
+
+  assert((R.be & 0xff) == 2 && "Unexpected command sequence!");
+  switch (R.cmd) {
+  case 2: memset((void *)B.seq_dst, (int)(out & 0xff), B.seq_num); break;
+  case 3: memcpy((void *)B.seq_dst, (void *)R.addr, B.seq_num); break;
+  case 4: memmove((void *)B.seq_dst, (void *)R.addr, B.seq_num); break;
+  default: assert(0 && "Unsupported command!"); break;
+  }
+
+  // Memcpy and memmove read and write every word.
+  unsigned long long beats = (B.seq_num + 7) / 8;
+  return 1 + beats * (R.cmd == 2 ? 1 : 2);
+}
+
+// Perform the load or the store of the request, return the loaded data.
+static unsigned long long access_memory(const BusRequest &R) {
+  unsigned long long addr = R.addr, data = 0;
+  unsigned char addrmask = 0;
+  if (R.cmd) { // Write memory
+    switch (R.be & 0xff) {
+    case 1:  *((unsigned char *)(addr)) = ((unsigned char ) (R.out));   addrmask = 0; break;
+    case 3:  *((unsigned short *)(addr)) = ((unsigned short ) (R.out)); addrmask = 1; break;
+    case 15: *((unsigned int *)(addr)) = ((unsigned int ) (R.out));     addrmask = 3; break;
+    case 255: *((unsigned long long *)(addr)) = ((unsigned long long ) (R.out)); addrmask = 7; break;
+    default: assert(0 && "Unsupported size!"); break;
+    }
+  } else { // Read memory
+    switch (R.be & 0xff) {
+    case 1:  data = *((unsigned char *)(addr));  addrmask = 0; break;
+    case 3:  data = *((unsigned short *)(addr)); addrmask = 1; break;
+    case 15: data = *((unsigned int *)(addr));   addrmask = 3; break;
+    case 255: data = *((unsigned long long *)(addr)); addrmask = 7; break;
+    default: assert(0 && "Unsupported size!"); break;
+    }
+  }
+
+  assert((addr & addrmask) == 0 && "Unexpected unalign access!");
+  return data;
+}
+
+#if Pipelined then
+// Serve the memory request that is sampled at the rising edge, and return the
+// data of the read sent BusLatency - 1 edges before.
+static void bus_transaction(MemBus &B, const BusRequest &R) {
+  if (R.en) {
+    assert(R.cmd <= 1 && "Unexpected block transfer on the pipelined bus!");
+    assert(bus_cycle - B.last_request >= BusStartInterval
+           && "Memory request sent before the start interval!");
+    B.last_request = bus_cycle;
+
+    unsigned long long data = access_memory(R);
+    if (R.cmd == 0)
+      B.read_data[(bus_cycle + BusLatency - 1) % BusLatency] = data;
+  }
+
+  unsigned long long &data = B.read_data[bus_cycle % BusLatency];
+  B.in = data;
+  data = 0xcdcdcdcdcdcdcdcdull;
+}
+#else
+// Serve the memory request that is sampled at the rising edge.
+static void bus_transaction(MemBus &B, const BusRequest &R) {
+  switch (B.state) {
+  case BusWaiting:
+    ++memcnt;
+    if (--B.cycles_left == 0) B.state = BusRelease;
+    return;
+  case BusRelease:
+    B.waitrequest = false;
+    B.state = BusIdle;
+    return;
+  case BusIdle:
+    break;
+  }
+
+  if (!R.en) {
+    B.in = 0xcdcdcdcdcdcdcdcdull;
+    return;
+  }
+
+  unsigned CyclesToWait = 0;
+  if (R.cmd > 1) // Block transfer
+    CyclesToWait = block_transfer(B, R);
+  else if (R.cmd) { // Write memory
+    CyclesToWait = 1;
+    access_memory(R);
+  } else { // Read memory
+    // The data fetched by the stream read is available in the next cycle.
+    CyclesToWait = in_stream(B, R.addr) ? 1 : 2;
+    B.in = access_memory(R);
+  }
+
+  B.waitrequest = true;
+  ++memcnt;
+  B.cycles_left = CyclesToWait - 1;
+  B.state = B.cycles_left ? BusWaiting : BusRelease;
+}
+#end
+
+// Run the module for one clock cycle.
+static void clock_cycle() {
+  // The memory buses sample the outputs of the module at the rising edge.
+  BusRequest Reqs[NumBuses];
+#for i = 0, NumBuses - 1 do
+  Reqs[$(i)].en = DUT->mem$(i)en;
+  Reqs[$(i)].cmd = DUT->mem$(i)cmd;
+  Reqs[$(i)].be = DUT->mem$(i)be;
+  Reqs[$(i)].addr = DUT->mem$(i)addr;
+  Reqs[$(i)].out = DUT->mem$(i)out;
+#end
+
+  DUT->clk = 1;
+  ++sim_time;
+  DUT->eval();
 
-// Instantiation of module
-#local RTLModuleNameInst = 'V' .. RTLModuleName .. '_Inst'
-static V$(RTLModuleName) $(RTLModuleNameInst)("$(FuncInfo.Name)");
+  for (unsigned i = 0; i < NumBuses; ++i)
+    bus_transaction(buses[i], Reqs[i]);
+  ++bus_cycle;
+#for i = 0, NumBuses - 1 do
+  DUT->mem$(i)in = buses[$(i)].in;
+#end
+
+  DUT->clk = 0;
+  ++sim_time;
+  eval_comb();
+}
 
 $('#')ifdef __cplusplus
 extern "C" {
@@ -74,106 +324,97 @@ $(getType(FuncInfo.ReturnSize)) $(FuncInfo.Name)_if($(
     _put(getType(v.Size) .. ' '.. v.Name)
   end
  )) {
-  $(RTLModuleNameInst).rstN = (1);
   // Reset the module if we first time invoke the module.
-  if (sim_time == 0) {
-    //Increase clk by half cycle.
-    $(RTLModuleNameInst).clk = (sim_time++ & 0x1);
-    // Evaluate model.
-    $(RTLModuleNameInst).eval();
-    $(RTLModuleNameInst).rstN = (0);
+  if (DUT == 0) {
+    DUT = new V$(RTLModuleName)("DUT");
+    DUT->clk = 0;
+    DUT->start = 0;
+    DUT->rstN = 0;
+    eval_comb();
+    for (unsigned i = 0; i < 10; ++i)
+      clock_cycle();
+    DUT->rstN = 1;
+    clock_cycle();
   }
 
-  //Increase clk by half cycle.
-  $(RTLModuleNameInst).clk = (sim_time++ & 0x1);
-  // Evaluate model.
-  $(RTLModuleNameInst).eval();
-    // Deassert reset
-  $(RTLModuleNameInst).rstN = (1);
-  //Increase clk by half cycle.
-  $(RTLModuleNameInst).clk = (sim_time++ & 0x1);
-  // Evaluate model.
-  $(RTLModuleNameInst).eval();
-
-  //Increase clk by half cycle.
-  $(RTLModuleNameInst).clk = (sim_time++ & 0x1);
-  // Evaluate model.
-  $(RTLModuleNameInst).eval();
-  assert(!($(RTLModuleNameInst).fin)&& "Module finished before start!");
+  assert(!(DUT->fin) && "Module finished before start!");
+  for (unsigned i = 0; i < NumBuses; ++i) {
+    clear_streams(buses[i]);
+#if Pipelined then
+    buses[i].last_request = bus_cycle - BusStartInterval;
+#end
+  }
 
   // Setup the parameters.
 #for i,v in ipairs(FuncInfo.Args) do
-  $(RTLModuleNameInst).$(v.Name) = $(v.Name);
+  DUT->$(v.Name) = $(v.Name);
 #end
 
   // Start the module.
-  $(RTLModuleNameInst).start = (1);
-  // Remember the start time.
-  long start_time = sim_time;
-  long ready_time = sim_time;
-  // Commit the signals.
-  //Increase clk by half cycle.
-  $(RTLModuleNameInst).clk = (sim_time++ & 0x1);
-  // Evaluate model.
-  $(RTLModuleNameInst).eval();
-
-  // The main evaluation loop.
-  do{
-    // Check for if the clk rising
-    if (( (~sim_time) & 0x1) == 1) {
-      $(RTLModuleNameInst).mem0rdy = ((sim_time >= ready_time));
-      if (($(RTLModuleNameInst).mem0en)){ // If membus0 active
-$('#')ifdef __DEBUG_IF
-        unsigned long long Addr = ($(RTLModuleNameInst).mem0addr);
-        printf("Bus active with address %x\n", Addr);
-$('#')endif
-        if (($(RTLModuleNameInst).mem0we)){ // This is a write
-          switch (($(RTLModuleNameInst).mem0be) & 0xff){
-            case 1: *((unsigned char *)($(RTLModuleNameInst).mem0addr)) = ((unsigned char ) ($(RTLModuleNameInst).mem0out)); break;
-            case 3: *((unsigned short *)($(RTLModuleNameInst).mem0addr)) = ((unsigned short ) ($(RTLModuleNameInst).mem0out)); break;
-            case 15: *((unsigned int *)($(RTLModuleNameInst).mem0addr)) = ((unsigned int ) ($(RTLModuleNameInst).mem0out)); break;
-            case 255: *((unsigned long long *)($(RTLModuleNameInst).mem0addr)) = ((unsigned long long ) ($(RTLModuleNameInst).mem0out)); break;
-            default: assert(0 && "Unsupported size!"); break;
-          }
-        } else { // This is a read
-          switch (($(RTLModuleNameInst).mem0be) & 0xff){
-            case 1: ($(RTLModuleNameInst).mem0in) = *((unsigned char *)($(RTLModuleNameInst).mem0addr)); break;
-            case 3: ($(RTLModuleNameInst).mem0in) = *((unsigned short *)($(RTLModuleNameInst).mem0addr)); break;
-            case 15: ($(RTLModuleNameInst).mem0in) = *((unsigned int *)($(RTLModuleNameInst).mem0addr)); break;
-            case 255: ($(RTLModuleNameInst).mem0in) = *((unsigned long long *)($(RTLModuleNameInst).mem0addr)); break;
-            default: assert(0 && "Unsupported size!"); break;
-          }
-        } // end read/write
-      } // end membus0
-      // Simulate the ready port of the membus.
-      if (($(RTLModuleNameInst).mem0rdy) && ($(RTLModuleNameInst).mem0en)){ // If membus0 ready for next transaction
-        // Update the ready time of membus.
-        ready_time = sim_time + 2 + 5;
-$('#')ifdef __DEBUG_IF
-        printf("Memory Active at %x going to ready at %x\n", sim_time, ready_time);
-$('#')endif
-      } // end next transaction membus0
-    } // end clk rising
+  DUT->start = 1;
+  eval_comb();
+  clock_cycle();
+  DUT->start = 0;
+  eval_comb();
 
-    // Check if the module finish its job at last.
-    if (($(RTLModuleNameInst).fin)) {
-      return $(if FuncInfo.ReturnSize ~= 0 then _put('(' .. getType(FuncInfo.ReturnSize) .. ')' .. RTLModuleNameInst .. '.return_value') end);
-    }
+  // Give up if the module does not finish in 16M cycles.
+  long long start_cnt = cnt;
+  while (!(DUT->fin)) {
+    clock_cycle();
+    ++cnt;
 
-    //Increase clk by half cycle.
-    $(RTLModuleNameInst).clk = (sim_time++ & 0x1);
-    // Evaluate model.
-    $(RTLModuleNameInst).eval();
-    $(RTLModuleNameInst).start = (0);
-  } while(!Verilated::gotFinish() && (sim_time - start_time) <  16000000);
+    if (Verilated::gotFinish() || (cnt - start_cnt) >= 16000000) {
+      assert(0 && "Something went wrong during the simulation!");
+      break;
+    }
+  }
 
-  assert(0 && "Something went wrong during the simulation!");
-  return $(if FuncInfo.ReturnSize ~= 0 then _put('0') end);
+#if FuncInfo.ReturnSize~=0 then
+  return ($(getType(FuncInfo.ReturnSize))) DUT->return_value;
+#else
+  return;
+#end
 }
-// Dirty Hack: Only C function is supported now.
 $('#')ifdef __cplusplus
 }
 $('#')endif
+
+int main(int vlt_argc, char **vlt_argv) {
+  Verilated::commandArgs(vlt_argc, vlt_argv);
+#if FuncInfo.Name ~= "main" then
+  sw_main();
+#else
+  // Pass argc and argv to the hardware main, if it takes them.
+#for i,v in ipairs(FuncInfo.Args) do
+  $(getType(v.Size)) $(v.Name) = ($(getType(v.Size))) $(
+    if i == 1 then _put('vlt_argc')
+    elseif i == 2 then _put('(unsigned long)vlt_argv')
+    else _put('0') end);
+#end
+  $(getType(FuncInfo.ReturnSize)) RetVle = $(FuncInfo.Name)_if($(
+    for i,v in ipairs(FuncInfo.Args) do
+      if i ~= 1 then _put(', ') end
+      _put(v.Name)
+    end
+  ));
+  assert(RetVle == 0 && "Return value of main function is not 0!");
+#end
+
+  ofstream outfile;
+  outfile.open ("$(CounterFile)");
+  outfile <<"$(RTLModuleName) hardware run cycles " << cnt << " wait cycles " << memcnt <<endl;
+  outfile.close();
+  outfile.open ("$(BenchmarkCycles)", ios_base::app);
+  outfile <<",\n{\"name\":\"$(RTLModuleName)\", \"total\":" << cnt << ", \"wait\":" << memcnt << '}' <<endl;
+  outfile.close();
+
+  if (DUT) {
+    DUT->final();
+    delete DUT;
+  }
+
+  return 0;
+}
 #end
 ]=]
 
@@ -191,3 +432,6 @@ if message ~= nil then print(message) end
 IfFile:close()
 ]=]}
 
+-- The function scripts append the interfaces to IFFileName.
+Misc.PerFunctionOutputs = Misc.PerFunctionOutputs or {}
+table.insert(Misc.PerFunctionOutputs, 'IFFileName')
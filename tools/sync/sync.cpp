@@ -14,12 +14,15 @@
 //===----------------------------------------------------------------------===//
 #include "vtm/Passes.h"
 #include "vtm/LuaScript.h"
+#include "vtm/BBProfile.h"
 
 #include "llvm/LLVMContext.h"
 #include "llvm/Module.h"
 #include "llvm/PassManager.h"
 #include "llvm/Pass.h"
 #include "llvm/Config/config.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/Analysis/Passes.h"
 #include "llvm/Analysis/Verifier.h"
 #include "llvm/Assembly/PrintModulePass.h"
@@ -35,15 +38,35 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
 #include "llvm/Support/PluginLoader.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/SourceMgr.h"
-
+#include "llvm/Support/system_error.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
 #include <memory>
+#include <set>
+
+#if LLVM_MULTITHREADED && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#include <unistd.h>
+#define SYNC_USE_PTHREADS
+#endif
 
 // This is the only header we need to include for LuaBind to work
 #include "luabind/luabind.hpp"
@@ -66,6 +89,19 @@ using namespace llvm;
 static cl::opt<std::string>
 InputFilename(cl::Positional, cl::desc("<input lua script>"), cl::init("-"));
 
+static cl::opt<unsigned>
+NumThreads("j", cl::desc("Number of threads to compile the hardware functions,"
+                         " or to evaluate the design points with -dse, which"
+                         " use all processors by default"),
+           cl::init(1));
+
+static cl::opt<bool>
+ExploreDesignSpace("dse",
+                   cl::desc("Evaluate the design points described by the DSE"
+                            " table of the script and write the Pareto front,"
+                            " instead of generating the RTL"),
+                   cl::init(false));
+
 namespace llvm {
   extern Target TheVBackendTarget;
 }
@@ -79,10 +115,678 @@ static void LoopOptimizerEndExtensionFn(const PassManagerBuilder &Builder,
   PM.add(createMemoryAccessAlignerPass());
   PM.add(createScalarEvolutionAliasAnalysisPass());
   PM.add(createTrivialLoopUnrollPass());
+  PM.add(createLoopFlatteningPass());
   PM.add(createMemoryAccessAlignerPass());
   PM.add(createInstructionCombiningPass());
 }
 
+// Add the per-function backend passes: code generation, timing analysis, RTL
+// writing and the user scripting passes. If IsShard is true, the passes only
+// emit the per-function part of the outputs and leave the module level part
+// (RTL global code, timing script header, global scripts of the scripting
+// passes) to the driver.
+static void addBackendPasses(PassManagerBase &PM, TargetMachine &TM,
+                             LuaScript &S, raw_ostream &RTLOut,
+                             formatted_raw_ostream &NullOut, bool IsShard) {
+  // Ask the target to add backend passes as necessary.
+  TM.addPassesToEmitFile(PM, NullOut, TargetMachine::CGFT_Null,
+                         false/*NoVerify*/);
+
+  // Analyse the slack between registers.
+  PM.add(createCombPathDelayAnalysisPass(!IsShard));
+  PM.add(createVerilogASTWriterPass(RTLOut, !IsShard));
+
+  // Run some scripting passes. The optional SetupScript of a pass sets up the
+  // globals used by its FunctionScript, and the GlobalScript writes the module
+  // level outputs, which are only written by the driver.
+  for (LuaScript::scriptpass_it I = S.passes_begin(), E = S.passes_end();
+       I != E; ++I) {
+    const luabind::object &o = *I;
+    boost::optional<std::string> SetupScript
+      = luabind::object_cast_nothrow<std::string>(o["SetupScript"]);
+    std::string GlobalScript = SetupScript ? SetupScript.get() : "";
+    if (!IsShard)
+      GlobalScript
+        += '\n' + luabind::object_cast<std::string>(o["GlobalScript"]);
+    Pass *P = createScriptingPass(
+      luabind::object_cast<std::string>(I.key()).c_str(),
+      luabind::object_cast<std::string>(o["FunctionScript"]).c_str(),
+      GlobalScript.c_str());
+    PM.add(P);
+  }
+}
+
+namespace {
+// The backend pipeline of a single hardware function in parallel mode. Each
+// job owns its script engine and, while running, its LLVMContext, module copy
+// and target machine, so jobs do not share any mutable state.
+struct BackendJob {
+  std::string FnName;
+  OwningPtr<LuaScript> Engine;
+  // The outputs of the job, merged by the driver in the original order.
+  std::string RTL;
+  std::vector<LuaScript::RedirectedOutput> Outputs;
+  std::string ErrMsg;
+
+  explicit BackendJob(StringRef FnName) : FnName(FnName) {}
+
+  void run(StringRef Bitcode);
+};
+
+// A point of the design space, i.e. the whole backend pipeline of all hardware
+// functions with the knobs set to the chosen values. The job owns its script
+// engine, in which the backend passes record the metrics of the functions.
+struct DSEJob {
+  // The index of the chosen value of each knob.
+  std::vector<unsigned> Choices;
+  OwningPtr<LuaScript> Engine;
+  // The metrics of the design, accumulated over the functions.
+  std::map<std::string, double> Metrics;
+  std::string ErrMsg;
+
+  explicit DSEJob(ArrayRef<unsigned> Choices)
+    : Choices(Choices.begin(), Choices.end()) {}
+
+  void run(StringRef Bitcode);
+  void collectMetrics();
+
+  double getMetric(const std::string &Name) const {
+    std::map<std::string, double>::const_iterator at = Metrics.find(Name);
+    return at == Metrics.end() ? 0 : at->second;
+  }
+
+  // Return true if this point is not worse than RHS in any objective, and
+  // better in at least one of them. All objectives are minimized.
+  bool dominates(const DSEJob &RHS, ArrayRef<std::string> Objectives) const;
+};
+
+// A knob of the design space, the value at Path in the script engine, e.g.
+// FUs.Mult.Latency, and its candidate values.
+struct DSEKnob {
+  std::string Path;
+  std::vector<luabind::object> Values;
+
+  bool operator<(const DSEKnob &RHS) const { return Path < RHS.Path; }
+};
+
+template<typename JobTy>
+struct JobQueue {
+  StringRef Bitcode;
+  std::vector<JobTy*> Jobs;
+  unsigned NextJob;
+  sys::Mutex Lock;
+
+  explicit JobQueue(StringRef Bitcode) : Bitcode(Bitcode), NextJob(0) {}
+  ~JobQueue() { DeleteContainerPointers(Jobs); }
+
+  JobTy *getNextJob() {
+    MutexGuard G(Lock);
+    if (NextJob == Jobs.size()) return 0;
+
+    return Jobs[NextJob++];
+  }
+
+  void runJobs() {
+    while (JobTy *Job = getNextJob())
+      Job->run(Bitcode);
+  }
+
+  static void *runWorker(void *Q) {
+    static_cast<JobQueue*>(Q)->runJobs();
+    return 0;
+  }
+
+  // Run all jobs with NumWorkers threads, including the calling thread.
+  void runJobsInParallel(unsigned NumWorkers) {
+    NumWorkers = std::min<unsigned>(NumWorkers, Jobs.size());
+    // Read the profile before the workers start, so they only read the
+    // process-wide profile instead of racing to create it.
+    BBProfile::get();
+#ifdef SYNC_USE_PTHREADS
+    std::vector<pthread_t> Workers;
+    if (NumWorkers > 1 && llvm_start_multithreaded()) {
+      // The calling thread is also a worker.
+      for (unsigned i = 1; i < NumWorkers; ++i) {
+        pthread_t T;
+        if (::pthread_create(&T, 0, runWorker, this) == 0)
+          Workers.push_back(T);
+      }
+    }
+
+    runJobs();
+
+    for (unsigned i = 0, e = Workers.size(); i != e; ++i)
+      ::pthread_join(Workers[i], 0);
+#else
+    // No thread support, simply run the jobs one by one.
+    runJobs();
+#endif
+  }
+};
+
+typedef JobQueue<BackendJob> BackendJobQueue;
+typedef JobQueue<DSEJob> DSEJobQueue;
+}
+
+void BackendJob::run(StringRef Bitcode) {
+  setThreadScriptEngine(Engine.get());
+
+  LLVMContext Context;
+  OwningPtr<MemoryBuffer> Buffer(MemoryBuffer::getMemBuffer(Bitcode, FnName,
+                                                            false));
+  OwningPtr<Module> M(ParseBitcodeFile(Buffer.get(), Context, &ErrMsg));
+
+  if (M) {
+    Function *F = M->getFunction(FnName);
+    Triple TheTriple(M->getTargetTriple());
+    TargetOptions TO;
+    OwningPtr<TargetMachine>
+      TM(TheVBackendTarget.createTargetMachine(TheTriple.getTriple(), "",
+                                               Engine->getDataLayout(), TO));
+    // The target IR passes are already run by the driver.
+    disableTargetIRPasses(*TM);
+
+    FunctionPassManager FPM(M.get());
+    FPM.add(new TargetData(*TM->getTargetData()));
+    FPM.add(createVAliasAnalysisPass(TM->getIntrinsicInfo()));
+
+    raw_string_ostream RTLOut(RTL);
+    formatted_raw_ostream formatted_nulls(nulls());
+    addBackendPasses(FPM, *TM, *Engine, RTLOut, formatted_nulls, true);
+
+    FPM.doInitialization();
+    FPM.run(*F);
+    FPM.doFinalization();
+    RTLOut.flush();
+  }
+
+  setThreadScriptEngine(0);
+}
+
+// Create the script engine for a backend job by running the same script as the
+// driver, the engine also take the synthesis settings from the driver because
+// the SW/HW partition may have created settings for the sub-functions. If the
+// knobs of a design point are given, they are set before the engine status is
+// updated, and the settings that are changed by the knobs are kept.
+static LuaScript *createJobEngine(const LuaScript &Driver, SMDiagnostic &Err,
+                                  ArrayRef<DSEKnob> Knobs = ArrayRef<DSEKnob>(),
+                                  ArrayRef<unsigned> Choices
+                                    = ArrayRef<unsigned>()) {
+  OwningPtr<LuaScript> S(new LuaScript());
+  S->init();
+
+  if (!S->runScriptFile(InputFilename, Err))
+    return 0;
+
+  for (unsigned i = 0, e = Knobs.size(); i != e; ++i) {
+    bool Set = S->setValue(Knobs[i].Path, Knobs[i].Values[Choices[i]]);
+    assert(Set && "Bad knob value!");
+    (void) Set;
+  }
+
+  S->updateStatus();
+  S->inheritSynSettings(Driver, Knobs.empty());
+  return S.take();
+}
+
+static void writeBitcodeToString(Module &Mod, std::string &Bitcode) {
+  raw_string_ostream BitcodeOut(Bitcode);
+  WriteBitcodeToFile(&Mod, BitcodeOut);
+  BitcodeOut.flush();
+}
+
+static bool appendFile(const std::string &To, const std::string &From,
+                       std::string &ErrMsg) {
+  OwningPtr<MemoryBuffer> Buffer;
+  // The per-function script did not write anything.
+  if (MemoryBuffer::getFile(From, Buffer)) return true;
+
+  raw_fd_ostream Out(To.c_str(), ErrMsg, raw_fd_ostream::F_Append);
+  if (!ErrMsg.empty()) return false;
+
+  Out << Buffer->getBuffer();
+  Buffer.reset();
+
+  bool Existed;
+  sys::fs::remove(From, Existed);
+  return true;
+}
+
+// Compile the hardware functions in Mod with NumThreads worker threads, the
+// module level passes must be already run over Mod.
+static bool runParallelBackend(Module &Mod, TargetMachine &TM, LuaScript &S,
+                               const char *ProgName) {
+  std::string Bitcode;
+  writeBitcodeToString(Mod, Bitcode);
+
+  BackendJobQueue Queue(Bitcode);
+  for (Module::iterator I = Mod.begin(), E = Mod.end(); I != E; ++I) {
+    if (I->isDeclaration()) continue;
+
+    BackendJob *Job = new BackendJob(I->getName());
+    Queue.Jobs.push_back(Job);
+
+    // Create the script engines in the driver thread, updating the engine
+    // status also writes some global settings.
+    SMDiagnostic Err;
+    Job->Engine.reset(createJobEngine(S, Err));
+    if (!Job->Engine) {
+      Err.print(ProgName, errs());
+      return false;
+    }
+
+    Job->Engine->redirectPerFunctionOutputs("." + utostr(Queue.Jobs.size())
+                                            + ".part", Job->Outputs);
+  }
+
+  raw_ostream &RTLOut = S.getOutputStream("RTLOutput");
+  formatted_raw_ostream formatted_nulls(nulls());
+
+  // Emit the module level part of the outputs with the driver engine, the
+  // pipeline is only initialized and finalized without compiling any function.
+  disableTargetIRPasses(TM);
+  FunctionPassManager GlobalPasses(&Mod);
+  GlobalPasses.add(new TargetData(*TM.getTargetData()));
+  GlobalPasses.add(createVAliasAnalysisPass(TM.getIntrinsicInfo()));
+  addBackendPasses(GlobalPasses, TM, S, RTLOut, formatted_nulls, false);
+  GlobalPasses.doInitialization();
+
+  Queue.runJobsInParallel(NumThreads);
+
+  // Merge the outputs in the original function order.
+  for (unsigned i = 0, e = Queue.Jobs.size(); i != e; ++i) {
+    BackendJob *Job = Queue.Jobs[i];
+    if (!Job->ErrMsg.empty()) {
+      errs() << ProgName << ": " << Job->FnName << ": " << Job->ErrMsg << '\n';
+      return false;
+    }
+
+    RTLOut << Job->RTL;
+
+    for (unsigned j = 0, je = Job->Outputs.size(); j != je; ++j) {
+      const LuaScript::RedirectedOutput &O = Job->Outputs[j];
+      std::string ErrMsg;
+      if (!appendFile(O.first, O.second, ErrMsg)) {
+        errs() << ProgName << ": " << ErrMsg << '\n';
+        return false;
+      }
+    }
+  }
+
+  GlobalPasses.doFinalization();
+  return true;
+}
+
+void DSEJob::run(StringRef Bitcode) {
+  setThreadScriptEngine(Engine.get());
+
+  LLVMContext Context;
+  OwningPtr<MemoryBuffer> Buffer(MemoryBuffer::getMemBuffer(Bitcode, "DSE",
+                                                            false));
+  OwningPtr<Module> M(ParseBitcodeFile(Buffer.get(), Context, &ErrMsg));
+
+  if (M) {
+    Triple TheTriple(M->getTargetTriple());
+    TargetOptions TO;
+    OwningPtr<TargetMachine>
+      TM(TheVBackendTarget.createTargetMachine(TheTriple.getTriple(), "",
+                                               Engine->getDataLayout(), TO));
+    // The target IR passes are already run by the driver.
+    disableTargetIRPasses(*TM);
+
+    FunctionPassManager FPM(M.get());
+    FPM.add(new TargetData(*TM->getTargetData()));
+    FPM.add(createVAliasAnalysisPass(TM->getIntrinsicInfo()));
+    // Estimate the data-path cost before the function is lowered.
+    FPM.add(createDesignMetricsPass());
+
+    // Only the metrics are interesting, do not write the RTL and the timing
+    // constraints.
+    formatted_raw_ostream formatted_nulls(nulls());
+    TM->addPassesToEmitFile(FPM, formatted_nulls, TargetMachine::CGFT_Null,
+                            false/*NoVerify*/);
+
+    FPM.doInitialization();
+    for (Module::iterator I = M->begin(), E = M->end(); I != E; ++I)
+      if (!I->isDeclaration())
+        FPM.run(*I);
+    FPM.doFinalization();
+
+    collectMetrics();
+  }
+
+  setThreadScriptEngine(0);
+}
+
+void DSEJob::collectMetrics() {
+  typedef luabind::iterator tab_it;
+  for (tab_it I = tab_it(Engine->getMetrics()), E = tab_it(); I != E; ++I)
+    for (tab_it MI = tab_it(*I), ME = tab_it(); MI != ME; ++MI) {
+      std::string Name = luabind::object_cast<std::string>(MI.key());
+      double Value = luabind::object_cast<double>(*MI);
+      double &Total = Metrics[Name];
+      // The critical path of the design is the longest one of the functions,
+      // the other metrics are accumulated.
+      if (Name == "CriticalPathSlots") Total = std::max(Total, Value);
+      else                             Total += Value;
+    }
+
+  // The area is the cost of the bound registers and function units.
+  Metrics["Area"] = getMetric("RegisterCost") + getMetric("FUCost");
+}
+
+bool DSEJob::dominates(const DSEJob &RHS,
+                       ArrayRef<std::string> Objectives) const {
+  bool Better = false;
+  for (unsigned i = 0, e = Objectives.size(); i != e; ++i) {
+    double L = getMetric(Objectives[i]), R = RHS.getMetric(Objectives[i]);
+    if (L > R) return false;
+    Better |= L < R;
+  }
+
+  return Better;
+}
+
+static void writeJSONString(raw_ostream &OS, StringRef Str) {
+  OS << '"';
+  for (unsigned i = 0, e = Str.size(); i != e; ++i) {
+    unsigned char C = Str[i];
+    if (C == '"' || C == '\\') OS << '\\' << C;
+    else if (C < 0x20)         OS << format("\\u%04x", C);
+    else                       OS << C;
+  }
+  OS << '"';
+}
+
+static void writeJSONValue(raw_ostream &OS, const luabind::object &V) {
+  switch (luabind::type(V)) {
+  case LUA_TNUMBER:
+    OS << format("%.10g", luabind::object_cast<double>(V));
+    break;
+  case LUA_TSTRING:
+    writeJSONString(OS, luabind::object_cast<std::string>(V));
+    break;
+  case LUA_TBOOLEAN:
+    OS << (luabind::object_cast<bool>(V) ? "true" : "false");
+    break;
+  default: llvm_unreachable("Bad knob value!");
+  }
+}
+
+static void writeJSONStrings(raw_ostream &OS, ArrayRef<std::string> Strs) {
+  OS << '[';
+  for (unsigned i = 0, e = Strs.size(); i != e; ++i) {
+    if (i) OS << ", ";
+    writeJSONString(OS, Strs[i]);
+  }
+  OS << ']';
+}
+
+namespace {
+// Sort the design points by the first objective, then the second, and so on.
+struct DSEJobLess {
+  ArrayRef<std::string> Objectives;
+
+  explicit DSEJobLess(ArrayRef<std::string> Objectives)
+    : Objectives(Objectives) {}
+
+  bool operator()(const DSEJob *LHS, const DSEJob *RHS) const {
+    for (unsigned i = 0, e = Objectives.size(); i != e; ++i) {
+      double L = LHS->getMetric(Objectives[i]),
+             R = RHS->getMetric(Objectives[i]);
+      if (L != R) return L < R;
+    }
+
+    return false;
+  }
+};
+}
+
+static void writeParetoFront(raw_ostream &OS, ArrayRef<DSEKnob> Knobs,
+                             ArrayRef<std::string> Objectives,
+                             ArrayRef<DSEJob*> Jobs) {
+  std::vector<DSEJob*> Front;
+  for (unsigned i = 0, e = Jobs.size(); i != e; ++i) {
+    bool Dominated = false;
+    for (unsigned j = 0; j != e && !Dominated; ++j)
+      Dominated = Jobs[j]->dominates(*Jobs[i], Objectives);
+
+    if (!Dominated) Front.push_back(Jobs[i]);
+  }
+
+  std::stable_sort(Front.begin(), Front.end(), DSEJobLess(Objectives));
+
+  std::vector<std::string> KnobPaths;
+  for (unsigned i = 0, e = Knobs.size(); i != e; ++i)
+    KnobPaths.push_back(Knobs[i].Path);
+
+  OS << "{\n  \"Knobs\": ";
+  writeJSONStrings(OS, KnobPaths);
+  OS << ",\n  \"Objectives\": ";
+  writeJSONStrings(OS, Objectives);
+  OS << ",\n  \"NumPoints\": " << Jobs.size()
+     << ",\n  \"ParetoFront\": [";
+
+  for (unsigned i = 0, e = Front.size(); i != e; ++i) {
+    const DSEJob *Job = Front[i];
+    OS << (i ? ",\n" : "\n") << "    {\n      \"Knobs\": {";
+    for (unsigned j = 0, je = Knobs.size(); j != je; ++j) {
+      OS << (j ? ", " : " ");
+      writeJSONString(OS, Knobs[j].Path);
+      OS << ": ";
+      writeJSONValue(OS, Knobs[j].Values[Job->Choices[j]]);
+    }
+    OS << " },\n      \"Metrics\": {";
+
+    typedef std::map<std::string, double>::const_iterator metric_it;
+    for (metric_it I = Job->Metrics.begin(), E = Job->Metrics.end(); I != E;
+         ++I) {
+      OS << (I == Job->Metrics.begin() ? " " : ", ");
+      writeJSONString(OS, I->first);
+      OS << ": " << format("%.10g", I->second);
+    }
+    OS << " }\n    }";
+  }
+
+  OS << "\n  ]\n}\n";
+}
+
+// Read the knobs from the DSE table of the script, which is written as:
+//   DSE = { Knobs = { [<Path>] = { <candidate values> }, ... },
+//           Budget = <number of random points, 0 for the whole grid>,
+//           Seed = <seed of the random search>,
+//           Objectives = { <metrics to minimize> },
+//           Output = <path of the Pareto front> }
+// Only the knobs under FUs.<FU> and Functions.<Function> are allowed, the
+// other settings, e.g. FUs.LUTCost, are process-wide.
+static bool readDSEKnobs(const luabind::object &Config,
+                         std::vector<DSEKnob> &Knobs, std::string &ErrMsg) {
+  if (luabind::type(Config["Knobs"]) != LUA_TTABLE) {
+    ErrMsg = "No knob is found in the DSE table";
+    return false;
+  }
+
+  typedef luabind::iterator tab_it;
+  for (tab_it I = tab_it(Config["Knobs"]), E = tab_it(); I != E; ++I) {
+    boost::optional<std::string> Path
+      = luabind::object_cast_nothrow<std::string>(I.key());
+    if (!Path) {
+      ErrMsg = "The knob path in the DSE table is not a string";
+      return false;
+    }
+
+    DSEKnob K;
+    K.Path = Path.get();
+
+    std::pair<StringRef, StringRef> Table = StringRef(K.Path).split('.');
+    if (!(Table.first == "Functions" && !Table.second.empty())
+        && !(Table.first == "FUs" && Table.second.count('.'))) {
+      ErrMsg = "Knob '" + K.Path + "' is not a FU or function setting";
+      return false;
+    }
+
+    if (luabind::type(*I) == LUA_TTABLE)
+      for (tab_it VI = tab_it(*I), VE = tab_it(); VI != VE; ++VI) {
+        luabind::object V = *VI;
+        int T = luabind::type(V);
+        if (T != LUA_TNUMBER && T != LUA_TSTRING && T != LUA_TBOOLEAN) {
+          ErrMsg = "Unexpected value type of knob '" + K.Path + "'";
+          return false;
+        }
+
+        K.Values.push_back(V);
+      }
+
+    if (K.Values.empty()) {
+      ErrMsg = "No candidate value for knob '" + K.Path + "'";
+      return false;
+    }
+
+    Knobs.push_back(K);
+  }
+
+  // Visit the knobs in a deterministic order.
+  std::sort(Knobs.begin(), Knobs.end());
+  return true;
+}
+
+// Choose the points to evaluate, all points of the grid, or Budget distinct
+// random points if the grid is bigger than the budget.
+static void chooseDSEPoints(ArrayRef<DSEKnob> Knobs, unsigned Budget,
+                            unsigned Seed,
+                            std::vector<std::vector<unsigned> > &Points) {
+  uint64_t GridSize = 1;
+  for (unsigned i = 0, e = Knobs.size(); i != e && GridSize <= Budget; ++i)
+    GridSize *= Knobs[i].Values.size();
+
+  if (Budget == 0 || GridSize <= Budget) {
+    std::vector<unsigned> Choices(Knobs.size(), 0);
+    for (;;) {
+      Points.push_back(Choices);
+
+      // Advance to the next point like a mixed radix counter.
+      unsigned i = 0, e = Knobs.size();
+      for (; i != e; ++i) {
+        if (++Choices[i] != Knobs[i].Values.size()) break;
+        Choices[i] = 0;
+      }
+
+      if (i == e) return;
+    }
+  }
+
+  std::srand(Seed);
+  std::set<std::vector<unsigned> > Chosen;
+  while (Chosen.size() < Budget) {
+    std::vector<unsigned> Choices;
+    for (unsigned i = 0, e = Knobs.size(); i != e; ++i)
+      Choices.push_back(std::rand() % Knobs[i].Values.size());
+
+    if (Chosen.insert(Choices).second)
+      Points.push_back(Choices);
+  }
+}
+
+static unsigned getNumDSEWorkers() {
+  if (NumThreads.getNumOccurrences()) return NumThreads;
+
+#ifdef SYNC_USE_PTHREADS
+  long NumProcessors = ::sysconf(_SC_NPROCESSORS_ONLN);
+  if (NumProcessors > 0) return NumProcessors;
+#endif
+
+  return 1;
+}
+
+// Run the backend over the hardware functions in Mod once per design point,
+// and write the Pareto front of the points. The module level passes must be
+// already run over Mod, so all points share the same optimized IR, and the
+// knobs of the IR level passes, e.g. the unroll and inline thresholds, cannot
+// be explored.
+static bool runDesignSpaceExploration(Module &Mod, LuaScript &S,
+                                      const char *ProgName) {
+  luabind::object Config = S.getDSEConfig();
+  if (luabind::type(Config) != LUA_TTABLE) {
+    errs() << ProgName << ": No DSE table is found in the script\n";
+    return false;
+  }
+
+  std::string ErrMsg;
+  std::vector<DSEKnob> Knobs;
+  if (!readDSEKnobs(Config, Knobs, ErrMsg)) {
+    errs() << ProgName << ": " << ErrMsg << '\n';
+    return false;
+  }
+
+  std::vector<std::string> Objectives;
+  if (luabind::type(Config["Objectives"]) == LUA_TTABLE) {
+    typedef luabind::iterator tab_it;
+    for (tab_it I = tab_it(Config["Objectives"]), E = tab_it(); I != E; ++I) {
+      boost::optional<std::string> Objective
+        = luabind::object_cast_nothrow<std::string>(*I);
+      if (!Objective) {
+        errs() << ProgName << ": The DSE objective is not a metric name\n";
+        return false;
+      }
+
+      Objectives.push_back(Objective.get());
+    }
+  } else {
+    Objectives.push_back("Cycles");
+    Objectives.push_back("Area");
+  }
+
+  boost::optional<unsigned> Budget
+    = luabind::object_cast_nothrow<unsigned>(Config["Budget"]);
+  boost::optional<unsigned> Seed
+    = luabind::object_cast_nothrow<unsigned>(Config["Seed"]);
+  std::vector<std::vector<unsigned> > Points;
+  chooseDSEPoints(Knobs, Budget ? Budget.get() : 0, Seed ? Seed.get() : 0,
+                  Points);
+
+  std::string Bitcode;
+  writeBitcodeToString(Mod, Bitcode);
+
+  DSEJobQueue Queue(Bitcode);
+  for (unsigned i = 0, e = Points.size(); i != e; ++i) {
+    DSEJob *Job = new DSEJob(Points[i]);
+    Queue.Jobs.push_back(Job);
+
+    // Create the script engines in the driver thread, updating the engine
+    // status also writes some global settings.
+    SMDiagnostic Err;
+    Job->Engine.reset(createJobEngine(S, Err, Knobs, Job->Choices));
+    if (!Job->Engine) {
+      Err.print(ProgName, errs());
+      return false;
+    }
+  }
+
+  Queue.runJobsInParallel(getNumDSEWorkers());
+
+  for (unsigned i = 0, e = Queue.Jobs.size(); i != e; ++i)
+    if (!Queue.Jobs[i]->ErrMsg.empty()) {
+      errs() << ProgName << ": " << Queue.Jobs[i]->ErrMsg << '\n';
+      return false;
+    }
+
+  boost::optional<std::string> Output
+    = luabind::object_cast_nothrow<std::string>(Config["Output"]);
+  if (!Output) {
+    writeParetoFront(outs(), Knobs, Objectives, Queue.Jobs);
+    return true;
+  }
+
+  raw_fd_ostream Out(Output.get().c_str(), ErrMsg);
+  if (!ErrMsg.empty()) {
+    errs() << ProgName << ": " << ErrMsg << '\n';
+    return false;
+  }
+
+  writeParetoFront(Out, Knobs, Objectives, Queue.Jobs);
+  return true;
+}
+
 // main - Entry point for the sync compiler.
 //
 int main(int argc, char **argv) {
@@ -139,6 +843,13 @@ int main(int argc, char **argv) {
   Builder.DisableUnrollLoops = true;
   Builder.LibraryInfo = new TargetLibraryInfo();
   Builder.LibraryInfo->disableAllFunctions();
+  // LoopIdiomRecognize only forms memset/memcpy if they are available, only
+  // make them available if they can be lowered to the block transfer commands,
+  // otherwise they become calls to the external library.
+  if (isStreamBurstEnabled()) {
+    Builder.LibraryInfo->setAvailable(LibFunc::memset);
+    Builder.LibraryInfo->setAvailable(LibFunc::memcpy);
+  }
   Builder.OptLevel = 3;
   Builder.SizeLevel = 2;
   Builder.DisableSimplifyLibCalls = true;
@@ -168,32 +879,33 @@ int main(int argc, char **argv) {
                                  /*RunInliner*/true);
 
   //PM.add(createPrintModulePass(&dbgs()));
-   
-  // We do not use the stream that passing into addPassesToEmitFile.
-  formatted_raw_ostream formatted_nulls(nulls());
-  // Ask the target to add backend passes as necessary.
-  target->addPassesToEmitFile(Passes, formatted_nulls,
-                              TargetMachine::CGFT_Null,
-                              false/*NoVerify*/);
 
-  // Analyse the slack between registers.
-  Passes.add(createCombPathDelayAnalysisPass());
-  Passes.add(createVerilogASTWriterPass(S->getOutputStream("RTLOutput")));
-
-  // Run some scripting passes.
-  for (LuaScript::scriptpass_it I = S->passes_begin(), E = S->passes_end();
-       I != E; ++I) {
-    const luabind::object &o = *I;
-    Pass *P = createScriptingPass(
-      luabind::object_cast<std::string>(I.key()).c_str(),
-      luabind::object_cast<std::string>(o["FunctionScript"]).c_str(),
-      luabind::object_cast<std::string>(o["GlobalScript"]).c_str());
-    Passes.add(P);
+  if (ExploreDesignSpace) {
+    // Optimize the module once, and then run the backend for each design
+    // point from the optimized module.
+    addTargetIRPasses(*target, Passes);
+    Passes.run(mod);
+
+    if (!runDesignSpaceExploration(mod, *S, argv[0]))
+      return 1;
+  } else if (NumThreads > 1) {
+    // Run the target IR passes over the whole module here, and then compile
+    // each hardware function in its own backend pipeline.
+    addTargetIRPasses(*target, Passes);
+    Passes.run(mod);
+
+    if (!runParallelBackend(mod, *target, *S, argv[0]))
+      return 1;
+  } else {
+    // We do not use the stream that passing into addPassesToEmitFile.
+    formatted_raw_ostream formatted_nulls(nulls());
+    addBackendPasses(Passes, *target, *S, S->getOutputStream("RTLOutput"),
+                     formatted_nulls, false);
+
+    // Run the passes.
+    Passes.run(mod);
   }
 
-  // Run the passes.
-  Passes.run(mod);
-
   // If no error occur, keep the files.
   S->keepAllFiles();
 
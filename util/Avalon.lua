@@ -1,4 +1,14 @@
 local  AvalonTemplate = [=[
+#local NumBuses = FUs.MemoryBus.NumBuses or 1
+#local Pipelined = FUs.MemoryBus.Pipelined or false
+#local Latency = math.ceil(FUs.MemoryBus.Latency)
+#local AddrWidth = FUs.MemoryBus.AddressWidth
+#local DataWidth = FUs.MemoryBus.DataWidth
+#-- The Avalon master of memory bus 0 is avm_*, the others are avm<N>_*.
+#local function getMasterPrefix(b)
+#  if b == 0 then return 'avm_' end
+#  return 'avm' .. b .. '_'
+#end
 module  Avalon_user_logic(
   // -- ADD USER PORTS BELOW THIS LINE ---------------
   clk,                                   // Bus to IP clock
@@ -11,13 +21,18 @@ module  Avalon_user_logic(
   avs_Readdata_IP2Bus,                   // IP  to Bus readdate
   avs_Waitrequest_IP2Bus,                // IP  to Bus waitrequest
 
-  avm_Readdata_Bus2IP,                   // Bus to IP master readdata
-  avm_Waitrequest_Bus2IP,                // Bus to IP master waitrequest
-  avm_Address_IP2Bus,                    // IP  to Bus master address
-  avm_Byteenable_IP2Bus,                 // IP  to Bus master byteenable
-  avm_Read_IP2Bus,                       // IP  to Bus master read
-  avm_Write_IP2Bus,                      // IP  to Bus master write
-  avm_Writedata_IP2Bus                   // IP  to Bus master writedata
+#for b = 0, NumBuses - 1 do
+#  local avm = getMasterPrefix(b)
+  $(avm)Readdata_Bus2IP,                   // Bus to IP master readdata
+  $(avm)Readdatavalid_Bus2IP,              // Bus to IP master readdatavalid
+  $(avm)Waitrequest_Bus2IP,                // Bus to IP master waitrequest
+  $(avm)Address_IP2Bus,                    // IP  to Bus master address
+  $(avm)Byteenable_IP2Bus,                 // IP  to Bus master byteenable
+  $(avm)Read_IP2Bus,                       // IP  to Bus master read
+  $(avm)Write_IP2Bus,                      // IP  to Bus master write
+  $(avm)Writedata_IP2Bus,                  // IP  to Bus master writedata
+  $(avm)Burstcount_IP2Bus$(if b ~= NumBuses - 1 then _put(',') end)                  // IP  to Bus master burstcount
+#end
 ); // user_logic
 
   // -- ADD USER PARAMETERS BELOW THIS LINE ------------
@@ -25,6 +40,13 @@ module  Avalon_user_logic(
   parameter C_SLV_DWIDTH = 32;
   parameter C_MST_AWIDTH = 32;
   parameter C_MST_DWIDTH = 32;
+  // The burst transfers of the block transfer commands are at most
+  // 2^(C_MST_BWIDTH-1) words long.
+  parameter C_MST_BWIDTH = 5;
+  // The stream read commands fetch the data into 2^C_STREAM_SLOTS_LOG2
+  // buffers of 2^C_STREAM_WORDS_LOG2 words each.
+  parameter C_STREAM_SLOTS_LOG2 = 2;
+  parameter C_STREAM_WORDS_LOG2 = 5;
 
   // -- Bus protocol ports, do not add to or delete
   input                                clk;
@@ -37,25 +59,24 @@ module  Avalon_user_logic(
   output     [C_SLV_DWIDTH-1:0]        avs_Readdata_IP2Bus;
   output                               avs_Waitrequest_IP2Bus;
 
-  input      [C_MST_DWIDTH-1:0]        avm_Readdata_Bus2IP;
-  input                                avm_Waitrequest_Bus2IP;
-  output     [C_MST_AWIDTH-1:0]        avm_Address_IP2Bus;
-  output     [C_MST_DWIDTH/8-1:0]      avm_Byteenable_IP2Bus;
-  output                               avm_Read_IP2Bus;
-  output                               avm_Write_IP2Bus;
-  output     [C_MST_DWIDTH-1:0]        avm_Writedata_IP2Bus;
+#for b = 0, NumBuses - 1 do
+#  local avm = getMasterPrefix(b)
+  input      [C_MST_DWIDTH-1:0]        $(avm)Readdata_Bus2IP;
+  input                                $(avm)Readdatavalid_Bus2IP;
+  input                                $(avm)Waitrequest_Bus2IP;
+  output     [C_MST_AWIDTH-1:0]        $(avm)Address_IP2Bus;
+  output     [C_MST_DWIDTH/8-1:0]      $(avm)Byteenable_IP2Bus;
+  output                               $(avm)Read_IP2Bus;
+  output                               $(avm)Write_IP2Bus;
+  output     [C_MST_DWIDTH-1:0]        $(avm)Writedata_IP2Bus;
+  output     [C_MST_BWIDTH-1:0]        $(avm)Burstcount_IP2Bus;
+#end
 
 //Implementation
 //----------------------------------------------------------------------------
   //Slave output register
   wire        [C_SLV_DWIDTH-1:0]       avs_Readdata_IP2Bus;
   wire                                 avs_Waitrequest_IP2Bus;
-  //Master output register
-  reg        [C_MST_AWIDTH-1:0]        avm_Address_IP2Bus;
-  reg        [C_MST_DWIDTH/8-1:0]      avm_Byteenable_IP2Bus;
-  reg                                  avm_Read_IP2Bus;
-  reg                                  avm_Write_IP2Bus;
-  reg        [C_MST_DWIDTH-1:0]        avm_Writedata_IP2Bus;
   //IP_slave internal register
   reg                                  begin_wr;          //begin to write, pull down slave_waitrequest
   reg                                  begin_rd;          //begin to read, pull down slave_waitrequest
@@ -194,6 +215,13 @@ module  Avalon_user_logic(
   reg [2:0] LocalBRamState;
   reg       BRam2Mem0rdy;
   reg       LocalBRam_en;
+  // The pipelined bus cannot wait for the local block RAM, all its requests
+  // are sent to the Avalon master.
+#if Pipelined then
+  wire      LocalBRam_Req = 1'b0;
+#else
+  wire      LocalBRam_Req = mem0en && (mem0addr[31:16] == BlockRamBase);
+#end
   always @(posedge clk) begin
     if (~reset_n) begin
       wren_b          <= 0;
@@ -207,7 +235,7 @@ module  Avalon_user_logic(
       case (LocalBRamState)
         LocalBRam_Idle: begin
           LocalBRam_en <= 0;
-          if (mem0en && (mem0addr[31:16] == BlockRamBase)) begin
+          if (LocalBRam_Req) begin
             address_b <= mem0addr[11:2];
             byteena_b <= mem0be;
             case(mem0cmd)
@@ -463,38 +491,209 @@ module  Avalon_user_logic(
   //---------------------------------------------------------------------------------------------------------------------------------
   // master below
   //---------------------------------------------------------------------------------------------------------------------------------
-  //IP_master FSM declaration
+  // The masters of the memory buses, bus 0 shares the requests with the local
+  // block RAM.
+#for b = 0, NumBuses - 1 do
+#  local avm = getMasterPrefix(b)
+  wire                                 Mst2Mem$(b)rdy;
+  wire       [$(DataWidth-1):0]                    Master2Mem$(b)in;
+#if Pipelined then
+  Avalon_pipelined_master #(
+        .C_LATENCY($(Latency)),
+#else
+  Avalon_bus_master #(
+        .C_STREAM_SLOTS_LOG2(C_STREAM_SLOTS_LOG2),
+        .C_STREAM_WORDS_LOG2(C_STREAM_WORDS_LOG2),
+#end
+        .C_MST_AWIDTH(C_MST_AWIDTH),
+        .C_MST_DWIDTH(C_MST_DWIDTH),
+        .C_MST_BWIDTH(C_MST_BWIDTH),
+        .C_IP_AWIDTH($(AddrWidth)),
+        .C_IP_DWIDTH($(DataWidth))
+  ) master$(b)(
+        .clk(clk),
+        .reset_n(reset_n),
+        .memen(mem$(b)en$(if b == 0 then _put(' & ~LocalBRam_Req') end)),
+        .memcmd(mem$(b)cmd),
+        .memaddr(mem$(b)addr),
+        .memout(mem$(b)out),
+        .membe(mem$(b)be),
+        .memrdy(Mst2Mem$(b)rdy),
+        .memin(Master2Mem$(b)in),
+        .avm_Readdata_Bus2IP($(avm)Readdata_Bus2IP),
+        .avm_Readdatavalid_Bus2IP($(avm)Readdatavalid_Bus2IP),
+        .avm_Waitrequest_Bus2IP($(avm)Waitrequest_Bus2IP),
+        .avm_Address_IP2Bus($(avm)Address_IP2Bus),
+        .avm_Byteenable_IP2Bus($(avm)Byteenable_IP2Bus),
+        .avm_Read_IP2Bus($(avm)Read_IP2Bus),
+        .avm_Write_IP2Bus($(avm)Write_IP2Bus),
+        .avm_Writedata_IP2Bus($(avm)Writedata_IP2Bus),
+        .avm_Burstcount_IP2Bus($(avm)Burstcount_IP2Bus)
+  );
+
+#if Pipelined then
+  // The data of the pipelined bus is read at the fixed latency.
+  assign mem$(b)rdy = Mst2Mem$(b)rdy;
+  assign mem$(b)in = Master2Mem$(b)in;
+#elseif b == 0 then
+  // assign the ready signal to the IP.
+  assign mem0rdy = BRam2Mem0rdy | Mst2Mem0rdy;
+  // assign the mem0in data to the IP.
+  assign mem0in = (Mst2Mem0rdy)? Master2Mem0in : (BRam2Mem0rdy)? q_b : 0;
+#else
+  assign mem$(b)rdy = Mst2Mem$(b)rdy;
+  assign mem$(b)in = (Mst2Mem$(b)rdy)? Master2Mem$(b)in : 0;
+#end
+
+#end
+endmodule
+
+// The Avalon master of a memory bus of the module in the handshake mode. It
+// performs the requests of the bus, and asserts memrdy for one cycle when the
+// request is done.
+module  Avalon_bus_master(
+  clk,                                   // Bus to IP clock
+  reset_n,                               // Bus to IP reset_n
+  memen,                                 // Module to IP request enable
+  memcmd,                                // Module to IP request command
+  memaddr,                               // Module to IP request address
+  memout,                                // Module to IP request data
+  membe,                                 // Module to IP request byteenable
+  memrdy,                                // IP  to Module ready
+  memin,                                 // IP  to Module read data
+  avm_Readdata_Bus2IP,                   // Bus to IP master readdata
+  avm_Readdatavalid_Bus2IP,              // Bus to IP master readdatavalid
+  avm_Waitrequest_Bus2IP,                // Bus to IP master waitrequest
+  avm_Address_IP2Bus,                    // IP  to Bus master address
+  avm_Byteenable_IP2Bus,                 // IP  to Bus master byteenable
+  avm_Read_IP2Bus,                       // IP  to Bus master read
+  avm_Write_IP2Bus,                      // IP  to Bus master write
+  avm_Writedata_IP2Bus,                  // IP  to Bus master writedata
+  avm_Burstcount_IP2Bus                  // IP  to Bus master burstcount
+);
+
+  parameter C_MST_AWIDTH = 32;
+  parameter C_MST_DWIDTH = 32;
+  parameter C_MST_BWIDTH = 5;
+  // The widths of the memory bus of the module.
+  parameter C_IP_AWIDTH = 32;
+  parameter C_IP_DWIDTH = 64;
+  // The stream read commands fetch the data into 2^C_STREAM_SLOTS_LOG2
+  // buffers of 2^C_STREAM_WORDS_LOG2 words each.
+  parameter C_STREAM_SLOTS_LOG2 = 2;
+  parameter C_STREAM_WORDS_LOG2 = 5;
+
+  input                                clk;
+  input                                reset_n;
+  input                                memen;
+  input      [3:0]                     memcmd;
+  input      [C_IP_AWIDTH-1:0]         memaddr;
+  input      [C_IP_DWIDTH-1:0]         memout;
+  input      [C_IP_DWIDTH/8-1:0]       membe;
+  output                               memrdy;
+  output     [C_IP_DWIDTH-1:0]         memin;
+  input      [C_MST_DWIDTH-1:0]        avm_Readdata_Bus2IP;
+  input                                avm_Readdatavalid_Bus2IP;
+  input                                avm_Waitrequest_Bus2IP;
+  output     [C_MST_AWIDTH-1:0]        avm_Address_IP2Bus;
+  output     [C_MST_DWIDTH/8-1:0]      avm_Byteenable_IP2Bus;
+  output                               avm_Read_IP2Bus;
+  output                               avm_Write_IP2Bus;
+  output     [C_MST_DWIDTH-1:0]        avm_Writedata_IP2Bus;
+  output     [C_MST_BWIDTH-1:0]        avm_Burstcount_IP2Bus;
+
+  reg                                  memrdy;
+  reg        [C_IP_DWIDTH-1:0]         memin;
+  reg        [C_MST_AWIDTH-1:0]        avm_Address_IP2Bus;
+  reg        [C_MST_DWIDTH/8-1:0]      avm_Byteenable_IP2Bus;
+  reg                                  avm_Read_IP2Bus;
+  reg                                  avm_Write_IP2Bus;
+  reg        [C_MST_DWIDTH-1:0]        avm_Writedata_IP2Bus;
+  reg        [C_MST_BWIDTH-1:0]        avm_Burstcount_IP2Bus;
+
   // FSM state declareation
-  parameter m_start      = 11'b00000000001,
-            m_read_0     = 11'b00000000010,
-            m_write_0    = 11'b00000000100,
-            Memset       = 11'b00000001000,
-            Memset_Loop  = 11'b00000010000,
-            Memcpy       = 11'b00000100000,
-            Memcpy_Read  = 11'b00001000000,
-            Memcpy_Write = 11'b00010000000,
-            Memmove      = 11'b00100000000,
-            Memmove_Read = 11'b01000000000,
-            Memmove_Write= 11'b10000000000;
-  // mem0cmd parameter
+  parameter m_start         = 12'b000000000001,
+            m_read_0        = 12'b000000000010,
+            m_write_0       = 12'b000000000100,
+            Memset          = 12'b000000001000,
+            Memset_Loop     = 12'b000000010000,
+            Copy            = 12'b000000100000,
+            Copy_Chunk      = 12'b000001000000,
+            Copy_Read       = 12'b000010000000,
+            Copy_Write      = 12'b000100000000,
+            Copy_Write_Loop = 12'b001000000000,
+            Stream_Fetch    = 12'b010000000000,
+            Stream_Read     = 12'b100000000000;
+  // memcmd parameter
   parameter IP_read    = 4'b0000,
             IP_write   = 4'b0001,
             IP_memset  = 4'b0010,
             IP_memcpy  = 4'b0011,
-            IP_memmove = 4'b0100;
-  reg [7:0]  mst_state;
-  reg        Mst2Mem0rdy;
-  reg [31:0] Master2Mem0in;
-  reg [31:0] mem0addr_reg;
+            IP_memmove = 4'b0100,
+            IP_stream  = 4'b0101;
+  parameter Max_Burst    = (1 << (C_MST_BWIDTH - 1)),
+            Stream_Slots = (1 << C_STREAM_SLOTS_LOG2),
+            Stream_Words = (1 << C_STREAM_WORDS_LOG2);
+  reg [11:0] mst_state;
+  reg [31:0] memaddr_reg;
   reg [31:0] Memset_NUM;
   reg [31:0] Memset_Value;
-  reg [31:0] Memcpy_Destination;
-  reg [31:0] Memcpy_Source;
-  reg [31:0] Memcpy_NUM;
-  reg [31:0] Memmove_Destination;
-  reg [31:0] Memmove_Source;
-  reg [31:0] Memmove_NUM;
+  // The words left in the current burst.
+  reg [C_MST_BWIDTH-1:0] Burst_Left;
+  // The value to fill is read from memout before the first burst only.
+  reg        Memset_First;
+  wire [31:0] Memset_Data = Memset_First ? memout : Memset_Value;
+  // The data and the byte enable of the single word write.
+  wire [31:0] Write_Data = (memout << {memaddr[1:0], 3'b0});
+  wire [3:0]  Write_BE   = (membe >> (memaddr[1:0]));
+  integer    i;
+
+  // Memcpy and memmove copy the words in chunks, each chunk is read into the
+  // copy buffer by a burst read and then written by a burst write. The chunks
+  // are copied from the end of the ranges if the destination of the memmove
+  // overlaps the end of the source.
+  reg [31:0] Copy_Buf [0:Max_Burst-1];
+  reg [31:0] Copy_Destination;
+  reg [31:0] Copy_Source;
+  reg [31:0] Copy_NUM;
+  reg [C_MST_BWIDTH-1:0] Copy_Len;
+  reg [C_MST_BWIDTH-1:0] Copy_Idx;
+  reg        Is_Memmove;
   reg        Is_Overlap;
+  wire [C_MST_BWIDTH-1:0] Copy_Next_Len
+    = (Copy_NUM > Max_Burst) ? Max_Burst : Copy_NUM[C_MST_BWIDTH-1:0];
+
+  // The stream read command fetches the words in [Stream_Begin, Stream_End)
+  // into a slot of the stream buffer by burst reads, the slots are reused in
+  // round robin. The reads that hit a slot are served in one cycle, the writes
+  // that hit a slot also update it (write through), and the block transfer
+  // commands invalidate all slots.
+  reg [31:0] Stream_Buf [0:Stream_Slots*Stream_Words-1];
+  reg [31:0] Stream_Begin [0:Stream_Slots-1];
+  reg [31:0] Stream_End [0:Stream_Slots-1];
+  // The slot to fill, and the number of words fetched and left to fetch.
+  reg [C_STREAM_SLOTS_LOG2-1:0] Stream_Slot;
+  reg [C_STREAM_WORDS_LOG2:0]   Stream_Fill;
+  reg [C_STREAM_WORDS_LOG2:0]   Stream_NUM;
+  // The number of bytes to fetch is carried by memout.
+  wire [31:0] Stream_Request_Words = (memaddr[1:0] + memout + 3) >> 2;
+  // Look up the address of the request in the stream buffer.
+  reg                           Stream_Hit;
+  reg [C_STREAM_SLOTS_LOG2-1:0] Stream_Hit_Slot;
+  integer                       slot;
+  always @* begin
+    Stream_Hit      = 0;
+    Stream_Hit_Slot = 0;
+    for (slot = 0; slot < Stream_Slots; slot = slot + 1)
+      if (Stream_Begin[slot] <= memaddr && memaddr < Stream_End[slot]) begin
+        Stream_Hit      = 1;
+        Stream_Hit_Slot = slot;
+      end
+  end
+  wire [31:0] Stream_Hit_Offset = memaddr - Stream_Begin[Stream_Hit_Slot];
+  wire [C_STREAM_SLOTS_LOG2+C_STREAM_WORDS_LOG2-1:0] Stream_Hit_Addr
+    = {Stream_Hit_Slot, Stream_Hit_Offset[C_STREAM_WORDS_LOG2+1:2]};
+
   //master block to get the data according to the address sent by lookup_rtl
   always@(posedge  clk) begin
     if(~reset_n) begin
@@ -504,53 +703,90 @@ module  Avalon_user_logic(
       avm_Read_IP2Bus       <= 0;
       avm_Write_IP2Bus      <= 0;
       avm_Writedata_IP2Bus  <= 32'hffffffff;
-      Mst2Mem0rdy           <= 0;
-      Master2Mem0in         <= 0;
-      mem0addr_reg          <= 0;
+      avm_Burstcount_IP2Bus <= 1;
+      Burst_Left            <= 0;
+      Memset_First          <= 0;
+      memrdy                <= 0;
+      memin                 <= 0;
+      memaddr_reg           <= 0;
       Memset_NUM            <= 0;
       Memset_Value          <= 0;
-      Memcpy_Destination    <= 0;
-      Memcpy_Source         <= 0;
-      Memcpy_NUM            <= 0;
-      Memmove_Destination   <= 0;
-      Memmove_Source        <= 0;
-      Memmove_NUM           <= 0;
+      Copy_Destination      <= 0;
+      Copy_Source           <= 0;
+      Copy_NUM              <= 0;
+      Copy_Len              <= 0;
+      Copy_Idx              <= 0;
+      Is_Memmove            <= 0;
       Is_Overlap            <= 0;
+      Stream_Slot           <= 0;
+      Stream_Fill           <= 0;
+      Stream_NUM            <= 0;
+      for (i = 0; i < Stream_Slots; i = i + 1) begin
+        Stream_Begin[i]     <= 0;
+        Stream_End[i]       <= 0;
+      end
     end else begin
       case(mst_state)
         m_start: begin
-          Mst2Mem0rdy <= 0;
-          if(mem0en & (mem0addr[31:16] != BlockRamBase)) begin  //if signal mem0en is asserted ,this block choose to read or write by checking signal mem0cmd
-            avm_Address_IP2Bus    <= {mem0addr[31:2], 2'b0};
-            case(mem0cmd)
+          memrdy <= 0;
+          // Single word transfer by default.
+          avm_Burstcount_IP2Bus <= 1;
+          if(memen) begin  //if signal memen is asserted ,this block choose to read or write by checking signal memcmd
+            avm_Address_IP2Bus    <= {memaddr[31:2], 2'b0};
+            // The block transfers write the memory behind the stream buffer.
+            if (memcmd == IP_memset || memcmd == IP_memcpy ||
+                memcmd == IP_memmove)
+              for (i = 0; i < Stream_Slots; i = i + 1)
+                Stream_End[i] <= 0;
+            case(memcmd)
               IP_read : begin
-                avm_Read_IP2Bus       <= 1;
-                mst_state             <= m_read_0;
-                mem0addr_reg          <= mem0addr;
-                avm_Byteenable_IP2Bus <= (mem0be >> (mem0addr[1:0]));
+                if (Stream_Hit) begin
+                  // Serve the read from the stream buffer.
+                  memrdy                <= 1;
+                  memin                 <= (Stream_Buf[Stream_Hit_Addr] >> {memaddr[1:0], 3'b0});
+                end else begin
+                  avm_Read_IP2Bus       <= 1;
+                  mst_state             <= m_read_0;
+                  memaddr_reg           <= memaddr;
+                  avm_Byteenable_IP2Bus <= (membe >> (memaddr[1:0]));
+                end
               end
               IP_write : begin
                 avm_Write_IP2Bus      <= 1;
                 mst_state             <= m_write_0;
-                avm_Writedata_IP2Bus  <= (mem0out << {mem0addr[1:0], 3'b0});
-                avm_Byteenable_IP2Bus <= (mem0be >> (mem0addr[1:0]));
+                avm_Writedata_IP2Bus  <= Write_Data;
+                avm_Byteenable_IP2Bus <= Write_BE;
+                if (Stream_Hit) begin
+                  if (Write_BE[0]) Stream_Buf[Stream_Hit_Addr][7:0]   <= Write_Data[7:0];
+                  if (Write_BE[1]) Stream_Buf[Stream_Hit_Addr][15:8]  <= Write_Data[15:8];
+                  if (Write_BE[2]) Stream_Buf[Stream_Hit_Addr][23:16] <= Write_Data[23:16];
+                  if (Write_BE[3]) Stream_Buf[Stream_Hit_Addr][31:24] <= Write_Data[31:24];
+                end
               end
               IP_memset : begin
                 mst_state <= Memset;
-                mem0addr_reg <= mem0addr;
+                Memset_First <= 1;
+                memaddr_reg <= memaddr;
                 avm_Byteenable_IP2Bus <= 4'b1111;
-                Memset_NUM <= mem0out;
+                Memset_NUM <= memout;
               end
-              IP_memcpy :begin
-                mst_state <= Memcpy;
-                Memcpy_Destination <= mem0addr;
+              IP_memcpy, IP_memmove : begin
+                mst_state <= Copy;
+                Copy_Destination <= memaddr;
+                Copy_NUM <= memout;
+                Is_Memmove <= (memcmd == IP_memmove);
                 avm_Byteenable_IP2Bus <= 4'b1111;
-                Memcpy_NUM <= mem0out;
               end
-              IP_memmove :begin
-                mst_state <= Memmove;
-                Memmove_Destination <= mem0addr;
-                Memmove_NUM <= mem0out;
+              IP_stream : begin
+                mst_state <= Stream_Fetch;
+                Stream_Begin[Stream_Slot] <= {memaddr[31:2], 2'b0};
+                Stream_End[Stream_Slot]   <= 0;
+                Stream_Fill <= 0;
+                // Only fetch the words that fit in a slot.
+                if (Stream_Request_Words > Stream_Words)
+                  Stream_NUM <= Stream_Words;
+                else
+                  Stream_NUM <= Stream_Request_Words;
                 avm_Byteenable_IP2Bus <= 4'b1111;
               end
               default : mst_state <= m_start;
@@ -562,205 +798,194 @@ module  Avalon_user_logic(
           end
         end
 
+        // The read is accepted when waitrequest is not asserted, and the
+        // data arrives with readdatavalid.
         m_read_0 : begin
-          if(~avm_Waitrequest_Bus2IP) begin
+          if (avm_Read_IP2Bus & ~avm_Waitrequest_Bus2IP)
             avm_Read_IP2Bus       <= 0;
-            Mst2Mem0rdy           <= 1;
-            Master2Mem0in         <= (avm_Readdata_Bus2IP >> {mem0addr_reg[1:0], 3'b0});
+          if(avm_Readdatavalid_Bus2IP) begin
+            memrdy                <= 1;
+            memin                 <= (avm_Readdata_Bus2IP >> {memaddr_reg[1:0], 3'b0});
             avm_Address_IP2Bus    <= 32'b0;
             avm_Byteenable_IP2Bus <= 4'b0;
             mst_state             <= m_start;
           end else begin
             mst_state   <= m_read_0;
-            Mst2Mem0rdy <= 0;
+            memrdy <= 0;
           end
         end
 
         m_write_0 : begin
           if(~avm_Waitrequest_Bus2IP) begin
             avm_Write_IP2Bus      <= 0;
-            Mst2Mem0rdy           <= 1;
+            memrdy                <= 1;
             avm_Address_IP2Bus    <= 32'b0;
             avm_Byteenable_IP2Bus <= 4'b0;
             mst_state             <= m_start;
           end else begin
             mst_state   <= m_write_0;
-            Mst2Mem0rdy <= 0;
+            memrdy <= 0;
           end
         end
 
+        // Fill the memory with burst writes, the address and the burstcount
+        // are sampled with the first word of the burst, and a word is
+        // accepted in each cycle that waitrequest is not asserted.
         Memset : begin
           if (Memset_NUM != 0) begin
-            if(~avm_Waitrequest_Bus2IP) begin
-              avm_Write_IP2Bus      <= 1;
-              Memset_Value         <= mem0out;
-              avm_Address_IP2Bus   <= mem0addr_reg;
-              avm_Writedata_IP2Bus <= mem0out;
-              Mst2Mem0rdy          <= 0;
-              Memset_NUM           <= Memset_NUM - 1;
-              mem0addr_reg         <= mem0addr_reg + 4;
-              mst_state            <= Memset_Loop;
+            avm_Write_IP2Bus      <= 1;
+            Memset_First          <= 0;
+            Memset_Value          <= Memset_Data;
+            avm_Address_IP2Bus    <= memaddr_reg;
+            avm_Writedata_IP2Bus  <= Memset_Data;
+            memrdy                <= 0;
+            if (Memset_NUM > (1 << (C_MST_BWIDTH - 1))) begin
+              avm_Burstcount_IP2Bus <= (1 << (C_MST_BWIDTH - 1));
+              Burst_Left            <= (1 << (C_MST_BWIDTH - 1));
             end else begin
-              mst_state            <= Memset;
+              avm_Burstcount_IP2Bus <= Memset_NUM;
+              Burst_Left            <= Memset_NUM;
             end
+            mst_state             <= Memset_Loop;
           end else begin
             avm_Byteenable_IP2Bus <= 4'b0;
             avm_Address_IP2Bus    <= 32'b0;
-            Mst2Mem0rdy           <= 1;
+            avm_Burstcount_IP2Bus <= 1;
+            memrdy                <= 1;
             mst_state             <= m_start;
           end
         end
 
         Memset_Loop : begin
-          if (Memset_NUM != 0) begin
-            if(~avm_Waitrequest_Bus2IP) begin
-              avm_Address_IP2Bus   <= mem0addr_reg;
-              avm_Writedata_IP2Bus <= Memset_Value;
-              Mst2Mem0rdy          <= 0;
-              Memset_NUM           <= Memset_NUM - 1;
-              mem0addr_reg         <= mem0addr_reg + 4;
-              mst_state            <= Memset_Loop;
+          if(~avm_Waitrequest_Bus2IP) begin
+            avm_Writedata_IP2Bus <= Memset_Value;
+            Memset_NUM           <= Memset_NUM - 1;
+            memaddr_reg          <= memaddr_reg + 4;
+            Burst_Left           <= Burst_Left - 1;
+            // Start the next burst after the last word is accepted.
+            if (Burst_Left == 1) begin
+              avm_Write_IP2Bus   <= 0;
+              mst_state          <= Memset;
             end else begin
-              mst_state            <= Memset_Loop;
+              mst_state          <= Memset_Loop;
             end
           end else begin
-            avm_Byteenable_IP2Bus <= 4'b0;
-            avm_Address_IP2Bus    <= 32'b0;
-            avm_Write_IP2Bus      <= 0;
-            Mst2Mem0rdy           <= 1;
-            mst_state             <= m_start;
+            mst_state            <= Memset_Loop;
           end
         end
 
-        Memcpy : begin
-          if (Memcpy_NUM != 0) begin
-            if(~avm_Waitrequest_Bus2IP) begin
-              avm_Read_IP2Bus      <= 1;
-              Memcpy_Source        <= mem0addr;
-              avm_Address_IP2Bus   <= mem0addr;
-              Mst2Mem0rdy          <= 0;
-              mst_state            <= Memcpy_Write;
-            end else begin
-              mst_state            <= Memcpy;
-            end
+        // The second request of the command sequence carries the source.
+        Copy : begin
+          Copy_Source <= memaddr;
+          Is_Overlap  <= 0;
+          if (Is_Memmove && (memaddr < Copy_Destination) &&
+              ((memaddr + (Copy_NUM << 2)) > Copy_Destination)) begin
+            Is_Overlap       <= 1;
+            Copy_Source      <= memaddr + (Copy_NUM << 2);
+            Copy_Destination <= Copy_Destination + (Copy_NUM << 2);
+          end
+          mst_state <= Copy_Chunk;
+        end
+
+        Copy_Chunk : begin
+          if (Copy_NUM != 0) begin
+            avm_Read_IP2Bus       <= 1;
+            avm_Burstcount_IP2Bus <= Copy_Next_Len;
+            avm_Address_IP2Bus    <= Is_Overlap ? (Copy_Source - (Copy_Next_Len << 2))
+                                                : Copy_Source;
+            Copy_Len              <= Copy_Next_Len;
+            Burst_Left            <= Copy_Next_Len;
+            Copy_Idx              <= 0;
+            memrdy                <= 0;
+            mst_state             <= Copy_Read;
           end else begin
+            Is_Overlap            <= 0;
             avm_Byteenable_IP2Bus <= 4'b0;
             avm_Address_IP2Bus    <= 32'b0;
-            Mst2Mem0rdy           <= 1;
+            avm_Burstcount_IP2Bus <= 1;
+            memrdy                <= 1;
             mst_state             <= m_start;
           end
         end
 
-        Memcpy_Read : begin
-          if(~avm_Waitrequest_Bus2IP) begin
-            avm_Address_IP2Bus   <= Memcpy_Source;
-            avm_Read_IP2Bus      <= 1;
-            avm_Write_IP2Bus     <= 0;
-            mst_state            <= Memcpy_Write;
-          end else begin
-            mst_state            <= Memcpy_Read;
+        Copy_Read : begin
+          if (avm_Read_IP2Bus & ~avm_Waitrequest_Bus2IP)
+            avm_Read_IP2Bus <= 0;
+          if (avm_Readdatavalid_Bus2IP) begin
+            Copy_Buf[Copy_Idx[C_MST_BWIDTH-2:0]] <= avm_Readdata_Bus2IP;
+            Copy_Idx   <= Copy_Idx + 1;
+            Burst_Left <= Burst_Left - 1;
+            if (Burst_Left == 1)
+              mst_state <= Copy_Write;
           end
         end
 
-        Memcpy_Write : begin
-          if (Memcpy_NUM != 0) begin
-            if(~avm_Waitrequest_Bus2IP) begin
-              avm_Read_IP2Bus      <= 0;
-              avm_Write_IP2Bus     <= 1;
-              avm_Address_IP2Bus   <= Memcpy_Destination;
-              avm_Writedata_IP2Bus <= avm_Readdata_Bus2IP;
-              Mst2Mem0rdy          <= 0;
-              Memcpy_NUM           <= Memcpy_NUM - 1;
-              Memcpy_Source        <= Memcpy_Source + 4;
-              Memcpy_Destination   <= Memcpy_Destination + 4;
-              mst_state            <= Memcpy_Read;
-            end else begin
-              mst_state            <= Memcpy_Write;
-            end
-          end else begin
-            if(~avm_Waitrequest_Bus2IP) begin
-              avm_Byteenable_IP2Bus <= 4'b0;
-              avm_Address_IP2Bus    <= 32'b0;
-              avm_Write_IP2Bus      <= 0;
-              avm_Read_IP2Bus       <= 0;
-              Mst2Mem0rdy           <= 1;
-              mst_state             <= m_start;
-            end else begin
-              mst_state             <= Memcpy_Write;
+        Copy_Write : begin
+          avm_Write_IP2Bus      <= 1;
+          avm_Burstcount_IP2Bus <= Copy_Len;
+          avm_Address_IP2Bus    <= Is_Overlap ? (Copy_Destination - (Copy_Len << 2))
+                                              : Copy_Destination;
+          avm_Writedata_IP2Bus  <= Copy_Buf[0];
+          Copy_Idx              <= 1;
+          Burst_Left            <= Copy_Len;
+          mst_state             <= Copy_Write_Loop;
+        end
+
+        Copy_Write_Loop : begin
+          if(~avm_Waitrequest_Bus2IP) begin
+            avm_Writedata_IP2Bus <= Copy_Buf[Copy_Idx[C_MST_BWIDTH-2:0]];
+            Copy_Idx             <= Copy_Idx + 1;
+            Burst_Left           <= Burst_Left - 1;
+            // Copy the next chunk after the last word is accepted.
+            if (Burst_Left == 1) begin
+              avm_Write_IP2Bus   <= 0;
+              Copy_NUM           <= Copy_NUM - Copy_Len;
+              if (Is_Overlap) begin
+                Copy_Source      <= Copy_Source - (Copy_Len << 2);
+                Copy_Destination <= Copy_Destination - (Copy_Len << 2);
+              end else begin
+                Copy_Source      <= Copy_Source + (Copy_Len << 2);
+                Copy_Destination <= Copy_Destination + (Copy_Len << 2);
+              end
+              mst_state          <= Copy_Chunk;
             end
           end
         end
 
-        Memmove : begin
-          if (Memmove_NUM != 0) begin
-            Memmove_Source        <= mem0addr;
-            if ((mem0addr <= Memmove_Destination) &&
-                ((mem0addr + (Memmove_NUM << 2)) > Memmove_Destination)) begin
-              Is_Overlap             <= 1;
-              Memmove_Source         <= mem0addr + (Memmove_NUM << 2);
-              Memmove_Destination    <= Memmove_Destination + (Memmove_NUM << 2);
-              avm_Read_IP2Bus        <= 1;
-              Mst2Mem0rdy            <= 0;
-              avm_Address_IP2Bus     <= mem0addr + (Memmove_NUM << 2);
-              mst_state              <= Memmove_Write;
+        Stream_Fetch : begin
+          if (Stream_NUM != 0) begin
+            avm_Read_IP2Bus       <= 1;
+            avm_Address_IP2Bus    <= Stream_Begin[Stream_Slot] + (Stream_Fill << 2);
+            if (Stream_NUM > Max_Burst) begin
+              avm_Burstcount_IP2Bus <= Max_Burst;
+              Burst_Left            <= Max_Burst;
             end else begin
-              Is_Overlap             <= 0;
-              Memmove_Source         <= mem0addr;
-              avm_Address_IP2Bus     <= mem0addr;
-              avm_Read_IP2Bus        <= 1;
-              Mst2Mem0rdy            <= 0;
-              mst_state              <= Memmove_Write;
+              avm_Burstcount_IP2Bus <= Stream_NUM;
+              Burst_Left            <= Stream_NUM;
             end
+            mst_state             <= Stream_Read;
           end else begin
-            Is_Overlap            <= 0;
+            // The reads are served from the slot after it is filled.
+            Stream_End[Stream_Slot] <= Stream_Begin[Stream_Slot] + (Stream_Fill << 2);
+            Stream_Slot           <= Stream_Slot + 1;
             avm_Byteenable_IP2Bus <= 4'b0;
             avm_Address_IP2Bus    <= 32'b0;
-            Mst2Mem0rdy           <= 1;
+            avm_Burstcount_IP2Bus <= 1;
+            memrdy                <= 1;
             mst_state             <= m_start;
           end
         end
 
-        Memmove_Read : begin
-          if(~avm_Waitrequest_Bus2IP) begin
-            avm_Address_IP2Bus   <= Memmove_Source;
-            avm_Read_IP2Bus      <= 1;
-            avm_Write_IP2Bus     <= 0;
-            mst_state            <= Memmove_Write;
-          end else begin
-            mst_state            <= Memmove_Read;
-          end
-        end
-
-        Memmove_Write : begin
-          if(Memmove_NUM != 0) begin
-            if(~avm_Waitrequest_Bus2IP) begin
-              avm_Read_IP2Bus       <= 0;
-              avm_Write_IP2Bus      <= 1;
-              Mst2Mem0rdy           <= 0;
-              mst_state             <= Memmove_Read;
-              avm_Address_IP2Bus    <= Memmove_Destination;
-              avm_Writedata_IP2Bus  <= avm_Readdata_Bus2IP;
-              Memmove_NUM           <= Memmove_NUM - 1;
-              if(~Is_Overlap) begin
-                Memmove_Source        <= Memmove_Source + 4;
-                Memmove_Destination   <= Memmove_Destination + 4;
-              end else begin
-                Memmove_Source        <= Memmove_Source - 4;
-                Memmove_Destination   <= Memmove_Destination - 4;
-              end
-            end else begin
-              mst_state             <= Memmove_Write;
-            end
-          end else begin
-            if(~avm_Waitrequest_Bus2IP) begin
-              Is_Overlap            <= 0;
-              avm_Byteenable_IP2Bus <= 4'b0;
-              avm_Address_IP2Bus    <= 32'b0;
-              avm_Write_IP2Bus      <= 0;
-              avm_Read_IP2Bus       <= 0;
-              Mst2Mem0rdy           <= 1;
-              mst_state             <= m_start;
-            end
+        Stream_Read : begin
+          if (avm_Read_IP2Bus & ~avm_Waitrequest_Bus2IP)
+            avm_Read_IP2Bus <= 0;
+          if (avm_Readdatavalid_Bus2IP) begin
+            Stream_Buf[{Stream_Slot, Stream_Fill[C_STREAM_WORDS_LOG2-1:0]}] <= avm_Readdata_Bus2IP;
+            Stream_Fill <= Stream_Fill + 1;
+            Stream_NUM  <= Stream_NUM - 1;
+            Burst_Left  <= Burst_Left - 1;
+            if (Burst_Left == 1)
+              mst_state <= Stream_Fetch;
           end
         end
 
@@ -769,12 +994,126 @@ module  Avalon_user_logic(
     end
   end
 
-  // assign the ready signal to the IP.
-  assign mem0rdy = BRam2Mem0rdy | Mst2Mem0rdy;
-  // assign the mem0in data to the IP.
-  assign mem0in = (Mst2Mem0rdy)? Master2Mem0in : (BRam2Mem0rdy)? q_b : 0;
+endmodule
 
+// The Avalon master of a memory bus of the module in the pipelined mode. The
+// module sends a request every StartInterval cycles without waiting for
+// memrdy, and reads the data of a read request exactly C_LATENCY cycles after
+// the request. The requests are forwarded to the Avalon master interface in the
+// cycle they are sent, so the slave must accept a request in every cycle and
+// return the read data within C_LATENCY cycles, e.g. the on-chip memory. Only
+// the loads and stores that fit in a single word of the master are sent over
+// the pipelined bus.
+module  Avalon_pipelined_master(
+  clk,                                   // Bus to IP clock
+  reset_n,                               // Bus to IP reset_n
+  memen,                                 // Module to IP request enable
+  memcmd,                                // Module to IP request command
+  memaddr,                               // Module to IP request address
+  memout,                                // Module to IP request data
+  membe,                                 // Module to IP request byteenable
+  memrdy,                                // IP  to Module ready
+  memin,                                 // IP  to Module read data
+  avm_Readdata_Bus2IP,                   // Bus to IP master readdata
+  avm_Readdatavalid_Bus2IP,              // Bus to IP master readdatavalid
+  avm_Waitrequest_Bus2IP,                // Bus to IP master waitrequest
+  avm_Address_IP2Bus,                    // IP  to Bus master address
+  avm_Byteenable_IP2Bus,                 // IP  to Bus master byteenable
+  avm_Read_IP2Bus,                       // IP  to Bus master read
+  avm_Write_IP2Bus,                      // IP  to Bus master write
+  avm_Writedata_IP2Bus,                  // IP  to Bus master writedata
+  avm_Burstcount_IP2Bus                  // IP  to Bus master burstcount
+);
+
+  parameter C_MST_AWIDTH = 32;
+  parameter C_MST_DWIDTH = 32;
+  parameter C_MST_BWIDTH = 5;
+  // The widths of the memory bus of the module.
+  parameter C_IP_AWIDTH = 32;
+  parameter C_IP_DWIDTH = 64;
+  // The latency of the memory bus of the module.
+  parameter C_LATENCY = 1;
+
+  input                                clk;
+  input                                reset_n;
+  input                                memen;
+  input      [3:0]                     memcmd;
+  input      [C_IP_AWIDTH-1:0]         memaddr;
+  input      [C_IP_DWIDTH-1:0]         memout;
+  input      [C_IP_DWIDTH/8-1:0]       membe;
+  output                               memrdy;
+  output     [C_IP_DWIDTH-1:0]         memin;
+  input      [C_MST_DWIDTH-1:0]        avm_Readdata_Bus2IP;
+  input                                avm_Readdatavalid_Bus2IP;
+  input                                avm_Waitrequest_Bus2IP;
+  output     [C_MST_AWIDTH-1:0]        avm_Address_IP2Bus;
+  output     [C_MST_DWIDTH/8-1:0]      avm_Byteenable_IP2Bus;
+  output                               avm_Read_IP2Bus;
+  output                               avm_Write_IP2Bus;
+  output     [C_MST_DWIDTH-1:0]        avm_Writedata_IP2Bus;
+  output     [C_MST_BWIDTH-1:0]        avm_Burstcount_IP2Bus;
+
+  parameter IP_read    = 4'b0000,
+            IP_write   = 4'b0001;
+
+  assign avm_Address_IP2Bus    = {memaddr[31:2], 2'b0};
+  assign avm_Byteenable_IP2Bus = (membe >> (memaddr[1:0]));
+  assign avm_Read_IP2Bus       = memen & (memcmd == IP_read);
+  assign avm_Write_IP2Bus      = memen & (memcmd == IP_write);
+  assign avm_Writedata_IP2Bus  = (memout << {memaddr[1:0], 3'b0});
+  assign avm_Burstcount_IP2Bus = 1;
+  // The pipelined bus never waits.
+  assign memrdy = 1'b1;
+
+  // The reads in flight, the read sent C_LATENCY cycles ago is at stage
+  // C_LATENCY, and its data is read by the module in this cycle.
+  reg        [C_LATENCY:1]             Read_Pending;
+  reg        [1:0]                     Read_Offset [1:C_LATENCY];
+  // The read data returned by the slave before the module reads it, the reads
+  // are returned in order.
+  reg        [C_MST_DWIDTH-1:0]        Read_Data [0:C_LATENCY-1];
+  reg        [7:0]                     Read_Head;
+  reg        [7:0]                     Read_Tail;
+  reg        [7:0]                     Read_Count;
+  integer                              i;
+  wire Read_Pop    = Read_Pending[C_LATENCY];
+  // The data returned in the cycle the module reads it is not buffered.
+  wire Read_Bypass = Read_Pop && (Read_Count == 0);
+  wire Read_Push   = avm_Readdatavalid_Bus2IP && ~Read_Bypass;
+  wire [C_MST_DWIDTH-1:0] Read_Word = Read_Bypass ? avm_Readdata_Bus2IP
+                                                  : Read_Data[Read_Head];
+  assign memin = (Read_Word >> {Read_Offset[C_LATENCY], 3'b0});
+
+  always@(posedge clk) begin
+    if(~reset_n) begin
+      Read_Pending <= 0;
+      Read_Head    <= 0;
+      Read_Tail    <= 0;
+      Read_Count   <= 0;
+    end else begin
+      Read_Pending[1] <= avm_Read_IP2Bus;
+      Read_Offset[1]  <= memaddr[1:0];
+      for (i = 2; i <= C_LATENCY; i = i + 1) begin
+        Read_Pending[i] <= Read_Pending[i - 1];
+        Read_Offset[i]  <= Read_Offset[i - 1];
+      end
+
+      if (Read_Push) begin
+        Read_Data[Read_Tail] <= avm_Readdata_Bus2IP;
+        Read_Tail <= (Read_Tail == C_LATENCY - 1) ? 0 : Read_Tail + 1;
+      end
+
+      if (Read_Pop && ~Read_Bypass)
+        Read_Head <= (Read_Head == C_LATENCY - 1) ? 0 : Read_Head + 1;
+
+      Read_Count <= Read_Count + Read_Push - (Read_Pop && ~Read_Bypass);
+
+      if (Read_Bypass && ~avm_Readdatavalid_Bus2IP)
+        $display("Avalon_pipelined_master: the read data is not returned in %d cycles!", C_LATENCY);
+    end
+  end
 endmodule
+
 ]=]
 
 local preprocess = require "luapp" . preprocess